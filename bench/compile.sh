@@ -0,0 +1,17 @@
+#!/bin/sh
+set -e
+cd "$(dirname "$0")"
+
+CLANG=${CLANG:-clang}
+FLAGS="--target=riscv64-unknown-elf -mabi=lp64d -O2 -ffreestanding -fno-builtin -nostdlib -nostartfiles -mno-relax -Wl,--no-relax"
+
+$CLANG $FLAGS -march=rv64gc guest/integer.c -o integer.elf
+$CLANG $FLAGS -march=rv64gc guest/memcpy.c -o memcpy.elf
+$CLANG $FLAGS -march=rv64gc guest/branches.c -o branches.elf
+$CLANG $FLAGS -march=rv64gcv guest/vector_fill.c -o vector_fill.elf
+$CLANG $FLAGS -march=rv64gc guest/present.c -o present.elf
+$CLANG $FLAGS -march=rv64gc guest/command_list.c -o command_list.elf
+$CLANG $FLAGS -march=rv64gc guest/command_ring.c -o command_ring.elf
+$CLANG $FLAGS -march=rv64gc guest/blit.c -o blit.elf
+
+${CC:-cc} -O2 runner/runner.c -o runner/runner
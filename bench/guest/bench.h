@@ -0,0 +1,160 @@
+#ifndef KOMPJUTA_BENCH_HEADER
+#define KOMPJUTA_BENCH_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared by the benchmark programs, which run bare on the emulator. Every program includes
+// this once, it brings the entry point and the stack along.
+//
+// A program runs its work in rounds forever and presents after every round, the runner stops
+// it after a budget of instructions or frames.
+
+// the registers of sources/mmio.h
+#define MMIO_BASE 0xffffffff00000000ull
+
+#define FB_ADDR              0x0
+#define FB_STRIDE            0x08
+#define FB_WIDTH             0x0c
+#define FB_HEIGHT            0x10
+#define FB_FORMAT            0x14
+#define PRESENT              0x18
+#define COMMAND_LIST_ADDR    0x20
+#define COMMAND_LIST_SIZE    0x28
+#define EXECUTE_COMMAND_LIST 0x32
+#define COMMAND_RING_ADDR    0x38
+#define COMMAND_RING_SIZE    0x40
+#define COMMAND_RING_TAIL    0x48
+#define COMMAND_RING_HEAD    0x50
+#define COMMAND_RING_FENCE   0x58
+
+// the blitter, at an offset from MMIO_BASE
+#define BLITTER_BASE            0x20000
+#define BLIT_SOURCE             0x00
+#define BLIT_SOURCE_STRIDE      0x08
+#define BLIT_SOURCE_FORMAT      0x10
+#define BLIT_DESTINATION        0x18
+#define BLIT_DESTINATION_STRIDE 0x20
+#define BLIT_DESTINATION_FORMAT 0x28
+#define BLIT_WIDTH              0x30
+#define BLIT_HEIGHT             0x38
+#define BLIT_COLOR              0x40
+#define BLIT_START              0x48
+#define BLIT_COMPLETED          0x50
+#define BLIT_FAILED             0x58
+
+// kompjuta_blit_operation and kompjuta_pixel_format in sources/mmio.h
+typedef enum blit_operation {
+	BLIT_COPY_BYTES,
+	BLIT_FILL_BYTES,
+	BLIT_FILL,
+	BLIT_COPY,
+	BLIT_BLEND,
+} blit_operation;
+
+typedef enum pixel_format {
+	PIXEL_FORMAT_RGBA8,
+	PIXEL_FORMAT_BGRA8,
+	PIXEL_FORMAT_RGB565,
+	PIXEL_FORMAT_A8,
+} pixel_format;
+
+// the layout of kompjuta_gpu_command in sources/mmio.h
+typedef enum gpu_command_kind {
+	GPU_COMMAND_CLEAR,
+	GPU_COMMAND_SET_INDEX_BUFFER,
+	GPU_COMMAND_SET_VERTEX_BUFFER,
+	GPU_COMMAND_SET_RENDER_PIPELINE,
+	GPU_COMMAND_DRAW_INDEXED,
+	GPU_COMMAND_PRESENT,
+	GPU_COMMAND_SIGNAL_FENCE,
+} gpu_command_kind;
+
+typedef struct gpu_command {
+	gpu_command_kind kind;
+	union {
+		struct {
+			float r;
+			float g;
+			float b;
+			float a;
+		} clear;
+		struct {
+			void    *data;
+			uint32_t index_format;
+		} set_index_buffer;
+		struct {
+			void    *data;
+			uint64_t stride;
+		} set_vertex_buffer;
+		struct {
+			void *vertex_shader;
+			void *fragment_shader;
+		} set_render_pipeline;
+		struct {
+			uint32_t index_count;
+			uint32_t instance_count;
+			uint32_t first_index;
+			int32_t  base_vertex;
+			uint32_t first_instance;
+		} draw_indexed;
+		struct {
+			uint64_t value;
+		} signal_fence;
+	} data;
+} gpu_command;
+
+_Static_assert(sizeof(gpu_command) == 32, "gpu_command has to match kompjuta_gpu_command");
+
+static inline uint32_t mmio_read32(uint32_t offset) {
+	return *(volatile uint32_t *)(uintptr_t)(MMIO_BASE + offset);
+}
+
+static inline uint64_t mmio_read64(uint32_t offset) {
+	return *(volatile uint64_t *)(uintptr_t)(MMIO_BASE + offset);
+}
+
+static inline void mmio_write8(uint32_t offset, uint8_t value) {
+	*(volatile uint8_t *)(uintptr_t)(MMIO_BASE + offset) = value;
+}
+
+static inline void mmio_write64(uint32_t offset, uint64_t value) {
+	*(volatile uint64_t *)(uintptr_t)(MMIO_BASE + offset) = value;
+}
+
+static inline void present(void) {
+	mmio_write8(PRESENT, 1);
+}
+
+// Results go here so the compiler can not drop the work.
+volatile uint64_t bench_sink;
+
+// A fast xorshift generator for inputs that the compiler can not see through.
+static inline uint64_t bench_random(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+#define BENCH_STACK_SIZE (64 * 1024)
+
+__attribute__((aligned(16))) uint8_t bench_stack[BENCH_STACK_SIZE];
+
+int main(void);
+
+// The emulator starts harts at the entry point with nothing but a0 set.
+__attribute__((naked, noreturn)) void _start(void) {
+	__asm__ volatile("la sp, bench_stack\n"
+	                 "li t0, %0\n"
+	                 "add sp, sp, t0\n"
+	                 "call main\n"
+	                 "1: j 1b\n"
+	                 :
+	                 : "i"(BENCH_STACK_SIZE));
+}
+
+#endif
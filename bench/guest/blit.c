@@ -0,0 +1,63 @@
+#include "bench.h"
+
+// The blitter: every frame clears the framebuffer, copies an RGB565 sprite into it,
+// blends alpha masks over it in a color and copies the top half over the bottom half, each
+// with a single store to BLIT_START. What is measured is the host's fill, conversion and
+// blend paths, the guest itself runs a few hundred instructions per frame.
+
+#define MAX_PIXELS  (1920 * 1080)
+#define SPRITE_SIZE 64
+#define MASK_COUNT  16
+
+static uint32_t framebuffer[MAX_PIXELS];
+static uint16_t sprite[SPRITE_SIZE * SPRITE_SIZE];
+static uint8_t  mask[SPRITE_SIZE * SPRITE_SIZE];
+
+static void blit_rectangle(blit_operation operation, const void *source, uint64_t source_stride, pixel_format source_format, uint32_t *destination,
+                           uint32_t stride, uint32_t width, uint32_t height, uint32_t color) {
+	mmio_write64(BLITTER_BASE + BLIT_SOURCE, (uint64_t)(uintptr_t)source);
+	mmio_write64(BLITTER_BASE + BLIT_SOURCE_STRIDE, source_stride);
+	mmio_write64(BLITTER_BASE + BLIT_SOURCE_FORMAT, source_format);
+	mmio_write64(BLITTER_BASE + BLIT_DESTINATION, (uint64_t)(uintptr_t)destination);
+	mmio_write64(BLITTER_BASE + BLIT_DESTINATION_STRIDE, stride * 4);
+	mmio_write64(BLITTER_BASE + BLIT_DESTINATION_FORMAT, PIXEL_FORMAT_RGBA8);
+	mmio_write64(BLITTER_BASE + BLIT_WIDTH, width);
+	mmio_write64(BLITTER_BASE + BLIT_HEIGHT, height);
+	mmio_write64(BLITTER_BASE + BLIT_COLOR, color);
+	mmio_write64(BLITTER_BASE + BLIT_START, operation);
+}
+
+int main(void) {
+	uint32_t width  = mmio_read32(FB_WIDTH);
+	uint32_t height = mmio_read32(FB_HEIGHT);
+	uint32_t stride = mmio_read32(FB_STRIDE) / 4;
+	if (stride * height > MAX_PIXELS) {
+		height = MAX_PIXELS / stride;
+	}
+
+	mmio_write64(FB_ADDR, (uint64_t)(uintptr_t)framebuffer);
+
+	for (uint32_t y = 0; y < SPRITE_SIZE; ++y) {
+		for (uint32_t x = 0; x < SPRITE_SIZE; ++x) {
+			sprite[y * SPRITE_SIZE + x] = (uint16_t)((x / 2) << 11 | (y & 0x3f) << 5 | ((x ^ y) & 0x1f));
+			mask[y * SPRITE_SIZE + x]   = (uint8_t)((x + y) * 2);
+		}
+	}
+
+	for (uint32_t frame = 0;; ++frame) {
+		blit_rectangle(BLIT_FILL, 0, 0, PIXEL_FORMAT_RGBA8, framebuffer, stride, width, height, 0xff000000 | frame);
+
+		uint32_t sprite_x = frame % (width - SPRITE_SIZE);
+		blit_rectangle(BLIT_COPY, sprite, SPRITE_SIZE * 2, PIXEL_FORMAT_RGB565, &framebuffer[sprite_x], stride, SPRITE_SIZE, SPRITE_SIZE, 0);
+
+		for (uint32_t index = 0; index < MASK_COUNT; ++index) {
+			uint32_t x = (index * 97 + frame) % (width - SPRITE_SIZE);
+			uint32_t y = (index * 53) % (height - SPRITE_SIZE);
+			blit_rectangle(BLIT_BLEND, mask, SPRITE_SIZE, PIXEL_FORMAT_A8, &framebuffer[y * stride + x], stride, SPRITE_SIZE, SPRITE_SIZE, 0x00ffc080);
+		}
+
+		blit_rectangle(BLIT_COPY, framebuffer, stride * 4, PIXEL_FORMAT_RGBA8, &framebuffer[height / 2 * stride], stride, width, height / 2, 0);
+
+		present();
+	}
+}
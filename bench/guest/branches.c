@@ -0,0 +1,113 @@
+#include "bench.h"
+
+// Branch-heavy code: insertion sorts of random arrays, binary searches and a state machine
+// behind a jump table, so blocks stay short and indirect jumps are common.
+
+#define ARRAY_SIZE 256
+
+static uint32_t values[ARRAY_SIZE];
+
+static void insertion_sort(uint32_t *array, uint32_t count) {
+	for (uint32_t index = 1; index < count; ++index) {
+		uint32_t value    = array[index];
+		uint32_t position = index;
+		while (position > 0 && array[position - 1] > value) {
+			array[position] = array[position - 1];
+			--position;
+		}
+		array[position] = value;
+	}
+}
+
+static uint32_t binary_search(const uint32_t *array, uint32_t count, uint32_t value) {
+	uint32_t low  = 0;
+	uint32_t high = count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (array[middle] < value) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+__attribute__((noinline)) static uint64_t state_machine(uint64_t input, uint32_t steps) {
+	uint64_t result = 0;
+	uint32_t state  = 0;
+	for (uint32_t step = 0; step < steps; ++step) {
+		uint32_t symbol = (input >> (step & 63)) & 7;
+		switch ((state << 3 | symbol) % 11) {
+		case 0:
+			result += step;
+			state = 1;
+			break;
+		case 1:
+			result ^= input;
+			state = 2;
+			break;
+		case 2:
+			result = result * 3 + 1;
+			state  = 0;
+			break;
+		case 3:
+			result >>= 1;
+			state = 3;
+			break;
+		case 4:
+			result -= symbol;
+			state = 4;
+			break;
+		case 5:
+			result |= 1ull << (step & 63);
+			state = 5;
+			break;
+		case 6:
+			result += state;
+			state = 6;
+			break;
+		case 7:
+			result ^= result >> 13;
+			state = 7;
+			break;
+		case 8:
+			result += 0x9e3779b9;
+			state = 1;
+			break;
+		case 9:
+			result = ~result;
+			state  = 3;
+			break;
+		default:
+			state = 0;
+			break;
+		}
+	}
+	return result;
+}
+
+int main(void) {
+	uint64_t state = 12345;
+
+	for (;;) {
+		uint64_t result = 0;
+
+		for (uint32_t round = 0; round < 16; ++round) {
+			for (uint32_t index = 0; index < ARRAY_SIZE; ++index) {
+				values[index] = (uint32_t)bench_random(&state);
+			}
+			insertion_sort(values, ARRAY_SIZE);
+
+			for (uint32_t search = 0; search < 256; ++search) {
+				result += binary_search(values, ARRAY_SIZE, (uint32_t)bench_random(&state));
+			}
+
+			result += state_machine(bench_random(&state), 4096);
+		}
+
+		bench_sink = result;
+		present();
+	}
+}
@@ -0,0 +1,26 @@
+#include "bench.h"
+
+// Command-list submission: a small list of clears ending in a present is submitted every
+// frame, which measures the path from EXECUTE_COMMAND_LIST to the host GPU.
+
+#define CLEAR_COUNT 7
+
+static gpu_command commands[CLEAR_COUNT + 1];
+
+int main(void) {
+	mmio_write64(COMMAND_LIST_ADDR, (uint64_t)(uintptr_t)commands);
+	mmio_write64(COMMAND_LIST_SIZE, CLEAR_COUNT + 1);
+
+	for (uint32_t frame = 0;; ++frame) {
+		for (uint32_t index = 0; index < CLEAR_COUNT; ++index) {
+			commands[index].kind         = GPU_COMMAND_CLEAR;
+			commands[index].data.clear.r = (float)((frame + index) & 0xff) / 255.0f;
+			commands[index].data.clear.g = (float)index / CLEAR_COUNT;
+			commands[index].data.clear.b = 0.25f;
+			commands[index].data.clear.a = 1.0f;
+		}
+		commands[CLEAR_COUNT].kind = GPU_COMMAND_PRESENT;
+
+		mmio_write8(EXECUTE_COMMAND_LIST, 1);
+	}
+}
@@ -0,0 +1,42 @@
+#include "bench.h"
+
+// Command-ring submission: the same clears and present as command_list, queued in the ring
+// with a fence per frame. The guest runs up to FRAMES_IN_FLIGHT frames ahead of the host and
+// waits on the fence of older frames, which measures the doorbell path.
+
+#define CLEAR_COUNT      7
+#define FRAME_COMMANDS   (CLEAR_COUNT + 2)
+#define RING_SIZE        64
+#define FRAMES_IN_FLIGHT 2
+
+static gpu_command ring[RING_SIZE];
+
+int main(void) {
+	mmio_write64(COMMAND_RING_ADDR, (uint64_t)(uintptr_t)ring);
+	mmio_write64(COMMAND_RING_SIZE, RING_SIZE);
+
+	uint64_t tail = 0;
+	for (uint64_t frame = 1;; ++frame) {
+		if (frame > FRAMES_IN_FLIGHT) {
+			mmio_write64(COMMAND_RING_FENCE, frame - FRAMES_IN_FLIGHT);
+		}
+		while (tail + FRAME_COMMANDS - mmio_read64(COMMAND_RING_HEAD) > RING_SIZE) {
+		}
+
+		for (uint32_t index = 0; index < CLEAR_COUNT; ++index) {
+			gpu_command *command  = &ring[tail++ % RING_SIZE];
+			command->kind         = GPU_COMMAND_CLEAR;
+			command->data.clear.r = (float)((frame + index) & 0xff) / 255.0f;
+			command->data.clear.g = (float)index / CLEAR_COUNT;
+			command->data.clear.b = 0.25f;
+			command->data.clear.a = 1.0f;
+		}
+		ring[tail++ % RING_SIZE].kind = GPU_COMMAND_PRESENT;
+
+		gpu_command *fence             = &ring[tail++ % RING_SIZE];
+		fence->kind                    = GPU_COMMAND_SIGNAL_FENCE;
+		fence->data.signal_fence.value = frame;
+
+		mmio_write64(COMMAND_RING_TAIL, tail);
+	}
+}
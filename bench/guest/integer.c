@@ -0,0 +1,27 @@
+#include "bench.h"
+
+// Integer loops: multiply, divide, shift and logic over a few dependency chains, the bread
+// and butter of the decoded block handlers and the JIT's ALU templates.
+
+int main(void) {
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+
+	for (;;) {
+		uint64_t a = bench_random(&state);
+		uint64_t b = bench_random(&state) | 1;
+		uint64_t c = 0;
+		uint32_t d = (uint32_t)a;
+
+		for (uint32_t index = 0; index < 100000; ++index) {
+			a = a * 6364136223846793005ull + 1442695040888963407ull;
+			b  = (b ^ (a >> 29)) | 1;
+			c += (a % b) + (b << (index & 15));
+			d  = d * 1103515245u + 12345u;
+			c ^= (uint64_t)(d / ((index & 7) + 1)) << 7;
+			c  = (c >> 3) | (c << 61);
+		}
+
+		bench_sink = a + b + c + d;
+		present();
+	}
+}
@@ -0,0 +1,43 @@
+#include "bench.h"
+
+// Copies between two 1 MiB buffers, word-wise when both sides are aligned and byte-wise at
+// odd offsets, which is load and store traffic through the TLB and the page flags.
+
+#define BUFFER_SIZE (1024 * 1024)
+
+static uint64_t source[BUFFER_SIZE / 8];
+static uint64_t destination[BUFFER_SIZE / 8];
+
+static void copy_words(uint64_t *to, const uint64_t *from, size_t count) {
+	for (size_t index = 0; index < count; index += 4) {
+		uint64_t a    = from[index + 0];
+		uint64_t b    = from[index + 1];
+		uint64_t c    = from[index + 2];
+		uint64_t d    = from[index + 3];
+		to[index + 0] = a;
+		to[index + 1] = b;
+		to[index + 2] = c;
+		to[index + 3] = d;
+	}
+}
+
+static void copy_bytes(uint8_t *to, const uint8_t *from, size_t size) {
+	for (size_t index = 0; index < size; ++index) {
+		to[index] = from[index];
+	}
+}
+
+int main(void) {
+	uint64_t state = 1;
+	for (size_t index = 0; index < BUFFER_SIZE / 8; ++index) {
+		source[index] = bench_random(&state);
+	}
+
+	for (uint32_t round = 0;; ++round) {
+		copy_words(destination, source, BUFFER_SIZE / 8);
+		copy_bytes((uint8_t *)destination + 1 + (round & 7), (const uint8_t *)source + 3, BUFFER_SIZE / 16);
+
+		bench_sink = destination[round & (BUFFER_SIZE / 8 - 1)];
+		present();
+	}
+}
@@ -0,0 +1,29 @@
+#include "bench.h"
+
+// The MMIO present loop: a few framebuffer rows change and the frame is presented, so the
+// cost per frame is mostly the present path itself.
+
+#define MAX_PIXELS (1920 * 1080)
+
+static uint32_t framebuffer[MAX_PIXELS];
+
+int main(void) {
+	uint32_t width  = mmio_read32(FB_WIDTH);
+	uint32_t height = mmio_read32(FB_HEIGHT);
+	uint32_t stride = mmio_read32(FB_STRIDE) / 4;
+	if (stride * height > MAX_PIXELS) {
+		height = MAX_PIXELS / stride;
+	}
+
+	mmio_write64(FB_ADDR, (uint64_t)(uintptr_t)framebuffer);
+
+	for (uint32_t frame = 0;; ++frame) {
+		for (uint32_t row = 0; row < 4; ++row) {
+			uint32_t *pixels = &framebuffer[((frame * 4 + row) % height) * stride];
+			for (uint32_t x = 0; x < width; ++x) {
+				pixels[x] = 0xff000000 | (frame + x) << 8 | row;
+			}
+		}
+		present();
+	}
+}
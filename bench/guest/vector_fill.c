@@ -0,0 +1,37 @@
+#include "bench.h"
+
+#include <riscv_vector.h>
+
+// RVV fills of a 1 MiB buffer, a constant with unit-stride stores and a gradient from vid,
+// at the widest register groups. Built with the V extension.
+
+#define BUFFER_SIZE (1024 * 1024)
+
+static uint32_t buffer[BUFFER_SIZE / 4];
+
+static void fill_constant(uint32_t *to, size_t count, uint32_t value) {
+	for (size_t index = 0; index < count;) {
+		size_t vl = __riscv_vsetvl_e32m8(count - index);
+		__riscv_vse32_v_u32m8(&to[index], __riscv_vmv_v_x_u32m8(value, vl), vl);
+		index += vl;
+	}
+}
+
+static void fill_gradient(uint32_t *to, size_t count, uint32_t start) {
+	for (size_t index = 0; index < count;) {
+		size_t      vl     = __riscv_vsetvl_e32m8(count - index);
+		vuint32m8_t values = __riscv_vadd_vx_u32m8(__riscv_vid_v_u32m8(vl), start + (uint32_t)index, vl);
+		__riscv_vse32_v_u32m8(&to[index], __riscv_vsll_vx_u32m8(values, 8, vl), vl);
+		index += vl;
+	}
+}
+
+int main(void) {
+	for (uint32_t round = 0;; ++round) {
+		fill_constant(buffer, BUFFER_SIZE / 4, round);
+		fill_gradient(buffer, BUFFER_SIZE / 4, round);
+
+		bench_sink = buffer[round & (BUFFER_SIZE / 4 - 1)];
+		present();
+	}
+}
@@ -0,0 +1,376 @@
+// Runs the benchmark programs on a headless emulator and collects the numbers.
+//
+//   runner <kompjuta> <benchmark directory> <results.json> [emulator options...]
+//
+// Every benchmark is <benchmark directory>/<name>.elf and runs in its own emulator process,
+// which stops after a budget of instructions or frames. Options after the results file, for
+// example --no-jit or --harts 4, are passed to every run.
+//
+//   runner --compare <baseline.json> <results.json>
+//
+// Prints the numbers of two results files side by side, for example of builds with and without
+// KOMPJUTA_THREADED_DISPATCH that both ran with --no-jit.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define MAX_ARGUMENTS 64
+#define OUTPUT_SIZE   (64 * 1024)
+
+typedef struct benchmark {
+	const char *name;
+	const char *budget_option; // --max-instructions or --max-frames
+	const char *budget;
+} benchmark;
+
+static const benchmark benchmarks[] = {
+    {"integer", "--max-instructions", "500000000"},
+    {"memcpy", "--max-instructions", "500000000"},
+    {"branches", "--max-instructions", "500000000"},
+    {"vector_fill", "--max-instructions", "100000000"},
+    {"present", "--max-frames", "2000"},
+    {"command_list", "--max-frames", "20000"},
+    {"command_ring", "--max-frames", "20000"},
+    {"blit", "--max-frames", "2000"},
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+// a run that does not reach its budget in time is cut short and reported as it is
+#define MAX_SECONDS "60"
+
+typedef struct result {
+	bool               ran;
+	int                exit_code;
+	unsigned long long instructions;
+	unsigned long long frames;
+	double             seconds;
+	uint64_t           peak_rss_kib;
+} result;
+
+static char output[OUTPUT_SIZE];
+
+// Called after every read, the pipe is drained to the end either way so the emulator never blocks
+// on it. The summary comes last, so once output is full the older half of it is dropped.
+static size_t make_room(size_t length) {
+	if (length < OUTPUT_SIZE - 1) {
+		return length;
+	}
+	memmove(output, output + OUTPUT_SIZE / 2, length - OUTPUT_SIZE / 2);
+	return length - OUTPUT_SIZE / 2;
+}
+
+#ifdef _WIN32
+
+static void append_argument(char *command_line, size_t size, const char *argument) {
+	size_t length = strlen(command_line);
+	snprintf(command_line + length, size - length, length == 0 ? "\"%s\"" : " \"%s\"", argument);
+}
+
+// Runs the arguments, collects stdout and stderr in output and returns false when the process
+// could not be started.
+static bool run(const char **arguments, int *exit_code, uint64_t *peak_rss_kib) {
+	static char command_line[32 * 1024];
+	command_line[0] = 0;
+	for (int index = 0; arguments[index] != NULL; ++index) {
+		append_argument(command_line, sizeof(command_line), arguments[index]);
+	}
+
+	SECURITY_ATTRIBUTES attributes = {sizeof(attributes), NULL, TRUE};
+	HANDLE              read_pipe;
+	HANDLE              write_pipe;
+	if (!CreatePipe(&read_pipe, &write_pipe, &attributes, 0)) {
+		return false;
+	}
+	SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOA startup = {0};
+	startup.cb           = sizeof(startup);
+	startup.dwFlags      = STARTF_USESTDHANDLES;
+	startup.hStdInput    = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput   = write_pipe;
+	startup.hStdError    = write_pipe;
+
+	PROCESS_INFORMATION process;
+	if (!CreateProcessA(NULL, command_line, NULL, NULL, TRUE, 0, NULL, NULL, &startup, &process)) {
+		CloseHandle(read_pipe);
+		CloseHandle(write_pipe);
+		return false;
+	}
+	CloseHandle(write_pipe);
+
+	size_t length = 0;
+	DWORD  read;
+	while (ReadFile(read_pipe, output + length, (DWORD)(OUTPUT_SIZE - 1 - length), &read, NULL) && read > 0) {
+		length = make_room(length + read);
+	}
+	output[length] = 0;
+	CloseHandle(read_pipe);
+
+	WaitForSingleObject(process.hProcess, INFINITE);
+
+	DWORD code;
+	GetExitCodeProcess(process.hProcess, &code);
+	*exit_code = (int)code;
+
+	PROCESS_MEMORY_COUNTERS counters;
+	*peak_rss_kib = GetProcessMemoryInfo(process.hProcess, &counters, sizeof(counters)) ? counters.PeakWorkingSetSize / 1024 : 0;
+
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+	return true;
+}
+
+#else
+
+static bool run(const char **arguments, int *exit_code, uint64_t *peak_rss_kib) {
+	int pipe_ends[2];
+	if (pipe(pipe_ends) != 0) {
+		return false;
+	}
+
+	pid_t child = fork();
+	if (child < 0) {
+		close(pipe_ends[0]);
+		close(pipe_ends[1]);
+		return false;
+	}
+
+	if (child == 0) {
+		dup2(pipe_ends[1], STDOUT_FILENO);
+		dup2(pipe_ends[1], STDERR_FILENO);
+		close(pipe_ends[0]);
+		close(pipe_ends[1]);
+		execv(arguments[0], (char *const *)arguments);
+		_exit(127);
+	}
+	close(pipe_ends[1]);
+
+	size_t  length = 0;
+	ssize_t read_size;
+	while ((read_size = read(pipe_ends[0], output + length, OUTPUT_SIZE - 1 - length)) > 0) {
+		length = make_room(length + (size_t)read_size);
+	}
+	output[length] = 0;
+	close(pipe_ends[0]);
+
+	// wait4 reports the peak of this child alone, getrusage(RUSAGE_CHILDREN) would be the
+	// largest child so far
+	int           status;
+	struct rusage usage;
+	if (wait4(child, &status, 0, &usage) != child) {
+		return false;
+	}
+	*exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	if (*exit_code == 127) {
+		return false;
+	}
+
+#ifdef __APPLE__
+	*peak_rss_kib = (uint64_t)usage.ru_maxrss / 1024; // bytes on macOS
+#else
+	*peak_rss_kib = (uint64_t)usage.ru_maxrss;
+#endif
+	return true;
+}
+
+#endif
+
+// Finds the summary that the emulator logs at the end of a headless run.
+static bool parse_summary(result *result) {
+	const char *line = strstr(output, "Ran ");
+	while (line != NULL) {
+		if (sscanf(line, "Ran %llu instructions and %llu frames in %lf s", &result->instructions, &result->frames, &result->seconds) == 3) {
+			return true;
+		}
+		line = strstr(line + 4, "Ran ");
+	}
+	return false;
+}
+
+static double mips(const result *result) {
+	return result->seconds > 0.0 ? (double)result->instructions / result->seconds / 1000000.0 : 0.0;
+}
+
+static double ns_per_instruction(const result *result) {
+	return result->instructions > 0 ? result->seconds * 1000000000.0 / (double)result->instructions : 0.0;
+}
+
+static double presents_per_second(const result *result) {
+	return result->seconds > 0.0 ? (double)result->frames / result->seconds : 0.0;
+}
+
+static bool write_results(const char *path, const char *emulator, const result *results) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+
+	fprintf(file, "{\n  \"emulator\": \"");
+	for (const char *character = emulator; *character != 0; ++character) {
+		if (*character == '"' || *character == '\\') {
+			fputc('\\', file);
+		}
+		fputc(*character, file);
+	}
+	fprintf(file, "\",\n  \"benchmarks\": [\n");
+
+	for (size_t index = 0; index < BENCHMARK_COUNT; ++index) {
+		const result *result = &results[index];
+		fprintf(file,
+		        "    {\"name\": \"%s\", \"ran\": %s, \"exit_code\": %d, \"instructions\": %llu, \"frames\": %llu, \"seconds\": %.6f, \"mips\": %.3f, "
+		        "\"ns_per_instruction\": %.4f, \"presents_per_second\": %.3f, \"peak_rss_kib\": %llu}%s\n",
+		        benchmarks[index].name, result->ran ? "true" : "false", result->exit_code, result->instructions, result->frames, result->seconds, mips(result),
+		        ns_per_instruction(result), presents_per_second(result), (unsigned long long)result->peak_rss_kib, index + 1 < BENCHMARK_COUNT ? "," : "");
+	}
+
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+	return true;
+}
+
+typedef struct summary {
+	char   name[64];
+	double mips;
+	double presents_per_second;
+} summary;
+
+// Reads the benchmarks that ran from a file of write_results, which puts each on a line of its own.
+static bool read_summaries(const char *path, summary *summaries, size_t *count) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	char line[1024];
+	*count = 0;
+	while (*count < BENCHMARK_COUNT && fgets(line, sizeof(line), file) != NULL) {
+		summary    *summary  = &summaries[*count];
+		const char *name     = strstr(line, "\"name\": \"");
+		const char *mips     = strstr(line, "\"mips\": ");
+		const char *presents = strstr(line, "\"presents_per_second\": ");
+		if (name == NULL || mips == NULL || presents == NULL || strstr(line, "\"ran\": true") == NULL) {
+			continue;
+		}
+		if (sscanf(name, "\"name\": \"%63[^\"]\"", summary->name) == 1 && sscanf(mips, "\"mips\": %lf", &summary->mips) == 1 &&
+		    sscanf(presents, "\"presents_per_second\": %lf", &summary->presents_per_second) == 1) {
+			++*count;
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+static double change(double baseline, double value) {
+	return baseline > 0.0 ? (value / baseline - 1.0) * 100.0 : 0.0;
+}
+
+static int compare(const char *baseline_path, const char *results_path) {
+	summary baselines[BENCHMARK_COUNT];
+	summary results[BENCHMARK_COUNT];
+	size_t  baseline_count;
+	size_t  result_count;
+	if (!read_summaries(baseline_path, baselines, &baseline_count) || !read_summaries(results_path, results, &result_count)) {
+		fprintf(stderr, "Could not read %s or %s.\n", baseline_path, results_path);
+		return 1;
+	}
+
+	printf("%-14s %10s %10s %8s %12s %12s %8s\n", "benchmark", "base MIPS", "MIPS", "change", "base pres/s", "pres/s", "change");
+	for (size_t result_index = 0; result_index < result_count; ++result_index) {
+		const summary *result = &results[result_index];
+		for (size_t baseline_index = 0; baseline_index < baseline_count; ++baseline_index) {
+			const summary *baseline = &baselines[baseline_index];
+			if (strcmp(baseline->name, result->name) == 0) {
+				printf("%-14s %10.1f %10.1f %+7.1f%% %12.1f %12.1f %+7.1f%%\n", result->name, baseline->mips, result->mips, change(baseline->mips, result->mips),
+				       baseline->presents_per_second, result->presents_per_second, change(baseline->presents_per_second, result->presents_per_second));
+			}
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc == 4 && strcmp(argv[1], "--compare") == 0) {
+		return compare(argv[2], argv[3]);
+	}
+
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s <kompjuta> <benchmark directory> <results.json> [emulator options...]\n", argv[0]);
+		fprintf(stderr, "       %s --compare <baseline.json> <results.json>\n", argv[0]);
+		return 2;
+	}
+
+	const char *emulator       = argv[1];
+	const char *directory      = argv[2];
+	const char *results_path   = argv[3];
+	int         extra_count    = argc - 4;
+	result      results[BENCHMARK_COUNT];
+	bool        failed         = false;
+	char        program[4096];
+	const char *arguments[MAX_ARGUMENTS];
+
+	if (extra_count > MAX_ARGUMENTS - 10) {
+		fprintf(stderr, "Too many emulator options.\n");
+		return 2;
+	}
+
+	printf("%-14s %14s %8s %10s %8s %12s %10s %12s\n", "benchmark", "instructions", "frames", "seconds", "MIPS", "ns/instr", "presents/s", "peak RSS KiB");
+
+	for (size_t index = 0; index < BENCHMARK_COUNT; ++index) {
+		const benchmark *benchmark = &benchmarks[index];
+		result          *result    = &results[index];
+		memset(result, 0, sizeof(*result));
+
+		snprintf(program, sizeof(program), "%s/%s.elf", directory, benchmark->name);
+
+		int count          = 0;
+		arguments[count++] = emulator;
+		arguments[count++] = "--headless";
+		arguments[count++] = benchmark->budget_option;
+		arguments[count++] = benchmark->budget;
+		arguments[count++] = "--max-seconds";
+		arguments[count++] = MAX_SECONDS;
+		for (int extra = 0; extra < extra_count; ++extra) {
+			arguments[count++] = argv[4 + extra];
+		}
+		arguments[count++] = program;
+		arguments[count]   = NULL;
+
+		if (!run(arguments, &result->exit_code, &result->peak_rss_kib)) {
+			fprintf(stderr, "Could not run %s.\n", emulator);
+			return 1;
+		}
+
+		result->ran = parse_summary(result) && result->exit_code == 0;
+		if (!result->ran) {
+			fprintf(stderr, "%s failed with exit code %d:\n%s\n", benchmark->name, result->exit_code, output);
+			failed = true;
+			continue;
+		}
+
+		printf("%-14s %14llu %8llu %10.3f %8.1f %12.3f %10.1f %12llu\n", benchmark->name, result->instructions, result->frames, result->seconds, mips(result),
+		       ns_per_instruction(result), presents_per_second(result), (unsigned long long)result->peak_rss_kib);
+	}
+
+	if (!write_results(results_path, emulator, results)) {
+		fprintf(stderr, "Could not write %s.\n", results_path);
+		return 1;
+	}
+
+	return failed ? 1 : 0;
+}
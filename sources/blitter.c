@@ -0,0 +1,202 @@
+#include "blitter.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Conversions and blends go through RGBA8 chunks of CHUNK_PIXELS, copies within one format are memmove of whole rows.
+
+#define CHUNK_PIXELS 64
+
+uint32_t blitter_pixel_size(kompjuta_pixel_format format) {
+	switch (format) {
+	case KOMPJUTA_PIXEL_FORMAT_RGBA8:
+	case KOMPJUTA_PIXEL_FORMAT_BGRA8:
+		return 4;
+	case KOMPJUTA_PIXEL_FORMAT_RGB565:
+		return 2;
+	case KOMPJUTA_PIXEL_FORMAT_A8:
+		return 1;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+static uint32_t swap_red_blue(uint32_t pixel) {
+	return (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff) | ((pixel & 0xff) << 16);
+}
+
+static void load_chunk(uint32_t *restrict rgba, const uint8_t *restrict pixels, kompjuta_pixel_format format, uint32_t color) {
+	switch (format) {
+	case KOMPJUTA_PIXEL_FORMAT_RGBA8:
+		memcpy(rgba, pixels, CHUNK_PIXELS * 4);
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_BGRA8:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			uint32_t pixel;
+			memcpy(&pixel, &pixels[index * 4], 4);
+			rgba[index] = swap_red_blue(pixel);
+		}
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_RGB565:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			uint16_t pixel;
+			memcpy(&pixel, &pixels[index * 2], 2);
+			// the top bits repeat in the bottom ones so white stays white
+			uint32_t r  = pixel >> 11;
+			uint32_t g  = (pixel >> 5) & 0x3f;
+			uint32_t b  = pixel & 0x1f;
+			rgba[index] = ((r << 3) | (r >> 2)) | ((g << 2) | (g >> 4)) << 8 | ((b << 3) | (b >> 2)) << 16 | 0xff000000;
+		}
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_A8:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			rgba[index] = (color & 0x00ffffff) | (uint32_t)pixels[index] << 24;
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+static void store_chunk(uint8_t *restrict pixels, kompjuta_pixel_format format, const uint32_t *restrict rgba) {
+	switch (format) {
+	case KOMPJUTA_PIXEL_FORMAT_RGBA8:
+		memcpy(pixels, rgba, CHUNK_PIXELS * 4);
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_BGRA8:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			uint32_t pixel = swap_red_blue(rgba[index]);
+			memcpy(&pixels[index * 4], &pixel, 4);
+		}
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_RGB565:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			uint32_t color = rgba[index];
+			uint16_t pixel = (uint16_t)(((color & 0xf8) << 8) | ((color >> 5) & 0x7e0) | ((color >> 19) & 0x1f));
+			memcpy(&pixels[index * 2], &pixel, 2);
+		}
+		break;
+	case KOMPJUTA_PIXEL_FORMAT_A8:
+		for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+			pixels[index] = (uint8_t)(rgba[index] >> 24);
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+// the ends of rows are shorter than a chunk and go through a bounce buffer
+static void load_pixels(uint32_t *rgba, const uint8_t *pixels, kompjuta_pixel_format format, uint32_t count, uint32_t color) {
+	if (count == CHUNK_PIXELS) {
+		load_chunk(rgba, pixels, format, color);
+		return;
+	}
+	uint8_t bounce[CHUNK_PIXELS * 4] = {0};
+	memcpy(bounce, pixels, (size_t)count * blitter_pixel_size(format));
+	load_chunk(rgba, bounce, format, color);
+}
+
+static void store_pixels(uint8_t *pixels, kompjuta_pixel_format format, const uint32_t *rgba, uint32_t count) {
+	if (count == CHUNK_PIXELS) {
+		store_chunk(pixels, format, rgba);
+		return;
+	}
+	uint8_t bounce[CHUNK_PIXELS * 4];
+	store_chunk(bounce, format, rgba);
+	memcpy(pixels, bounce, (size_t)count * blitter_pixel_size(format));
+}
+
+// Source over destination, two channels at a time in the 16 bit halves of a uint32_t with
+// x / 255 rounded as (x + 128 + ((x + 128) >> 8)) >> 8, which is exact for x up to 255 * 255.
+// The source's alpha lane multiplies 255 so the result's alpha is a + da * (1 - a).
+static void blend_chunk(uint32_t *restrict destination, const uint32_t *restrict source) {
+	for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+		uint32_t s       = source[index];
+		uint32_t d       = destination[index];
+		uint32_t alpha   = s >> 24;
+		uint32_t inverse = 255 - alpha;
+
+		uint32_t red_blue = (s & 0x00ff00ff) * alpha + (d & 0x00ff00ff) * inverse + 0x00800080;
+		red_blue          = ((red_blue + ((red_blue >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+
+		uint32_t green_alpha = (((s | 0xff000000) >> 8) & 0x00ff00ff) * alpha + ((d >> 8) & 0x00ff00ff) * inverse + 0x00800080;
+		green_alpha          = (green_alpha + ((green_alpha >> 8) & 0x00ff00ff)) & 0xff00ff00;
+
+		destination[index] = red_blue | green_alpha;
+	}
+}
+
+void blitter_fill(const blitter_surface *destination, uint32_t width, uint32_t height, uint32_t color) {
+	uint32_t pixel_size = blitter_pixel_size(destination->format);
+
+	// one chunk of the color in the destination's format, repeated along the first row
+	uint32_t rgba[CHUNK_PIXELS];
+	uint8_t  pattern[CHUNK_PIXELS * 4];
+	for (uint32_t index = 0; index < CHUNK_PIXELS; ++index) {
+		rgba[index] = color;
+	}
+	store_chunk(pattern, destination->format, rgba);
+
+	uint8_t *first = destination->pixels;
+	for (uint32_t x = 0; x < width; x += CHUNK_PIXELS) {
+		uint32_t count = width - x < CHUNK_PIXELS ? width - x : CHUNK_PIXELS;
+		memcpy(&first[(uint64_t)x * pixel_size], pattern, (size_t)count * pixel_size);
+	}
+
+	for (uint32_t y = 1; y < height; ++y) {
+		memcpy(&destination->pixels[destination->stride * y], first, (size_t)width * pixel_size);
+	}
+}
+
+// Rows are walked bottom up when the destination starts after the source, like memmove does
+// with bytes, so copies within one buffer can move rectangles down as well as up.
+static uint64_t row_order(const blitter_surface *destination, const blitter_surface *source, uint32_t height, uint32_t y) {
+	return (uintptr_t)destination->pixels > (uintptr_t)source->pixels ? height - 1 - y : y;
+}
+
+void blitter_copy(const blitter_surface *destination, const blitter_surface *source, uint32_t width, uint32_t height, uint32_t color) {
+	if (destination->format == source->format) {
+		size_t row_size = (size_t)width * blitter_pixel_size(source->format);
+		for (uint32_t y = 0; y < height; ++y) {
+			uint64_t row = row_order(destination, source, height, y);
+			memmove(&destination->pixels[destination->stride * row], &source->pixels[source->stride * row], row_size);
+		}
+		return;
+	}
+
+	uint32_t source_size      = blitter_pixel_size(source->format);
+	uint32_t destination_size = blitter_pixel_size(destination->format);
+	uint32_t rgba[CHUNK_PIXELS];
+	for (uint32_t y = 0; y < height; ++y) {
+		const uint8_t *source_row      = &source->pixels[source->stride * y];
+		uint8_t       *destination_row = &destination->pixels[destination->stride * y];
+		for (uint32_t x = 0; x < width; x += CHUNK_PIXELS) {
+			uint32_t count = width - x < CHUNK_PIXELS ? width - x : CHUNK_PIXELS;
+			load_pixels(rgba, &source_row[(uint64_t)x * source_size], source->format, count, color);
+			store_pixels(&destination_row[(uint64_t)x * destination_size], destination->format, rgba, count);
+		}
+	}
+}
+
+void blitter_blend(const blitter_surface *destination, const blitter_surface *source, uint32_t width, uint32_t height, uint32_t color) {
+	uint32_t source_size      = blitter_pixel_size(source->format);
+	uint32_t destination_size = blitter_pixel_size(destination->format);
+	uint32_t source_rgba[CHUNK_PIXELS];
+	uint32_t destination_rgba[CHUNK_PIXELS];
+	for (uint32_t y = 0; y < height; ++y) {
+		const uint8_t *source_row      = &source->pixels[source->stride * y];
+		uint8_t       *destination_row = &destination->pixels[destination->stride * y];
+		for (uint32_t x = 0; x < width; x += CHUNK_PIXELS) {
+			uint32_t count = width - x < CHUNK_PIXELS ? width - x : CHUNK_PIXELS;
+			load_pixels(source_rgba, &source_row[(uint64_t)x * source_size], source->format, count, color);
+			load_pixels(destination_rgba, &destination_row[(uint64_t)x * destination_size], destination->format, count, 0);
+			blend_chunk(destination_rgba, source_rgba);
+			store_pixels(&destination_row[(uint64_t)x * destination_size], destination->format, destination_rgba, count);
+		}
+	}
+}
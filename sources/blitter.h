@@ -0,0 +1,36 @@
+#ifndef KOMPJUTA_BLITTER_HEADER
+#define KOMPJUTA_BLITTER_HEADER
+
+#include "mmio.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The pixel work of the blitter registers in mmio.h, on host memory. Colors are RGBA8
+// pixels read as a little endian uint32_t, R in the lowest bits.
+
+// the registers of a hart, BLIT_SOURCE to BLIT_FAILED
+#define BLITTER_REGISTER_COUNT (BLIT_FAILED / 8 + 1)
+
+typedef struct blitter_surface {
+	uint8_t              *pixels;
+	uint64_t              stride;
+	kompjuta_pixel_format format;
+} blitter_surface;
+
+uint32_t blitter_pixel_size(kompjuta_pixel_format format);
+
+void blitter_fill(const blitter_surface *destination, uint32_t width, uint32_t height, uint32_t color);
+
+// color is what A8 sources take their color from. Copies within one format may overlap.
+void blitter_copy(const blitter_surface *destination, const blitter_surface *source, uint32_t width, uint32_t height, uint32_t color);
+void blitter_blend(const blitter_surface *destination, const blitter_surface *source, uint32_t width, uint32_t height, uint32_t color);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include "block_device.h"
+#include "ram.h"
+
+#include <kore3/log.h>
+#include <kore3/threads/semaphore.h>
+#include <kore3/threads/thread.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static FILE    *image_file      = NULL;
+static uint8_t *image           = NULL;
+static uint64_t image_size      = 0;
+static uint64_t sector_count    = 0;
+static uint64_t host_page_size  = 0;
+static bool     async_transfers = false;
+
+// transfer n waits in slot n % BLOCK_QUEUE_MAX_SIZE, the semaphore counts the waiting ones
+static block_transfer   transfers[BLOCK_QUEUE_MAX_SIZE];
+static _Atomic uint64_t submitted;
+static _Atomic uint64_t completed;
+static kore_semaphore   transfers_waiting;
+static kore_thread      transfer_thread;
+
+static bool whole_pages(uint64_t value) {
+	return value % host_page_size == 0;
+}
+
+static bool run_transfer(const block_transfer *transfer) {
+	if (transfer->sector > sector_count || transfer->sector_count > sector_count - transfer->sector) {
+		return false;
+	}
+	if (transfer->sector_count == 0) {
+		return true;
+	}
+	if (transfer->destination == NULL) {
+		return false;
+	}
+
+	uint64_t offset = transfer->sector * BLOCK_SECTOR_SIZE;
+	uint64_t size   = transfer->sector_count * BLOCK_SECTOR_SIZE;
+	// only the last sector can reach past the end of the file
+	uint64_t available = size < image_size - offset ? size : image_size - offset;
+
+	uint64_t ahead = available + BLOCK_DEVICE_READ_AHEAD < image_size - offset ? available + BLOCK_DEVICE_READ_AHEAD : image_size - offset;
+	ram_prefetch(&image[offset], ahead);
+
+	if (transfer->mappable && available == size && whole_pages(offset) && whole_pages(size) && whole_pages((uintptr_t)transfer->destination) &&
+	    ram_map_file(transfer->destination, size, image_file, offset)) {
+		return true;
+	}
+
+	memcpy(transfer->destination, &image[offset], available);
+	memset(transfer->destination + available, 0, size - available);
+	return true;
+}
+
+static void finish_transfer(const block_transfer *transfer) {
+	uint32_t status = run_transfer(transfer) ? KOMPJUTA_BLOCK_STATUS_OK : KOMPJUTA_BLOCK_STATUS_ERROR;
+	memcpy(transfer->status, &status, sizeof(status));
+}
+
+static void run_transfers(void *data) {
+	(void)data;
+	for (;;) {
+		kore_semaphore_acquire(&transfers_waiting);
+		uint64_t position = atomic_load_explicit(&completed, memory_order_relaxed);
+		// released once more than there are transfers when the device closes
+		if (position == atomic_load_explicit(&submitted, memory_order_acquire)) {
+			return;
+		}
+		finish_transfer(&transfers[position % BLOCK_QUEUE_MAX_SIZE]);
+		atomic_store_explicit(&completed, position + 1, memory_order_release);
+	}
+}
+
+bool block_device_open(const char *path, bool async) {
+	host_page_size = ram_host_page_size();
+
+	if (path != NULL) {
+		image_file = fopen(path, "rb");
+		image      = image_file != NULL ? ram_map_file_read_only(image_file, &image_size) : NULL;
+		if (image == NULL) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Could not open the disk image %s.", path);
+			if (image_file != NULL) {
+				fclose(image_file);
+				image_file = NULL;
+			}
+			return false;
+		}
+		sector_count = (image_size + BLOCK_SECTOR_SIZE - 1) / BLOCK_SECTOR_SIZE;
+		kore_log(KORE_LOG_LEVEL_INFO, "Disk image %s: %llu sectors.", path, sector_count);
+	}
+
+	async_transfers = async;
+	if (async_transfers) {
+		kore_semaphore_init(&transfers_waiting, 0, BLOCK_QUEUE_MAX_SIZE + 1);
+		kore_thread_init(&transfer_thread, run_transfers, NULL);
+	}
+	return true;
+}
+
+void block_device_close(void) {
+	if (async_transfers) {
+		kore_semaphore_release(&transfers_waiting, 1);
+		kore_thread_wait_and_destroy(&transfer_thread);
+		kore_semaphore_destroy(&transfers_waiting);
+		async_transfers = false;
+	}
+
+	// pages mapped into RAM stay valid without the file
+	if (image != NULL) {
+		ram_unmap_file(image, image_size);
+		fclose(image_file);
+		image      = NULL;
+		image_file = NULL;
+	}
+}
+
+uint64_t block_device_sector_count(void) {
+	return sector_count;
+}
+
+void block_device_submit(const block_transfer *transfer) {
+	uint64_t position = atomic_load_explicit(&submitted, memory_order_relaxed);
+	assert(position - atomic_load_explicit(&completed, memory_order_relaxed) < BLOCK_QUEUE_MAX_SIZE);
+
+	if (!async_transfers) {
+		finish_transfer(transfer);
+		atomic_store_explicit(&submitted, position + 1, memory_order_relaxed);
+		atomic_store_explicit(&completed, position + 1, memory_order_release);
+		return;
+	}
+
+	transfers[position % BLOCK_QUEUE_MAX_SIZE] = *transfer;
+	atomic_store_explicit(&submitted, position + 1, memory_order_release);
+	kore_semaphore_release(&transfers_waiting, 1);
+}
+
+uint64_t block_device_completed(void) {
+	return atomic_load_explicit(&completed, memory_order_acquire);
+}
+
+void block_device_set_completed(uint64_t count) {
+	atomic_store(&submitted, count);
+	atomic_store(&completed, count);
+}
@@ -0,0 +1,54 @@
+#ifndef KOMPJUTA_BLOCK_DEVICE_HEADER
+#define KOMPJUTA_BLOCK_DEVICE_HEADER
+
+#include "mmio.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The host side of the block device, the image of --disk. The image is mapped instead of
+// read, a transfer copies out of the mapping after telling the host to read the sectors and
+// BLOCK_DEVICE_READ_AHEAD bytes past them in the background, so streaming through the image
+// mostly finds its pages in the file cache already. Transfers of whole host pages map the
+// image's pages over RAM copy-on-write instead of copying them, those cost nothing until the
+// guest touches them and stay shared with the file cache until it writes to them.
+//
+// With async transfers run on a thread of their own, in the order they were submitted.
+
+#define BLOCK_DEVICE_READ_AHEAD (1024 * 1024)
+
+typedef struct block_transfer {
+	uint64_t sector;
+	uint64_t sector_count;
+	uint8_t *destination; // NULL when the guest memory is not RAM, the transfer fails then
+	bool     mappable;    // destination is the RAM reservation itself, not aliased, watched or holding code
+	uint8_t *status;      // of the request, gets a kompjuta_block_status
+} block_transfer;
+
+// Returns false when the image can not be opened. Without an image the device has no sectors
+// and every transfer but empty ones fails.
+bool block_device_open(const char *path, bool async);
+// Finishes the submitted transfers first.
+void block_device_close(void);
+
+uint64_t block_device_sector_count(void);
+
+// The destination and status stay valid until the transfer completed, at most
+// BLOCK_QUEUE_MAX_SIZE transfers are in flight.
+void block_device_submit(const block_transfer *transfer);
+
+// Transfers completed since the start, what they wrote is visible to the caller.
+uint64_t block_device_completed(void);
+
+// For restoring a snapshot, while no transfer is in flight.
+void block_device_set_completed(uint64_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+#include "compressed.h"
+
+// Fields of the 16 bit formats. The three bit register fields name x8 to x15.
+
+static uint32_t bits(uint16_t instruction, uint32_t high, uint32_t low) {
+	return (instruction >> low) & ((1u << (high - low + 1)) - 1);
+}
+
+static uint32_t sign_extend(uint32_t value, uint32_t bit_count) {
+	uint32_t mask = 1u << (bit_count - 1);
+	return (value ^ mask) - mask;
+}
+
+static uint32_t full_rd(uint16_t instruction) {
+	return bits(instruction, 11, 7);
+}
+
+static uint32_t full_rs2(uint16_t instruction) {
+	return bits(instruction, 6, 2);
+}
+
+static uint32_t short_rd(uint16_t instruction) {
+	return 8 + bits(instruction, 4, 2);
+}
+
+static uint32_t short_rs1(uint16_t instruction) {
+	return 8 + bits(instruction, 9, 7);
+}
+
+// the 6 bit immediate of CI instructions
+static uint32_t immediate6(uint16_t instruction) {
+	return sign_extend((bits(instruction, 12, 12) << 5) | bits(instruction, 6, 2), 6);
+}
+
+// Encoders of the 32 bit formats.
+
+static uint32_t r_type(uint32_t opcode, uint32_t funct3, uint32_t funct7, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+	return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t i_type(uint32_t opcode, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t immediate) {
+	return ((immediate & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t s_type(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t immediate) {
+	return (((immediate >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((immediate & 0x1f) << 7) | opcode;
+}
+
+static uint32_t b_type(uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t immediate) {
+	return (((immediate >> 12) & 0x1) << 31) | (((immediate >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (((immediate >> 1) & 0xf) << 8) |
+	       (((immediate >> 11) & 0x1) << 7) | 0x63;
+}
+
+static uint32_t j_type(uint32_t rd, uint32_t immediate) {
+	return (((immediate >> 20) & 0x1) << 31) | (((immediate >> 1) & 0x3ff) << 21) | (((immediate >> 11) & 0x1) << 20) | (((immediate >> 12) & 0xff) << 12) |
+	       (rd << 7) | 0x6f;
+}
+
+static uint32_t expand_quadrant0(uint16_t instruction) {
+	uint32_t rd  = short_rd(instruction);
+	uint32_t rs1 = short_rs1(instruction);
+
+	// offsets scaled by 4 and by 8
+	uint32_t word       = (bits(instruction, 12, 10) << 3) | (bits(instruction, 6, 6) << 2) | (bits(instruction, 5, 5) << 6);
+	uint32_t doubleword = (bits(instruction, 12, 10) << 3) | (bits(instruction, 6, 5) << 6);
+
+	switch (bits(instruction, 15, 13)) {
+	case 0x0: { // c.addi4spn
+		uint32_t immediate = (bits(instruction, 12, 11) << 4) | (bits(instruction, 10, 7) << 6) | (bits(instruction, 6, 6) << 2) | (bits(instruction, 5, 5) << 3);
+		if (immediate == 0) {
+			return 0;
+		}
+		return i_type(0x13, 0x0, rd, 2, immediate);
+	}
+	case 0x1: // c.fld
+		return i_type(0x07, 0x3, rd, rs1, doubleword);
+	case 0x2: // c.lw
+		return i_type(0x03, 0x2, rd, rs1, word);
+	case 0x3: // c.ld
+		return i_type(0x03, 0x3, rd, rs1, doubleword);
+	case 0x5: // c.fsd
+		return s_type(0x27, 0x3, rs1, rd, doubleword);
+	case 0x6: // c.sw
+		return s_type(0x23, 0x2, rs1, rd, word);
+	case 0x7: // c.sd
+		return s_type(0x23, 0x3, rs1, rd, doubleword);
+	default:
+		return 0;
+	}
+}
+
+static uint32_t expand_arithmetic(uint16_t instruction) {
+	uint32_t rd    = short_rs1(instruction);
+	uint32_t rs2   = short_rd(instruction);
+	uint32_t shift = (bits(instruction, 12, 12) << 5) | bits(instruction, 6, 2);
+
+	switch (bits(instruction, 11, 10)) {
+	case 0x0: // c.srli
+		return i_type(0x13, 0x5, rd, rd, shift);
+	case 0x1: // c.srai
+		return i_type(0x13, 0x5, rd, rd, 0x400 | shift);
+	case 0x2: // c.andi
+		return i_type(0x13, 0x7, rd, rd, immediate6(instruction));
+	}
+
+	if (bits(instruction, 12, 12) == 0) {
+		switch (bits(instruction, 6, 5)) {
+		case 0x0: // c.sub
+			return r_type(0x33, 0x0, 0x20, rd, rd, rs2);
+		case 0x1: // c.xor
+			return r_type(0x33, 0x4, 0x00, rd, rd, rs2);
+		case 0x2: // c.or
+			return r_type(0x33, 0x6, 0x00, rd, rd, rs2);
+		default: // c.and
+			return r_type(0x33, 0x7, 0x00, rd, rd, rs2);
+		}
+	}
+
+	switch (bits(instruction, 6, 5)) {
+	case 0x0: // c.subw
+		return r_type(0x3b, 0x0, 0x20, rd, rd, rs2);
+	case 0x1: // c.addw
+		return r_type(0x3b, 0x0, 0x00, rd, rd, rs2);
+	default:
+		return 0;
+	}
+}
+
+static uint32_t expand_quadrant1(uint16_t instruction) {
+	uint32_t rd        = full_rd(instruction);
+	uint32_t immediate = immediate6(instruction);
+
+	switch (bits(instruction, 15, 13)) {
+	case 0x0: // c.addi, c.nop
+		return i_type(0x13, 0x0, rd, rd, immediate);
+	case 0x1: // c.addiw
+		if (rd == 0) {
+			return 0;
+		}
+		return i_type(0x1b, 0x0, rd, rd, immediate);
+	case 0x2: // c.li
+		return i_type(0x13, 0x0, rd, 0, immediate);
+	case 0x3:
+		if (rd == 2) { // c.addi16sp
+			uint32_t offset = (bits(instruction, 12, 12) << 9) | (bits(instruction, 6, 6) << 4) | (bits(instruction, 5, 5) << 6) | (bits(instruction, 4, 3) << 7) |
+			                  (bits(instruction, 2, 2) << 5);
+			if (offset == 0) {
+				return 0;
+			}
+			return i_type(0x13, 0x0, 2, 2, sign_extend(offset, 10));
+		}
+		if (immediate == 0) { // c.lui
+			return 0;
+		}
+		return (immediate << 12) | (rd << 7) | 0x37;
+	case 0x4:
+		return expand_arithmetic(instruction);
+	case 0x5: { // c.j
+		uint32_t offset = (bits(instruction, 12, 12) << 11) | (bits(instruction, 11, 11) << 4) | (bits(instruction, 10, 9) << 8) | (bits(instruction, 8, 8) << 10) |
+		                  (bits(instruction, 7, 7) << 6) | (bits(instruction, 6, 6) << 7) | (bits(instruction, 5, 3) << 1) | (bits(instruction, 2, 2) << 5);
+		return j_type(0, sign_extend(offset, 12));
+	}
+	default: { // c.beqz, c.bnez
+		uint32_t offset = (bits(instruction, 12, 12) << 8) | (bits(instruction, 11, 10) << 3) | (bits(instruction, 6, 5) << 6) | (bits(instruction, 4, 3) << 1) |
+		                  (bits(instruction, 2, 2) << 5);
+		return b_type(bits(instruction, 15, 13) == 0x6 ? 0x0 : 0x1, short_rs1(instruction), 0, sign_extend(offset, 9));
+	}
+	}
+}
+
+static uint32_t expand_quadrant2(uint16_t instruction) {
+	uint32_t rd  = full_rd(instruction);
+	uint32_t rs2 = full_rs2(instruction);
+
+	// stack pointer relative offsets of loads and of stores, scaled by 4 and by 8
+	uint32_t load_word    = (bits(instruction, 12, 12) << 5) | (bits(instruction, 6, 4) << 2) | (bits(instruction, 3, 2) << 6);
+	uint32_t load_double  = (bits(instruction, 12, 12) << 5) | (bits(instruction, 6, 5) << 3) | (bits(instruction, 4, 2) << 6);
+	uint32_t store_word   = (bits(instruction, 12, 9) << 2) | (bits(instruction, 8, 7) << 6);
+	uint32_t store_double = (bits(instruction, 12, 10) << 3) | (bits(instruction, 9, 7) << 6);
+
+	switch (bits(instruction, 15, 13)) {
+	case 0x0: // c.slli
+		return i_type(0x13, 0x1, rd, rd, (bits(instruction, 12, 12) << 5) | rs2);
+	case 0x1: // c.fldsp
+		return i_type(0x07, 0x3, rd, 2, load_double);
+	case 0x2: // c.lwsp
+		if (rd == 0) {
+			return 0;
+		}
+		return i_type(0x03, 0x2, rd, 2, load_word);
+	case 0x3: // c.ldsp
+		if (rd == 0) {
+			return 0;
+		}
+		return i_type(0x03, 0x3, rd, 2, load_double);
+	case 0x4:
+		if (bits(instruction, 12, 12) == 0) {
+			if (rs2 == 0) { // c.jr
+				if (rd == 0) {
+					return 0;
+				}
+				return i_type(0x67, 0x0, 0, rd, 0);
+			}
+			return r_type(0x33, 0x0, 0x00, rd, 0, rs2); // c.mv
+		}
+		if (rs2 == 0) {
+			if (rd == 0) { // c.ebreak
+				return 0x00100073;
+			}
+			return i_type(0x67, 0x0, 1, rd, 0); // c.jalr
+		}
+		return r_type(0x33, 0x0, 0x00, rd, rd, rs2); // c.add
+	case 0x5: // c.fsdsp
+		return s_type(0x27, 0x3, 2, rs2, store_double);
+	case 0x6: // c.swsp
+		return s_type(0x23, 0x2, 2, rs2, store_word);
+	default: // c.sdsp
+		return s_type(0x23, 0x3, 2, rs2, store_double);
+	}
+}
+
+uint32_t compressed_expand(uint16_t instruction) {
+	switch (instruction & 0x3) {
+	case 0x0:
+		return expand_quadrant0(instruction);
+	case 0x1:
+		return expand_quadrant1(instruction);
+	case 0x2:
+		return expand_quadrant2(instruction);
+	default:
+		return 0;
+	}
+}
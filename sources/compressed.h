@@ -0,0 +1,26 @@
+#ifndef KOMPJUTA_COMPRESSED_HEADER
+#define KOMPJUTA_COMPRESSED_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The C extension for RV64 with F and D. Every 16 bit instruction has a 32 bit equivalent,
+// blocks are decoded from those and only remember that the original was 2 bytes long.
+
+static inline bool compressed_instruction(uint16_t parcel) {
+	return (parcel & 0x3) != 0x3;
+}
+
+// Returns the 32 bit instruction a 16 bit one stands for, 0 for reserved and illegal
+// encodings, which is illegal as well.
+uint32_t compressed_expand(uint16_t instruction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,503 @@
+#include "floating_point.h"
+
+#include <assert.h>
+#include <fenv.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The host status flags are the guest's, the compiler may not move or drop the operations
+// that raise them. GCC knows no such pragma and keeps them with -ftrapping-math, its default.
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fenv_access(on)
+#elif defined(__clang__)
+#pragma STDC FENV_ACCESS ON
+#endif
+
+// Arithmetic is plain C float and double arithmetic, which compiles to the scalar SSE
+// instructions on x86-64 hosts, and NaN results are replaced by the canonical NaN. The host
+// rounding mode is only switched around instructions that do not round to nearest even. RMM
+// has no host equivalent, it rounds to nearest even except in conversions to integers.
+// Conversions to integers saturate and raise their flags by hand, which C does not do.
+//
+// Comparisons, fmin/fmax and conversions to integers of singles work on the value widened to
+// double, which is exact and raises invalid for signaling NaNs only, just like the ISA. flt and
+// fle raise invalid for quiet NaNs as well, which they check for themselves because compilers
+// are free to use a quiet compare for < and <=.
+
+enum { ROUND_NEAREST_EVEN, ROUND_TOWARD_ZERO, ROUND_DOWN, ROUND_UP, ROUND_NEAREST_MAX, ROUND_DYNAMIC = 7 };
+
+static const int host_rounding_modes[5] = {FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD, FE_TONEAREST};
+
+#define SQUARE_ROOT(x) _Generic((x), float: sqrtf, default: sqrt)(x)
+
+static void begin(hart *hart) {
+	if (!hart->float_flags_live) {
+		feclearexcept(FE_ALL_EXCEPT);
+		hart->float_flags_live = true;
+	}
+}
+
+void float_collect_flags(hart *hart) {
+	if (!hart->float_flags_live) {
+		return;
+	}
+
+	int raised = fetestexcept(FE_ALL_EXCEPT);
+	if ((raised & FE_INEXACT) != 0) {
+		hart->fflags |= FLOAT_FLAG_INEXACT;
+	}
+	if ((raised & FE_UNDERFLOW) != 0) {
+		hart->fflags |= FLOAT_FLAG_UNDERFLOW;
+	}
+	if ((raised & FE_OVERFLOW) != 0) {
+		hart->fflags |= FLOAT_FLAG_OVERFLOW;
+	}
+	if ((raised & FE_DIVBYZERO) != 0) {
+		hart->fflags |= FLOAT_FLAG_DIVIDE;
+	}
+	if ((raised & FE_INVALID) != 0) {
+		hart->fflags |= FLOAT_FLAG_INVALID;
+	}
+	hart->float_flags_live = false;
+}
+
+// rm 5 and 6 are reserved and so are frm 5 to 7, instructions that would round with one are illegal
+static bool valid_rounding_mode(const hart *hart, uint32_t instruction) {
+	uint32_t mode = (instruction >> 12) & 0x7;
+	if (mode == ROUND_DYNAMIC) {
+		mode = hart->frm;
+	}
+	return mode <= ROUND_NEAREST_MAX;
+}
+
+static uint32_t rounding_mode(const hart *hart, uint32_t instruction) {
+	uint32_t mode = (instruction >> 12) & 0x7;
+	if (mode == ROUND_DYNAMIC) {
+		mode = hart->frm;
+	}
+	assert(mode <= ROUND_NEAREST_MAX);
+	return mode;
+}
+
+// Returns whether the host mode was changed and has to be reset.
+static bool set_rounding(uint32_t mode) {
+	if (host_rounding_modes[mode] == FE_TONEAREST) {
+		return false;
+	}
+	fesetround(host_rounding_modes[mode]);
+	return true;
+}
+
+static void reset_rounding(bool changed) {
+	if (changed) {
+		fesetround(FE_TONEAREST);
+	}
+}
+
+static float read_single(const hart *hart, uint8_t reg) {
+	uint32_t bits = float_unbox(hart->f[reg]);
+	float    value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static double read_double(const hart *hart, uint8_t reg) {
+	double value;
+	memcpy(&value, &hart->f[reg], sizeof(value));
+	return value;
+}
+
+static double read_operand(const hart *hart, uint8_t reg, bool single) {
+	return single ? (double)read_single(hart, reg) : read_double(hart, reg);
+}
+
+static void write_single(hart *hart, uint8_t reg, float value) {
+	uint32_t bits = FLOAT_CANONICAL_NAN32;
+	if (!isnan(value)) {
+		memcpy(&bits, &value, sizeof(bits));
+	}
+	hart->f[reg] = float_box(bits);
+}
+
+static void write_double(hart *hart, uint8_t reg, double value) {
+	uint64_t bits = FLOAT_CANONICAL_NAN64;
+	if (!isnan(value)) {
+		memcpy(&bits, &value, sizeof(bits));
+	}
+	hart->f[reg] = bits;
+}
+
+static void write_result(hart *hart, uint8_t reg, double value, bool single) {
+	if (single) {
+		write_single(hart, reg, (float)value);
+	}
+	else {
+		write_double(hart, reg, value);
+	}
+}
+
+static void write_integer(hart *hart, uint8_t rd, uint64_t value) {
+	if (rd != 0) {
+		hart->x[rd] = value;
+	}
+}
+
+// fclass, from the raw bits of a single or a double
+static uint32_t classify(uint64_t bits, bool single) {
+	uint32_t mantissa_bits = single ? 23 : 52;
+	uint64_t exponent_max  = single ? 0xff : 0x7ff;
+	bool     negative      = ((bits >> (single ? 31 : 63)) & 1) != 0;
+	uint64_t exponent      = (bits >> mantissa_bits) & exponent_max;
+	uint64_t mantissa      = bits & ((1ull << mantissa_bits) - 1);
+
+	if (exponent == exponent_max) {
+		if (mantissa == 0) {
+			return negative ? 1u << 0 : 1u << 7;
+		}
+		return (mantissa >> (mantissa_bits - 1)) != 0 ? 1u << 9 : 1u << 8;
+	}
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			return negative ? 1u << 3 : 1u << 4;
+		}
+		return negative ? 1u << 2 : 1u << 5;
+	}
+	return negative ? 1u << 1 : 1u << 6;
+}
+
+static uint64_t register_bits(const hart *hart, uint8_t reg, bool single) {
+	return single ? float_unbox(hart->f[reg]) : hart->f[reg];
+}
+
+static void write_bits(hart *hart, uint8_t reg, uint64_t bits, bool single) {
+	hart->f[reg] = single ? float_box((uint32_t)bits) : bits;
+}
+
+// fmin and fmax return the other operand when one is a NaN and order -0 below +0.
+static double minimum_maximum(double a, double b, bool maximum) {
+	if (isnan(a) || isnan(b)) {
+		return isnan(a) ? (isnan(b) ? (double)NAN : b) : a;
+	}
+	if (a == b) {
+		return (signbit(a) != 0) != maximum ? a : b;
+	}
+	return (a < b) != maximum ? a : b;
+}
+
+// Sets fflags itself, the host flags are left as they were because libm's rounding functions
+// may raise inexact where the ISA raises invalid only.
+static uint64_t convert_to_integer(hart *hart, double value, uint32_t mode, bool is_signed, uint32_t bits) {
+	fexcept_t host_flags;
+	fegetexceptflag(&host_flags, FE_ALL_EXCEPT);
+
+	double rounded;
+	switch (mode) {
+	case ROUND_NEAREST_EVEN:
+		rounded = nearbyint(value); // the host rounds to nearest even outside of set_rounding
+		break;
+	case ROUND_TOWARD_ZERO:
+		rounded = trunc(value);
+		break;
+	case ROUND_DOWN:
+		rounded = floor(value);
+		break;
+	case ROUND_UP:
+		rounded = ceil(value);
+		break;
+	default:
+		rounded = round(value);
+		break;
+	}
+
+	fesetexceptflag(&host_flags, FE_ALL_EXCEPT);
+
+	double   limit        = ldexp(1.0, is_signed ? bits - 1 : bits);
+	uint64_t signed_max   = (1ull << (bits - 1)) - 1;
+	uint64_t unsigned_max = ~0ull >> (64 - bits);
+
+	if (isnan(value)) {
+		hart->fflags |= FLOAT_FLAG_INVALID;
+		return is_signed ? signed_max : unsigned_max;
+	}
+	if (rounded >= limit) {
+		hart->fflags |= FLOAT_FLAG_INVALID;
+		return is_signed ? signed_max : unsigned_max;
+	}
+	if (rounded < (is_signed ? -limit : 0.0)) {
+		hart->fflags |= FLOAT_FLAG_INVALID;
+		return is_signed ? 0 - (1ull << (bits - 1)) : 0;
+	}
+	if (rounded != value) {
+		hart->fflags |= FLOAT_FLAG_INEXACT;
+	}
+	return is_signed ? (uint64_t)(int64_t)rounded : (uint64_t)rounded;
+}
+
+static void arithmetic(hart *hart, uint32_t instruction, bool single) {
+	uint8_t rd     = (instruction >> 7) & 0x1f;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t rs2    = (instruction >> 20) & 0x1f;
+	uint8_t funct5 = instruction >> 27;
+
+	begin(hart);
+	bool changed = set_rounding(rounding_mode(hart, instruction));
+
+	if (single) {
+		float a = read_single(hart, rs1);
+		float b = read_single(hart, rs2);
+		float result;
+		switch (funct5) {
+		case 0x00:
+			result = a + b;
+			break;
+		case 0x01:
+			result = a - b;
+			break;
+		case 0x02:
+			result = a * b;
+			break;
+		case 0x03:
+			result = a / b;
+			break;
+		default:
+			result = SQUARE_ROOT(a);
+			break;
+		}
+		write_single(hart, rd, result);
+	}
+	else {
+		double a = read_double(hart, rs1);
+		double b = read_double(hart, rs2);
+		double result;
+		switch (funct5) {
+		case 0x00:
+			result = a + b;
+			break;
+		case 0x01:
+			result = a - b;
+			break;
+		case 0x02:
+			result = a * b;
+			break;
+		case 0x03:
+			result = a / b;
+			break;
+		default:
+			result = SQUARE_ROOT(a);
+			break;
+		}
+		write_double(hart, rd, result);
+	}
+
+	reset_rounding(changed);
+}
+
+// fcvt.s.w, fcvt.s.wu, fcvt.s.l, fcvt.s.lu and the same to double
+static void convert_from_integer(hart *hart, uint32_t instruction, bool single) {
+	uint8_t  rd    = (instruction >> 7) & 0x1f;
+	uint8_t  rs2   = (instruction >> 20) & 0x1f;
+	uint64_t value = hart->x[(instruction >> 15) & 0x1f];
+
+	begin(hart);
+	bool changed = set_rounding(rounding_mode(hart, instruction));
+
+	if (single) {
+		switch (rs2) {
+		case 0x0:
+			write_single(hart, rd, (float)(int32_t)value);
+			break;
+		case 0x1:
+			write_single(hart, rd, (float)(uint32_t)value);
+			break;
+		case 0x2:
+			write_single(hart, rd, (float)(int64_t)value);
+			break;
+		case 0x3:
+			write_single(hart, rd, (float)value);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+	else {
+		switch (rs2) {
+		case 0x0:
+			write_double(hart, rd, (double)(int32_t)value);
+			break;
+		case 0x1:
+			write_double(hart, rd, (double)(uint32_t)value);
+			break;
+		case 0x2:
+			write_double(hart, rd, (double)(int64_t)value);
+			break;
+		case 0x3:
+			write_double(hart, rd, (double)value);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+
+	reset_rounding(changed);
+}
+
+bool float_execute(hart *hart, uint32_t instruction) {
+	uint8_t rd     = (instruction >> 7) & 0x1f;
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t rs2    = (instruction >> 20) & 0x1f;
+	uint8_t format = (instruction >> 25) & 0x3;
+	uint8_t funct5 = instruction >> 27;
+
+	assert(format <= 1); // no Zfh or Q
+	bool single = format == 0;
+
+	// the others use the field as funct3
+	bool rounds = funct5 <= 0x03 || funct5 == 0x08 || funct5 == 0x0b || funct5 == 0x18 || funct5 == 0x1a;
+	if (rounds && !valid_rounding_mode(hart, instruction)) {
+		return false;
+	}
+
+	switch (funct5) {
+	case 0x00: // fadd
+	case 0x01: // fsub
+	case 0x02: // fmul
+	case 0x03: // fdiv
+	case 0x0b: // fsqrt
+		arithmetic(hart, instruction, single);
+		break;
+	case 0x04: { // fsgnj, fsgnjn, fsgnjx
+		uint64_t sign = single ? 1ull << 31 : 1ull << 63;
+		uint64_t a    = register_bits(hart, rs1, single);
+		uint64_t b    = register_bits(hart, rs2, single);
+		switch (funct3) {
+		case 0x0:
+			write_bits(hart, rd, (a & ~sign) | (b & sign), single);
+			break;
+		case 0x1:
+			write_bits(hart, rd, (a & ~sign) | (~b & sign), single);
+			break;
+		case 0x2:
+			write_bits(hart, rd, a ^ (b & sign), single);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		break;
+	}
+	case 0x05: // fmin, fmax
+		begin(hart);
+		write_result(hart, rd, minimum_maximum(read_operand(hart, rs1, single), read_operand(hart, rs2, single), funct3 == 0x1), single);
+		break;
+	case 0x08: { // fcvt.s.d, fcvt.d.s
+		begin(hart);
+		bool changed = set_rounding(rounding_mode(hart, instruction));
+		if (single) {
+			assert(rs2 == 0x1);
+			write_single(hart, rd, (float)read_double(hart, rs1));
+		}
+		else {
+			assert(rs2 == 0x0);
+			write_double(hart, rd, (double)read_single(hart, rs1));
+		}
+		reset_rounding(changed);
+		break;
+	}
+	case 0x14: { // fle, flt, feq
+		begin(hart);
+		double a = read_operand(hart, rs1, single);
+		double b = read_operand(hart, rs2, single);
+		if (funct3 != 0x2 && (isnan(a) || isnan(b))) {
+			hart->fflags |= FLOAT_FLAG_INVALID;
+			write_integer(hart, rd, 0);
+			break;
+		}
+		switch (funct3) {
+		case 0x0:
+			write_integer(hart, rd, a <= b);
+			break;
+		case 0x1:
+			write_integer(hart, rd, a < b);
+			break;
+		case 0x2:
+			write_integer(hart, rd, a == b);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		break;
+	}
+	case 0x18: { // fcvt.w, fcvt.wu, fcvt.l, fcvt.lu
+		double   value         = read_operand(hart, rs1, single);
+		uint32_t mode          = rounding_mode(hart, instruction);
+		bool     signed_result = (rs2 & 0x1) == 0;
+		if (rs2 < 0x2) {
+			write_integer(hart, rd, (uint64_t)(int64_t)(int32_t)convert_to_integer(hart, value, mode, signed_result, 32));
+		}
+		else {
+			write_integer(hart, rd, convert_to_integer(hart, value, mode, signed_result, 64));
+		}
+		break;
+	}
+	case 0x1a: // fcvt.s.w, fcvt.s.wu, fcvt.s.l, fcvt.s.lu
+		convert_from_integer(hart, instruction, single);
+		break;
+	case 0x1c: // fmv.x.w, fmv.x.d, fclass
+		if (funct3 == 0x0) {
+			write_integer(hart, rd, single ? (uint64_t)(int64_t)(int32_t)hart->f[rs1] : hart->f[rs1]);
+		}
+		else {
+			write_integer(hart, rd, classify(register_bits(hart, rs1, single), single));
+		}
+		break;
+	case 0x1e: // fmv.w.x, fmv.d.x
+		write_bits(hart, rd, hart->x[rs1], single);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	return true;
+}
+
+// fmadd, fmsub, fnmsub and fnmadd
+bool float_fused_multiply_add(hart *hart, uint32_t instruction) {
+	uint8_t opcode = instruction & 0x7f;
+	uint8_t rd     = (instruction >> 7) & 0x1f;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t rs2    = (instruction >> 20) & 0x1f;
+	uint8_t format = (instruction >> 25) & 0x3;
+	uint8_t rs3    = instruction >> 27;
+
+	bool negate_product = opcode == 0x4b || opcode == 0x4f;
+	bool negate_addend  = opcode == 0x47 || opcode == 0x4f;
+
+	assert(format <= 1);
+
+	if (!valid_rounding_mode(hart, instruction)) {
+		return false;
+	}
+
+	begin(hart);
+	bool changed = set_rounding(rounding_mode(hart, instruction));
+
+	if (format == 0) {
+		float a = read_single(hart, rs1);
+		float c = read_single(hart, rs3);
+		write_single(hart, rd, fmaf(negate_product ? -a : a, read_single(hart, rs2), negate_addend ? -c : c));
+	}
+	else {
+		double a = read_double(hart, rs1);
+		double c = read_double(hart, rs3);
+		write_double(hart, rd, fma(negate_product ? -a : a, read_double(hart, rs2), negate_addend ? -c : c));
+	}
+
+	reset_rounding(changed);
+	return true;
+}
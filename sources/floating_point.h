@@ -0,0 +1,49 @@
+#ifndef KOMPJUTA_FLOATING_POINT_HEADER
+#define KOMPJUTA_FLOATING_POINT_HEADER
+
+#include "risc-v.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The F and D extensions. f holds the raw bits of the registers, singles are NaN-boxed in the
+// upper 32 bits and a single that is not boxed reads as the canonical NaN.
+
+#define FLOAT_CANONICAL_NAN32 0x7fc00000u
+#define FLOAT_CANONICAL_NAN64 0x7ff8000000000000ull
+
+// fflags
+#define FLOAT_FLAG_INEXACT   0x01
+#define FLOAT_FLAG_UNDERFLOW 0x02
+#define FLOAT_FLAG_OVERFLOW  0x04
+#define FLOAT_FLAG_DIVIDE    0x08
+#define FLOAT_FLAG_INVALID   0x10
+
+static inline uint64_t float_box(uint32_t bits) {
+	return 0xffffffff00000000ull | bits;
+}
+
+static inline uint32_t float_unbox(uint64_t bits) {
+	return (bits >> 32) == 0xffffffff ? (uint32_t)bits : FLOAT_CANONICAL_NAN32;
+}
+
+// Executes an instruction of the OP-FP major opcode or of one of the four fused multiply-add
+// opcodes. Neither advances the pc. Both return false without executing anything when the
+// instruction rounds with a reserved rounding mode, which makes it an illegal instruction.
+bool float_execute(hart *hart, uint32_t instruction);
+bool float_fused_multiply_add(hart *hart, uint32_t instruction);
+
+// Exception flags accrue in the host's floating point status while a block runs, the first
+// instruction that can raise one clears it. Collecting moves them to fflags, which has to
+// happen before fflags is accessed and before the thread runs anything but guest code.
+void float_collect_flags(hart *hart);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
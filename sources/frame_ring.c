@@ -0,0 +1,47 @@
+#include "frame_ring.h"
+
+void frame_ring_init(frame_ring *ring) {
+	atomic_init(&ring->write_count, 0);
+	atomic_init(&ring->read_count, 0);
+	kore_semaphore_init(&ring->free_slots, FRAME_RING_SIZE, FRAME_RING_SIZE + 1);
+}
+
+void frame_ring_destroy(frame_ring *ring) {
+	kore_semaphore_destroy(&ring->free_slots);
+}
+
+uint32_t frame_ring_begin_write(frame_ring *ring) {
+	kore_semaphore_acquire(&ring->free_slots);
+	return atomic_load_explicit(&ring->write_count, memory_order_relaxed) % FRAME_RING_SIZE;
+}
+
+// Counts wrap at twice the ring size so they never disagree about the slot and a full ring is
+// still distinguishable from an empty one.
+static uint32_t next_count(uint32_t count) {
+	return (count + 1) % (2 * FRAME_RING_SIZE);
+}
+
+void frame_ring_end_write(frame_ring *ring) {
+	// publishes the slot contents together with the count
+	uint32_t write_count = atomic_load_explicit(&ring->write_count, memory_order_relaxed);
+	atomic_store_explicit(&ring->write_count, next_count(write_count), memory_order_release);
+}
+
+bool frame_ring_begin_read(frame_ring *ring, uint32_t *slot) {
+	uint32_t read_count = atomic_load_explicit(&ring->read_count, memory_order_relaxed);
+	if (atomic_load_explicit(&ring->write_count, memory_order_acquire) == read_count) {
+		return false;
+	}
+	*slot = read_count % FRAME_RING_SIZE;
+	return true;
+}
+
+void frame_ring_end_read(frame_ring *ring) {
+	uint32_t read_count = atomic_load_explicit(&ring->read_count, memory_order_relaxed);
+	atomic_store_explicit(&ring->read_count, next_count(read_count), memory_order_release);
+	kore_semaphore_release(&ring->free_slots, 1);
+}
+
+void frame_ring_wake_writer(frame_ring *ring) {
+	kore_semaphore_release(&ring->free_slots, 1);
+}
@@ -0,0 +1,43 @@
+#ifndef KOMPJUTA_FRAME_RING_HEADER
+#define KOMPJUTA_FRAME_RING_HEADER
+
+#include <kore3/threads/semaphore.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hands slots from one producer thread to one consumer thread in order. The indices are
+// lock-free, the semaphore only puts the producer to sleep while every slot is taken.
+
+#define FRAME_RING_SIZE 3
+
+typedef struct frame_ring {
+	_Atomic uint32_t write_count;
+	_Atomic uint32_t read_count;
+	kore_semaphore   free_slots;
+} frame_ring;
+
+void frame_ring_init(frame_ring *ring);
+void frame_ring_destroy(frame_ring *ring);
+
+// Producer side, blocks until a slot is free and returns its index.
+uint32_t frame_ring_begin_write(frame_ring *ring);
+void     frame_ring_end_write(frame_ring *ring);
+
+// Consumer side, returns false when no slot is ready.
+bool frame_ring_begin_read(frame_ring *ring, uint32_t *slot);
+void frame_ring_end_read(frame_ring *ring);
+
+// Lets a producer that waits in frame_ring_begin_write return, used for shutting down.
+void frame_ring_wake_writer(frame_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
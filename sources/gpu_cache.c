@@ -0,0 +1,184 @@
+#include "gpu_cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Kore keeps up to three frames in flight, a buffer that sat out more presents is idle.
+#define GPU_CACHE_IDLE_PRESENTS 4
+
+typedef struct cached_buffer {
+	bool                vertices;
+	uint64_t            hash;
+	uint64_t            size;   // of the guest data
+	uint64_t            stride; // 0 for indices
+	uint64_t            last_used;
+	guest_vertex_buffer vertex_buffer;
+	kore_gpu_buffer     index_buffer;
+} cached_buffer;
+
+typedef struct builtin_pipeline {
+	const char  *vertex_shader;
+	const char  *fragment_shader;
+	gpu_pipeline set;
+} builtin_pipeline;
+
+static const builtin_pipeline pipelines[] = {
+    {"colored_vertex", "colored_fragment", kong_set_render_pipeline_colored},
+};
+
+static kore_gpu_device *device = NULL;
+
+// allocated one by one, draws keep using an entry while others are added
+static cached_buffer **buffers         = NULL;
+static uint32_t        buffer_count    = 0;
+static uint32_t        buffer_capacity = 0;
+static uint64_t        presents        = 0;
+
+// FNV-1a over words, with the upper half folded back in so every bit of the data reaches
+// every bit of the hash.
+static uint64_t hash_bytes(const uint8_t *bytes, uint64_t size) {
+	uint64_t hash  = 14695981039346656037ull;
+	uint64_t index = 0;
+	for (; index + 8 <= size; index += 8) {
+		uint64_t word;
+		memcpy(&word, &bytes[index], sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 32;
+	}
+	for (; index < size; ++index) {
+		hash = (hash ^ bytes[index]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static void destroy_buffer(cached_buffer *buffer) {
+	if (buffer->vertices) {
+		kore_gpu_buffer_destroy(&buffer->vertex_buffer.buffer);
+	}
+	else {
+		kore_gpu_buffer_destroy(&buffer->index_buffer);
+	}
+	free(buffer);
+}
+
+static cached_buffer *find_buffer(bool vertices, uint64_t hash, uint64_t size, uint64_t stride) {
+	for (uint32_t buffer_index = 0; buffer_index < buffer_count; ++buffer_index) {
+		cached_buffer *buffer = buffers[buffer_index];
+		if (buffer->vertices == vertices && buffer->hash == hash && buffer->size == size && buffer->stride == stride) {
+			buffer->last_used = presents;
+			return buffer;
+		}
+	}
+	return NULL;
+}
+
+static cached_buffer *add_buffer(bool vertices, uint64_t hash, uint64_t size, uint64_t stride) {
+	if (buffer_count == buffer_capacity) {
+		buffer_capacity = buffer_capacity == 0 ? 64 : buffer_capacity * 2;
+		buffers         = (cached_buffer **)realloc(buffers, buffer_capacity * sizeof(cached_buffer *));
+		assert(buffers != NULL);
+	}
+
+	cached_buffer *buffer = (cached_buffer *)calloc(1, sizeof(cached_buffer));
+	assert(buffer != NULL);
+	buffer->vertices  = vertices;
+	buffer->hash      = hash;
+	buffer->size      = size;
+	buffer->stride    = stride;
+	buffer->last_used = presents;
+
+	buffers[buffer_count++] = buffer;
+	return buffer;
+}
+
+void gpu_cache_init(kore_gpu_device *gpu_device) {
+	device = gpu_device;
+}
+
+void gpu_cache_destroy(void) {
+	for (uint32_t buffer_index = 0; buffer_index < buffer_count; ++buffer_index) {
+		destroy_buffer(buffers[buffer_index]);
+	}
+	free(buffers);
+	buffers         = NULL;
+	buffer_count    = 0;
+	buffer_capacity = 0;
+}
+
+gpu_pipeline gpu_cache_pipeline(const char *vertex_shader, const char *fragment_shader) {
+	for (size_t pipeline_index = 0; pipeline_index < sizeof(pipelines) / sizeof(pipelines[0]); ++pipeline_index) {
+		const builtin_pipeline *pipeline = &pipelines[pipeline_index];
+		if (strcmp(pipeline->vertex_shader, vertex_shader) == 0 && strcmp(pipeline->fragment_shader, fragment_shader) == 0) {
+			return pipeline->set;
+		}
+	}
+	return NULL;
+}
+
+guest_vertex_buffer *gpu_cache_vertices(const uint8_t *vertices, uint64_t stride, uint32_t count) {
+	assert(count > 0 && stride >= sizeof(guest_vertex));
+
+	// the padding after the last vertex is not read
+	uint64_t size = (count - 1) * stride + sizeof(guest_vertex);
+	uint64_t hash = hash_bytes(vertices, size);
+
+	cached_buffer *buffer = find_buffer(true, hash, size, stride);
+	if (buffer != NULL) {
+		return &buffer->vertex_buffer;
+	}
+
+	buffer = add_buffer(true, hash, size, stride);
+	kong_create_buffer_guest_vertex(device, count, &buffer->vertex_buffer);
+
+	guest_vertex *target = kong_guest_vertex_buffer_lock(&buffer->vertex_buffer);
+	if (stride == sizeof(guest_vertex)) {
+		memcpy(target, vertices, size);
+	}
+	else {
+		for (uint32_t vertex_index = 0; vertex_index < count; ++vertex_index) {
+			memcpy(&target[vertex_index], &vertices[vertex_index * stride], sizeof(guest_vertex));
+		}
+	}
+	kong_guest_vertex_buffer_unlock(&buffer->vertex_buffer);
+
+	return &buffer->vertex_buffer;
+}
+
+kore_gpu_buffer *gpu_cache_indices(const uint8_t *indices, uint64_t size) {
+	uint64_t hash = hash_bytes(indices, size);
+
+	cached_buffer *buffer = find_buffer(false, hash, size, 0);
+	if (buffer != NULL) {
+		return &buffer->index_buffer;
+	}
+
+	buffer = add_buffer(false, hash, size, 0);
+
+	kore_gpu_buffer_parameters parameters = {
+	    .size        = size,
+	    .usage_flags = KORE_GPU_BUFFER_USAGE_INDEX | KORE_GPU_BUFFER_USAGE_CPU_WRITE,
+	};
+	kore_gpu_device_create_buffer(device, &parameters, &buffer->index_buffer);
+
+	memcpy(kore_gpu_buffer_lock_all(&buffer->index_buffer), indices, size);
+	kore_gpu_buffer_unlock(&buffer->index_buffer);
+
+	return &buffer->index_buffer;
+}
+
+void gpu_cache_frame_presented(void) {
+	++presents;
+
+	uint32_t kept = 0;
+	for (uint32_t buffer_index = 0; buffer_index < buffer_count; ++buffer_index) {
+		cached_buffer *buffer = buffers[buffer_index];
+		if (presents - buffer->last_used > GPU_CACHE_IDLE_PRESENTS) {
+			destroy_buffer(buffer);
+		}
+		else {
+			buffers[kept++] = buffer;
+		}
+	}
+	buffer_count = kept;
+}
@@ -0,0 +1,41 @@
+#ifndef KOMPJUTA_GPU_CACHE_HEADER
+#define KOMPJUTA_GPU_CACHE_HEADER
+
+#include <kore3/gpu/device.h>
+
+#include <kong.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host objects for the draws of guest command lists. Vertex and index data is uploaded into
+// buffers that are keyed by a hash of their contents, so meshes that do not change are
+// uploaded once and then reused every frame. Buffers that were not used for a few presents
+// are destroyed, the GPU is done with them by then.
+
+typedef void (*gpu_pipeline)(kore_gpu_command_list *list);
+
+void gpu_cache_init(kore_gpu_device *device);
+void gpu_cache_destroy(void);
+
+// The pipelines are created by kong_init, guests pick one by the names of its shaders.
+// Returns NULL for pairs that are not built in.
+gpu_pipeline gpu_cache_pipeline(const char *vertex_shader, const char *fragment_shader);
+
+// count vertices of stride bytes in the layout of guest_vertex, stride is at least
+// sizeof(guest_vertex).
+guest_vertex_buffer *gpu_cache_vertices(const uint8_t *vertices, uint64_t stride, uint32_t count);
+
+kore_gpu_buffer *gpu_cache_indices(const uint8_t *indices, uint64_t size);
+
+void gpu_cache_frame_presented(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,822 @@
+#include "jit.h"
+
+#include <kore3/log.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(KOMPJUTA_NO_JIT)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Translates decoded blocks to x86-64. The hart stays in memory and its registers, pc and
+// leave_block are addressed relative to rbx, guest RAM is addressed relative to r12 and the page flags relative
+// to r13. RAM accesses that are in range (and for stores not aligned badly and not
+// hitting a flagged page) are done inline, everything else goes through the same C
+// functions the interpreter uses. Instructions without a translation call their
+// interpreter handler.
+
+#define JIT_CODE_SIZE        (16 * 1024 * 1024)
+#define JIT_INSTRUCTION_SIZE 128
+#define JIT_BLOCK_SIZE       (BLOCK_MAX_INSTRUCTIONS * JIT_INSTRUCTION_SIZE + 64)
+
+enum {
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+	RBX = 3,
+	RSP = 4,
+	RBP = 5,
+	RSI = 6,
+	RDI = 7,
+	R11 = 11,
+	R12 = 12,
+	R13 = 13,
+};
+
+enum {
+	CONDITION_B  = 0x2,
+	CONDITION_AE = 0x3,
+	CONDITION_E  = 0x4,
+	CONDITION_NE = 0x5,
+	CONDITION_A  = 0x7,
+	CONDITION_L  = 0xc,
+	CONDITION_GE = 0xd,
+};
+
+#ifdef _WIN32
+#define ARGUMENT0    RCX
+#define ARGUMENT1    RDX
+#define SHADOW_SPACE 32
+#else
+#define ARGUMENT0    RDI
+#define ARGUMENT1    RSI
+#define SHADOW_SPACE 0
+#endif
+
+#define MAX_EXITS (BLOCK_MAX_INSTRUCTIONS * 2 + 1)
+
+typedef struct emitter {
+	uint8_t *cursor;
+	uint8_t *exits[MAX_EXITS];
+	uint32_t exit_count;
+} emitter;
+
+// Every hart thread translates into its own buffer, so a reset never pulls code out from
+// under another hart.
+static _Thread_local uint8_t *code      = NULL;
+static _Thread_local size_t   code_used = 0;
+
+#define HART_PC          ((int32_t)offsetof(hart, pc))
+#define HART_LEAVE_BLOCK ((int32_t)offsetof(hart, leave_block))
+
+static void emit8(emitter *e, uint8_t value) {
+	*e->cursor++ = value;
+}
+
+static void emit32(emitter *e, uint32_t value) {
+	memcpy(e->cursor, &value, sizeof(value));
+	e->cursor += sizeof(value);
+}
+
+static void emit64(emitter *e, uint64_t value) {
+	memcpy(e->cursor, &value, sizeof(value));
+	e->cursor += sizeof(value);
+}
+
+static void emit_rex(emitter *e, bool wide, int reg, int index, int base, bool force) {
+	uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+	if (rex != 0x40 || force) {
+		emit8(e, rex);
+	}
+}
+
+// op reg, rm (register direct)
+static void emit_register(emitter *e, bool wide, uint8_t opcode0, int16_t opcode1, int reg, int rm) {
+	emit_rex(e, wide, reg, 0, rm, false);
+	emit8(e, opcode0);
+	if (opcode1 >= 0) {
+		emit8(e, (uint8_t)opcode1);
+	}
+	emit8(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [base + index + displacement], index is ignored when negative
+static void emit_memory(emitter *e, bool wide, bool operand16, uint8_t opcode0, int16_t opcode1, int reg, int base, int index, int32_t displacement) {
+	if (operand16) {
+		emit8(e, 0x66);
+	}
+	emit_rex(e, wide, reg, index < 0 ? 0 : index, base, false);
+	emit8(e, opcode0);
+	if (opcode1 >= 0) {
+		emit8(e, (uint8_t)opcode1);
+	}
+
+	uint8_t mod;
+	if (displacement == 0 && (base & 7) != RBP) {
+		mod = 0x00;
+	}
+	else if (displacement >= -128 && displacement <= 127) {
+		mod = 0x40;
+	}
+	else {
+		mod = 0x80;
+	}
+
+	if (index >= 0) {
+		emit8(e, mod | ((reg & 7) << 3) | 0x4);
+		emit8(e, ((index & 7) << 3) | (base & 7));
+	}
+	else {
+		emit8(e, mod | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == RSP) {
+			emit8(e, 0x24);
+		}
+	}
+
+	if (mod == 0x40) {
+		emit8(e, (uint8_t)displacement);
+	}
+	else if (mod == 0x80) {
+		emit32(e, (uint32_t)displacement);
+	}
+}
+
+static void emit_move_immediate(emitter *e, int reg, uint64_t value) {
+	if ((int64_t)value == (int32_t)value) {
+		emit_rex(e, true, 0, 0, reg, false);
+		emit8(e, 0xc7);
+		emit8(e, 0xc0 | (reg & 7));
+		emit32(e, (uint32_t)value);
+	}
+	else {
+		emit_rex(e, true, 0, 0, reg, false);
+		emit8(e, 0xb8 + (reg & 7));
+		emit64(e, value);
+	}
+}
+
+static void emit_load_register(emitter *e, int host, uint8_t guest) {
+	if (guest == 0) {
+		emit_register(e, false, 0x31, -1, host, host); // xor
+	}
+	else {
+		emit_memory(e, true, false, 0x8b, -1, host, RBX, -1, guest * 8);
+	}
+}
+
+static void emit_store_register(emitter *e, uint8_t guest, int host) {
+	if (guest != 0) {
+		emit_memory(e, true, false, 0x89, -1, host, RBX, -1, guest * 8);
+	}
+}
+
+// add/or/and/sub/xor/cmp rm, imm32, selected by the ModRM digit
+static void emit_alu_immediate(emitter *e, bool wide, int digit, int rm, int32_t value) {
+	emit_rex(e, wide, 0, 0, rm, false);
+	if (value >= -128 && value <= 127) {
+		emit8(e, 0x83);
+		emit8(e, 0xc0 | (digit << 3) | (rm & 7));
+		emit8(e, (uint8_t)value);
+	}
+	else {
+		emit8(e, 0x81);
+		emit8(e, 0xc0 | (digit << 3) | (rm & 7));
+		emit32(e, (uint32_t)value);
+	}
+}
+
+// cmp rax, limit - the limit only fits an immediate for guest RAM below 2 GiB, rdx is free
+// at this point in loads and stores
+static void emit_compare_address_limit(emitter *e, uint64_t limit) {
+	if (limit <= INT32_MAX) {
+		emit_alu_immediate(e, true, 7, RAX, (int32_t)limit);
+	}
+	else {
+		emit_move_immediate(e, RDX, limit);
+		emit_register(e, true, 0x39, -1, RDX, RAX); // cmp rax, rdx
+	}
+}
+
+static void emit_shift_immediate(emitter *e, bool wide, int digit, int rm, uint8_t amount) {
+	emit_rex(e, wide, 0, 0, rm, false);
+	emit8(e, 0xc1);
+	emit8(e, 0xc0 | (digit << 3) | (rm & 7));
+	emit8(e, amount);
+}
+
+static void emit_shift_cl(emitter *e, bool wide, int digit, int rm) {
+	emit_rex(e, wide, 0, 0, rm, false);
+	emit8(e, 0xd3);
+	emit8(e, 0xc0 | (digit << 3) | (rm & 7));
+}
+
+static void emit_sign_extend_word(emitter *e, int reg) {
+	emit_register(e, true, 0x63, -1, reg, reg); // movsxd
+}
+
+static void emit_set_condition(emitter *e, int condition) {
+	emit_register(e, false, 0x0f, 0x90 + condition, 0, RAX); // setcc al
+	emit_register(e, false, 0x0f, 0xb6, RAX, RAX);           // movzx eax, al
+}
+
+static void emit_call(emitter *e, const void *function) {
+	emit_move_immediate(e, R11, (uint64_t)(uintptr_t)function);
+	emit8(e, 0x41);
+	emit8(e, 0xff);
+	emit8(e, 0xd3); // call r11
+}
+
+static uint8_t *emit_jump_condition(emitter *e, int condition) {
+	emit8(e, 0x0f);
+	emit8(e, 0x80 + condition);
+	emit32(e, 0);
+	return e->cursor;
+}
+
+static uint8_t *emit_jump(emitter *e) {
+	emit8(e, 0xe9);
+	emit32(e, 0);
+	return e->cursor;
+}
+
+static void patch_jump(uint8_t *after_jump, uint8_t *target) {
+	int32_t distance = (int32_t)(target - after_jump);
+	memcpy(after_jump - 4, &distance, sizeof(distance));
+}
+
+// Leaves the block with rax as the next pc.
+static void emit_exit(emitter *e) {
+	assert(e->exit_count < MAX_EXITS);
+	e->exits[e->exit_count++] = emit_jump(e);
+}
+
+static void emit_exit_with_pc(emitter *e, uint64_t next_pc) {
+	emit_move_immediate(e, RAX, next_pc);
+	emit_exit(e);
+}
+
+static void emit_exit_if_leaving(emitter *e, uint64_t next_pc, bool read_pc) {
+	emit_memory(e, false, false, 0x80, -1, 7, RBX, -1, HART_LEAVE_BLOCK); // cmp byte [rbx + leave_block], 0
+	emit8(e, 0);
+	uint8_t *stay = emit_jump_condition(e, CONDITION_E);
+	if (read_pc) {
+		emit_memory(e, true, false, 0x8b, -1, RAX, RBX, -1, HART_PC);
+		emit_exit(e);
+	}
+	else {
+		emit_exit_with_pc(e, next_pc);
+	}
+	patch_jump(stay, e->cursor);
+}
+
+static void emit_two_arguments(emitter *e) {
+	// a in rax, b in rcx
+#ifdef _WIN32
+	emit_register(e, true, 0x89, -1, RCX, RDX); // mov rdx, rcx
+	emit_register(e, true, 0x89, -1, RAX, RCX); // mov rcx, rax
+#else
+	emit_register(e, true, 0x89, -1, RAX, RDI); // mov rdi, rax
+	emit_register(e, true, 0x89, -1, RCX, RSI); // mov rsi, rcx
+#endif
+}
+
+static void emit_effective_address(emitter *e, const decoded_instruction *instruction) {
+	emit_load_register(e, RAX, instruction->rs1);
+	if (instruction->immediate != 0) {
+		emit_alu_immediate(e, true, 0, RAX, instruction->immediate);
+	}
+}
+
+static void emit_load(emitter *e, const decoded_instruction *instruction, uint64_t next_pc) {
+	static const void *functions[4] = {(const void *)read_memory8, (const void *)read_memory16, (const void *)read_memory32, (const void *)read_memory64};
+
+	uint32_t size_log2;
+	switch (instruction->op) {
+	case DECODED_OP_LB:
+	case DECODED_OP_LBU:
+		size_log2 = 0;
+		break;
+	case DECODED_OP_LH:
+	case DECODED_OP_LHU:
+		size_log2 = 1;
+		break;
+	case DECODED_OP_LW:
+	case DECODED_OP_LWU:
+		size_log2 = 2;
+		break;
+	default:
+		size_log2 = 3;
+		break;
+	}
+
+	emit_effective_address(e, instruction);
+
+	emit_compare_address_limit(e, memory_size - (1 << size_log2));
+	uint8_t *slow       = emit_jump_condition(e, CONDITION_A);
+	uint8_t *slow_alias = NULL;
+	if (aliased_page_count != 0) {
+		emit_register(e, true, 0x89, -1, RAX, RDX); // mov rdx, rax
+		emit_shift_immediate(e, true, 5, RDX, MEMORY_PAGE_SHIFT);
+		emit_memory(e, false, false, 0xf6, -1, 0, R13, RDX, 0); // test byte [r13 + rdx], PAGE_FLAG_ALIAS
+		emit8(e, PAGE_FLAG_ALIAS);
+		slow_alias = emit_jump_condition(e, CONDITION_NE);
+	}
+
+	switch (size_log2) {
+	case 0:
+		emit_memory(e, false, false, 0x0f, 0xb6, RAX, R12, RAX, 0); // movzx eax, byte
+		break;
+	case 1:
+		emit_memory(e, false, false, 0x0f, 0xb7, RAX, R12, RAX, 0); // movzx eax, word
+		break;
+	case 2:
+		emit_memory(e, false, false, 0x8b, -1, RAX, R12, RAX, 0); // mov eax, dword
+		break;
+	default:
+		emit_memory(e, true, false, 0x8b, -1, RAX, R12, RAX, 0); // mov rax, qword
+		break;
+	}
+	uint8_t *done = emit_jump(e);
+
+	patch_jump(slow, e->cursor);
+	if (slow_alias != NULL) {
+		patch_jump(slow_alias, e->cursor);
+	}
+	emit_register(e, true, 0x89, -1, RAX, ARGUMENT0);
+	emit_call(e, functions[size_log2]);
+	// leaves the loaded value in rax, a faulting load does not write rd
+	emit_exit_if_leaving(e, next_pc, false);
+
+	patch_jump(done, e->cursor);
+	switch (instruction->op) {
+	case DECODED_OP_LB:
+		emit_register(e, true, 0x0f, 0xbe, RAX, RAX); // movsx rax, al
+		break;
+	case DECODED_OP_LH:
+		emit_register(e, true, 0x0f, 0xbf, RAX, RAX); // movsx rax, ax
+		break;
+	case DECODED_OP_LW:
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_LBU:
+		emit_register(e, false, 0x0f, 0xb6, RAX, RAX); // movzx eax, al
+		break;
+	case DECODED_OP_LHU:
+		emit_register(e, false, 0x0f, 0xb7, RAX, RAX); // movzx eax, ax
+		break;
+	case DECODED_OP_LWU:
+		emit_register(e, false, 0x89, -1, RAX, RAX); // mov eax, eax
+		break;
+	default:
+		break;
+	}
+
+	emit_store_register(e, instruction->rd, RAX);
+}
+
+static void emit_store(emitter *e, const decoded_instruction *instruction, uint64_t next_pc) {
+	static const void *functions[4] = {(const void *)store_memory8, (const void *)store_memory16, (const void *)store_memory32, (const void *)store_memory64};
+
+	uint32_t size_log2 = instruction->op - DECODED_OP_SB;
+
+	emit_effective_address(e, instruction);
+	emit_load_register(e, RCX, instruction->rs2);
+
+	emit_compare_address_limit(e, memory_size - (1 << size_log2));
+	uint8_t *slow_range     = emit_jump_condition(e, CONDITION_A);
+	uint8_t *slow_alignment = NULL;
+	if (size_log2 > 0) {
+		emit8(e, 0xa8); // test al, imm8
+		emit8(e, (uint8_t)((1 << size_log2) - 1));
+		slow_alignment = emit_jump_condition(e, CONDITION_NE);
+	}
+	emit_register(e, true, 0x89, -1, RAX, RDX); // mov rdx, rax
+	emit_shift_immediate(e, true, 5, RDX, MEMORY_PAGE_SHIFT);
+	emit_memory(e, false, false, 0x80, -1, 7, R13, RDX, 0); // cmp byte [r13 + rdx], 0
+	emit8(e, 0);
+	uint8_t *slow_flags = emit_jump_condition(e, CONDITION_NE);
+
+	switch (size_log2) {
+	case 0:
+		emit_memory(e, false, false, 0x88, -1, RCX, R12, RAX, 0);
+		break;
+	case 1:
+		emit_memory(e, false, true, 0x89, -1, RCX, R12, RAX, 0);
+		break;
+	case 2:
+		emit_memory(e, false, false, 0x89, -1, RCX, R12, RAX, 0);
+		break;
+	default:
+		emit_memory(e, true, false, 0x89, -1, RCX, R12, RAX, 0);
+		break;
+	}
+	uint8_t *done = emit_jump(e);
+
+	patch_jump(slow_range, e->cursor);
+	if (slow_alignment != NULL) {
+		patch_jump(slow_alignment, e->cursor);
+	}
+	patch_jump(slow_flags, e->cursor);
+	emit_two_arguments(e);
+	emit_call(e, functions[size_log2]);
+	emit_exit_if_leaving(e, next_pc, false);
+
+	patch_jump(done, e->cursor);
+}
+
+static void emit_alu(emitter *e, const decoded_instruction *instruction) {
+	emit_load_register(e, RAX, instruction->rs1);
+	emit_load_register(e, RCX, instruction->rs2);
+
+	switch (instruction->op) {
+	case DECODED_OP_ADD:
+		emit_register(e, true, 0x01, -1, RCX, RAX);
+		break;
+	case DECODED_OP_SUB:
+		emit_register(e, true, 0x29, -1, RCX, RAX);
+		break;
+	case DECODED_OP_XOR:
+		emit_register(e, true, 0x31, -1, RCX, RAX);
+		break;
+	case DECODED_OP_OR:
+		emit_register(e, true, 0x09, -1, RCX, RAX);
+		break;
+	case DECODED_OP_AND:
+		emit_register(e, true, 0x21, -1, RCX, RAX);
+		break;
+	case DECODED_OP_SLL:
+		emit_shift_cl(e, true, 4, RAX);
+		break;
+	case DECODED_OP_SRL:
+		emit_shift_cl(e, true, 5, RAX);
+		break;
+	case DECODED_OP_SRA:
+		emit_shift_cl(e, true, 7, RAX);
+		break;
+	case DECODED_OP_SLT:
+		emit_register(e, true, 0x39, -1, RCX, RAX);
+		emit_set_condition(e, CONDITION_L);
+		break;
+	case DECODED_OP_SLTU:
+		emit_register(e, true, 0x39, -1, RCX, RAX);
+		emit_set_condition(e, CONDITION_B);
+		break;
+	case DECODED_OP_MUL:
+		emit_register(e, true, 0x0f, 0xaf, RAX, RCX); // imul rax, rcx
+		break;
+	case DECODED_OP_MULH:
+		emit_register(e, true, 0xf7, -1, 5, RCX);   // imul rcx
+		emit_register(e, true, 0x89, -1, RDX, RAX); // mov rax, rdx
+		break;
+	case DECODED_OP_MULHU:
+		emit_register(e, true, 0xf7, -1, 4, RCX);   // mul rcx
+		emit_register(e, true, 0x89, -1, RDX, RAX); // mov rax, rdx
+		break;
+	case DECODED_OP_MULHSU:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)multiply_high_signed_unsigned);
+		break;
+	case DECODED_OP_DIV:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)divide_signed);
+		break;
+	case DECODED_OP_DIVU:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)divide_unsigned);
+		break;
+	case DECODED_OP_REM:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)remainder_signed);
+		break;
+	case DECODED_OP_REMU:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)remainder_unsigned);
+		break;
+	case DECODED_OP_ADDW:
+		emit_register(e, false, 0x01, -1, RCX, RAX);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SUBW:
+		emit_register(e, false, 0x29, -1, RCX, RAX);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SLLW:
+		emit_shift_cl(e, false, 4, RAX);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SRLW:
+		emit_shift_cl(e, false, 5, RAX);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SRAW:
+		emit_shift_cl(e, false, 7, RAX);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_MULW:
+		emit_register(e, false, 0x0f, 0xaf, RAX, RCX); // imul eax, ecx
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_DIVW:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)divide_signed_word);
+		break;
+	case DECODED_OP_DIVUW:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)divide_unsigned_word);
+		break;
+	case DECODED_OP_REMW:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)remainder_signed_word);
+		break;
+	case DECODED_OP_REMUW:
+		emit_two_arguments(e);
+		emit_call(e, (const void *)remainder_unsigned_word);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	emit_store_register(e, instruction->rd, RAX);
+}
+
+static void emit_alu_immediate_instruction(emitter *e, const decoded_instruction *instruction) {
+	int32_t immediate = instruction->immediate;
+
+	emit_load_register(e, RAX, instruction->rs1);
+
+	switch (instruction->op) {
+	case DECODED_OP_ADDI:
+		emit_alu_immediate(e, true, 0, RAX, immediate);
+		break;
+	case DECODED_OP_SLTI:
+		emit_alu_immediate(e, true, 7, RAX, immediate);
+		emit_set_condition(e, CONDITION_L);
+		break;
+	case DECODED_OP_SLTIU:
+		emit_alu_immediate(e, true, 7, RAX, immediate);
+		emit_set_condition(e, CONDITION_B);
+		break;
+	case DECODED_OP_XORI:
+		emit_alu_immediate(e, true, 6, RAX, immediate);
+		break;
+	case DECODED_OP_ORI:
+		emit_alu_immediate(e, true, 1, RAX, immediate);
+		break;
+	case DECODED_OP_ANDI:
+		emit_alu_immediate(e, true, 4, RAX, immediate);
+		break;
+	case DECODED_OP_SLLI:
+		emit_shift_immediate(e, true, 4, RAX, (uint8_t)immediate);
+		break;
+	case DECODED_OP_SRLI:
+		emit_shift_immediate(e, true, 5, RAX, (uint8_t)immediate);
+		break;
+	case DECODED_OP_SRAI:
+		emit_shift_immediate(e, true, 7, RAX, (uint8_t)immediate);
+		break;
+	case DECODED_OP_ADDIW:
+		emit_alu_immediate(e, false, 0, RAX, immediate);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SLLIW:
+		emit_shift_immediate(e, false, 4, RAX, (uint8_t)immediate);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SRLIW:
+		emit_shift_immediate(e, false, 5, RAX, (uint8_t)immediate);
+		emit_sign_extend_word(e, RAX);
+		break;
+	case DECODED_OP_SRAIW:
+		emit_shift_immediate(e, false, 7, RAX, (uint8_t)immediate);
+		emit_sign_extend_word(e, RAX);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	emit_store_register(e, instruction->rd, RAX);
+}
+
+static void emit_branch(emitter *e, const decoded_instruction *instruction, uint64_t instruction_pc) {
+	int condition;
+	switch (instruction->op) {
+	case DECODED_OP_BEQ:
+		condition = CONDITION_E;
+		break;
+	case DECODED_OP_BNE:
+		condition = CONDITION_NE;
+		break;
+	case DECODED_OP_BLT:
+		condition = CONDITION_L;
+		break;
+	case DECODED_OP_BGE:
+		condition = CONDITION_GE;
+		break;
+	case DECODED_OP_BLTU:
+		condition = CONDITION_B;
+		break;
+	default:
+		condition = CONDITION_AE;
+		break;
+	}
+
+	emit_load_register(e, RAX, instruction->rs1);
+	emit_load_register(e, RCX, instruction->rs2);
+	emit_register(e, true, 0x39, -1, RCX, RAX); // cmp rax, rcx
+	emit_move_immediate(e, RAX, instruction_pc + decoded_size(instruction));
+	emit_move_immediate(e, RDX, instruction_pc + (int64_t)instruction->immediate);
+	emit_register(e, true, 0x0f, 0x40 + condition, RAX, RDX); // cmovcc rax, rdx
+	emit_exit(e);
+}
+
+static void emit_fallback(emitter *e, const decoded_instruction *instruction, uint64_t instruction_pc, bool last) {
+	emit_move_immediate(e, RCX, instruction_pc);
+	emit_memory(e, true, false, 0x89, -1, RCX, RBX, -1, HART_PC);
+	emit_move_immediate(e, ARGUMENT0, (uint64_t)(uintptr_t)instruction);
+	emit_call(e, (const void *)decoded_fallback);
+
+	if (last) {
+		emit_memory(e, true, false, 0x8b, -1, RAX, RBX, -1, HART_PC);
+		emit_exit(e);
+	}
+	else {
+		emit_exit_if_leaving(e, 0, true);
+	}
+}
+
+static void emit_instruction(emitter *e, const decoded_instruction *instruction, uint64_t instruction_pc, bool last) {
+	switch (instruction->op) {
+	case DECODED_OP_FALLBACK:
+		emit_fallback(e, instruction, instruction_pc, last);
+		break;
+	case DECODED_OP_NOP:
+		break;
+	case DECODED_OP_LUI:
+		emit_move_immediate(e, RAX, (int64_t)instruction->immediate);
+		emit_store_register(e, instruction->rd, RAX);
+		break;
+	case DECODED_OP_AUIPC:
+		emit_move_immediate(e, RAX, instruction_pc + (int64_t)instruction->immediate);
+		emit_store_register(e, instruction->rd, RAX);
+		break;
+	case DECODED_OP_JAL:
+		emit_move_immediate(e, RAX, instruction_pc + decoded_size(instruction));
+		emit_store_register(e, instruction->rd, RAX);
+		emit_exit_with_pc(e, instruction_pc + (int64_t)instruction->immediate);
+		break;
+	case DECODED_OP_JALR:
+		emit_effective_address(e, instruction);
+		emit_alu_immediate(e, true, 4, RAX, -2); // and
+		emit_move_immediate(e, RCX, instruction_pc + decoded_size(instruction));
+		emit_store_register(e, instruction->rd, RCX);
+		emit_exit(e);
+		break;
+	case DECODED_OP_BEQ:
+	case DECODED_OP_BNE:
+	case DECODED_OP_BLT:
+	case DECODED_OP_BGE:
+	case DECODED_OP_BLTU:
+	case DECODED_OP_BGEU:
+		emit_branch(e, instruction, instruction_pc);
+		break;
+	case DECODED_OP_LB:
+	case DECODED_OP_LH:
+	case DECODED_OP_LW:
+	case DECODED_OP_LD:
+	case DECODED_OP_LBU:
+	case DECODED_OP_LHU:
+	case DECODED_OP_LWU:
+		emit_load(e, instruction, instruction_pc + decoded_size(instruction));
+		break;
+	case DECODED_OP_SB:
+	case DECODED_OP_SH:
+	case DECODED_OP_SW:
+	case DECODED_OP_SD:
+		emit_store(e, instruction, instruction_pc + decoded_size(instruction));
+		break;
+	case DECODED_OP_ADDI:
+	case DECODED_OP_SLTI:
+	case DECODED_OP_SLTIU:
+	case DECODED_OP_XORI:
+	case DECODED_OP_ORI:
+	case DECODED_OP_ANDI:
+	case DECODED_OP_SLLI:
+	case DECODED_OP_SRLI:
+	case DECODED_OP_SRAI:
+	case DECODED_OP_ADDIW:
+	case DECODED_OP_SLLIW:
+	case DECODED_OP_SRLIW:
+	case DECODED_OP_SRAIW:
+		emit_alu_immediate_instruction(e, instruction);
+		break;
+	default:
+		emit_alu(e, instruction);
+		break;
+	}
+}
+
+bool jit_available(void) {
+	return true;
+}
+
+void jit_init(void) {
+	static_assert(offsetof(hart, x) == 0, "translated blocks address the registers from the start of the hart");
+
+#ifdef _WIN32
+	code = (uint8_t *)VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#else
+	code = (uint8_t *)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		code = NULL;
+	}
+#endif
+	if (code == NULL) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Could not allocate executable memory, the JIT is disabled.");
+	}
+	code_used = 0;
+}
+
+void jit_reset(void) {
+	code_used = 0;
+}
+
+jit_func *jit_compile(const block *block) {
+	if (code == NULL || code_used + JIT_BLOCK_SIZE > JIT_CODE_SIZE) {
+		return NULL;
+	}
+
+	emitter e;
+	e.cursor     = &code[code_used];
+	e.exit_count = 0;
+
+	uint8_t *start = e.cursor;
+
+	emit8(&e, 0x53);       // push rbx
+	emit8(&e, 0x41);       // push r12
+	emit8(&e, 0x50 + (R12 & 7));
+	emit8(&e, 0x41);       // push r13
+	emit8(&e, 0x50 + (R13 & 7));
+	if (SHADOW_SPACE > 0) {
+		emit_alu_immediate(&e, true, 5, RSP, SHADOW_SPACE); // sub
+	}
+	emit_register(&e, true, 0x89, -1, ARGUMENT0, RBX);
+	emit_move_immediate(&e, R12, (uint64_t)(uintptr_t)&ram);
+	emit_memory(&e, true, false, 0x8b, -1, R12, R12, -1, 0);
+	emit_move_immediate(&e, R13, (uint64_t)(uintptr_t)page_flags);
+
+	uint64_t instruction_pc = block->pc;
+	for (uint32_t index = 0; index < block->count; ++index) {
+		emit_instruction(&e, &block->instructions[index], instruction_pc, index == block->count - 1);
+		instruction_pc += decoded_size(&block->instructions[index]);
+	}
+
+	const decoded_instruction *last = &block->instructions[block->count - 1];
+	if (!((last->op >= DECODED_OP_JAL && last->op <= DECODED_OP_BGEU) || last->op == DECODED_OP_FALLBACK)) {
+		emit_move_immediate(&e, RAX, instruction_pc);
+	}
+
+	uint8_t *epilogue = e.cursor;
+	for (uint32_t exit_index = 0; exit_index < e.exit_count; ++exit_index) {
+		patch_jump(e.exits[exit_index], epilogue);
+	}
+	if (SHADOW_SPACE > 0) {
+		emit_alu_immediate(&e, true, 0, RSP, SHADOW_SPACE); // add
+	}
+	emit8(&e, 0x41); // pop r13
+	emit8(&e, 0x58 + (R13 & 7));
+	emit8(&e, 0x41); // pop r12
+	emit8(&e, 0x58 + (R12 & 7));
+	emit8(&e, 0x5b); // pop rbx
+	emit8(&e, 0xc3); // ret
+
+	assert((size_t)(e.cursor - start) <= JIT_BLOCK_SIZE);
+	code_used += (size_t)(e.cursor - start);
+	code_used = (code_used + 15) & ~(size_t)15;
+
+	return (jit_func *)(uintptr_t)start;
+}
+
+#else
+
+bool jit_available(void) {
+	return false;
+}
+
+void jit_init(void) {}
+
+jit_func *jit_compile(const block *block) {
+	return NULL;
+}
+
+void jit_reset(void) {}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef KOMPJUTA_JIT_HEADER
+#define KOMPJUTA_JIT_HEADER
+
+#include "risc-v.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blocks that ran this often in the interpreter get translated.
+#define JIT_THRESHOLD 64
+
+bool jit_available(void);
+
+// Allocates the code buffer of the calling thread, every thread that runs a hart needs one.
+void jit_init(void);
+
+// Returns NULL when the code buffer is exhausted, call jit_reset and drop all
+// previously translated blocks before trying again.
+jit_func *jit_compile(const block *block);
+void      jit_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
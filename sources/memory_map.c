@@ -0,0 +1,84 @@
+#include "memory_map.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+_Thread_local tlb_entry tlb[TLB_SIZE];
+
+static memory_region regions[MAX_MEMORY_REGIONS];
+static uint32_t      region_count = 0;
+
+static memory_region *add_region(const char *name, uint64_t base, uint64_t size) {
+	assert(region_count < MAX_MEMORY_REGIONS);
+	assert((base & (MEMORY_PAGE_SIZE - 1)) == 0 && (size & (MEMORY_PAGE_SIZE - 1)) == 0 && size != 0);
+	assert(base + size - 1 >= base);
+
+	memory_region *region = &regions[region_count++];
+	region->base          = base;
+	region->size          = size;
+	region->host          = NULL;
+	region->read          = NULL;
+	region->write         = NULL;
+	region->data          = NULL;
+	region->name          = name;
+
+	tlb_flush();
+
+	return region;
+}
+
+void memory_map_add_ram(const char *name, uint64_t base, uint64_t size, uint8_t *host) {
+	memory_region *region = add_region(name, base, size);
+	region->kind          = MEMORY_REGION_RAM;
+	region->host          = host;
+}
+
+void memory_map_add_mmio(const char *name, uint64_t base, uint64_t size, mmio_read_func *read, mmio_write_func *write, void *data) {
+	memory_region *region = add_region(name, base, size);
+	region->kind          = MEMORY_REGION_MMIO;
+	region->read          = read;
+	region->write         = write;
+	region->data          = data;
+}
+
+void memory_map_remove(uint64_t base) {
+	for (uint32_t region_index = region_count; region_index > 0; --region_index) {
+		if (regions[region_index - 1].base == base) {
+			for (uint32_t next = region_index; next < region_count; ++next) {
+				regions[next - 1] = regions[next];
+			}
+			--region_count;
+			tlb_flush();
+			return;
+		}
+	}
+	assert(false);
+}
+
+const memory_region *memory_map_find(uint64_t address) {
+	for (uint32_t region_index = region_count; region_index > 0; --region_index) {
+		const memory_region *region = &regions[region_index - 1];
+		if (address - region->base < region->size) {
+			return region;
+		}
+	}
+	return NULL;
+}
+
+uint8_t *tlb_fill(const memory_region *region, uint64_t address) {
+	assert(region->kind == MEMORY_REGION_RAM);
+
+	uint64_t   page  = address >> MEMORY_PAGE_SHIFT;
+	tlb_entry *entry = &tlb[page & (TLB_SIZE - 1)];
+	entry->page      = page;
+	entry->host      = region->host + ((page << MEMORY_PAGE_SHIFT) - region->base);
+
+	return region->host + (address - region->base);
+}
+
+void tlb_flush(void) {
+	for (uint32_t entry_index = 0; entry_index < TLB_SIZE; ++entry_index) {
+		tlb[entry_index].page = UINT64_MAX;
+		tlb[entry_index].host = NULL;
+	}
+}
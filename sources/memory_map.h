@@ -0,0 +1,79 @@
+#ifndef KOMPJUTA_MEMORY_MAP_HEADER
+#define KOMPJUTA_MEMORY_MAP_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The guest physical address space, a list of page aligned regions that are either backed
+// by host memory or handled by an MMIO device. Regions added later shadow the parts of
+// earlier ones they overlap, everything not covered is unmapped. RAM pages that
+// were looked up recently are kept in a direct-mapped software TLB so that the common case
+// is one tag compare and a pointer add. Every thread has its own TLB, which has to be flushed
+// before the thread's first lookup, and changing the map only flushes the TLB of the calling
+// thread, so the map has to stay as it is while more than one thread accesses guest memory.
+
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE  (1ull << MEMORY_PAGE_SHIFT)
+
+#define MAX_MEMORY_REGIONS 16
+
+#define TLB_SIZE 256
+
+typedef uint64_t mmio_read_func(void *data, uint64_t offset, uint32_t size);
+typedef void     mmio_write_func(void *data, uint64_t offset, uint64_t value, uint32_t size);
+
+typedef enum memory_region_kind {
+	MEMORY_REGION_RAM,
+	MEMORY_REGION_MMIO,
+} memory_region_kind;
+
+typedef struct memory_region {
+	uint64_t           base;
+	uint64_t           size;
+	memory_region_kind kind;
+	uint8_t           *host; // RAM only
+	mmio_read_func    *read; // MMIO only
+	mmio_write_func   *write;
+	void              *data;
+	const char        *name;
+} memory_region;
+
+typedef struct tlb_entry {
+	uint64_t page;
+	uint8_t *host; // host address of the first byte of the page
+} tlb_entry;
+
+extern _Thread_local tlb_entry tlb[TLB_SIZE];
+
+void memory_map_add_ram(const char *name, uint64_t base, uint64_t size, uint8_t *host);
+void memory_map_add_mmio(const char *name, uint64_t base, uint64_t size, mmio_read_func *read, mmio_write_func *write, void *data);
+void memory_map_remove(uint64_t base);
+
+// NULL for unmapped addresses
+const memory_region *memory_map_find(uint64_t address);
+
+// Enters the page of a RAM region address into the TLB and returns the host address.
+uint8_t *tlb_fill(const memory_region *region, uint64_t address);
+void     tlb_flush(void);
+
+// Host address for an access that stays within one cached RAM page, NULL otherwise.
+static inline uint8_t *tlb_lookup(uint64_t address, uint32_t size) {
+	uint64_t   page   = address >> MEMORY_PAGE_SHIFT;
+	uint64_t   offset = address & (MEMORY_PAGE_SIZE - 1);
+	tlb_entry *entry  = &tlb[page & (TLB_SIZE - 1)];
+	if (entry->page == page && offset <= MEMORY_PAGE_SIZE - size) {
+		return entry->host + offset;
+	}
+	return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
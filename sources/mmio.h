@@ -9,6 +9,7 @@
 extern "C" {
 #endif
 
+// Only hart 0 can write these registers, writes of other harts are ignored.
 #define MMIO_BASE 0xffffffff00000000
 
 #define FB_ADDR              0x0
@@ -21,6 +22,110 @@ extern "C" {
 #define COMMAND_LIST_SIZE    0x28
 #define EXECUTE_COMMAND_LIST 0x32
 
+// The command ring, an array of COMMAND_RING_SIZE kompjuta_gpu_commands at
+// COMMAND_RING_ADDR that the host works through while the guest goes on. Head and tail
+// count commands since the start and are never wrapped, command n lives in slot
+// n % COMMAND_RING_SIZE. The guest writes commands behind the tail and then stores the new
+// tail to COMMAND_RING_TAIL, slots below COMMAND_RING_HEAD may be written again. Buffers and
+// shader names the commands point to stay in use until a later
+// KOMPJUTA_GPU_COMMAND_SIGNAL_FENCE completed, COMMAND_RING_FENCE reads the value of the
+// last one that did and a store to it waits until the fence reached the stored value or
+// the ring ran empty. Address and size only change while the ring is empty.
+#define COMMAND_RING_ADDR  0x38
+#define COMMAND_RING_SIZE  0x40 // a power of two
+#define COMMAND_RING_TAIL  0x48
+#define COMMAND_RING_HEAD  0x50 // read only
+#define COMMAND_RING_FENCE 0x58
+
+// After every present of the host the first hart gets a machine external interrupt,
+// which stays pending until it is acknowledged with a store to VSYNC_ACK. Without a
+// display, with --headless, the guest's own presents count as vsyncs.
+#define VSYNC_COUNT 0x60 // read only, the vsyncs so far
+#define VSYNC_ACK   0x68
+
+// The timer and software interrupts, laid out like the SiFive CLINT. Every hart can write
+// every other hart's registers, the accesses are 8 bytes wide but for MSIP's 4.
+#define CLINT_BASE     (MMIO_BASE + 0x10000)
+#define CLINT_SIZE     0x10000
+#define CLINT_MSIP     0x0000 // 4 bytes per hart, bit 0 is the hart's pending software interrupt
+#define CLINT_MTIMECMP 0x4000 // 8 bytes per hart, the timer interrupt is pending while mtime >= mtimecmp
+#define CLINT_MTIME    0xbff8 // read only, the time CSR
+
+// The blitter, bulk copies and fills of guest memory and 2D rectangle fills, copies and blends
+// that the host runs in one go. Every hart has registers of its own. An operation is
+// described in the other registers and started by storing its kompjuta_blit_operation to
+// BLIT_START. It is done once the store returns, BLIT_COMPLETED counts it then, and
+// operations with invalid parameters or ranges that are not RAM count in BLIT_FAILED
+// instead and do not touch memory. Strides are in bytes, rectangles of copies that convert
+// and of blends do not overlap.
+#define BLITTER_BASE (MMIO_BASE + 0x20000)
+
+#define BLIT_SOURCE             0x00
+#define BLIT_SOURCE_STRIDE      0x08
+#define BLIT_SOURCE_FORMAT      0x10 // a kompjuta_pixel_format
+#define BLIT_DESTINATION        0x18
+#define BLIT_DESTINATION_STRIDE 0x20
+#define BLIT_DESTINATION_FORMAT 0x28
+#define BLIT_WIDTH              0x30 // in pixels, in bytes for the byte operations
+#define BLIT_HEIGHT             0x38 // in rows, unused by the byte operations
+#define BLIT_COLOR              0x40 // like an RGBA8 pixel, the fill byte of KOMPJUTA_BLIT_FILL_BYTES in the lowest 8 bits
+#define BLIT_START              0x48
+#define BLIT_COMPLETED          0x50 // read only
+#define BLIT_FAILED             0x58 // read only
+
+// The block device, reads BLOCK_SECTOR_SIZE byte sectors of the --disk image into RAM. Its
+// queue is an array of BLOCK_QUEUE_SIZE kompjuta_block_requests at BLOCK_QUEUE_ADDR that
+// works like the command ring: head and tail count requests and are never wrapped, the guest
+// fills slots behind the tail and stores the new tail to BLOCK_QUEUE_TAIL, and a request,
+// its status and the memory it reads into are done once BLOCK_QUEUE_HEAD passed it. Requests
+// complete in order. Without --disk-async that is before the store to the tail returns,
+// with it they run in the background and the guest polls the head. Any hart can drive the
+// queue, one at a time.
+#define BLOCK_BASE (MMIO_BASE + 0x30000)
+
+#define BLOCK_SECTOR_COUNT 0x00 // read only, the size of the image, 0 without one
+#define BLOCK_QUEUE_ADDR   0x08
+#define BLOCK_QUEUE_SIZE   0x10 // a power of two up to BLOCK_QUEUE_MAX_SIZE
+#define BLOCK_QUEUE_TAIL   0x18
+#define BLOCK_QUEUE_HEAD   0x20 // read only
+
+#define BLOCK_SECTOR_SIZE    512
+#define BLOCK_QUEUE_MAX_SIZE 1024
+
+// the rate of the time CSR, in Hz
+#define TIMEBASE_FREQUENCY 10000000
+
+typedef enum kompjuta_blit_operation {
+	KOMPJUTA_BLIT_COPY_BYTES, // like memmove
+	KOMPJUTA_BLIT_FILL_BYTES, // like memset
+	KOMPJUTA_BLIT_FILL,       // the destination rectangle with BLIT_COLOR
+	KOMPJUTA_BLIT_COPY,       // the source rectangle to the destination, converted to its format
+	KOMPJUTA_BLIT_BLEND,      // the source rectangle over the destination, by the source's alpha
+} kompjuta_blit_operation;
+
+// Pixels in memory order, RGBA8 is what the framebuffer holds. A8 pixels are alpha only
+// and take their color from BLIT_COLOR when they are the source, RGB565 is opaque.
+typedef enum kompjuta_pixel_format {
+	KOMPJUTA_PIXEL_FORMAT_RGBA8,
+	KOMPJUTA_PIXEL_FORMAT_BGRA8,
+	KOMPJUTA_PIXEL_FORMAT_RGB565,
+	KOMPJUTA_PIXEL_FORMAT_A8,
+	KOMPJUTA_PIXEL_FORMAT_COUNT,
+} kompjuta_pixel_format;
+
+typedef enum kompjuta_block_status {
+	KOMPJUTA_BLOCK_STATUS_OK,
+	KOMPJUTA_BLOCK_STATUS_ERROR, // sectors past the end of the image or memory that is not RAM, nothing was read
+} kompjuta_block_status;
+
+// The bytes of the image's last sector that are past the end of the file read as zeros.
+typedef struct kompjuta_block_request {
+	uint64_t sector;
+	uint64_t address;
+	uint32_t sector_count;
+	uint32_t status; // a kompjuta_block_status, written by the device
+} kompjuta_block_request;
+
 typedef enum kompjuta_gpu_command_kind {
 	KOMPJUTA_GPU_COMMAND_CLEAR,
 	KOMPJUTA_GPU_COMMAND_SET_INDEX_BUFFER,
@@ -28,8 +133,13 @@ typedef enum kompjuta_gpu_command_kind {
 	KOMPJUTA_GPU_COMMAND_SET_RENDER_PIPELINE,
 	KOMPJUTA_GPU_COMMAND_DRAW_INDEXED,
 	KOMPJUTA_GPU_COMMAND_PRESENT,
+	KOMPJUTA_GPU_COMMAND_SIGNAL_FENCE,
 } kompjuta_gpu_command_kind;
 
+// Pointers are guest addresses. Vertices start with the fields of guest_vertex in
+// shaders/guest.kong, three floats of position and four of color, and the shaders are the
+// NUL-terminated names of shader functions there, like "colored_vertex" and
+// "colored_fragment". Draws read their data when the list is executed.
 typedef struct kompjuta_gpu_command {
 	kompjuta_gpu_command_kind kind;
 	union {
@@ -58,6 +168,9 @@ typedef struct kompjuta_gpu_command {
 			int32_t  base_vertex;
 			uint32_t first_instance;
 		} draw_indexed;
+		struct {
+			uint64_t value;
+		} signal_fence;
 	} data;
 } kompjuta_gpu_command;
 
@@ -0,0 +1,169 @@
+#include "profile.h"
+#include "symbols.h"
+
+#include <kore3/log.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PROFILE_INITIAL_CAPACITY 4096
+
+static uint32_t hash_pc(uint64_t pc, uint32_t capacity) {
+	return (uint32_t)(((pc >> 1) * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+}
+
+static profile_entry *find_entry(profile *profile, uint64_t pc) {
+	uint32_t index = hash_pc(pc, profile->capacity);
+	while (profile->entries[index].executions != 0 && profile->entries[index].pc != pc) {
+		index = (index + 1) & (profile->capacity - 1);
+	}
+	return &profile->entries[index];
+}
+
+static void grow(profile *profile) {
+	profile_entry *old_entries  = profile->entries;
+	uint32_t       old_capacity = profile->capacity;
+
+	profile->capacity = old_capacity == 0 ? PROFILE_INITIAL_CAPACITY : old_capacity * 2;
+	profile->entries  = (profile_entry *)calloc(profile->capacity, sizeof(profile_entry));
+	assert(profile->entries != NULL);
+
+	for (uint32_t entry_index = 0; entry_index < old_capacity; ++entry_index) {
+		if (old_entries[entry_index].executions != 0) {
+			*find_entry(profile, old_entries[entry_index].pc) = old_entries[entry_index];
+		}
+	}
+	free(old_entries);
+}
+
+static void add(profile *profile, uint64_t pc, uint64_t executions, uint64_t instructions) {
+	// kept at most half full
+	if ((profile->count + 1) * 2 > profile->capacity) {
+		grow(profile);
+	}
+
+	profile_entry *entry = find_entry(profile, pc);
+	if (entry->executions == 0) {
+		entry->pc = pc;
+		++profile->count;
+	}
+	entry->executions   += executions;
+	entry->instructions += instructions;
+}
+
+void profile_count(profile *profile, uint64_t pc, uint32_t instructions) {
+	add(profile, pc, 1, instructions);
+}
+
+typedef struct symbol_total {
+	const symbol *symbol; // NULL for code outside of all symbols
+	uint64_t      instructions;
+} symbol_total;
+
+static int compare_entry_pcs(const void *a, const void *b) {
+	uint64_t pc_a = ((const profile_entry *)a)->pc;
+	uint64_t pc_b = ((const profile_entry *)b)->pc;
+	return pc_a < pc_b ? -1 : (pc_a > pc_b ? 1 : 0);
+}
+
+static int compare_entry_instructions(const void *a, const void *b) {
+	uint64_t instructions_a = ((const profile_entry *)a)->instructions;
+	uint64_t instructions_b = ((const profile_entry *)b)->instructions;
+	return instructions_a > instructions_b ? -1 : (instructions_a < instructions_b ? 1 : 0);
+}
+
+static int compare_total_instructions(const void *a, const void *b) {
+	uint64_t instructions_a = ((const symbol_total *)a)->instructions;
+	uint64_t instructions_b = ((const symbol_total *)b)->instructions;
+	return instructions_a > instructions_b ? -1 : (instructions_a < instructions_b ? 1 : 0);
+}
+
+static void write_location(FILE *file, uint64_t pc) {
+	const symbol *symbol = symbols_find(pc);
+	if (symbol == NULL) {
+		fprintf(file, "?");
+	}
+	else if (pc == symbol->address) {
+		fprintf(file, "%s", symbol->name);
+	}
+	else {
+		fprintf(file, "%s+0x%llx", symbol->name, (unsigned long long)(pc - symbol->address));
+	}
+}
+
+bool profile_write(const profile *profiles, uint32_t profile_count, const char *path) {
+	profile merged = {0};
+	for (uint32_t profile_index = 0; profile_index < profile_count; ++profile_index) {
+		const profile *source = &profiles[profile_index];
+		for (uint32_t entry_index = 0; entry_index < source->capacity; ++entry_index) {
+			const profile_entry *entry = &source->entries[entry_index];
+			if (entry->executions != 0) {
+				add(&merged, entry->pc, entry->executions, entry->instructions);
+			}
+		}
+	}
+
+	// the used entries packed to the front, in address order so symbols come in runs
+	profile_entry *entries = merged.entries;
+	uint32_t       count   = 0;
+	for (uint32_t entry_index = 0; entry_index < merged.capacity; ++entry_index) {
+		if (entries[entry_index].executions != 0) {
+			entries[count++] = entries[entry_index];
+		}
+	}
+	qsort(entries, count, sizeof(profile_entry), compare_entry_pcs);
+
+	symbol_total *totals      = (symbol_total *)calloc(count + 1, sizeof(symbol_total));
+	uint32_t      total_count = 0;
+	uint64_t      executed    = 0;
+	assert(totals != NULL);
+	for (uint32_t entry_index = 0; entry_index < count; ++entry_index) {
+		const symbol *symbol = symbols_find(entries[entry_index].pc);
+		if (total_count == 0 || totals[total_count - 1].symbol != symbol) {
+			totals[total_count++].symbol = symbol;
+		}
+		totals[total_count - 1].instructions += entries[entry_index].instructions;
+		executed                             += entries[entry_index].instructions;
+	}
+	qsort(totals, total_count, sizeof(symbol_total), compare_total_instructions);
+	qsort(entries, count, sizeof(profile_entry), compare_entry_instructions);
+
+	FILE *file    = fopen(path, "w");
+	bool  written = file != NULL;
+	if (!written) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Could not write the profile to %s.", path);
+	}
+	else {
+		fprintf(file, "# %llu instructions in %u blocks\n\n", (unsigned long long)executed, count);
+
+		fprintf(file, "# instructions share symbol\n");
+		for (uint32_t total_index = 0; total_index < total_count; ++total_index) {
+			fprintf(file, "%llu %.2f%% %s\n", (unsigned long long)totals[total_index].instructions,
+			        100.0 * (double)totals[total_index].instructions / (double)executed,
+			        totals[total_index].symbol != NULL ? totals[total_index].symbol->name : "?");
+		}
+
+		fprintf(file, "\n# instructions executions pc location\n");
+		for (uint32_t entry_index = 0; entry_index < count; ++entry_index) {
+			fprintf(file, "%llu %llu 0x%llx ", (unsigned long long)entries[entry_index].instructions, (unsigned long long)entries[entry_index].executions,
+			        (unsigned long long)entries[entry_index].pc);
+			write_location(file, entries[entry_index].pc);
+			fprintf(file, "\n");
+		}
+
+		fclose(file);
+	}
+
+	free(totals);
+	profile_release(&merged);
+
+	return written;
+}
+
+void profile_release(profile *profile) {
+	free(profile->entries);
+	profile->entries  = NULL;
+	profile->capacity = 0;
+	profile->count    = 0;
+}
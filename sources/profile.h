@@ -0,0 +1,39 @@
+#ifndef KOMPJUTA_PROFILE_HEADER
+#define KOMPJUTA_PROFILE_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The execution histogram of --profile, counted per block like the instruction counters: a
+// block that is left early still counts all of its instructions. Every hart counts into a
+// table of its own, the tables are only merged when the profile is written.
+
+typedef struct profile_entry {
+	uint64_t pc; // where the block starts
+	uint64_t executions;
+	uint64_t instructions;
+} profile_entry;
+
+typedef struct profile {
+	profile_entry *entries; // open addressing, free entries have no executions
+	uint32_t       capacity;
+	uint32_t       count;
+} profile;
+
+void profile_count(profile *profile, uint64_t pc, uint32_t instructions);
+
+// Writes the histogram of all the tables as text, per symbol and per block, both sorted by
+// executed instructions.
+bool profile_write(const profile *profiles, uint32_t profile_count, const char *path);
+
+void profile_release(profile *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+#include "ram.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t ram_host_page_size(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+typedef struct file_range {
+	const uint8_t *start;
+	const uint8_t *end;
+} file_range;
+
+// what ram_map_file mapped, neighbouring ranges are merged
+static file_range *file_ranges         = NULL;
+static size_t      file_range_count    = 0;
+static size_t      file_range_capacity = 0;
+
+static void add_file_range(const uint8_t *start, uint64_t size) {
+	if (file_range_count > 0 && file_ranges[file_range_count - 1].end == start) {
+		file_ranges[file_range_count - 1].end = start + size;
+		return;
+	}
+
+	// the block device maps into the same buffers over and over
+	for (size_t range_index = 0; range_index < file_range_count; ++range_index) {
+		if (file_ranges[range_index].start <= start && file_ranges[range_index].end >= start + size) {
+			return;
+		}
+	}
+
+	if (file_range_count == file_range_capacity) {
+		file_range_capacity = file_range_capacity == 0 ? 64 : file_range_capacity * 2;
+		file_ranges         = (file_range *)realloc(file_ranges, file_range_capacity * sizeof(file_range));
+		assert(file_ranges != NULL);
+	}
+	file_ranges[file_range_count].start = start;
+	file_ranges[file_range_count].end   = start + size;
+	++file_range_count;
+}
+
+static void remove_file_ranges(const uint8_t *start, uint64_t size) {
+	size_t kept = 0;
+	for (size_t range_index = 0; range_index < file_range_count; ++range_index) {
+		if (file_ranges[range_index].start < start || file_ranges[range_index].end > start + size) {
+			file_ranges[kept++] = file_ranges[range_index];
+		}
+	}
+	file_range_count = kept;
+}
+
+bool ram_file_mapped(const uint8_t *memory, uint64_t size) {
+	for (size_t range_index = 0; range_index < file_range_count; ++range_index) {
+		if (file_ranges[range_index].start < memory + size && file_ranges[range_index].end > memory) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef _WIN32
+
+// Windows has no overcommit, committed memory counts against the commit limit of the system
+// whether it is touched or not. Reservations are therefore only reserved, and a vectored
+// exception handler commits a page the first time anything in the process touches it. The
+// kernel does not fault on behalf of system calls, so ranges handed to ReadFile are
+// committed beforehand.
+
+#define RAM_MAX_RESERVATIONS 8
+
+typedef struct reservation {
+	uint8_t *start;
+	uint64_t size; // 0 for a free slot
+} reservation;
+
+static reservation reservations[RAM_MAX_RESERVATIONS];
+static PVOID       commit_handler = NULL;
+
+static LONG CALLBACK commit_on_access(EXCEPTION_POINTERS *exception) {
+	const EXCEPTION_RECORD *record = exception->ExceptionRecord;
+	if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2) {
+		return EXCEPTION_CONTINUE_SEARCH;
+	}
+
+	const uint8_t *address = (const uint8_t *)record->ExceptionInformation[1];
+	for (size_t index = 0; index < RAM_MAX_RESERVATIONS; ++index) {
+		const reservation *reservation = &reservations[index];
+		if (reservation->size == 0 || address < reservation->start || address >= reservation->start + reservation->size) {
+			continue;
+		}
+
+		// another thread may have committed the page in the meantime, which does no harm
+		uint64_t page_size = ram_host_page_size();
+		void    *page      = (void *)((uintptr_t)address & ~(uintptr_t)(page_size - 1));
+		return VirtualAlloc(page, (SIZE_T)page_size, MEM_COMMIT, PAGE_READWRITE) != NULL ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+	}
+
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+uint8_t *ram_reserve(uint64_t size) {
+	size_t slot = 0;
+	while (slot < RAM_MAX_RESERVATIONS && reservations[slot].size != 0) {
+		++slot;
+	}
+	if (slot == RAM_MAX_RESERVATIONS) {
+		return NULL;
+	}
+
+	if (commit_handler == NULL) {
+		commit_handler = AddVectoredExceptionHandler(1, commit_on_access);
+		if (commit_handler == NULL) {
+			return NULL;
+		}
+	}
+
+	uint8_t *memory = (uint8_t *)VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+	if (memory == NULL) {
+		return NULL;
+	}
+
+	reservations[slot].start = memory;
+	reservations[slot].size  = size;
+	return memory;
+}
+
+void ram_release(uint8_t *memory, uint64_t size) {
+	remove_file_ranges(memory, size);
+	for (size_t index = 0; index < RAM_MAX_RESERVATIONS; ++index) {
+		if (reservations[index].start == memory) {
+			reservations[index].size = 0;
+		}
+	}
+	VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+// Committed pages, which are exactly the ones that were touched.
+uint64_t ram_resident_pages(const uint8_t *memory, uint64_t size) {
+	uint64_t committed = 0;
+	for (const uint8_t *region = memory; region < memory + size;) {
+		MEMORY_BASIC_INFORMATION information;
+		if (VirtualQuery(region, &information, sizeof(information)) == 0) {
+			return UINT64_MAX;
+		}
+
+		const uint8_t *end = (const uint8_t *)information.BaseAddress + information.RegionSize;
+		if (end > memory + size) {
+			end = memory + size;
+		}
+		if (information.State == MEM_COMMIT) {
+			committed += (uint64_t)(end - region);
+		}
+		region = end;
+	}
+	return committed / ram_host_page_size();
+}
+
+bool ram_map_file(uint8_t *memory, uint64_t size, FILE *file, uint64_t offset) {
+	// MapViewOfFile can not place a view inside of a VirtualAlloc reservation
+	if (VirtualAlloc(memory, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+		return false;
+	}
+	if (_fseeki64(file, (__int64)offset, SEEK_SET) != 0 || fread(memory, 1, (size_t)size, file) != size) {
+		return false;
+	}
+	add_file_range(memory, size);
+	return true;
+}
+
+uint8_t *ram_map_file_read_only(FILE *file, uint64_t *size) {
+	HANDLE        handle = (HANDLE)_get_osfhandle(_fileno(file));
+	LARGE_INTEGER length;
+	if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &length) || length.QuadPart == 0) {
+		return NULL;
+	}
+
+	// the view keeps the mapping object alive
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	void *memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	*size = (uint64_t)length.QuadPart;
+	return (uint8_t *)memory;
+}
+
+void ram_unmap_file(uint8_t *memory, uint64_t size) {
+	UnmapViewOfFile(memory);
+}
+
+void ram_prefetch(const uint8_t *memory, uint64_t size) {
+	WIN32_MEMORY_RANGE_ENTRY range = {
+	    .VirtualAddress = (PVOID)memory,
+	    .NumberOfBytes  = (SIZE_T)size,
+	};
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+#ifdef MAP_NORESERVE
+#define RAM_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+#else
+#define RAM_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+uint8_t *ram_reserve(uint64_t size) {
+	void *memory = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, RAM_MAP_FLAGS, -1, 0);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+	return (uint8_t *)memory;
+}
+
+void ram_release(uint8_t *memory, uint64_t size) {
+	remove_file_ranges(memory, size);
+	munmap(memory, (size_t)size);
+}
+
+bool ram_map_file(uint8_t *memory, uint64_t size, FILE *file, uint64_t offset) {
+	void *mapped = mmap(memory, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), (off_t)offset);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	add_file_range(memory, size);
+	return true;
+}
+
+uint8_t *ram_map_file_read_only(FILE *file, uint64_t *size) {
+	struct stat status;
+	if (fstat(fileno(file), &status) != 0 || status.st_size == 0) {
+		return NULL;
+	}
+
+	void *memory = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+
+	*size = (uint64_t)status.st_size;
+	return (uint8_t *)memory;
+}
+
+void ram_unmap_file(uint8_t *memory, uint64_t size) {
+	munmap(memory, (size_t)size);
+}
+
+void ram_prefetch(const uint8_t *memory, uint64_t size) {
+#ifdef MADV_WILLNEED
+	// madvise wants the start of a page
+	uintptr_t start = (uintptr_t)memory & ~(uintptr_t)(ram_host_page_size() - 1);
+	madvise((void *)start, (size_t)((uintptr_t)memory + size - start), MADV_WILLNEED);
+#endif
+}
+
+uint64_t ram_resident_pages(const uint8_t *memory, uint64_t size) {
+#if defined(__linux__) || defined(__APPLE__)
+	uint64_t page_size = ram_host_page_size();
+	uint64_t resident  = 0;
+
+	// queried in slices to keep the status vector on the stack
+	unsigned char status[4096];
+	for (uint64_t offset = 0; offset < size; offset += sizeof(status) * page_size) {
+		uint64_t length = size - offset;
+		if (length > sizeof(status) * page_size) {
+			length = sizeof(status) * page_size;
+		}
+#ifdef __APPLE__
+		if (mincore((void *)(memory + offset), (size_t)length, (char *)status) != 0) {
+#else
+		if (mincore((void *)(memory + offset), (size_t)length, status) != 0) {
+#endif
+			return UINT64_MAX;
+		}
+		uint64_t pages = (length + page_size - 1) / page_size;
+		for (uint64_t page = 0; page < pages; ++page) {
+			resident += status[page] & 1;
+		}
+	}
+
+	return resident;
+#else
+	return UINT64_MAX;
+#endif
+}
+
+#endif
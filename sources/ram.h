@@ -0,0 +1,45 @@
+#ifndef KOMPJUTA_RAM_HEADER
+#define KOMPJUTA_RAM_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reserves zeroed memory that is only backed by the host once it is touched. Returns NULL when
+// the memory could not be reserved.
+uint8_t *ram_reserve(uint64_t size);
+void     ram_release(uint8_t *memory, uint64_t size);
+
+// Number of host pages of a reservation that are currently resident, UINT64_MAX when the
+// host can not tell.
+uint64_t ram_resident_pages(const uint8_t *memory, uint64_t size);
+uint64_t ram_host_page_size(void);
+
+// Maps size bytes of the file at offset over part of a reservation, copy-on-write, so
+// processes that map the same file share its pages until they write to them. Where the host
+// can not map into a reservation the bytes are read instead. memory, size and offset have to
+// be multiples of the host's page size.
+bool ram_map_file(uint8_t *memory, uint64_t size, FILE *file, uint64_t offset);
+
+// Whether part of the range was mapped by ram_map_file. Such pages hold data even when the
+// host does not count them as resident because they were dropped from its file cache.
+bool ram_file_mapped(const uint8_t *memory, uint64_t size);
+
+// Maps a whole file read-only and sets size to its length. Returns NULL when the file can not
+// be mapped. The mapping stays valid after the file is closed.
+uint8_t *ram_map_file_read_only(FILE *file, uint64_t *size);
+void     ram_unmap_file(uint8_t *memory, uint64_t size);
+
+// Tells the host that a range of a file mapping is about to be read, it then reads the pages
+// ahead in the background instead of on the first touch of every one.
+void ram_prefetch(const uint8_t *memory, uint64_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
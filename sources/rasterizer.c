@@ -0,0 +1,499 @@
+#include "rasterizer.h"
+
+#include <kore3/threads/semaphore.h>
+#include <kore3/threads/thread.h>
+
+#include <kong.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Fixed point edge functions with an exact tie rule, filled in BLOCK_SIZE blocks by row loops without branches.
+
+#define TILE_SIZE     64
+#define SUBPIXEL_BITS 8
+#define SUBPIXELS     (1 << SUBPIXEL_BITS)
+#define GUARD_BAND    (1 << 18) // pixels off the target, triangles reaching further are dropped instead of clipped
+#define BLOCK_SIZE    8
+
+enum { PLANE_R, PLANE_G, PLANE_B, PLANE_A, PLANE_Z, PLANE_COUNT };
+
+typedef struct raster_triangle {
+	int64_t edge_x[3]; // per pixel steps of the edge functions
+	int64_t edge_y[3];
+	int64_t edge_c[3]; // at the center of pixel (0, 0), with the tie rule folded in
+	float   plane_x[PLANE_COUNT];
+	float   plane_y[PLANE_COUNT];
+	float   plane_c[PLANE_COUNT]; // at the center of pixel (min_x, min_y)
+	int32_t min_x;
+	int32_t min_y;
+	int32_t max_x;
+	int32_t max_y;
+} raster_triangle;
+
+typedef struct tile_bin {
+	uint32_t *triangles;
+	uint32_t  count;
+	uint32_t  capacity;
+} tile_bin;
+
+static rasterizer_target target;
+static uint32_t          tiles_x;
+static uint32_t          tiles_y;
+static tile_bin         *bins         = NULL;
+static uint32_t          bin_capacity = 0;
+static bool              cleared;
+static uint32_t          clear_color;
+
+static raster_triangle *triangles         = NULL;
+static uint32_t         triangle_count    = 0;
+static uint32_t         triangle_capacity = 0;
+
+static kore_thread      threads[RASTERIZER_MAX_THREADS];
+static uint32_t         worker_count = 0; // threads besides the one that calls rasterizer_end
+static kore_semaphore   work_ready;
+static kore_semaphore   work_done;
+static _Atomic uint32_t next_tile;
+static atomic_bool      stopping;
+
+static uint32_t host_cores(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (uint32_t)cores : 1;
+#endif
+}
+
+// Clamps to [0, 1] and NaN to 0 without branches, which keep the loops below from being
+// vectorized at -O2.
+static inline float saturate(float value) {
+	uint32_t above = 0u - (uint32_t)(value > 0.0f);
+	uint32_t below = 0u - (uint32_t)(value < 1.0f);
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = ((bits & below) | (0x3f800000u & ~below)) & above; // 0x3f800000 is 1.0f
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint32_t pack_color(float r, float g, float b, float a) {
+	float    channels[4] = {r, g, b, a};
+	uint32_t color       = 0;
+	for (uint32_t channel = 0; channel < 4; ++channel) {
+		color |= (uint32_t)(saturate(channels[channel]) * 255.0f + 0.5f) << (channel * 8);
+	}
+	return color;
+}
+
+static int64_t floor_divide(int64_t value, int64_t divisor) {
+	return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+static bool to_fixed(float value, int64_t *fixed) {
+	// also false for NaN
+	if (!(value > -GUARD_BAND && value < GUARD_BAND)) {
+		return false;
+	}
+	*fixed = (int64_t)llrintf(value * SUBPIXELS);
+	return true;
+}
+
+static void fill_tile(uint32_t tile_x, uint32_t tile_y) {
+	uint32_t x0 = tile_x * TILE_SIZE;
+	uint32_t y0 = tile_y * TILE_SIZE;
+	uint32_t x1 = x0 + TILE_SIZE < target.width ? x0 + TILE_SIZE : target.width;
+	uint32_t y1 = y0 + TILE_SIZE < target.height ? y0 + TILE_SIZE : target.height;
+
+	uint32_t row[TILE_SIZE];
+	for (uint32_t x = 0; x < TILE_SIZE; ++x) {
+		row[x] = clear_color;
+	}
+	for (uint32_t y = y0; y < y1; ++y) {
+		memcpy(&target.pixels[(uint64_t)target.stride * y + x0 * 4], row, (x1 - x0) * 4);
+	}
+}
+
+// edge_steps holds the edge functions' steps to the pixels of a row, precomputed so the
+// loops below are plain additions
+static void rasterize_row(const raster_triangle *triangle, const int64_t edge_steps[3][BLOCK_SIZE], const int64_t edges[3], int32_t x, int32_t y,
+                          uint32_t pixel_count) {
+	uint32_t masks[BLOCK_SIZE];
+	for (uint32_t pixel = 0; pixel < BLOCK_SIZE; ++pixel) {
+		int64_t inside = (edges[0] + edge_steps[0][pixel]) | (edges[1] + edge_steps[1][pixel]) | (edges[2] + edge_steps[2][pixel]);
+		masks[pixel]   = (uint32_t)((uint64_t)inside >> 63) - 1;
+	}
+
+	float offset_x = (float)(x - triangle->min_x);
+	float offset_y = (float)(y - triangle->min_y);
+	float planes[PLANE_COUNT];
+	for (uint32_t plane = 0; plane < PLANE_COUNT; ++plane) {
+		planes[plane] = triangle->plane_c[plane] + triangle->plane_x[plane] * offset_x + triangle->plane_y[plane] * offset_y;
+	}
+
+	uint32_t covered = 0;
+	for (uint32_t pixel = 0; pixel < BLOCK_SIZE; ++pixel) {
+		float z = planes[PLANE_Z] + triangle->plane_x[PLANE_Z] * (float)pixel;
+		masks[pixel] &= 0u - (uint32_t)((z >= 0.0f) & (z <= 1.0f) & (pixel < pixel_count));
+		covered |= masks[pixel];
+	}
+	if (covered == 0) {
+		return;
+	}
+
+	uint32_t colors[BLOCK_SIZE] = {0};
+	for (uint32_t channel = 0; channel < 4; ++channel) {
+		for (uint32_t pixel = 0; pixel < BLOCK_SIZE; ++pixel) {
+			float value = saturate(planes[channel] + triangle->plane_x[channel] * (float)pixel);
+			colors[pixel] |= (uint32_t)(int32_t)(value * 255.0f + 0.5f) << (channel * 8);
+		}
+	}
+
+	uint8_t *pixels          = &target.pixels[(uint64_t)target.stride * y + (uint64_t)x * 4];
+	uint32_t old[BLOCK_SIZE] = {0};
+	if (pixel_count == BLOCK_SIZE) {
+		memcpy(old, pixels, sizeof(old));
+	}
+	else {
+		memcpy(old, pixels, pixel_count * 4);
+	}
+	for (uint32_t pixel = 0; pixel < BLOCK_SIZE; ++pixel) {
+		old[pixel] = (colors[pixel] & masks[pixel]) | (old[pixel] & ~masks[pixel]);
+	}
+	if (pixel_count == BLOCK_SIZE) {
+		memcpy(pixels, old, sizeof(old));
+	}
+	else {
+		memcpy(pixels, old, pixel_count * 4);
+	}
+}
+
+static void rasterize_triangle(const raster_triangle *triangle, uint32_t tile_x, uint32_t tile_y) {
+	int32_t x0 = (int32_t)(tile_x * TILE_SIZE);
+	int32_t y0 = (int32_t)(tile_y * TILE_SIZE);
+	int32_t x1 = x0 + TILE_SIZE - 1 < (int32_t)target.width - 1 ? x0 + TILE_SIZE - 1 : (int32_t)target.width - 1;
+	int32_t y1 = y0 + TILE_SIZE - 1 < (int32_t)target.height - 1 ? y0 + TILE_SIZE - 1 : (int32_t)target.height - 1;
+
+	x0 = triangle->min_x > x0 ? triangle->min_x : x0;
+	y0 = triangle->min_y > y0 ? triangle->min_y : y0;
+	x1 = triangle->max_x < x1 ? triangle->max_x : x1;
+	y1 = triangle->max_y < y1 ? triangle->max_y : y1;
+
+	int64_t edge_steps[3][BLOCK_SIZE];
+	for (uint32_t edge = 0; edge < 3; ++edge) {
+		for (uint32_t pixel = 0; pixel < BLOCK_SIZE; ++pixel) {
+			edge_steps[edge][pixel] = triangle->edge_x[edge] * pixel;
+		}
+	}
+
+	for (int32_t block_y = y0; block_y <= y1; block_y += BLOCK_SIZE) {
+		uint32_t rows = y1 - block_y + 1 < BLOCK_SIZE ? (uint32_t)(y1 - block_y + 1) : BLOCK_SIZE;
+		for (int32_t block_x = x0; block_x <= x1; block_x += BLOCK_SIZE) {
+			uint32_t columns = x1 - block_x + 1 < BLOCK_SIZE ? (uint32_t)(x1 - block_x + 1) : BLOCK_SIZE;
+
+			// blocks that are outside of an edge at all four corners are skipped
+			int64_t edges[3];
+			bool    outside = false;
+			for (uint32_t edge = 0; edge < 3; ++edge) {
+				edges[edge]     = triangle->edge_x[edge] * block_x + triangle->edge_y[edge] * block_y + triangle->edge_c[edge];
+				int64_t largest = edges[edge] + (triangle->edge_x[edge] > 0 ? triangle->edge_x[edge] * (columns - 1) : 0) +
+				                  (triangle->edge_y[edge] > 0 ? triangle->edge_y[edge] * (rows - 1) : 0);
+				outside |= largest < 0;
+			}
+			if (outside) {
+				continue;
+			}
+
+			for (uint32_t row = 0; row < rows; ++row) {
+				rasterize_row(triangle, edge_steps, edges, block_x, block_y + (int32_t)row, columns);
+				for (uint32_t edge = 0; edge < 3; ++edge) {
+					edges[edge] += triangle->edge_y[edge];
+				}
+			}
+		}
+	}
+}
+
+static void rasterize_tiles(void) {
+	uint32_t tile_count = tiles_x * tiles_y;
+	for (uint32_t tile = atomic_fetch_add(&next_tile, 1); tile < tile_count; tile = atomic_fetch_add(&next_tile, 1)) {
+		uint32_t tile_x = tile % tiles_x;
+		uint32_t tile_y = tile / tiles_x;
+
+		if (cleared) {
+			fill_tile(tile_x, tile_y);
+		}
+
+		const tile_bin *bin = &bins[tile];
+		for (uint32_t index = 0; index < bin->count; ++index) {
+			rasterize_triangle(&triangles[bin->triangles[index]], tile_x, tile_y);
+		}
+	}
+}
+
+static void run_worker(void *data) {
+	(void)data;
+	for (;;) {
+		kore_semaphore_acquire(&work_ready);
+		if (atomic_load(&stopping)) {
+			return;
+		}
+		rasterize_tiles();
+		kore_semaphore_release(&work_done, 1);
+	}
+}
+
+void rasterizer_init(uint32_t thread_count) {
+	if (thread_count == 0) {
+		thread_count = host_cores();
+	}
+	thread_count = thread_count > RASTERIZER_MAX_THREADS ? RASTERIZER_MAX_THREADS : thread_count;
+
+	worker_count = thread_count - 1;
+	atomic_store(&stopping, false);
+	if (worker_count > 0) {
+		kore_semaphore_init(&work_ready, 0, worker_count);
+		kore_semaphore_init(&work_done, 0, worker_count);
+		for (uint32_t worker = 0; worker < worker_count; ++worker) {
+			kore_thread_init(&threads[worker], run_worker, NULL);
+		}
+	}
+}
+
+void rasterizer_destroy(void) {
+	if (worker_count > 0) {
+		atomic_store(&stopping, true);
+		kore_semaphore_release(&work_ready, worker_count);
+		for (uint32_t worker = 0; worker < worker_count; ++worker) {
+			kore_thread_wait_and_destroy(&threads[worker]);
+		}
+		kore_semaphore_destroy(&work_ready);
+		kore_semaphore_destroy(&work_done);
+		worker_count = 0;
+	}
+
+	for (uint32_t bin = 0; bin < bin_capacity; ++bin) {
+		free(bins[bin].triangles);
+	}
+	free(bins);
+	free(triangles);
+	bins              = NULL;
+	bin_capacity      = 0;
+	triangles         = NULL;
+	triangle_capacity = 0;
+}
+
+rasterizer_pipeline rasterizer_find_pipeline(const char *vertex_shader, const char *fragment_shader) {
+	if (strcmp(vertex_shader, "colored_vertex") == 0 && strcmp(fragment_shader, "colored_fragment") == 0) {
+		return RASTERIZER_PIPELINE_COLORED;
+	}
+	return RASTERIZER_PIPELINE_NONE;
+}
+
+static void reset_bins(void) {
+	for (uint32_t bin = 0; bin < tiles_x * tiles_y; ++bin) {
+		bins[bin].count = 0;
+	}
+	triangle_count = 0;
+}
+
+void rasterizer_begin(const rasterizer_target *new_target) {
+	target  = *new_target;
+	tiles_x = (target.width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+
+	if (tiles_x * tiles_y > bin_capacity) {
+		bins = (tile_bin *)realloc(bins, tiles_x * tiles_y * sizeof(tile_bin));
+		assert(bins != NULL);
+		memset(&bins[bin_capacity], 0, (tiles_x * tiles_y - bin_capacity) * sizeof(tile_bin));
+		bin_capacity = tiles_x * tiles_y;
+	}
+
+	reset_bins();
+	cleared = false;
+}
+
+void rasterizer_clear(float r, float g, float b, float a) {
+	// everything before is covered by the clear
+	reset_bins();
+	cleared     = true;
+	clear_color = pack_color(r, g, b, a);
+}
+
+static void bin_triangle(uint32_t triangle_index) {
+	const raster_triangle *triangle = &triangles[triangle_index];
+	for (uint32_t tile_y = (uint32_t)triangle->min_y / TILE_SIZE; tile_y <= (uint32_t)triangle->max_y / TILE_SIZE; ++tile_y) {
+		for (uint32_t tile_x = (uint32_t)triangle->min_x / TILE_SIZE; tile_x <= (uint32_t)triangle->max_x / TILE_SIZE; ++tile_x) {
+			tile_bin *bin = &bins[tile_y * tiles_x + tile_x];
+			if (bin->count == bin->capacity) {
+				bin->capacity  = bin->capacity == 0 ? 64 : bin->capacity * 2;
+				bin->triangles = (uint32_t *)realloc(bin->triangles, bin->capacity * sizeof(uint32_t));
+				assert(bin->triangles != NULL);
+			}
+			bin->triangles[bin->count++] = triangle_index;
+		}
+	}
+}
+
+static void setup_triangle(const guest_vertex *vertices[3]) {
+	int64_t x[3];
+	int64_t y[3];
+	for (uint32_t corner = 0; corner < 3; ++corner) {
+		float screen_x = (vertices[corner]->position.x + 1.0f) * 0.5f * (float)target.width;
+		float screen_y = (1.0f - vertices[corner]->position.y) * 0.5f * (float)target.height;
+		if (!to_fixed(screen_x, &x[corner]) || !to_fixed(screen_y, &y[corner])) {
+			return;
+		}
+	}
+
+	// counterclockwise on the screen, which has y going down, both windings are drawn
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0) {
+		return;
+	}
+	if (area < 0) {
+		const guest_vertex *vertex = vertices[1];
+		int64_t             swap_x = x[1];
+		int64_t             swap_y = y[1];
+		vertices[1]                = vertices[2];
+		x[1]                       = x[2];
+		y[1]                       = y[2];
+		vertices[2]                = vertex;
+		x[2]                       = swap_x;
+		y[2]                       = swap_y;
+		area                       = -area;
+	}
+
+	int64_t min_x = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2]) : (x[1] < x[2] ? x[1] : x[2]);
+	int64_t max_x = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2]) : (x[1] > x[2] ? x[1] : x[2]);
+	int64_t min_y = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+	int64_t max_y = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+
+	// the pixels whose centers are inside of the bounds
+	int64_t first_x = -floor_divide(-(min_x - SUBPIXELS / 2), SUBPIXELS);
+	int64_t first_y = -floor_divide(-(min_y - SUBPIXELS / 2), SUBPIXELS);
+	int64_t last_x  = floor_divide(max_x - SUBPIXELS / 2, SUBPIXELS);
+	int64_t last_y  = floor_divide(max_y - SUBPIXELS / 2, SUBPIXELS);
+	first_x         = first_x < 0 ? 0 : first_x;
+	first_y         = first_y < 0 ? 0 : first_y;
+	last_x          = last_x > (int64_t)target.width - 1 ? (int64_t)target.width - 1 : last_x;
+	last_y          = last_y > (int64_t)target.height - 1 ? (int64_t)target.height - 1 : last_y;
+	if (first_x > last_x || first_y > last_y) {
+		return;
+	}
+
+	if (triangle_count == triangle_capacity) {
+		triangle_capacity = triangle_capacity == 0 ? 1024 : triangle_capacity * 2;
+		triangles         = (raster_triangle *)realloc(triangles, triangle_capacity * sizeof(raster_triangle));
+		assert(triangles != NULL);
+	}
+	raster_triangle *triangle = &triangles[triangle_count];
+	triangle->min_x           = (int32_t)first_x;
+	triangle->min_y           = (int32_t)first_y;
+	triangle->max_x           = (int32_t)last_x;
+	triangle->max_y           = (int32_t)last_y;
+
+	// Edge k runs from corner k to the next one and is 0 there, positive inside and the
+	// area at the corner opposite of it. Every attribute is the sum of the corners' values
+	// weighted by the edge functions of the opposite edges.
+	double attributes[3][PLANE_COUNT];
+	for (uint32_t corner = 0; corner < 3; ++corner) {
+		attributes[corner][PLANE_R] = vertices[corner]->color.x;
+		attributes[corner][PLANE_G] = vertices[corner]->color.y;
+		attributes[corner][PLANE_B] = vertices[corner]->color.z;
+		attributes[corner][PLANE_A] = vertices[corner]->color.w;
+		attributes[corner][PLANE_Z] = vertices[corner]->position.z;
+	}
+	for (uint32_t plane = 0; plane < PLANE_COUNT; ++plane) {
+		triangle->plane_x[plane] = 0.0f;
+		triangle->plane_y[plane] = 0.0f;
+		triangle->plane_c[plane] = 0.0f;
+	}
+
+	for (uint32_t edge = 0; edge < 3; ++edge) {
+		uint32_t next = (edge + 1) % 3;
+		int64_t  a    = -(y[next] - y[edge]);
+		int64_t  b    = x[next] - x[edge];
+		int64_t  c    = (y[next] - y[edge]) * x[edge] - (x[next] - x[edge]) * y[edge];
+
+		// in pixels, sampled at pixel centers
+		int64_t step_x = a * SUBPIXELS;
+		int64_t step_y = b * SUBPIXELS;
+		int64_t center = c + a * (SUBPIXELS / 2) + b * (SUBPIXELS / 2);
+
+		uint32_t opposite = (edge + 2) % 3;
+		double   at_min   = (double)(center + step_x * first_x + step_y * first_y) / (double)area;
+		for (uint32_t plane = 0; plane < PLANE_COUNT; ++plane) {
+			triangle->plane_x[plane] += (float)((double)step_x / (double)area * attributes[opposite][plane]);
+			triangle->plane_y[plane] += (float)((double)step_y / (double)area * attributes[opposite][plane]);
+			triangle->plane_c[plane] += (float)(at_min * attributes[opposite][plane]);
+		}
+
+		// pixels on an edge belong to the triangle that has it on its left or top, the
+		// triangle on the other side sees the edge the other way around
+		bool owned             = a > 0 || (a == 0 && b > 0);
+		triangle->edge_x[edge] = step_x;
+		triangle->edge_y[edge] = step_y;
+		triangle->edge_c[edge] = center - (owned ? 0 : 1);
+	}
+
+	bin_triangle(triangle_count);
+	++triangle_count;
+}
+
+static const guest_vertex *fetch_vertex(const rasterizer_draw *draw, uint32_t index_position, guest_vertex *storage) {
+	uint32_t index = 0;
+	if (draw->index_size == 2) {
+		uint16_t short_index;
+		memcpy(&short_index, &draw->indices[(uint64_t)index_position * 2], sizeof(short_index));
+		index = short_index;
+	}
+	else {
+		memcpy(&index, &draw->indices[(uint64_t)index_position * 4], sizeof(index));
+	}
+
+	int64_t vertex = (int64_t)index + draw->base_vertex;
+	assert(vertex >= 0 && vertex < draw->vertex_count);
+	memcpy(storage, &draw->vertices[(uint64_t)vertex * draw->vertex_stride], sizeof(guest_vertex));
+	return storage;
+}
+
+void rasterizer_draw_indexed(const rasterizer_draw *draw) {
+	assert(draw->pipeline == RASTERIZER_PIPELINE_COLORED);
+
+	// instances have no data of their own and would draw the same pixels again
+	for (uint32_t first = 0; first + 3 <= draw->index_count; first += 3) {
+		guest_vertex        storage[3];
+		const guest_vertex *vertices[3];
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			vertices[corner] = fetch_vertex(draw, draw->first_index + first + corner, &storage[corner]);
+		}
+		setup_triangle(vertices);
+	}
+}
+
+void rasterizer_end(void) {
+	if (!cleared && triangle_count == 0) {
+		return;
+	}
+
+	atomic_store(&next_tile, 0);
+	if (worker_count > 0) {
+		kore_semaphore_release(&work_ready, worker_count);
+	}
+	rasterize_tiles();
+	for (uint32_t worker = 0; worker < worker_count; ++worker) {
+		kore_semaphore_acquire(&work_done);
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef KOMPJUTA_RASTERIZER_HEADER
+#define KOMPJUTA_RASTERIZER_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Renders guest command lists on the CPU, for --headless where there is no GPU. The clears
+// and triangles of a command list are binned into screen tiles and the tiles are rasterised
+// in parallel, every tile in command order, so the result does not depend on the number of
+// threads. The pipelines are the ones of shaders/guest.kong, implemented by hand.
+
+#define RASTERIZER_MAX_THREADS 64
+
+typedef enum rasterizer_pipeline {
+	RASTERIZER_PIPELINE_NONE,
+	RASTERIZER_PIPELINE_COLORED,
+} rasterizer_pipeline;
+
+// RGBA8 rows, like the guest framebuffer.
+typedef struct rasterizer_target {
+	uint8_t *pixels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+} rasterizer_target;
+
+// The vertices have the layout of guest_vertex, vertex_count of them are readable, and all
+// indices plus base_vertex are below vertex_count.
+typedef struct rasterizer_draw {
+	rasterizer_pipeline pipeline;
+	const uint8_t      *vertices;
+	uint64_t            vertex_stride;
+	uint32_t            vertex_count;
+	const uint8_t      *indices;
+	uint32_t            index_size; // 2 or 4
+	uint32_t            first_index;
+	uint32_t            index_count;
+	int32_t             base_vertex;
+} rasterizer_draw;
+
+// thread_count 0 uses every core of the host.
+void rasterizer_init(uint32_t thread_count);
+void rasterizer_destroy(void);
+
+rasterizer_pipeline rasterizer_find_pipeline(const char *vertex_shader, const char *fragment_shader);
+
+// Collects the work of one command list, which is rasterised by rasterizer_end.
+void rasterizer_begin(const rasterizer_target *target);
+void rasterizer_clear(float r, float g, float b, float a);
+void rasterizer_draw_indexed(const rasterizer_draw *draw);
+void rasterizer_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
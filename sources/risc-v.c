@@ -2,40 +2,111 @@
 #include <kore3/gpu/device.h>
 #include <kore3/log.h>
 #include <kore3/system.h>
+#include <kore3/threads/event.h>
+#include <kore3/threads/thread.h>
 
 #include <kong.h>
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
+#include <time.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "blitter.h"
+#include "block_device.h"
+#include "compressed.h"
+#include "floating_point.h"
+#include "frame_ring.h"
+#include "gpu_cache.h"
+#include "jit.h"
+#include "memory_map.h"
 #include "mmio.h"
+#include "ram.h"
+#include "rasterizer.h"
+#include "risc-v.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "trace.h"
+#include "vector.h"
+
+uint8_t *ram         = NULL;
+uint64_t memory_size = DEFAULT_MEMORY_SIZE;
+
+static hart     harts[MAX_HARTS];
+static uint32_t hart_count = 1;
+
+// The hart the calling thread executes, threads that do not run a hart of their own see
+// the first one.
+static _Thread_local hart *current_hart = &harts[0];
+
+// Kore's timer only runs after kore_init, which the headless path never calls, so everything
+// that measures time reads the host's monotonic clock itself.
+static uint64_t host_nanoseconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	uint64_t ticks = (uint64_t)counter.QuadPart;
+	uint64_t hertz = (uint64_t)frequency.QuadPart;
+	return ticks / hertz * 1000000000u + ticks % hertz * 1000000000u / hertz;
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+#endif
+}
+
+static double host_seconds(void) {
+	return (double)host_nanoseconds() / 1000000000.0;
+}
+
+#define NANOSECONDS_PER_TICK (1000000000 / TIMEBASE_FREQUENCY)
+static_assert(1000000000 % TIMEBASE_FREQUENCY == 0, "a tick is a whole number of nanoseconds");
+
+// host_nanoseconds when the time CSR was 0, wraps around when a restored time lies further back
+static uint64_t counter_start = 0;
+
+// Integer math only, double math here would raise inexact while the guest's flags are live in
+// the host's floating point status.
+static uint64_t read_time(void) {
+	return (host_nanoseconds() - counter_start) / NANOSECONDS_PER_TICK;
+}
 
-typedef struct vector {
-	union {
-		uint8_t  u8[128];
-		uint16_t u16[64];
-		uint32_t u32[32];
-		uint64_t u64[16];
-		float    f32[32];
-		double   f64[16];
-	} values;
-} vector;
-
-uint8_t *ram = NULL;
-
-static uint64_t x[32] = {0};
-static double   f[32] = {0};
-static vector   v[32] = {0};
-
-static uint64_t pc      = 0x0;
-static uint8_t  sew     = 0x0;
-static uint8_t  lmul    = 0x0;
-static uint8_t  lmuldiv = 0x0;
-static uint16_t vl      = 0x0;
+#define INTERRUPT_SOFTWARE 3
+#define INTERRUPT_TIMER    7
+#define INTERRUPT_EXTERNAL 11
+
+#define EXCEPTION_INSTRUCTION_ACCESS_FAULT 1
+#define EXCEPTION_ILLEGAL_INSTRUCTION      2
+#define EXCEPTION_BREAKPOINT               3
+#define EXCEPTION_LOAD_ACCESS_FAULT        5
+#define EXCEPTION_STORE_ACCESS_FAULT       7
+#define EXCEPTION_ECALL                    11
+
+#define MIP_MSIP (1ull << INTERRUPT_SOFTWARE)
+#define MIP_MTIP (1ull << INTERRUPT_TIMER)
+#define MIP_MEIP (1ull << INTERRUPT_EXTERNAL)
+
+// Harts in wfi sleep on their event, everything that can make an interrupt pending signals it.
+static kore_event hart_wakeups[MAX_HARTS];
+
+static void wake_hart(hart *hart) {
+	kore_event_signal(&hart_wakeups[hart->id]);
+}
+
+static _Atomic uint64_t vsync_count;
 
 typedef void opcode_func(uint32_t instruction);
 opcode_func *opcodes[];
@@ -50,118 +121,623 @@ static bool     command_list_present = false;
 static uint32_t command_list_size    = 0;
 static uint64_t command_list_address = 0;
 
-#define MEMORY_SIZE 1024 * 1024 * 1024
+// with --emulation-thread the render thread works through the ring
+static _Atomic uint64_t command_ring_address;
+static _Atomic uint64_t command_ring_size;
+static _Atomic uint64_t command_ring_tail;
+static _Atomic uint64_t command_ring_head;
+static _Atomic uint64_t command_ring_fence;
+// signalled whenever the fence or the head moved, wait_for_fence sleeps on it
+static kore_event command_ring_progress;
+
+_Atomic uint8_t *page_flags         = NULL;
+uint32_t         aliased_page_count = 0;
+
+static void enter_trap(uint64_t cause, uint64_t value);
+
+// Without a trap handler the hart halts. Instruction fetches fault before their block runs and
+// trap right away, loads and stores end their block and trap in take_access_fault, the first
+// fault of an instruction counts.
+static void access_fault(uint64_t cause, uint64_t address, const char *access) {
+	if ((current_hart->mtvec & ~3ull) == 0) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "%s access fault at 0x%llx in the block at 0x%llx, hart %u is halted.", access, address, current_hart->pc, current_hart->id);
+		current_hart->halted      = true;
+		current_hart->leave_block = true;
+		return;
+	}
+
+	if (cause == EXCEPTION_INSTRUCTION_ACCESS_FAULT) {
+		enter_trap(cause, address);
+		return;
+	}
+	if (current_hart->fault_cause == 0) {
+		current_hart->fault_cause   = cause;
+		current_hart->fault_address = address;
+	}
+	current_hart->leave_block = true;
+}
+
+static uint64_t read_memory_slow(uint64_t address, uint32_t size) {
+	const memory_region *region = memory_map_find(address);
+	if (region == NULL || address + size - 1 - region->base >= region->size) {
+		access_fault(EXCEPTION_LOAD_ACCESS_FAULT, address, "Load");
+		return 0;
+	}
+
+	if (region->kind == MEMORY_REGION_MMIO) {
+		return region->read(region->data, address - region->base, size);
+	}
 
-bool v0_bit(uint16_t lane) {
-	uint32_t byte = lane >> 3;
-	uint32_t bit  = lane & 7;
-	return (v[0].values.u8[byte] >> bit) & 1;
+	uint8_t *host  = tlb_fill(region, address);
+	uint64_t value = 0;
+	memcpy(&value, host, size);
+	return value;
 }
 
 uint32_t read_memory8(uint64_t address) {
-	if (address >= MMIO_BASE) {
-		return 0;
+	uint8_t *host = tlb_lookup(address, 1);
+	if (host != NULL) {
+		return *host;
 	}
-	return ram[address];
+	return (uint32_t)read_memory_slow(address, 1);
 }
 
 uint16_t read_memory16(uint64_t address) {
-	if (address >= MMIO_BASE) {
-		return 0;
+	uint8_t *host = tlb_lookup(address, 2);
+	if (host != NULL) {
+		return *(uint16_t *)host;
 	}
-	return *(uint16_t *)&ram[address];
+	return (uint16_t)read_memory_slow(address, 2);
 }
 
 uint32_t read_memory32(uint64_t address) {
-	if (address >= MMIO_BASE) {
-		uint64_t offset = address - MMIO_BASE;
-		switch (offset) {
-		case FB_STRIDE:
-			return framebuffer_stride;
-		case FB_WIDTH:
-			return framebuffer_width;
-		case FB_HEIGHT:
-			return framebuffer_height;
-		}
-		return 0;
+	uint8_t *host = tlb_lookup(address, 4);
+	if (host != NULL) {
+		return *(uint32_t *)host;
 	}
-	return *(uint32_t *)&ram[address];
+	return (uint32_t)read_memory_slow(address, 4);
 }
 
 uint64_t read_memory64(uint64_t address) {
-	if (address >= MMIO_BASE) {
-		return 0;
+	uint8_t *host = tlb_lookup(address, 8);
+	if (host != NULL) {
+		return *(uint64_t *)host;
 	}
-	return *(uint64_t *)&ram[address];
+	return read_memory_slow(address, 8);
 }
 
 static void execute_command_list(void);
+static void ring_command_doorbell(uint64_t tail);
+static void wait_for_fence(uint64_t value);
+static void catch_up_command_ring(void);
+static void invalidate_code_page(uint64_t page);
+static void framebuffer_page_written(uint64_t page);
+static void set_framebuffer_address(uint64_t address);
+static void flush_block_cache(void);
+
+// While the JIT is verified, RAM stores of the interpreter are journaled so they can be undone
+// and the same block can be run again natively.
+
+#define STORE_JOURNAL_SIZE 64
+
+typedef struct store_journal_entry {
+	uint64_t address;
+	uint64_t old_value;
+	uint8_t  size;
+} store_journal_entry;
+
+static store_journal_entry store_journal[STORE_JOURNAL_SIZE];
+static uint32_t            store_journal_count    = 0;
+static bool                store_journal_active   = false;
+static bool                store_journal_overflow = false;
+
+// Host address of a byte of guest RAM, aliased pages live in the region that shadows them.
+static uint8_t *guest_ram(uint64_t address) {
+	if ((page_flags[address >> MEMORY_PAGE_SHIFT] & PAGE_FLAG_ALIAS) == 0) {
+		return &ram[address];
+	}
+	const memory_region *region = memory_map_find(address);
+	return &region->host[address - region->base];
+}
 
-void store_memory8(uint64_t address, uint8_t value) {
-	if (address >= MMIO_BASE) {
-		uint64_t offset = address - MMIO_BASE;
-		switch (offset) {
-		case PRESENT:
-			framebuffer_present = true;
-			break;
-		case EXECUTE_COMMAND_LIST:
-			execute_command_list();
-			break;
+static void journal_store(uint64_t address, uint64_t size) {
+	if (store_journal_count == STORE_JOURNAL_SIZE) {
+		store_journal_overflow = true;
+		return;
+	}
+	store_journal_entry *entry = &store_journal[store_journal_count++];
+	entry->address             = address;
+	entry->old_value           = 0;
+	entry->size                = (uint8_t)size;
+	memcpy(&entry->old_value, guest_ram(address), size);
+}
+
+// Drops the blocks of the pages and reports framebuffer writes, for RAM stores that are not
+// journaled.
+static void prepare_pages(uint64_t address, uint64_t size) {
+	uint64_t first = address >> MEMORY_PAGE_SHIFT;
+	uint64_t last  = (address + size - 1) >> MEMORY_PAGE_SHIFT;
+	for (uint64_t page = first; page <= last; ++page) {
+		uint8_t flags = page_flags[page];
+		if ((flags & PAGE_FLAG_CODE) != 0) {
+			invalidate_code_page(page);
 		}
+		if ((flags & PAGE_FLAG_WATCH) != 0) {
+			framebuffer_page_written(page);
+		}
+	}
+}
+
+static void prepare_store(uint64_t address, uint64_t size) {
+	prepare_pages(address, size);
+	if (store_journal_active) {
+		journal_store(address, size);
+	}
+}
+
+// For the devices' writes to RAM, which can be larger than a journal entry.
+static void prepare_device_store(uint64_t address, uint64_t size) {
+	prepare_pages(address, size);
+	// the block is not compared then
+	if (store_journal_active) {
+		store_journal_overflow = true;
+	}
+}
+
+static void store_memory_slow(uint64_t address, uint64_t value, uint32_t size) {
+	const memory_region *region = memory_map_find(address);
+	if (region == NULL || address + size - 1 - region->base >= region->size) {
+		access_fault(EXCEPTION_STORE_ACCESS_FAULT, address, "Store");
+		return;
+	}
+
+	if (region->kind == MEMORY_REGION_MMIO) {
+		region->write(region->data, address - region->base, value, size);
+		current_hart->leave_block = true;
+		return;
+	}
+
+	uint8_t *host = tlb_fill(region, address);
+	prepare_store(address, size);
+	memcpy(host, &value, size);
+}
+
+void store_memory8(uint64_t address, uint8_t value) {
+	uint8_t *host = tlb_lookup(address, 1);
+	if (host != NULL) {
+		prepare_store(address, 1);
+		*host = value;
 	}
 	else {
-		ram[address] = value;
+		store_memory_slow(address, value, 1);
 	}
 }
 
 void store_memory16(uint64_t address, uint16_t value) {
-	if (address >= MMIO_BASE) {
+	uint8_t *host = tlb_lookup(address, 2);
+	if (host != NULL) {
+		prepare_store(address, 2);
+		*(uint16_t *)host = value;
 	}
 	else {
-		uint16_t *target = (uint16_t *)&ram[address];
-		*target          = value;
+		store_memory_slow(address, value, 2);
 	}
 }
 
 void store_memory32(uint64_t address, uint32_t value) {
-	if (address >= MMIO_BASE) {
-		uint64_t offset = address - MMIO_BASE;
-		switch (offset) {
-		case COMMAND_LIST_SIZE:
-			command_list_size = value;
-			break;
-		}
+	uint8_t *host = tlb_lookup(address, 4);
+	if (host != NULL) {
+		prepare_store(address, 4);
+		*(uint32_t *)host = value;
 	}
 	else {
-		uint32_t *target = (uint32_t *)&ram[address];
-		*target          = value;
+		store_memory_slow(address, value, 4);
 	}
 }
 
 void store_memory64(uint64_t address, uint64_t value) {
-	if (address >= MMIO_BASE) {
-		uint64_t offset = address - MMIO_BASE;
-		switch (offset) {
-		case FB_ADDR:
-			framebuffer_address = value;
-			break;
-		case COMMAND_LIST_ADDR:
-			command_list_address = value;
-			break;
+	uint8_t *host = tlb_lookup(address, 8);
+	if (host != NULL) {
+		prepare_store(address, 8);
+		*(uint64_t *)host = value;
+	}
+	else {
+		store_memory_slow(address, value, 8);
+	}
+}
+
+// Host address of the RAM page that holds address, NULL when it is not RAM.
+static uint8_t *ram_page(uint64_t address) {
+	uint8_t *host = tlb_lookup(address, 1);
+	if (host != NULL) {
+		return host;
+	}
+	const memory_region *region = memory_map_find(address);
+	if (region == NULL || region->kind != MEMORY_REGION_RAM) {
+		return NULL;
+	}
+	return tlb_fill(region, address);
+}
+
+static bool range_in_ram(uint64_t address, uint64_t size) {
+	for (uint64_t offset = 0; offset < size;) {
+		if (ram_page(address + offset) == NULL) {
+			return false;
+		}
+		offset += MEMORY_PAGE_SIZE - ((address + offset) & (MEMORY_PAGE_SIZE - 1));
+	}
+	return true;
+}
+
+// Host address of a range of RAM that is contiguous on the host as well, NULL otherwise.
+static uint8_t *ram_range(uint64_t address, uint64_t size) {
+	uint8_t *host = ram_page(address);
+	if (host == NULL || address + size < address) {
+		return NULL;
+	}
+	for (uint64_t offset = MEMORY_PAGE_SIZE - (address & (MEMORY_PAGE_SIZE - 1)); offset < size; offset += MEMORY_PAGE_SIZE) {
+		if (ram_page(address + offset) != host + offset) {
+			return NULL;
+		}
+	}
+	return host;
+}
+
+bool read_memory_block(uint64_t address, void *data, uint64_t size) {
+	if (!range_in_ram(address, size)) {
+		return false;
+	}
+
+	for (uint64_t offset = 0; offset < size;) {
+		uint64_t piece = MEMORY_PAGE_SIZE - ((address + offset) & (MEMORY_PAGE_SIZE - 1));
+		piece          = piece < size - offset ? piece : size - offset;
+		memcpy((uint8_t *)data + offset, ram_page(address + offset), piece);
+		offset += piece;
+	}
+	return true;
+}
+
+bool store_memory_block(uint64_t address, const void *data, uint64_t size) {
+	// journal entries hold at most 8 bytes
+	if (store_journal_active || !range_in_ram(address, size)) {
+		return false;
+	}
+
+	prepare_store(address, size);
+	for (uint64_t offset = 0; offset < size;) {
+		uint64_t piece = MEMORY_PAGE_SIZE - ((address + offset) & (MEMORY_PAGE_SIZE - 1));
+		piece          = piece < size - offset ? piece : size - offset;
+		memcpy(ram_page(address + offset), (const uint8_t *)data + offset, piece);
+		offset += piece;
+	}
+	return true;
+}
+
+// The framebuffer and GPU command registers at MMIO_BASE.
+
+static uint64_t system_device_read(void *data, uint64_t offset, uint32_t size) {
+	switch (offset) {
+	case FB_STRIDE:
+		return framebuffer_stride;
+	case FB_WIDTH:
+		return framebuffer_width;
+	case FB_HEIGHT:
+		return framebuffer_height;
+	case COMMAND_RING_HEAD:
+		catch_up_command_ring();
+		return atomic_load_explicit(&command_ring_head, memory_order_acquire);
+	case COMMAND_RING_FENCE:
+		catch_up_command_ring();
+		return atomic_load_explicit(&command_ring_fence, memory_order_acquire);
+	case VSYNC_COUNT:
+		return atomic_load_explicit(&vsync_count, memory_order_relaxed);
+	}
+	return 0;
+}
+
+static void system_device_write(void *data, uint64_t offset, uint64_t value, uint32_t size) {
+	// waiting for the GPU changes nothing, every hart may
+	if (offset == COMMAND_RING_FENCE) {
+		wait_for_fence(value);
+		return;
+	}
+
+	// presenting and the GPU belong to the first hart, writes of the others are dropped
+	if (current_hart->id != 0) {
+		return;
+	}
+
+	switch (offset) {
+	case FB_ADDR:
+		set_framebuffer_address(value);
+		break;
+	case PRESENT:
+		framebuffer_present = true;
+		break;
+	case COMMAND_LIST_ADDR:
+		command_list_address = value;
+		break;
+	case COMMAND_LIST_SIZE:
+		command_list_size = (uint32_t)value;
+		break;
+	case EXECUTE_COMMAND_LIST:
+		execute_command_list();
+		break;
+	case COMMAND_RING_ADDR:
+		atomic_store_explicit(&command_ring_address, value, memory_order_relaxed);
+		break;
+	case COMMAND_RING_SIZE:
+		atomic_store_explicit(&command_ring_size, value, memory_order_relaxed);
+		break;
+	case COMMAND_RING_TAIL:
+		ring_command_doorbell(value);
+		break;
+	case VSYNC_ACK:
+		atomic_fetch_and_explicit(&current_hart->mip, ~MIP_MEIP, memory_order_relaxed);
+		break;
+	}
+}
+
+// The CLINT at CLINT_BASE.
+
+static uint64_t clint_read(void *data, uint64_t offset, uint32_t size) {
+	if (offset == CLINT_MTIME) {
+		return read_time();
+	}
+	if (offset >= CLINT_MTIMECMP) {
+		uint64_t hart_index = (offset - CLINT_MTIMECMP) / 8;
+		return hart_index < hart_count ? atomic_load_explicit(&harts[hart_index].mtimecmp, memory_order_relaxed) : 0;
+	}
+	uint64_t hart_index = (offset - CLINT_MSIP) / 4;
+	return hart_index < hart_count && (atomic_load_explicit(&harts[hart_index].mip, memory_order_relaxed) & MIP_MSIP) != 0 ? 1 : 0;
+}
+
+static void clint_write(void *data, uint64_t offset, uint64_t value, uint32_t size) {
+	hart *target = NULL;
+	if (offset == CLINT_MTIME) {
+		return;
+	}
+	if (offset >= CLINT_MTIMECMP) {
+		uint64_t hart_index = (offset - CLINT_MTIMECMP) / 8;
+		if (hart_index >= hart_count) {
+			return;
+		}
+		target = &harts[hart_index];
+		atomic_store_explicit(&target->mtimecmp, value, memory_order_relaxed);
+	}
+	else {
+		uint64_t hart_index = (offset - CLINT_MSIP) / 4;
+		if (hart_index >= hart_count) {
+			return;
+		}
+		target = &harts[hart_index];
+		if ((value & 1) != 0) {
+			atomic_fetch_or_explicit(&target->mip, MIP_MSIP, memory_order_relaxed);
+		}
+		else {
+			atomic_fetch_and_explicit(&target->mip, ~MIP_MSIP, memory_order_relaxed);
+		}
+	}
+
+	// the writing hart compares time with mtimecmp again on its next block, others if they are parked
+	if (target == current_hart) {
+		target->interrupt_countdown = 0;
+	}
+	else {
+		wake_hart(target);
+	}
+}
+
+// The blitter at BLITTER_BASE, registers are indexed by their offset / 8.
+
+static uint64_t    blitter_registers[MAX_HARTS][BLITTER_REGISTER_COUNT];
+static atomic_bool blit_warning_logged = false;
+
+// Finds the rectangle's rows on the host, fails unless they are RAM the host has in one piece.
+static bool find_blit_surface(blitter_surface *surface, uint64_t address, uint64_t stride, uint64_t format, uint64_t width, uint64_t height, uint64_t *span) {
+	if (format >= KOMPJUTA_PIXEL_FORMAT_COUNT || width > UINT32_MAX || height > UINT32_MAX) {
+		return false;
+	}
+	uint64_t row = width * blitter_pixel_size((kompjuta_pixel_format)format);
+	if (height > 1 && stride > (UINT64_MAX - row) / (height - 1)) {
+		return false;
+	}
+
+	*span           = (height - 1) * stride + row;
+	surface->pixels = ram_range(address, *span);
+	surface->stride = stride;
+	surface->format = (kompjuta_pixel_format)format;
+	return surface->pixels != NULL;
+}
+
+// Returns false for invalid parameters, without touching memory.
+static bool run_blit(const uint64_t *registers) {
+	uint64_t operation = registers[BLIT_START / 8];
+	uint64_t width     = registers[BLIT_WIDTH / 8];
+	uint64_t height    = registers[BLIT_HEIGHT / 8];
+	uint32_t color     = (uint32_t)registers[BLIT_COLOR / 8];
+
+	if (operation == KOMPJUTA_BLIT_COPY_BYTES || operation == KOMPJUTA_BLIT_FILL_BYTES) {
+		if (width == 0) {
+			return true;
+		}
+		uint8_t *destination = ram_range(registers[BLIT_DESTINATION / 8], width);
+		uint8_t *source      = operation == KOMPJUTA_BLIT_COPY_BYTES ? ram_range(registers[BLIT_SOURCE / 8], width) : destination;
+		if (destination == NULL || source == NULL) {
+			return false;
 		}
+		prepare_device_store(registers[BLIT_DESTINATION / 8], width);
+		if (operation == KOMPJUTA_BLIT_COPY_BYTES) {
+			memmove(destination, source, width);
+		}
+		else {
+			memset(destination, color & 0xff, width);
+		}
+		return true;
+	}
+
+	if (operation != KOMPJUTA_BLIT_FILL && operation != KOMPJUTA_BLIT_COPY && operation != KOMPJUTA_BLIT_BLEND) {
+		return false;
+	}
+	if (width == 0 || height == 0) {
+		return true;
+	}
+
+	blitter_surface destination;
+	uint64_t        destination_span;
+	if (!find_blit_surface(&destination, registers[BLIT_DESTINATION / 8], registers[BLIT_DESTINATION_STRIDE / 8], registers[BLIT_DESTINATION_FORMAT / 8],
+	                       width, height, &destination_span)) {
+		return false;
+	}
+	// rows of the destination that overlap each other have no order to be written in
+	if (height > 1 && destination.stride < width * blitter_pixel_size(destination.format)) {
+		return false;
+	}
+
+	blitter_surface source;
+	uint64_t        source_span;
+	if (operation != KOMPJUTA_BLIT_FILL &&
+	    !find_blit_surface(&source, registers[BLIT_SOURCE / 8], registers[BLIT_SOURCE_STRIDE / 8], registers[BLIT_SOURCE_FORMAT / 8], width, height, &source_span)) {
+		return false;
+	}
+
+	prepare_device_store(registers[BLIT_DESTINATION / 8], destination_span);
+	switch (operation) {
+	case KOMPJUTA_BLIT_FILL:
+		blitter_fill(&destination, (uint32_t)width, (uint32_t)height, color);
+		break;
+	case KOMPJUTA_BLIT_COPY:
+		blitter_copy(&destination, &source, (uint32_t)width, (uint32_t)height, color);
+		break;
+	case KOMPJUTA_BLIT_BLEND:
+		blitter_blend(&destination, &source, (uint32_t)width, (uint32_t)height, color);
+		break;
+	}
+	return true;
+}
+
+static uint64_t blitter_read(void *data, uint64_t offset, uint32_t size) {
+	return offset / 8 < BLITTER_REGISTER_COUNT ? blitter_registers[current_hart->id][offset / 8] : 0;
+}
+
+static void blitter_write(void *data, uint64_t offset, uint64_t value, uint32_t size) {
+	uint64_t *registers = blitter_registers[current_hart->id];
+	if (offset % 8 != 0 || offset > BLIT_START) { // the counters are read-only
+		return;
+	}
+
+	registers[offset / 8] = value;
+	if (offset != BLIT_START) {
+		return;
+	}
+
+	if (run_blit(registers)) {
+		++registers[BLIT_COMPLETED / 8];
 	}
 	else {
-		uint64_t *target = (uint64_t *)&ram[address];
-		*target          = value;
+		++registers[BLIT_FAILED / 8];
+		if (!atomic_exchange(&blit_warning_logged, true)) {
+			kore_log(KORE_LOG_LEVEL_WARNING, "Dropped a blit with invalid parameters or memory outside of RAM.");
+		}
+	}
+}
+
+// The block device at BLOCK_BASE, the image and the transfers are block_device's.
+
+static _Atomic uint64_t block_queue_address;
+static _Atomic uint64_t block_queue_size;
+static _Atomic uint64_t block_queue_tail;
+
+static bool block_queue_valid(uint64_t size) {
+	return size != 0 && (size & (size - 1)) == 0 && size <= BLOCK_QUEUE_MAX_SIZE;
+}
+
+// The image may only be mapped over pages of the RAM reservation itself that nothing watches,
+// code and framebuffer pages need their stores seen.
+static bool block_destination_mappable(uint64_t address, uint64_t size) {
+	if (address + size > memory_size) {
+		return false;
+	}
+	for (uint64_t page = address >> MEMORY_PAGE_SHIFT; page <= (address + size - 1) >> MEMORY_PAGE_SHIFT; ++page) {
+		if ((page_flags[page] & (PAGE_FLAG_ALIAS | PAGE_FLAG_WATCH | PAGE_FLAG_CODE)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The requests between the old and the new tail are checked against RAM here, on the hart
+// that rings, and go to block_device as host memory. Their pages are prepared before the
+// transfers write them, the guest does not look at them before the head passed anyway.
+static void ring_block_doorbell(uint64_t tail) {
+	uint64_t address  = atomic_load_explicit(&block_queue_address, memory_order_relaxed);
+	uint64_t size     = atomic_load_explicit(&block_queue_size, memory_order_relaxed);
+	uint64_t old_tail = atomic_load_explicit(&block_queue_tail, memory_order_relaxed);
+	uint64_t head     = block_device_completed();
+	uint8_t *queue    = block_queue_valid(size) ? ram_range(address, size * sizeof(kompjuta_block_request)) : NULL;
+	if (queue == NULL || tail - old_tail > size || tail - head > size) {
+		access_fault(EXCEPTION_STORE_ACCESS_FAULT, address, "Block queue");
+		return;
+	}
+
+	for (uint64_t position = old_tail; position != tail; ++position) {
+		uint64_t               slot = (position & (size - 1)) * sizeof(kompjuta_block_request);
+		kompjuta_block_request request;
+		memcpy(&request, &queue[slot], sizeof(request));
+
+		block_transfer transfer = {
+		    .sector       = request.sector,
+		    .sector_count = request.sector_count,
+		    .status       = &queue[slot + offsetof(kompjuta_block_request, status)],
+		};
+		prepare_device_store(address + slot + offsetof(kompjuta_block_request, status), sizeof(request.status));
+
+		uint64_t bytes = (uint64_t)request.sector_count * BLOCK_SECTOR_SIZE;
+		if (bytes != 0) {
+			transfer.destination = ram_range(request.address, bytes);
+			if (transfer.destination != NULL) {
+				// before preparing, which clears the flags
+				transfer.mappable = block_destination_mappable(request.address, bytes);
+				prepare_device_store(request.address, bytes);
+			}
+		}
+
+		block_device_submit(&transfer);
+	}
+
+	atomic_store_explicit(&block_queue_tail, tail, memory_order_relaxed);
+}
+
+static uint64_t block_device_read(void *data, uint64_t offset, uint32_t size) {
+	switch (offset) {
+	case BLOCK_SECTOR_COUNT:
+		return block_device_sector_count();
+	case BLOCK_QUEUE_HEAD:
+		return block_device_completed();
+	}
+	return 0;
+}
+
+static void block_device_write(void *data, uint64_t offset, uint64_t value, uint32_t size) {
+	switch (offset) {
+	case BLOCK_QUEUE_ADDR:
+		atomic_store_explicit(&block_queue_address, value, memory_order_relaxed);
+		break;
+	case BLOCK_QUEUE_SIZE:
+		atomic_store_explicit(&block_queue_size, value, memory_order_relaxed);
+		break;
+	case BLOCK_QUEUE_TAIL:
+		ring_block_doorbell(value);
+		break;
 	}
 }
 
 static void increment_pc(void) {
-	pc += 4;
+	current_hart->pc += 4;
 }
 
 static void execute_opcode(void) {
-	uint32_t instruction = *(uint32_t *)&ram[pc];
+	uint32_t instruction = *(uint32_t *)&ram[current_hart->pc];
 	uint8_t  opcode      = instruction & 0x7f;
 	opcodes[opcode](instruction);
 }
@@ -176,6 +752,109 @@ static uint64_t sign_extend64(uint64_t value, int bits) {
 	return (value ^ mask) - mask;
 }
 
+uint64_t multiply_high_unsigned(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+	return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	return __umulh(a, b);
+#else
+	uint64_t a_low  = a & 0xffffffff;
+	uint64_t a_high = a >> 32;
+	uint64_t b_low  = b & 0xffffffff;
+	uint64_t b_high = b >> 32;
+
+	uint64_t low    = a_low * b_low;
+	uint64_t middle = a_high * b_low + (low >> 32);
+	uint64_t carry  = a_low * b_high + (middle & 0xffffffff);
+	return a_high * b_high + (middle >> 32) + (carry >> 32);
+#endif
+}
+
+uint64_t multiply_high_signed(uint64_t a, uint64_t b) {
+	uint64_t result = multiply_high_unsigned(a, b);
+	if ((int64_t)a < 0) {
+		result -= b;
+	}
+	if ((int64_t)b < 0) {
+		result -= a;
+	}
+	return result;
+}
+
+uint64_t multiply_high_signed_unsigned(uint64_t a, uint64_t b) {
+	uint64_t result = multiply_high_unsigned(a, b);
+	if ((int64_t)a < 0) {
+		result -= b;
+	}
+	return result;
+}
+
+// Division by zero and signed overflow do not trap, they produce the results defined by the M extension.
+
+uint64_t divide_signed(uint64_t a, uint64_t b) {
+	if (b == 0) {
+		return ~0ull;
+	}
+	if ((int64_t)a == INT64_MIN && (int64_t)b == -1) {
+		return a;
+	}
+	return (uint64_t)((int64_t)a / (int64_t)b);
+}
+
+uint64_t divide_unsigned(uint64_t a, uint64_t b) {
+	return b == 0 ? ~0ull : a / b;
+}
+
+uint64_t remainder_signed(uint64_t a, uint64_t b) {
+	if (b == 0) {
+		return a;
+	}
+	if ((int64_t)a == INT64_MIN && (int64_t)b == -1) {
+		return 0;
+	}
+	return (uint64_t)((int64_t)a % (int64_t)b);
+}
+
+uint64_t remainder_unsigned(uint64_t a, uint64_t b) {
+	return b == 0 ? a : a % b;
+}
+
+uint64_t divide_signed_word(uint64_t a, uint64_t b) {
+	int32_t dividend = (int32_t)a;
+	int32_t divisor  = (int32_t)b;
+	if (divisor == 0) {
+		return ~0ull;
+	}
+	if (dividend == INT32_MIN && divisor == -1) {
+		return (int64_t)dividend;
+	}
+	return (int64_t)(dividend / divisor);
+}
+
+uint64_t divide_unsigned_word(uint64_t a, uint64_t b) {
+	uint32_t dividend = (uint32_t)a;
+	uint32_t divisor  = (uint32_t)b;
+	return divisor == 0 ? ~0ull : (int64_t)(int32_t)(dividend / divisor);
+}
+
+uint64_t remainder_signed_word(uint64_t a, uint64_t b) {
+	int32_t dividend = (int32_t)a;
+	int32_t divisor  = (int32_t)b;
+	if (divisor == 0) {
+		return (int64_t)dividend;
+	}
+	if (dividend == INT32_MIN && divisor == -1) {
+		return 0;
+	}
+	return (int64_t)(dividend % divisor);
+}
+
+uint64_t remainder_unsigned_word(uint64_t a, uint64_t b) {
+	uint32_t dividend = (uint32_t)a;
+	uint32_t divisor  = (uint32_t)b;
+	return (int64_t)(int32_t)(divisor == 0 ? dividend : dividend % divisor);
+}
+
 static void opcode_nop(uint32_t instruction) {
 	increment_pc();
 }
@@ -184,7 +863,7 @@ static void opcode_lui(uint32_t instruction) {
 	uint32_t immediate = instruction >> 12u;
 	uint8_t  rd        = (instruction >> 7) & 0x1f;
 
-	x[rd] = sign_extend64(immediate << 12u, 32);
+	current_hart->x[rd] = sign_extend64(immediate << 12u, 32);
 
 	increment_pc();
 }
@@ -193,7 +872,7 @@ static void opcode_auipc(uint32_t instruction) {
 	uint32_t immediate = instruction >> 12u;
 	uint8_t  rd        = (instruction >> 7) & 0x1f;
 
-	x[rd] = pc + sign_extend64(immediate << 12u, 32);
+	current_hart->x[rd] = current_hart->pc + sign_extend64(immediate << 12u, 32);
 
 	increment_pc();
 }
@@ -207,41 +886,41 @@ static void opcode_addi_slti_sltiu_xori_ori_andi_slli_srli_srai(uint32_t instruc
 	uint8_t command = (instruction >> 12) & 0x7;
 	switch (command) {
 	case 0x0: // addi
-		x[rd] = x[rs1] + sign_extend64(immediate, 12);
+		current_hart->x[rd] = current_hart->x[rs1] + sign_extend64(immediate, 12);
 		break;
 	case 0x2: { // slti
 		uint64_t immediate_value = sign_extend64(immediate, 12);
 
-		int64_t rs1_value = *(int64_t *)&x[rs1];
+		int64_t rs1_value = *(int64_t *)&current_hart->x[rs1];
 		int64_t rs2_value = *(int64_t *)&immediate_value;
 
-		x[rd] = (rs1_value < rs2_value) ? 1 : 0;
+		current_hart->x[rd] = (rs1_value < rs2_value) ? 1 : 0;
 		break;
 	}
 	case 0x3: // sltiu
-		x[rd] = (x[rs1] < sign_extend64(immediate, 12)) ? 1 : 0;
+		current_hart->x[rd] = (current_hart->x[rs1] < sign_extend64(immediate, 12)) ? 1 : 0;
 		break;
 	case 0x4: // xori
-		x[rd] = x[rs1] ^ sign_extend64(immediate, 12);
+		current_hart->x[rd] = current_hart->x[rs1] ^ sign_extend64(immediate, 12);
 		break;
 	case 0x6: // ori
-		x[rd] = x[rs1] | sign_extend64(immediate, 12);
+		current_hart->x[rd] = current_hart->x[rs1] | sign_extend64(immediate, 12);
 		break;
 	case 0x7: // andi
-		x[rd] = x[rs1] & sign_extend64(immediate, 12);
+		current_hart->x[rd] = current_hart->x[rs1] & sign_extend64(immediate, 12);
 		break;
 	case 0x1: // slli
-		x[rd] = x[rs1] << shamt;
+		current_hart->x[rd] = current_hart->x[rs1] << shamt;
 		break;
 	case 0x5: { // srli_srai
 		uint8_t upper = instruction >> 26;
 		switch (upper) {
 		case 0x00: // srli
-			x[rd] = x[rs1] >> shamt;
+			current_hart->x[rd] = current_hart->x[rs1] >> shamt;
 			break;
 		case 0x10: { // srai
-			int64_t rs1_value = *(int64_t *)&x[rs1];
-			x[rd]             = rs1_value >> shamt;
+			int64_t rs1_value   = *(int64_t *)&current_hart->x[rs1];
+			current_hart->x[rd] = rs1_value >> shamt;
 			break;
 		}
 		default:
@@ -263,42 +942,43 @@ static void opcode_lb_lh_lw_lbu_lhu_lwu_ld(uint32_t instruction) {
 	uint8_t  rd     = (instruction >> 7) & 0x1f;
 	uint16_t offset = instruction >> 20;
 
-	uint8_t command = (instruction >> 12) & 0x7;
+	uint8_t  command  = (instruction >> 12) & 0x7;
+	uint64_t previous = current_hart->x[rd];
 
 	switch (command) {
 	case 0x0: { // lb
-		uint8_t value = read_memory8(x[rs1] + sign_extend64(offset, 12));
-		x[rd]         = sign_extend64(value, 8);
+		uint8_t value       = read_memory8(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = sign_extend64(value, 8);
 		break;
 	}
 	case 0x1: { // lh
-		uint16_t value = read_memory16(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = sign_extend64(value, 16);
+		uint16_t value      = read_memory16(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = sign_extend64(value, 16);
 		break;
 	}
 	case 0x2: { // lw
-		uint32_t value = read_memory32(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = sign_extend64(value, 32);
+		uint32_t value      = read_memory32(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = sign_extend64(value, 32);
 		break;
 	}
 	case 0x4: { // lbu
-		uint64_t value = read_memory8(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = value & 0xff;
+		uint64_t value      = read_memory8(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = value & 0xff;
 		break;
 	}
 	case 0x5: { // lhu
-		uint64_t value = read_memory16(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = value & 0xffff;
+		uint64_t value      = read_memory16(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = value & 0xffff;
 		break;
 	}
 	case 0x6: { // lwu
-		uint64_t value = read_memory32(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = value & 0xffffffff;
+		uint64_t value      = read_memory32(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = value & 0xffffffff;
 		break;
 	}
 	case 0x3: { // ld
-		uint64_t value = read_memory64(x[rs1] + sign_extend64(offset, 12));
-		x[rd]          = value;
+		uint64_t value      = read_memory64(current_hart->x[rs1] + sign_extend64(offset, 12));
+		current_hart->x[rd] = value;
 		break;
 	}
 	default:
@@ -306,17 +986,51 @@ static void opcode_lb_lh_lw_lbu_lhu_lwu_ld(uint32_t instruction) {
 		break;
 	}
 
+	// a load that faulted leaves rd alone
+	if (current_hart->leave_block) {
+		current_hart->x[rd] = previous;
+	}
+
 	increment_pc();
 }
 
-static void opcode_addiw(uint32_t instruction) {
+static void opcode_addiw_slliw_srliw_sraiw(uint32_t instruction) {
 	uint8_t  rs1       = (instruction >> 15) & 0x1f;
 	uint8_t  rd        = (instruction >> 7) & 0x1f;
 	uint16_t immediate = instruction >> 20u;
+	uint32_t shamt     = (instruction >> 20) & 0x1f;
+
+	uint32_t rs1_value = (uint32_t)current_hart->x[rs1];
 
-	uint32_t rs1_value = (uint32_t)x[rs1];
-	uint32_t result    = rs1_value + sign_extend32(immediate, 12);
-	x[rd]              = sign_extend64(result, 32);
+	uint8_t command = (instruction >> 12) & 0x7;
+	switch (command) {
+	case 0x0: { // addiw
+		uint32_t result     = rs1_value + sign_extend32(immediate, 12);
+		current_hart->x[rd] = sign_extend64(result, 32);
+		break;
+	}
+	case 0x1: // slliw
+		current_hart->x[rd] = sign_extend64(rs1_value << shamt, 32);
+		break;
+	case 0x5: { // srliw_sraiw
+		uint8_t upper = instruction >> 25;
+		switch (upper) {
+		case 0x00: // srliw
+			current_hart->x[rd] = sign_extend64(rs1_value >> shamt, 32);
+			break;
+		case 0x20: // sraiw
+			current_hart->x[rd] = (int64_t)((int32_t)rs1_value >> shamt);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		break;
+	}
+	default:
+		assert(false);
+		break;
+	}
 
 	increment_pc();
 }
@@ -333,16 +1047,16 @@ static void opcode_sb_sh_sw_sd(uint32_t instruction) {
 
 	switch (command) {
 	case 0x0: // sb
-		store_memory8(x[rs1] + sign_extend64(immediate, 12), *(uint8_t *)&x[rs2]);
+		store_memory8(current_hart->x[rs1] + sign_extend64(immediate, 12), *(uint8_t *)&current_hart->x[rs2]);
 		break;
 	case 0x1: // sh
-		store_memory16(x[rs1] + sign_extend64(immediate, 12), *(uint16_t *)&x[rs2]);
+		store_memory16(current_hart->x[rs1] + sign_extend64(immediate, 12), *(uint16_t *)&current_hart->x[rs2]);
 		break;
 	case 0x2: // sw
-		store_memory32(x[rs1] + sign_extend64(immediate, 12), *(uint32_t *)&x[rs2]);
+		store_memory32(current_hart->x[rs1] + sign_extend64(immediate, 12), *(uint32_t *)&current_hart->x[rs2]);
 		break;
 	case 0x3: // sd
-		store_memory64(x[rs1] + sign_extend64(immediate, 12), x[rs2]);
+		store_memory64(current_hart->x[rs1] + sign_extend64(immediate, 12), current_hart->x[rs2]);
 		break;
 	default:
 		assert(false);
@@ -356,14 +1070,14 @@ static void opcode_jal(uint32_t instruction) {
 	uint8_t rd = (instruction >> 7) & 0x1f;
 
 	if (rd != 0) {
-		x[rd] = pc + 4;
+		current_hart->x[rd] = current_hart->pc + 4;
 	}
 
 	uint32_t immediate =
 	    ((instruction >> 31) & 0x1) << 20 | ((instruction >> 21) & 0x3ff) << 1 | ((instruction >> 20) & 0x1) << 11 | ((instruction >> 12) & 0xff) << 12;
 
-	pc += sign_extend64(immediate, 21);
-	assert(pc != 0);
+	current_hart->pc += sign_extend64(immediate, 21);
+	assert(current_hart->pc != 0);
 }
 
 static void opcode_jalr(uint32_t instruction) {
@@ -371,13 +1085,13 @@ static void opcode_jalr(uint32_t instruction) {
 	uint8_t  rd        = (instruction >> 7) & 0x1f;
 	uint16_t immediate = (instruction >> 20) & 0xfff;
 
-	uint64_t t      = pc + 4;
-	uint64_t nextpc = (x[rs1] + sign_extend64(immediate, 12)) & ~1;
+	uint64_t t      = current_hart->pc + 4;
+	uint64_t nextpc = (current_hart->x[rs1] + sign_extend64(immediate, 12)) & ~1;
 	assert(nextpc != 0);
-	pc = nextpc;
+	current_hart->pc = nextpc;
 
 	if (rd != 0) {
-		x[rd] = t;
+		current_hart->x[rd] = t;
 	}
 }
 
@@ -390,28 +1104,28 @@ static void opcode_beq_bne_blt_bge_bltu_bgeu(uint32_t instruction) {
 	bool branch = false;
 	switch (command) {
 	case 0x0: // beq
-		branch = x[rs1] == x[rs2];
+		branch = current_hart->x[rs1] == current_hart->x[rs2];
 		break;
 	case 0x1: // bne
-		branch = x[rs1] != x[rs2];
+		branch = current_hart->x[rs1] != current_hart->x[rs2];
 		break;
 	case 0x4: { // blt
-		int64_t rs1_value = *(int64_t *)&x[rs1];
-		int64_t rs2_value = *(int64_t *)&x[rs2];
+		int64_t rs1_value = *(int64_t *)&current_hart->x[rs1];
+		int64_t rs2_value = *(int64_t *)&current_hart->x[rs2];
 		branch            = rs1_value < rs2_value;
 		break;
 	}
 	case 0x5: { // bge
-		int64_t rs1_value = *(int64_t *)&x[rs1];
-		int64_t rs2_value = *(int64_t *)&x[rs2];
+		int64_t rs1_value = *(int64_t *)&current_hart->x[rs1];
+		int64_t rs2_value = *(int64_t *)&current_hart->x[rs2];
 		branch            = rs1_value >= rs2_value;
 		break;
 	}
 	case 0x6: // bltu
-		branch = x[rs1] < x[rs2];
+		branch = current_hart->x[rs1] < current_hart->x[rs2];
 		break;
 	case 0x7: // bgeu
-		branch = x[rs1] >= x[rs2];
+		branch = current_hart->x[rs1] >= current_hart->x[rs2];
 		break;
 	default:
 		assert(false);
@@ -421,8 +1135,8 @@ static void opcode_beq_bne_blt_bge_bltu_bgeu(uint32_t instruction) {
 	if (branch) {
 		uint32_t immediate =
 		    (((instruction >> 31) & 0x1) << 12) | (((instruction >> 25) & 0x3f) << 5) | (((instruction >> 8) & 0xf) << 1) | (((instruction >> 7) & 0x1) << 11);
-		pc += sign_extend64(immediate, 13);
-		assert(pc != 0);
+		current_hart->pc += sign_extend64(immediate, 13);
+		assert(current_hart->pc != 0);
 	}
 	else {
 		increment_pc();
@@ -442,17 +1156,14 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 		case 0x0: { // add_sub
 			switch (upper) {
 			case 0x00: // add
-				x[rd] = x[rs1] + x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] + current_hart->x[rs2];
 				break;
 			case 0x20: // sub
-				x[rd] = x[rs1] - x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] - current_hart->x[rs2];
 				break;
-			case 0x01: { // mul
-				int64_t rs1_value = *(int64_t *)&x[rs1];
-				int64_t rs2_value = *(int64_t *)&x[rs2];
-				x[rd]             = rs1_value * rs2_value;
+			case 0x01: // mul
+				current_hart->x[rd] = current_hart->x[rs1] * current_hart->x[rs2];
 				break;
-			}
 			default:
 				assert(false);
 				break;
@@ -462,10 +1173,10 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 		case 0x1: // sll_mulh
 			switch (upper) {
 			case 0x00: // sll
-				x[rd] = x[rs1] << x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] << (current_hart->x[rs2] & 0x3f);
 				break;
 			case 0x01: // mulh
-				assert(false);
+				current_hart->x[rd] = multiply_high_signed(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			default:
 				assert(false);
@@ -473,14 +1184,14 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 			}
 			break;
 		case 0x2: { // slt_mulhsu
-			int64_t rs1_value = *(int64_t *)&x[rs1];
-			int64_t rs2_value = *(int64_t *)&x[rs2];
+			int64_t rs1_value = *(int64_t *)&current_hart->x[rs1];
+			int64_t rs2_value = *(int64_t *)&current_hart->x[rs2];
 			switch (upper) {
 			case 0x00: // slt
-				x[rd] = (rs1_value < rs2_value) ? 1u : 0u;
+				current_hart->x[rd] = (rs1_value < rs2_value) ? 1u : 0u;
 				break;
 			case 0x01: // mulhsu
-				assert(false);
+				current_hart->x[rd] = multiply_high_signed_unsigned(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			}
 			break;
@@ -488,39 +1199,39 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 		case 0x3: // sltu_mulhu
 			switch (upper) {
 			case 0x00: // sltu
-				x[rd] = (x[rs1] < x[rs2]) ? 1u : 0u;
+				current_hart->x[rd] = (current_hart->x[rs1] < current_hart->x[rs2]) ? 1u : 0u;
 				break;
 			case 0x01: // mulhu
-				assert(false);
+				current_hart->x[rd] = multiply_high_unsigned(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			}
 			break;
 		case 0x4: // xor_div
 			switch (upper) {
 			case 0x00: // xor
-				x[rd] = x[rs1] ^ x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] ^ current_hart->x[rs2];
 				break;
 			case 0x01: // div
-				assert(false);
+				current_hart->x[rd] = divide_signed(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			}
 			break;
 		case 0x5: { // srl_sra_divu
 			uint8_t upper = (instruction >> 25) & 0x7f;
 
-			uint8_t rs2_value = x[rs2] & 0x1f;
+			uint8_t rs2_value = current_hart->x[rs2] & 0x3f;
 
 			switch (upper) {
 			case 0x00: // srl
-				x[rd] = x[rs1] >> rs2_value;
+				current_hart->x[rd] = current_hart->x[rs1] >> rs2_value;
 				break;
 			case 0x01: // divu
-				x[rd] = x[rs1] / x[rs2];
+				current_hart->x[rd] = divide_unsigned(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			case 0x20: { // sra
-				int64_t rs1_value = *(int64_t *)&x[rs1];
-				int64_t result    = rs1_value >> rs2_value;
-				x[rd]             = *(uint64_t *)&result;
+				int64_t rs1_value   = *(int64_t *)&current_hart->x[rs1];
+				int64_t result      = rs1_value >> rs2_value;
+				current_hart->x[rd] = *(uint64_t *)&result;
 				break;
 			default:
 				assert(false);
@@ -532,20 +1243,20 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 		case 0x6: // or_rem
 			switch (upper) {
 			case 0x00: // or
-				x[rd] = x[rs1] | x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] | current_hart->x[rs2];
 				break;
 			case 0x01: // rem
-				assert(false);
+				current_hart->x[rd] = remainder_signed(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			}
 			break;
 		case 0x7: // and_remu
 			switch (upper) {
 			case 0x00: // and
-				x[rd] = x[rs1] & x[rs2];
+				current_hart->x[rd] = current_hart->x[rs1] & current_hart->x[rs2];
 				break;
 			case 0x01: // remu
-				assert(false);
+				current_hart->x[rd] = remainder_unsigned(current_hart->x[rs1], current_hart->x[rs2]);
 				break;
 			}
 			break;
@@ -558,7 +1269,7 @@ static void opcode_add_sub_sll_slt_sltu_xor_srl_sra_or_and_mul_mulh_mulhsu_mulhu
 	increment_pc();
 }
 
-static void opcode_addw_subw_sllw_srlw_sraw(uint32_t instruction) {
+static void opcode_addw_subw_sllw_srlw_sraw_mulw_divw_divuw_remw_remuw(uint32_t instruction) {
 	uint8_t middle = (instruction >> 12) & 0x7;
 
 	uint8_t rs1 = (instruction >> 15) & 0x1f;
@@ -572,36 +1283,47 @@ static void opcode_addw_subw_sllw_srlw_sraw(uint32_t instruction) {
 
 			switch (upper) {
 			case 0x00: // addw
-				x[rd] = sign_extend64((x[rs1] + x[rs2]) & 0xffffffff, 32);
+				current_hart->x[rd] = sign_extend64((current_hart->x[rs1] + current_hart->x[rs2]) & 0xffffffff, 32);
+				break;
+			case 0x20: // subw
+				current_hart->x[rd] = sign_extend64((current_hart->x[rs1] - current_hart->x[rs2]) & 0xffffffff, 32);
 				break;
-			case 0x30: // subw
-				x[rd] = sign_extend64((x[rs1] - x[rs2]) & 0xffffffff, 32);
+			case 0x01: // mulw
+				current_hart->x[rd] = sign_extend64((current_hart->x[rs1] * current_hart->x[rs2]) & 0xffffffff, 32);
 				break;
 			}
 			break;
 		}
 		case 0x1: // sllw
-			x[rd] = sign_extend64((x[rs1] << (x[rs2] & 0x1f)) & 0xffffffff, 32);
+			current_hart->x[rd] = sign_extend64((current_hart->x[rs1] << (current_hart->x[rs2] & 0x1f)) & 0xffffffff, 32);
 			break;
-		case 0x5: { // srlw_sraw
+		case 0x4: // divw
+			current_hart->x[rd] = divide_signed_word(current_hart->x[rs1], current_hart->x[rs2]);
+			break;
+		case 0x5: { // srlw_sraw_divuw
 			uint8_t upper = (instruction >> 25) & 0x7f;
 
-			uint8_t rs2_value = x[rs2] & 0x1f;
+			uint8_t rs2_value = current_hart->x[rs2] & 0x1f;
 
 			switch (upper) {
 			case 0x0: // srlw
-				x[rd] = sign_extend64((x[rs1] & 0xffffffff) >> rs2_value, 32);
+				current_hart->x[rd] = sign_extend64((current_hart->x[rs1] & 0xffffffff) >> rs2_value, 32);
 				break;
-			case 0x20: { // sraw
-				uint64_t reg1      = x[rs1] & 0xffffffff;
-				int32_t  rs1_value = *(int32_t *)&reg1;
-				int32_t  result    = rs1_value >> rs2_value;
-				x[rd]              = sign_extend64(result, 32);
+			case 0x01: // divuw
+				current_hart->x[rd] = divide_unsigned_word(current_hart->x[rs1], current_hart->x[rs2]);
+				break;
+			case 0x20: // sraw
+				current_hart->x[rd] = (int64_t)((int32_t)current_hart->x[rs1] >> rs2_value);
 				break;
-			}
 			}
 			break;
 		}
+		case 0x6: // remw
+			current_hart->x[rd] = remainder_signed_word(current_hart->x[rs1], current_hart->x[rs2]);
+			break;
+		case 0x7: // remuw
+			current_hart->x[rd] = remainder_unsigned_word(current_hart->x[rs1], current_hart->x[rs2]);
+			break;
 		default:
 			assert(false);
 			break;
@@ -611,18 +1333,34 @@ static void opcode_addw_subw_sllw_srlw_sraw(uint32_t instruction) {
 	increment_pc();
 }
 
-static void opcode_flw(uint32_t instruction) {
+static void opcode_flw_fld(uint32_t instruction) {
 	uint8_t  rs1    = (instruction >> 15) & 0x1f;
 	uint8_t  rd     = (instruction >> 7) & 0x1f;
 	uint16_t offset = instruction >> 20;
 	uint8_t  middle = (instruction >> 12) & 0x7;
 
 	switch (middle) {
+	case 0x0:
+	case 0x5:
+	case 0x6:
+	case 0x7: // vl<eew>, vlse<eew>, vl[uo]xei<eew>, vlseg, vl<eew>ff, vl<nf>re<eew>, vlm
+		if (!vector_load(current_hart, instruction)) {
+			enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+			return;
+		}
+		break;
 	case 0x2: { // flw
-		uint32_t memory_value = read_memory32(x[rs1] + sign_extend64(offset, 12));
-		float    float_value;
-		memcpy(&float_value, &memory_value, sizeof(uint32_t));
-		f[rd] = (double)float_value;
+		uint64_t value = float_box(read_memory32(current_hart->x[rs1] + sign_extend64(offset, 12)));
+		if (!current_hart->leave_block) {
+			current_hart->f[rd] = value;
+		}
+		break;
+	}
+	case 0x3: { // fld
+		uint64_t value = read_memory64(current_hart->x[rs1] + sign_extend64(offset, 12));
+		if (!current_hart->leave_block) {
+			current_hart->f[rd] = value;
+		}
 		break;
 	}
 	default:
@@ -633,7 +1371,7 @@ static void opcode_flw(uint32_t instruction) {
 	increment_pc();
 }
 
-static void opcode_fsw(uint32_t instruction) {
+static void opcode_fsw_fsd(uint32_t instruction) {
 	uint8_t middle = (instruction >> 12) & 0x7;
 
 	uint8_t  offset0 = (instruction >> 7) & 0x1f;
@@ -647,456 +1385,484 @@ static void opcode_fsw(uint32_t instruction) {
 	case 0x0:
 	case 0x5:
 	case 0x6:
-	case 0x7: { // vs<eew>_vs<nf>r
-		uint8_t funct = (instruction >> 20) & 0x1f;
-		switch (funct) {
-		case 0x0: { // vs<eew>
-			uint8_t vs3 = offset0;
-
-			uint8_t mask = (instruction >> 25) & 0x1;
-			assert(mask == 0x1);
-
-			uint8_t width = (instruction >> 12) & 0x7;
-			switch (width) {
-			case 0x0: // 8 bit
-				assert(false);
-				break;
-			case 0x5: // 16 bit
-				assert(false);
-				break;
-			case 0x6: { // 32 bit
-				assert(sew == 32);
-
-				uint64_t base = x[rs1];
+	case 0x7: // vs<eew>, vsse<eew>, vs[uo]xei<eew>, vsseg, vs<nf>r, vsm
+		if (!vector_store(current_hart, instruction)) {
+			enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+			return;
+		}
+		break;
+	case 0x2: // fsw
+		store_memory32(current_hart->x[rs1] + sign_extend64(offset, 12), (uint32_t)current_hart->f[rs2]);
+		break;
+	case 0x3: // fsd
+		store_memory64(current_hart->x[rs1] + sign_extend64(offset, 12), current_hart->f[rs2]);
+		break;
+	default:
+		assert(false);
+		break;
+	}
 
-				for (uint16_t i = 0; i < vl; ++i) {
-					*(uint32_t *)(&ram[base + 4 * i]) = v[vs3].values.u32[i];
-				}
+	increment_pc();
+}
 
-				break;
-			}
-			case 0x7: // 64 bit
-				assert(sew == 64);
+// The A extension. Atomics go straight to host atomics on guest RAM, so they are atomic against
+// the other harts as well, and every one of them is sequentially consistent whatever its aq and
+// rl bits say. SC succeeds while the value LR loaded is still in memory, a store of the same
+// value in between goes unnoticed.
+
+#define ATOMIC_MEMORY_OPERATION(name, type, signed_type)                          \
+	static type name(uint8_t operation, _Atomic type *memory, type operand) {     \
+		switch (operation) {                                                      \
+		case 0x00: /* amoadd */                                                   \
+			return atomic_fetch_add(memory, operand);                             \
+		case 0x01: /* amoswap */                                                  \
+			return atomic_exchange(memory, operand);                              \
+		case 0x04: /* amoxor */                                                   \
+			return atomic_fetch_xor(memory, operand);                             \
+		case 0x08: /* amoor */                                                    \
+			return atomic_fetch_or(memory, operand);                              \
+		case 0x0c: /* amoand */                                                   \
+			return atomic_fetch_and(memory, operand);                             \
+		}                                                                         \
+                                                                                  \
+		type old = atomic_load(memory);                                           \
+		type result;                                                              \
+		do {                                                                      \
+			switch (operation) {                                                  \
+			case 0x10: /* amomin */                                               \
+				result = (signed_type)old < (signed_type)operand ? old : operand; \
+				break;                                                            \
+			case 0x14: /* amomax */                                               \
+				result = (signed_type)old > (signed_type)operand ? old : operand; \
+				break;                                                            \
+			case 0x18: /* amominu */                                              \
+				result = old < operand ? old : operand;                           \
+				break;                                                            \
+			case 0x1c: /* amomaxu */                                              \
+				result = old > operand ? old : operand;                           \
+				break;                                                            \
+			default:                                                              \
+				assert(false);                                                    \
+				return old;                                                       \
+			}                                                                     \
+		} while (!atomic_compare_exchange_weak(memory, &old, result));            \
+		return old;                                                               \
+	}
 
-				uint64_t base = x[rs1];
+ATOMIC_MEMORY_OPERATION(atomic_memory_operation32, uint32_t, int32_t)
+ATOMIC_MEMORY_OPERATION(atomic_memory_operation64, uint64_t, int64_t)
 
-				for (uint16_t i = 0; i < vl; ++i) {
-					*(uint64_t *)(&ram[base + 8 * i]) = v[vs3].values.u64[i];
-				}
+// Host address of a naturally aligned atomic access to RAM, NULL after a fault. Misaligned
+// atomics raise access faults too, which the ISA allows.
+static uint8_t *atomic_host_address(uint64_t cause, uint64_t address, uint32_t size) {
+	if ((address & (size - 1)) != 0) {
+		access_fault(cause, address, "Misaligned atomic");
+		return NULL;
+	}
 
-				break;
-			}
+	uint8_t *host = tlb_lookup(address, size);
+	if (host != NULL) {
+		return host;
+	}
 
-			break;
-		}
-		case 0x8: { // vs<nf>r
-			assert(middle == 0x0);
+	const memory_region *region = memory_map_find(address);
+	if (region == NULL || region->kind != MEMORY_REGION_RAM || address + size - 1 - region->base >= region->size) {
+		access_fault(cause, address, "Atomic");
+		return NULL;
+	}
+	return tlb_fill(region, address);
+}
 
-			uint8_t nf;
-			switch (instruction >> 29) {
-			case 0x0:
-				nf = 1;
-				break;
-			case 0x1:
-				nf = 2;
-				break;
-			case 0x3:
-				nf = 4;
-				break;
-			case 0x7:
-				nf = 8;
-				break;
-			}
+static void opcode_lr_sc_amoswap_amoadd_amoxor_amoand_amoor_amomin_amomax_amominu_amomaxu(uint32_t instruction) {
+	uint8_t rd        = (instruction >> 7) & 0x1f;
+	uint8_t rs1       = (instruction >> 15) & 0x1f;
+	uint8_t rs2       = (instruction >> 20) & 0x1f;
+	uint8_t width     = (instruction >> 12) & 0x7;
+	uint8_t operation = instruction >> 27;
+
+	assert(width == 0x2 || width == 0x3); // w, d
+	uint32_t size    = width == 0x2 ? 4 : 8;
+	uint64_t address = current_hart->x[rs1];
+	uint64_t operand = current_hart->x[rs2];
+
+	// lr only loads
+	uint8_t *host = atomic_host_address(operation == 0x02 ? EXCEPTION_LOAD_ACCESS_FAULT : EXCEPTION_STORE_ACCESS_FAULT, address, size);
+	if (host == NULL) {
+		// on to the next instruction like the other loads and stores, the trap comes back to it
+		increment_pc();
+		return;
+	}
 
-			uint8_t vs3 = (instruction >> 7) & 0x17;
+	uint64_t result;
+	switch (operation) {
+	case 0x02: // lr
+		result = size == 4 ? atomic_load((_Atomic uint32_t *)host) : atomic_load((_Atomic uint64_t *)host);
 
-			for (uint8_t reg = vs3; reg < vs3 + lmul; ++reg) {
-				memcpy(&ram[rs1 + (reg - vs3)], &v[reg].values.u8[0], 128);
+		current_hart->reservation_valid   = true;
+		current_hart->reservation_address = address;
+		current_hart->reservation_value   = result;
+		break;
+	case 0x03: { // sc
+		bool stored = false;
+		if (current_hart->reservation_valid && current_hart->reservation_address == address) {
+			prepare_store(address, size);
+			if (size == 4) {
+				uint32_t expected = (uint32_t)current_hart->reservation_value;
+				stored            = atomic_compare_exchange_strong((_Atomic uint32_t *)host, &expected, (uint32_t)operand);
+			}
+			else {
+				uint64_t expected = current_hart->reservation_value;
+				stored            = atomic_compare_exchange_strong((_Atomic uint64_t *)host, &expected, operand);
 			}
-
-			break;
-		}
-		default:
-			assert(false);
-			break;
 		}
+		current_hart->reservation_valid = false;
 
-		break;
-	}
-	case 0x2: { // fsw
-		float    float_value = (float)f[rs2];
-		uint32_t value;
-		memcpy(&value, &float_value, sizeof(uint32_t));
-		store_memory32(x[rs1] + sign_extend64(offset, 12), value);
+		result = stored ? 0 : 1;
 		break;
 	}
 	default:
-		assert(false);
+		prepare_store(address, size);
+		if (size == 4) {
+			result = atomic_memory_operation32(operation, (_Atomic uint32_t *)host, (uint32_t)operand);
+		}
+		else {
+			result = atomic_memory_operation64(operation, (_Atomic uint64_t *)host, operand);
+		}
 		break;
 	}
 
+	if (rd != 0) {
+		current_hart->x[rd] = size == 4 ? sign_extend64(result, 32) : result;
+	}
+
 	increment_pc();
 }
 
 static void opcode_fence_fencei(uint32_t instruction) {
+	uint8_t middle = (instruction >> 12) & 0x7;
+	if (middle == 0x1) { // fence.i
+		flush_block_cache();
+	}
+	else { // fence, without looking at which accesses it orders
+		atomic_thread_fence(memory_order_seq_cst);
+	}
+
 	increment_pc();
 }
 
-static void opcode_csrrw_csrrs_csrrc_csrrwi_csrrsi_csrrci_ecall_ebreak_sret_mret_wfi_sfencevma(uint32_t instruction) {
-	uint8_t middle = (instruction >> 12) & 0x7;
+// Machine mode traps. Exceptions end the block of the instruction that raised them,
+// interrupts are taken between blocks.
 
-	switch (middle) {
-	case 0x00: // ecall_ebreak_sret_mret_wfi_sfencevma
-		assert(false);
-		break;
-	case 0x01: // csrrw
-		assert(false);
-		break;
-	case 0x02: { // csrrs
-		uint8_t  rs1 = (instruction >> 15) & 0x1f;
-		uint8_t  rd  = (instruction >> 7) & 0x1f;
-		uint16_t csr = instruction >> 20;
+#define MSTATUS_MIE  0x8ull
+#define MSTATUS_MPIE 0x80ull
+// MPP is machine mode and the floating point and vector state are always dirty, so SD is set
+#define MSTATUS_FIXED ((3ull << 9) | (3ull << 11) | (3ull << 13) | (1ull << 63))
+
+#define INTERRUPT_CHECK_BLOCKS 1024 // between reads of the clock for the timer
+#define WFI_MAX_SLEEP          0.01 // seconds a parked hart sleeps before it looks at the stop flags
+
+static uint64_t pending_interrupts(void) {
+	uint64_t pending = atomic_load_explicit(&current_hart->mip, memory_order_relaxed);
+	if (read_time() >= atomic_load_explicit(&current_hart->mtimecmp, memory_order_relaxed)) {
+		pending |= MIP_MTIP;
+	}
+	return pending;
+}
 
-		assert(csr == 0xc22); // CSR_VLENB
+static void enter_trap(uint64_t cause, uint64_t value) {
+	uint64_t base = current_hart->mtvec & ~3ull;
+	if (base == 0) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "Trap with mcause 0x%llx at 0x%llx before mtvec was set, hart %u is halted.", cause, current_hart->pc, current_hart->id);
+		current_hart->halted      = true;
+		current_hart->leave_block = true;
+		return;
+	}
 
-		const uint64_t csr_vlenb = 128;
+	bool interrupt        = (cause >> 63) != 0;
+	current_hart->mepc    = current_hart->pc;
+	current_hart->mcause  = cause;
+	current_hart->mtval   = value;
+	current_hart->mstatus = (current_hart->mstatus & MSTATUS_MIE) != 0 ? MSTATUS_MPIE : 0;
+	// vectored mode only applies to interrupts
+	current_hart->pc          = interrupt && (current_hart->mtvec & 3) == 1 ? base + 4 * (cause & 0x3f) : base;
+	current_hart->leave_block = true;
+	current_hart->trapped     = true;
+}
 
-		x[rd] = csr_vlenb;
+static void take_interrupt(uint64_t pending) {
+	static const uint32_t priorities[] = {INTERRUPT_EXTERNAL, INTERRUPT_SOFTWARE, INTERRUPT_TIMER};
+	for (uint32_t index = 0; index < sizeof(priorities) / sizeof(priorities[0]); ++index) {
+		if ((pending & (1ull << priorities[index])) != 0) {
+			enter_trap((1ull << 63) | priorities[index], 0);
+			return;
+		}
+	}
+}
 
-		break;
+// Sleeps until the timer could have expired or another thread woke the hart.
+static void park_hart(void) {
+	double seconds = WFI_MAX_SLEEP;
+	if ((current_hart->mie & MIP_MTIP) != 0) {
+		uint64_t time     = read_time();
+		uint64_t mtimecmp = atomic_load_explicit(&current_hart->mtimecmp, memory_order_relaxed);
+		double   until    = mtimecmp > time ? (double)(mtimecmp - time) / TIMEBASE_FREQUENCY : 0.0;
+		seconds           = until < seconds ? until : seconds;
+	}
+	kore_event_try_to_wait(&hart_wakeups[current_hart->id], seconds);
+}
+
+// Before a block while the hart takes interrupts or waits in wfi, returns whether the block
+// can run. Reading the clock costs about as much as a short block, so outside of wfi the
+// timer is only looked at every INTERRUPT_CHECK_BLOCKS blocks.
+static bool check_interrupts(void) {
+	uint64_t pending;
+	if (!current_hart->waiting && current_hart->interrupt_countdown != 0) {
+		--current_hart->interrupt_countdown;
+		pending = atomic_load_explicit(&current_hart->mip, memory_order_relaxed) & current_hart->mie;
+	}
+	else {
+		current_hart->interrupt_countdown = INTERRUPT_CHECK_BLOCKS;
+		pending                           = pending_interrupts() & current_hart->mie;
+	}
+
+	if (pending == 0) {
+		if (current_hart->waiting) {
+			park_hart();
+			return false;
+		}
+		return true;
 	}
-	case 0x03: // csrrc
+
+	// wfi also ends for interrupts that are enabled in mie alone
+	current_hart->waiting = false;
+	if ((current_hart->mstatus & MSTATUS_MIE) != 0) {
+		take_interrupt(pending);
+	}
+	return !current_hart->halted;
+}
+
+// The CSRs read_csr and write_csr know, the ones with the top two address bits set are
+// read-only.
+static bool csr_exists(uint16_t csr) {
+	switch (csr) {
+	case 0x001: // fflags
+	case 0x002: // frm
+	case 0x003: // fcsr
+	case 0xc00: // cycle
+	case 0xc01: // time
+	case 0xc02: // instret
+	case 0xc22: // vlenb
+	case 0xf14: // mhartid
+	case 0x300: // mstatus
+	case 0x304: // mie
+	case 0x305: // mtvec
+	case 0x340: // mscratch
+	case 0x341: // mepc
+	case 0x342: // mcause
+	case 0x343: // mtval
+	case 0x344: // mip
+		return true;
+	default:
+		return csr >= 0xc03 && csr <= 0xc1f; // hpmcounter3 to hpmcounter31
+	}
+}
+
+static uint64_t read_csr(uint16_t csr) {
+	switch (csr) {
+	case 0x001: // fflags
+		float_collect_flags(current_hart);
+		return current_hart->fflags;
+	case 0x002: // frm
+		return current_hart->frm;
+	case 0x003: // fcsr
+		float_collect_flags(current_hart);
+		return (current_hart->frm << 5) | current_hart->fflags;
+	case 0xc00: // cycle, one per instruction
+	case 0xc02: // instret
+		// counted for the whole block up front, which this instruction ends
+		return atomic_load_explicit(&current_hart->executed_instructions, memory_order_relaxed) - 1;
+	case 0xc01: // time
+		return read_time();
+	case 0xc22: // vlenb
+		return 128;
+	case 0xf14: // mhartid
+		return current_hart->id;
+	case 0x300: // mstatus
+		return current_hart->mstatus | MSTATUS_FIXED;
+	case 0x304: // mie
+		return current_hart->mie;
+	case 0x305: // mtvec
+		return current_hart->mtvec;
+	case 0x340: // mscratch
+		return current_hart->mscratch;
+	case 0x341: // mepc
+		return current_hart->mepc;
+	case 0x342: // mcause
+		return current_hart->mcause;
+	case 0x343: // mtval
+		return current_hart->mtval;
+	case 0x344: // mip
+		return pending_interrupts();
+	default:
+		if (csr >= 0xc03 && csr <= 0xc1f) { // hpmcounter3 to hpmcounter31
+			return csr - 0xc03 < HART_EVENT_COUNT ? current_hart->events[csr - 0xc03] : 0;
+		}
 		assert(false);
+		return 0;
+	}
+}
+
+static void write_csr(uint16_t csr, uint64_t value) {
+	switch (csr) {
+	case 0x001: // fflags
+		float_collect_flags(current_hart);
+		current_hart->fflags = value & 0x1f;
 		break;
-	case 0x05: // csrrwi
-		assert(false);
+	case 0x002: // frm
+		current_hart->frm = value & 0x7;
 		break;
-	case 0x06: // csrrsi
-		assert(false);
+	case 0x003: // fcsr
+		float_collect_flags(current_hart);
+		current_hart->fflags = value & 0x1f;
+		current_hart->frm    = (value >> 5) & 0x7;
 		break;
-	case 0x07: // csrrci
-		assert(false);
+	case 0x300: // mstatus
+		current_hart->mstatus             = value & (MSTATUS_MIE | MSTATUS_MPIE);
+		current_hart->interrupt_countdown = 0;
 		break;
-	default:
+	case 0x304: // mie
+		current_hart->mie                 = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP);
+		current_hart->interrupt_countdown = 0;
+		break;
+	case 0x305: // mtvec, direct or vectored
+		current_hart->mtvec = value & ~2ull;
+		break;
+	case 0x340: // mscratch
+		current_hart->mscratch = value;
+		break;
+	case 0x341: // mepc
+		current_hart->mepc = value & ~1ull;
+		break;
+	case 0x342: // mcause
+		current_hart->mcause = value;
+		break;
+	case 0x343: // mtval
+		current_hart->mtval = value;
+		break;
+	case 0x344: // mip, its bits are set by the CLINT and the vsync only
+		break;
+	default: // the counters, vlenb and mhartid are read-only, which the caller checked
 		assert(false);
+		break;
 	}
-
-	increment_pc();
 }
 
-static void opcode_vector(uint32_t instruction) {
-	uint8_t funct3 = (instruction >> 12) & 0x7;
-
-	switch (funct3) {
-	case 0x2: // vmv
-		assert(false);
-		break;
-	case 0x3: { // OPIVI
-		uint8_t funct6 = instruction >> 26;
-		switch (funct6) {
-		case 0x17: { // vmerge_vmv
-			uint8_t vs2  = (instruction >> 20) & 0x1f;
-			uint8_t vd   = (instruction >> 7) & 0x1f;
-			uint8_t imm  = (instruction >> 15) & 0x1f;
-			uint8_t mask = (instruction >> 25) & 0x1;
-
-			switch (sew) {
-			case 8: {
-				uint8_t value = (uint8_t)imm;
-
-				for (uint16_t element = 0; element < vl; ++element) {
-					if (mask == 1 || v0_bit(element)) {
-						v[vd].values.u8[element] = value;
-					}
-					else {
-						v[vd].values.u8[element] = v[vs2].values.u8[element];
-					}
-				}
-				break;
-			}
-			case 32: {
-				uint32_t value = (uint32_t)imm;
-
-				for (uint16_t element = 0; element < vl; ++element) {
-					if (mask == 1 || v0_bit(element)) {
-						v[vd].values.u32[element] = value;
-					}
-					else {
-						v[vd].values.u32[element] = v[vs2].values.u32[element];
-					}
-				}
-				break;
-			}
-			case 64: {
-				uint64_t value = (uint64_t)imm;
-
-				for (uint16_t element = 0; element < vl; ++element) {
-					if (mask == 1 || v0_bit(element)) {
-						v[vd].values.u64[element] = value;
-					}
-					else {
-						v[vd].values.u64[element] = v[vs2].values.u64[element];
-					}
-				}
-				break;
-			}
-			default:
-				assert(false);
-				break;
+static void opcode_csrrw_csrrs_csrrc_csrrwi_csrrsi_csrrci_ecall_ebreak_sret_mret_wfi_sfencevma(uint32_t instruction) {
+	uint8_t  middle = (instruction >> 12) & 0x7;
+	uint8_t  rs1    = (instruction >> 15) & 0x1f;
+	uint8_t  rd     = (instruction >> 7) & 0x1f;
+	uint16_t csr    = instruction >> 20;
+
+	if (middle == 0x00) { // ecall_ebreak_sret_mret_wfi_sfencevma
+		switch (csr) {
+		case 0x000: // ecall
+			enter_trap(EXCEPTION_ECALL, 0);
+			return;
+		case 0x001: // ebreak
+			enter_trap(EXCEPTION_BREAKPOINT, current_hart->pc);
+			return;
+		case 0x302: // mret, ends its block like every system instruction
+			current_hart->pc                  = current_hart->mepc;
+			current_hart->mstatus             = MSTATUS_MPIE | ((current_hart->mstatus & MSTATUS_MPIE) != 0 ? MSTATUS_MIE : 0);
+			current_hart->interrupt_countdown = 0;
+			return;
+		case 0x105: // wfi, the hart parks in execute_block
+			increment_pc();
+			if ((pending_interrupts() & current_hart->mie) == 0) {
+				current_hart->waiting     = true;
+				current_hart->leave_block = true;
 			}
-
-			break;
+			return;
+		default: // sret and sfence.vma, there is no supervisor mode
+			enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+			return;
 		}
-		default:
-			assert(false);
-			break;
-		}
-		break;
 	}
-	case 0x4: { // vslideup_vslidedown_vmerge_vmv
-		uint8_t funct6 = instruction >> 26;
-		switch (funct6) {
-		case 0x17: { // vmerge_vmv
-			uint8_t rs1  = (instruction >> 15) & 0x1f;
-			uint8_t vd   = (instruction >> 7) & 0x1f;
-			uint8_t mask = (instruction >> 25) & 0x1;
 
-			switch (sew) {
-			case 8: {
-				uint8_t value = (uint8_t)x[rs1];
-				for (uint16_t element = 0; element < vl; ++element) {
-					if (mask == 1 || v0_bit(element)) {
-						v[vd].values.u8[element] = value;
-					}
-				}
-				break;
-			}
-			case 32: {
-				uint32_t value = (uint32_t)x[rs1];
-				for (uint16_t element = 0; element < vl; ++element) {
-					if (mask == 1 || v0_bit(element)) {
-						v[vd].values.u32[element] = value;
-					}
-				}
-				break;
-			}
-			default:
-				assert(false);
-				break;
-			}
+	// csrrw always writes, csrrs and csrrc only with a non-zero rs1 or immediate
+	bool writes = (middle & 0x3) == 0x1 || rs1 != 0;
+	if (middle == 0x04 || !csr_exists(csr) || (writes && (csr >> 10) == 0x3)) {
+		enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+		return;
+	}
 
-			break;
-		}
-		default:
-			assert(false);
-			break;
+	// the immediate forms take rs1 as a 5 bit unsigned value
+	uint64_t operand = (middle & 0x4) != 0 ? rs1 : current_hart->x[rs1];
+
+	switch (middle & 0x3) {
+	case 0x01: { // csrrw, csrrwi
+		// csrrw only reads when the result is used
+		uint64_t value = rd != 0 ? read_csr(csr) : 0;
+		write_csr(csr, operand);
+		if (rd != 0) {
+			current_hart->x[rd] = value;
 		}
 		break;
 	}
-	case 0x6: { // OPMVX
-		uint8_t funct6 = instruction >> 26;
-		switch (funct6) {
-		case 0x10: { // VRXUNARY0
-			uint8_t vs2 = (instruction >> 20) & 0x1f;
-			assert(vs2 == 0); // vmv.s.x
-
-			uint8_t rs1 = (instruction >> 15) & 0x1f;
-			uint8_t vd  = (instruction >> 7) & 0x1f;
-
-			switch (sew) {
-			case 32: {
-				v[vd].values.u32[0] = (uint32_t)x[rs1];
-				break;
-			}
-			default:
-				assert(false);
-				break;
-			}
-			break;
+	case 0x02: { // csrrs, csrrsi
+		uint64_t value = read_csr(csr);
+		if (rs1 != 0) {
+			write_csr(csr, value | operand);
 		}
-		default:
-			assert(false);
-			break;
+		if (rd != 0) {
+			current_hart->x[rd] = value;
 		}
 		break;
 	}
-	case 0x7: { // vsetvli_vsetivli_vsetvl
-		uint8_t upper = instruction >> 31;
-		if (upper == 0) { // vsetvli
-			uint16_t zimm = (instruction >> 20) & 0x7ff;
-			uint8_t  rs1  = (instruction >> 15) & 0x1f;
-			uint8_t  rd   = (instruction >> 7) & 0x1f;
-
-			uint8_t vlmul = zimm & 0x7;
-			uint8_t vsew  = (zimm >> 3) & 0x7;
-			uint8_t vta   = (zimm >> 6) & 0x1;
-			uint8_t vma   = (zimm >> 7) & 0x1;
-
-			switch (vsew) {
-			case 0x0:
-				sew = 8;
-				break;
-			case 0x1:
-				sew = 16;
-				break;
-			case 0x2:
-				sew = 32;
-				break;
-			case 0x3:
-				sew = 64;
-				break;
-			default:
-				assert(false);
-				break;
-			}
-
-			switch (vlmul) {
-			case 0x0:
-				lmul    = 1;
-				lmuldiv = 1;
-				break;
-			case 0x1:
-				lmul    = 2;
-				lmuldiv = 1;
-				break;
-			case 0x2:
-				lmul    = 4;
-				lmuldiv = 1;
-				break;
-			case 0x3:
-				lmul    = 8;
-				lmuldiv = 1;
-				break;
-			case 0x5:
-				lmul    = 1;
-				lmuldiv = 8;
-				break;
-			case 0x6:
-				lmul    = 1;
-				lmuldiv = 4;
-				break;
-			case 0x7:
-				lmul    = 1;
-				lmuldiv = 2;
-				break;
-			default:
-				assert(false);
-				break;
-			}
-
-			uint16_t avl = 0;
-
-			if (rs1 != 0) {
-				avl = (uint16_t)x[rs1];
-			}
-			else if (rd != 0) {
-				avl = ~0;
-			}
-			else {
-				avl = vl;
-			}
-
-			uint16_t vlen  = 1024;
-			uint16_t vlmax = (vlen / sew) * lmul / lmuldiv;
-			vl             = min(avl, vlmax);
-
-			if (rd != 0) {
-				x[rd] = vl;
-			}
+	case 0x03: { // csrrc, csrrci
+		uint64_t value = read_csr(csr);
+		if (rs1 != 0) {
+			write_csr(csr, value & ~operand);
 		}
-		else {
-			if (((instruction >> 30) & 0x1) == 1) { // vsetivli
-				uint16_t zimm = (instruction >> 20) & 0x3ff;
-				uint8_t  uimm = (instruction >> 15) & 0x1f;
-				uint8_t  rd   = (instruction >> 7) & 0x1f;
-
-				uint8_t vlmul = zimm & 0x7;
-				uint8_t vsew  = (zimm >> 3) & 0x7;
-				uint8_t vta   = (zimm >> 6) & 0x1;
-				uint8_t vma   = (zimm >> 7) & 0x1;
-
-				switch (vsew) {
-				case 0x0:
-					sew = 8;
-					break;
-				case 0x1:
-					sew = 16;
-					break;
-				case 0x2:
-					sew = 32;
-					break;
-				case 0x3:
-					sew = 64;
-					break;
-				default:
-					assert(false);
-					break;
-				}
-
-				switch (vlmul) {
-				case 0x0:
-					lmul    = 1;
-					lmuldiv = 1;
-					break;
-				case 0x1:
-					lmul    = 2;
-					lmuldiv = 1;
-					break;
-				case 0x2:
-					lmul    = 4;
-					lmuldiv = 1;
-					break;
-				case 0x3:
-					lmul    = 8;
-					lmuldiv = 1;
-					break;
-				case 0x5:
-					lmul    = 1;
-					lmuldiv = 8;
-					break;
-				case 0x6:
-					lmul    = 1;
-					lmuldiv = 4;
-					break;
-				case 0x7:
-					lmul    = 1;
-					lmuldiv = 2;
-					break;
-				default:
-					assert(false);
-					break;
-				}
-
-				uint16_t avl = uimm;
-
-				uint16_t vlen  = 1024;
-				uint16_t vlmax = (vlen / sew) * lmul / lmuldiv;
-				vl             = min(avl, vlmax);
-
-				if (rd != 0) {
-					x[rd] = vl;
-				}
-			}
-			else { // vsetvl
-				assert(false);
-			}
+		if (rd != 0) {
+			current_hart->x[rd] = value;
 		}
-
 		break;
 	}
-	default:
-		assert(false);
-		break;
 	}
 
 	increment_pc();
 }
 
-static void opcode_not_implemented(uint32_t instruction) {
-	assert(false);
+static void opcode_fmadd_fmsub_fnmsub_fnmadd(uint32_t instruction) {
+	if (!float_fused_multiply_add(current_hart, instruction)) {
+		enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+		return;
+	}
+	increment_pc();
+}
+
+static void opcode_fadd_fsub_fmul_fdiv_fsqrt_fsgnj_fmin_fmax_fcvt_fmv_feq_flt_fle_fclass(uint32_t instruction) {
+	if (!float_execute(current_hart, instruction)) {
+		enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+		return;
+	}
+	increment_pc();
+}
+
+static void opcode_vector(uint32_t instruction) {
+	if (!vector_execute(current_hart, instruction)) {
+		enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+		return;
+	}
 	increment_pc();
 }
 
+// Also runs the reserved compressed encodings, which expand to 0.
+static void opcode_not_implemented(uint32_t instruction) {
+	enter_trap(EXCEPTION_ILLEGAL_INSTRUCTION, instruction);
+}
+
 opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
@@ -1105,7 +1871,7 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_flw,
+    &opcode_flw_fld,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented, // 10
@@ -1125,7 +1891,7 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_addiw,
+    &opcode_addiw_slliw_srliw_sraiw,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented, // 30
@@ -1137,7 +1903,7 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_fsw,
+    &opcode_fsw_fsd,
     &opcode_not_implemented, // 40
     &opcode_not_implemented,
     &opcode_not_implemented,
@@ -1145,7 +1911,7 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_not_implemented,
+    &opcode_lr_sc_amoswap_amoadd_amoxor_amoand_amoor_amomin_amomax_amominu_amomaxu,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented, // 50
@@ -1157,7 +1923,7 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_addw_subw_sllw_srlw_sraw,
+    &opcode_addw_subw_sllw_srlw_sraw_mulw_divw_divuw_remw_remuw,
     &opcode_not_implemented, // 60
     &opcode_not_implemented,
     &opcode_not_implemented,
@@ -1165,23 +1931,23 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_not_implemented,
+    &opcode_fmadd_fmsub_fnmsub_fnmadd,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented, // 70
+    &opcode_fmadd_fmsub_fnmsub_fnmadd,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
+    &opcode_fmadd_fmsub_fnmsub_fnmadd,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_not_implemented,
-    &opcode_not_implemented,
-    &opcode_not_implemented,
+    &opcode_fmadd_fmsub_fnmsub_fnmadd,
     &opcode_not_implemented, // 80
     &opcode_not_implemented,
     &opcode_not_implemented,
-    &opcode_not_implemented,
+    &opcode_fadd_fsub_fmul_fdiv_fsqrt_fsgnj_fmin_fmax_fcvt_fmv_feq_flt_fle_fclass,
     &opcode_not_implemented,
     &opcode_not_implemented,
     &opcode_not_implemented,
@@ -1356,291 +2122,3244 @@ opcode_func *opcodes[256] = {
     &opcode_not_implemented,
 };
 
-bool read_magic_number(uint8_t *binary, uint64_t *offset) {
-	bool value = binary[*offset + 0] == 0x7f && binary[*offset + 1] == 0x45 && binary[*offset + 2] == 0x4c && binary[*offset + 3] == 0x46;
-	*offset += 4;
-	return value;
+static void next_instruction(const decoded_instruction *instruction) {
+	current_hart->pc += decoded_size(instruction);
 }
 
-uint8_t read_uint8(uint8_t *binary, uint64_t *offset) {
-	uint8_t value = binary[*offset];
-	*offset += 1;
-	return value;
+void decoded_fallback(const decoded_instruction *instruction) {
+	uint64_t pc = current_hart->pc;
+	opcodes[instruction->instruction & 0x7f](instruction->instruction);
+	// the opcode handlers step over 4 bytes
+	if (instruction->compressed && current_hart->pc == pc + 4) {
+		current_hart->pc -= 2;
+	}
 }
 
-uint16_t read_uint16(uint8_t *binary, uint64_t *offset) {
-	uint16_t value = *(uint16_t *)&binary[*offset];
-	*offset += 2;
-	return value;
+static void decoded_nop(const decoded_instruction *instruction) {
+	next_instruction(instruction);
 }
 
-uint32_t read_uint32(uint8_t *binary, uint64_t *offset) {
-	uint32_t value = *(uint32_t *)&binary[*offset];
-	*offset += 4;
-	return value;
+static void decoded_lui(const decoded_instruction *instruction) {
+	current_hart->x[instruction->rd] = (int64_t)instruction->immediate;
+	next_instruction(instruction);
 }
 
-uint64_t read_uint64(uint8_t *binary, uint64_t *offset) {
-	uint64_t value = *(uint64_t *)&binary[*offset];
-	*offset += 8;
-	return value;
+static void decoded_auipc(const decoded_instruction *instruction) {
+	current_hart->x[instruction->rd] = current_hart->pc + (int64_t)instruction->immediate;
+	next_instruction(instruction);
+}
+
+static void decoded_jal(const decoded_instruction *instruction) {
+	if (instruction->rd != 0) {
+		current_hart->x[instruction->rd] = current_hart->pc + decoded_size(instruction);
+	}
+	current_hart->pc += (int64_t)instruction->immediate;
+}
+
+static void decoded_jalr(const decoded_instruction *instruction) {
+	uint64_t t       = current_hart->pc + decoded_size(instruction);
+	current_hart->pc = (current_hart->x[instruction->rs1] + (int64_t)instruction->immediate) & ~1ull;
+	if (instruction->rd != 0) {
+		current_hart->x[instruction->rd] = t;
+	}
+}
+
+#define DECODED_BRANCH(name, condition)                                  \
+	static void decoded_##name(const decoded_instruction *instruction) { \
+		uint64_t a = current_hart->x[instruction->rs1];                  \
+		uint64_t b = current_hart->x[instruction->rs2];                  \
+		if (condition) {                                                 \
+			current_hart->pc += (int64_t)instruction->immediate;         \
+		}                                                                \
+		else {                                                           \
+			next_instruction(instruction);                               \
+		}                                                                \
+	}
+
+DECODED_BRANCH(beq, a == b)
+DECODED_BRANCH(bne, a != b)
+DECODED_BRANCH(blt, (int64_t)a < (int64_t)b)
+DECODED_BRANCH(bge, (int64_t)a >= (int64_t)b)
+DECODED_BRANCH(bltu, a < b)
+DECODED_BRANCH(bgeu, a >= b)
+
+#define DECODED_LOAD(name, value)                                                                               \
+	static void decoded_##name(const decoded_instruction *instruction) {                                        \
+		uint64_t address                 = current_hart->x[instruction->rs1] + (int64_t)instruction->immediate; \
+		uint64_t result                  = (value);                                                             \
+		if (!current_hart->leave_block) {                                                                       \
+			current_hart->x[instruction->rd] = result;                                                          \
+			current_hart->x[0]               = 0;                                                               \
+		}                                                                                                       \
+		next_instruction(instruction);                                                                          \
+	}
+
+DECODED_LOAD(lb, (int64_t)(int8_t)read_memory8(address))
+DECODED_LOAD(lh, (int64_t)(int16_t)read_memory16(address))
+DECODED_LOAD(lw, (int64_t)(int32_t)read_memory32(address))
+DECODED_LOAD(ld, read_memory64(address))
+DECODED_LOAD(lbu, (uint8_t)read_memory8(address))
+DECODED_LOAD(lhu, read_memory16(address))
+DECODED_LOAD(lwu, read_memory32(address))
+
+#define DECODED_STORE(name, store)                                                              \
+	static void decoded_##name(const decoded_instruction *instruction) {                        \
+		uint64_t address = current_hart->x[instruction->rs1] + (int64_t)instruction->immediate; \
+		uint64_t value   = current_hart->x[instruction->rs2];                                   \
+		store;                                                                                  \
+		next_instruction(instruction);                                                          \
+	}
+
+DECODED_STORE(sb, store_memory8(address, (uint8_t)value))
+DECODED_STORE(sh, store_memory16(address, (uint16_t)value))
+DECODED_STORE(sw, store_memory32(address, (uint32_t)value))
+DECODED_STORE(sd, store_memory64(address, value))
+
+#define DECODED_ALU(name, result)                                             \
+	static void decoded_##name(const decoded_instruction *instruction) {      \
+		uint64_t a                       = current_hart->x[instruction->rs1]; \
+		uint64_t b                       = current_hart->x[instruction->rs2]; \
+		current_hart->x[instruction->rd] = (result);                          \
+		next_instruction(instruction);                                        \
+	}
+
+#define DECODED_ALU_IMMEDIATE(name, result)                                   \
+	static void decoded_##name(const decoded_instruction *instruction) {      \
+		uint64_t a                       = current_hart->x[instruction->rs1]; \
+		int64_t  immediate               = instruction->immediate;            \
+		current_hart->x[instruction->rd] = (result);                          \
+		next_instruction(instruction);                                        \
+	}
+
+DECODED_ALU_IMMEDIATE(addi, a + immediate)
+DECODED_ALU_IMMEDIATE(slti, (int64_t)a < immediate ? 1 : 0)
+DECODED_ALU_IMMEDIATE(sltiu, a < (uint64_t)immediate ? 1 : 0)
+DECODED_ALU_IMMEDIATE(xori, a ^ immediate)
+DECODED_ALU_IMMEDIATE(ori, a | immediate)
+DECODED_ALU_IMMEDIATE(andi, a & immediate)
+DECODED_ALU_IMMEDIATE(slli, a << immediate)
+DECODED_ALU_IMMEDIATE(srli, a >> immediate)
+DECODED_ALU_IMMEDIATE(srai, (int64_t)a >> immediate)
+DECODED_ALU(add, a + b)
+DECODED_ALU(sub, a - b)
+DECODED_ALU(sll, a << (b & 0x3f))
+DECODED_ALU(slt, (int64_t)a < (int64_t)b ? 1 : 0)
+DECODED_ALU(sltu, a < b ? 1 : 0)
+DECODED_ALU(xor, a ^ b)
+DECODED_ALU(srl, a >> (b & 0x3f))
+DECODED_ALU(sra, (int64_t)a >> (b & 0x3f))
+DECODED_ALU(or, a | b)
+DECODED_ALU(and, a & b)
+DECODED_ALU(mul, a * b)
+DECODED_ALU(mulh, multiply_high_signed(a, b))
+DECODED_ALU(mulhsu, multiply_high_signed_unsigned(a, b))
+DECODED_ALU(mulhu, multiply_high_unsigned(a, b))
+DECODED_ALU(div, divide_signed(a, b))
+DECODED_ALU(divu, divide_unsigned(a, b))
+DECODED_ALU(rem, remainder_signed(a, b))
+DECODED_ALU(remu, remainder_unsigned(a, b))
+DECODED_ALU_IMMEDIATE(addiw, (int64_t)(int32_t)(a + immediate))
+DECODED_ALU_IMMEDIATE(slliw, (int64_t)(int32_t)((uint32_t)a << immediate))
+DECODED_ALU_IMMEDIATE(srliw, (int64_t)(int32_t)((uint32_t)a >> immediate))
+DECODED_ALU_IMMEDIATE(sraiw, (int64_t)((int32_t)a >> immediate))
+DECODED_ALU(addw, (int64_t)(int32_t)(a + b))
+DECODED_ALU(subw, (int64_t)(int32_t)(a - b))
+DECODED_ALU(sllw, (int64_t)(int32_t)((uint32_t)a << (b & 0x1f)))
+DECODED_ALU(srlw, (int64_t)(int32_t)((uint32_t)a >> (b & 0x1f)))
+DECODED_ALU(sraw, (int64_t)((int32_t)a >> (b & 0x1f)))
+DECODED_ALU(mulw, (int64_t)(int32_t)(a * b))
+DECODED_ALU(divw, divide_signed_word(a, b))
+DECODED_ALU(divuw, divide_unsigned_word(a, b))
+DECODED_ALU(remw, remainder_signed_word(a, b))
+DECODED_ALU(remuw, remainder_unsigned_word(a, b))
+
+static decoded_func *decoded_handlers[DECODED_OP_COUNT] = {
+    [DECODED_OP_FALLBACK] = decoded_fallback,
+    [DECODED_OP_NOP]      = decoded_nop,
+    [DECODED_OP_LUI]      = decoded_lui,
+    [DECODED_OP_AUIPC]    = decoded_auipc,
+    [DECODED_OP_JAL]      = decoded_jal,
+    [DECODED_OP_JALR]     = decoded_jalr,
+    [DECODED_OP_BEQ]      = decoded_beq,
+    [DECODED_OP_BNE]      = decoded_bne,
+    [DECODED_OP_BLT]      = decoded_blt,
+    [DECODED_OP_BGE]      = decoded_bge,
+    [DECODED_OP_BLTU]     = decoded_bltu,
+    [DECODED_OP_BGEU]     = decoded_bgeu,
+    [DECODED_OP_LB]       = decoded_lb,
+    [DECODED_OP_LH]       = decoded_lh,
+    [DECODED_OP_LW]       = decoded_lw,
+    [DECODED_OP_LD]       = decoded_ld,
+    [DECODED_OP_LBU]      = decoded_lbu,
+    [DECODED_OP_LHU]      = decoded_lhu,
+    [DECODED_OP_LWU]      = decoded_lwu,
+    [DECODED_OP_SB]       = decoded_sb,
+    [DECODED_OP_SH]       = decoded_sh,
+    [DECODED_OP_SW]       = decoded_sw,
+    [DECODED_OP_SD]       = decoded_sd,
+    [DECODED_OP_ADDI]     = decoded_addi,
+    [DECODED_OP_SLTI]     = decoded_slti,
+    [DECODED_OP_SLTIU]    = decoded_sltiu,
+    [DECODED_OP_XORI]     = decoded_xori,
+    [DECODED_OP_ORI]      = decoded_ori,
+    [DECODED_OP_ANDI]     = decoded_andi,
+    [DECODED_OP_SLLI]     = decoded_slli,
+    [DECODED_OP_SRLI]     = decoded_srli,
+    [DECODED_OP_SRAI]     = decoded_srai,
+    [DECODED_OP_ADD]      = decoded_add,
+    [DECODED_OP_SUB]      = decoded_sub,
+    [DECODED_OP_SLL]      = decoded_sll,
+    [DECODED_OP_SLT]      = decoded_slt,
+    [DECODED_OP_SLTU]     = decoded_sltu,
+    [DECODED_OP_XOR]      = decoded_xor,
+    [DECODED_OP_SRL]      = decoded_srl,
+    [DECODED_OP_SRA]      = decoded_sra,
+    [DECODED_OP_OR]       = decoded_or,
+    [DECODED_OP_AND]      = decoded_and,
+    [DECODED_OP_MUL]      = decoded_mul,
+    [DECODED_OP_MULH]     = decoded_mulh,
+    [DECODED_OP_MULHSU]   = decoded_mulhsu,
+    [DECODED_OP_MULHU]    = decoded_mulhu,
+    [DECODED_OP_DIV]      = decoded_div,
+    [DECODED_OP_DIVU]     = decoded_divu,
+    [DECODED_OP_REM]      = decoded_rem,
+    [DECODED_OP_REMU]     = decoded_remu,
+    [DECODED_OP_ADDIW]    = decoded_addiw,
+    [DECODED_OP_SLLIW]    = decoded_slliw,
+    [DECODED_OP_SRLIW]    = decoded_srliw,
+    [DECODED_OP_SRAIW]    = decoded_sraiw,
+    [DECODED_OP_ADDW]     = decoded_addw,
+    [DECODED_OP_SUBW]     = decoded_subw,
+    [DECODED_OP_SLLW]     = decoded_sllw,
+    [DECODED_OP_SRLW]     = decoded_srlw,
+    [DECODED_OP_SRAW]     = decoded_sraw,
+    [DECODED_OP_MULW]     = decoded_mulw,
+    [DECODED_OP_DIVW]     = decoded_divw,
+    [DECODED_OP_DIVUW]    = decoded_divuw,
+    [DECODED_OP_REMW]     = decoded_remw,
+    [DECODED_OP_REMUW]    = decoded_remuw,
+};
+
+static decoded_op decode_op_imm(uint32_t instruction) {
+	switch ((instruction >> 12) & 0x7) {
+	case 0x0:
+		return DECODED_OP_ADDI;
+	case 0x1:
+		return (instruction >> 26) == 0x00 ? DECODED_OP_SLLI : DECODED_OP_FALLBACK;
+	case 0x2:
+		return DECODED_OP_SLTI;
+	case 0x3:
+		return DECODED_OP_SLTIU;
+	case 0x4:
+		return DECODED_OP_XORI;
+	case 0x5:
+		switch (instruction >> 26) {
+		case 0x00:
+			return DECODED_OP_SRLI;
+		case 0x10:
+			return DECODED_OP_SRAI;
+		}
+		return DECODED_OP_FALLBACK;
+	case 0x6:
+		return DECODED_OP_ORI;
+	case 0x7:
+		return DECODED_OP_ANDI;
+	}
+	return DECODED_OP_FALLBACK;
+}
+
+static decoded_op decode_op(uint32_t instruction) {
+	static const decoded_op loads[8] = {DECODED_OP_LB, DECODED_OP_LH, DECODED_OP_LW, DECODED_OP_LD, DECODED_OP_LBU, DECODED_OP_LHU, DECODED_OP_LWU, DECODED_OP_FALLBACK};
+	static const decoded_op stores[8] = {DECODED_OP_SB,       DECODED_OP_SH,       DECODED_OP_SW,       DECODED_OP_SD,
+	                                     DECODED_OP_FALLBACK, DECODED_OP_FALLBACK, DECODED_OP_FALLBACK, DECODED_OP_FALLBACK};
+	static const decoded_op branches[8] = {DECODED_OP_BEQ, DECODED_OP_BNE, DECODED_OP_FALLBACK, DECODED_OP_FALLBACK,
+	                                       DECODED_OP_BLT, DECODED_OP_BGE, DECODED_OP_BLTU,     DECODED_OP_BGEU};
+	static const decoded_op alu[8]      = {DECODED_OP_ADD, DECODED_OP_SLL, DECODED_OP_SLT, DECODED_OP_SLTU, DECODED_OP_XOR, DECODED_OP_SRL, DECODED_OP_OR, DECODED_OP_AND};
+	static const decoded_op multiply[8] = {DECODED_OP_MUL, DECODED_OP_MULH, DECODED_OP_MULHSU, DECODED_OP_MULHU,
+	                                       DECODED_OP_DIV, DECODED_OP_DIVU, DECODED_OP_REM,    DECODED_OP_REMU};
+	static const decoded_op multiply_word[8] = {DECODED_OP_MULW, DECODED_OP_FALLBACK, DECODED_OP_FALLBACK, DECODED_OP_FALLBACK,
+	                                            DECODED_OP_DIVW, DECODED_OP_DIVUW,    DECODED_OP_REMW,     DECODED_OP_REMUW};
+
+	uint8_t opcode = instruction & 0x7f;
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct7 = instruction >> 25;
+
+	switch (opcode) {
+	case 0x03:
+		return loads[funct3];
+	case 0x13:
+		return decode_op_imm(instruction);
+	case 0x17:
+		return DECODED_OP_AUIPC;
+	case 0x1b:
+		switch (funct3) {
+		case 0x0:
+			return DECODED_OP_ADDIW;
+		case 0x1:
+			return funct7 == 0x00 ? DECODED_OP_SLLIW : DECODED_OP_FALLBACK;
+		case 0x5:
+			return funct7 == 0x00 ? DECODED_OP_SRLIW : funct7 == 0x20 ? DECODED_OP_SRAIW : DECODED_OP_FALLBACK;
+		}
+		return DECODED_OP_FALLBACK;
+	case 0x23:
+		return stores[funct3];
+	case 0x33:
+		if (funct7 == 0x00) {
+			return alu[funct3];
+		}
+		if (funct7 == 0x20) {
+			return funct3 == 0x0 ? DECODED_OP_SUB : funct3 == 0x5 ? DECODED_OP_SRA : DECODED_OP_FALLBACK;
+		}
+		if (funct7 == 0x01) {
+			return multiply[funct3];
+		}
+		return DECODED_OP_FALLBACK;
+	case 0x37:
+		return DECODED_OP_LUI;
+	case 0x3b:
+		if (funct7 == 0x01) {
+			return multiply_word[funct3];
+		}
+		switch (funct3) {
+		case 0x0:
+			return funct7 == 0x00 ? DECODED_OP_ADDW : funct7 == 0x20 ? DECODED_OP_SUBW : DECODED_OP_FALLBACK;
+		case 0x1:
+			return funct7 == 0x00 ? DECODED_OP_SLLW : DECODED_OP_FALLBACK;
+		case 0x5:
+			return funct7 == 0x00 ? DECODED_OP_SRLW : funct7 == 0x20 ? DECODED_OP_SRAW : DECODED_OP_FALLBACK;
+		}
+		return DECODED_OP_FALLBACK;
+	case 0x63:
+		return branches[funct3];
+	case 0x67:
+		return DECODED_OP_JALR;
+	case 0x6f:
+		return DECODED_OP_JAL;
+	}
+	return DECODED_OP_FALLBACK;
+}
+
+static bool decoded_op_writes_rd(decoded_op op) {
+	return op == DECODED_OP_LUI || op == DECODED_OP_AUIPC || (op >= DECODED_OP_ADDI && op <= DECODED_OP_REMUW);
+}
+
+static bool decoded_op_ends_block(decoded_op op, uint32_t instruction) {
+	if (op >= DECODED_OP_JAL && op <= DECODED_OP_BGEU) {
+		return true;
+	}
+	if (op == DECODED_OP_FALLBACK) {
+		uint8_t opcode = instruction & 0x7f;
+		return opcode == 0x0f || opcode == 0x73; // fence and system instructions
+	}
+	return false;
+}
+
+#ifdef KOMPJUTA_COMPUTED_GOTO
+// published by execute_threaded
+static const void *const *threaded_labels = NULL;
+#endif
+
+static void decode_instruction(decoded_instruction *decoded, uint32_t instruction) {
+	decoded_op op = decode_op(instruction);
+
+	decoded->rd  = (instruction >> 7) & 0x1f;
+	decoded->rs1 = (instruction >> 15) & 0x1f;
+	decoded->rs2 = (instruction >> 20) & 0x1f;
+
+	switch (op) {
+	case DECODED_OP_FALLBACK:
+		decoded->instruction = instruction;
+		break;
+	case DECODED_OP_LUI:
+	case DECODED_OP_AUIPC:
+		decoded->immediate = (int32_t)(instruction & 0xfffff000);
+		break;
+	case DECODED_OP_JAL: {
+		uint32_t immediate =
+		    ((instruction >> 31) & 0x1) << 20 | ((instruction >> 21) & 0x3ff) << 1 | ((instruction >> 20) & 0x1) << 11 | ((instruction >> 12) & 0xff) << 12;
+		decoded->immediate = (int32_t)sign_extend32(immediate, 21);
+		break;
+	}
+	case DECODED_OP_BEQ:
+	case DECODED_OP_BNE:
+	case DECODED_OP_BLT:
+	case DECODED_OP_BGE:
+	case DECODED_OP_BLTU:
+	case DECODED_OP_BGEU: {
+		uint32_t immediate =
+		    (((instruction >> 31) & 0x1) << 12) | (((instruction >> 25) & 0x3f) << 5) | (((instruction >> 8) & 0xf) << 1) | (((instruction >> 7) & 0x1) << 11);
+		decoded->immediate = (int32_t)sign_extend32(immediate, 13);
+		break;
+	}
+	case DECODED_OP_SB:
+	case DECODED_OP_SH:
+	case DECODED_OP_SW:
+	case DECODED_OP_SD: {
+		uint32_t immediate = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1f);
+		decoded->immediate = (int32_t)sign_extend32(immediate, 12);
+		break;
+	}
+	case DECODED_OP_SLLI:
+	case DECODED_OP_SRLI:
+	case DECODED_OP_SRAI:
+		decoded->immediate = (instruction >> 20) & 0x3f;
+		break;
+	case DECODED_OP_SLLIW:
+	case DECODED_OP_SRLIW:
+	case DECODED_OP_SRAIW:
+		decoded->immediate = (instruction >> 20) & 0x1f;
+		break;
+	default:
+		decoded->immediate = (int32_t)instruction >> 20;
+		break;
+	}
+
+	if (decoded->rd == 0 && decoded_op_writes_rd(op)) {
+		op = DECODED_OP_NOP;
+	}
+
+	decoded->op      = op;
+	decoded->handler = decoded_handlers[op];
+#ifdef KOMPJUTA_COMPUTED_GOTO
+	decoded->label = threaded_labels[op];
+#endif
+}
+
+static void decode_block(block *block, uint64_t address) {
+	block->pc         = address;
+	block->count      = 0;
+	block->executions = 0;
+	block->native     = NULL;
+
+	++current_hart->events[HART_EVENT_BLOCK_DECODES];
+
+	uint64_t page = address >> MEMORY_PAGE_SHIFT;
+	page_flags[page] |= PAGE_FLAG_CODE;
+
+	do {
+		// Compressed instructions are expanded here once and run as their 32 bit forms.
+		uint16_t parcel     = *(uint16_t *)&ram[address];
+		bool     compressed = compressed_instruction(parcel);
+		uint32_t instruction;
+		if (compressed) {
+			instruction = compressed_expand(parcel);
+		}
+		else if (((address + 2) >> MEMORY_PAGE_SHIFT) == page) {
+			instruction = *(uint32_t *)&ram[address];
+		}
+		else {
+			// An instruction that continues on the next page is left to a block of its own,
+			// which also watches that page and is found by invalidate_code_page.
+			if (block->count != 0) {
+				break;
+			}
+			if (address + 4 > memory_size || (page_flags[page + 1] & PAGE_FLAG_ALIAS) != 0) {
+				access_fault(EXCEPTION_INSTRUCTION_ACCESS_FAULT, address + 2, "Instruction");
+				return;
+			}
+			page_flags[page + 1] |= PAGE_FLAG_CODE;
+			instruction = *(uint32_t *)&ram[address];
+		}
+
+		decoded_instruction *decoded = &block->instructions[block->count++];
+		decode_instruction(decoded, instruction);
+		decoded->compressed = compressed;
+		address += decoded_size(decoded);
+		if (decoded_op_ends_block(decoded->op, instruction)) {
+			break;
+		}
+	} while (block->count < BLOCK_MAX_INSTRUCTIONS && (address >> MEMORY_PAGE_SHIFT) == page);
+}
+
+static void invalidate_code_page(uint64_t page) {
+	for (uint32_t block_index = 0; block_index < BLOCK_CACHE_SIZE; ++block_index) {
+		uint64_t pc = current_hart->blocks[block_index].pc;
+		if ((pc >> MEMORY_PAGE_SHIFT) == page || pc == (page << MEMORY_PAGE_SHIFT) - 2) {
+			current_hart->blocks[block_index].count = 0;
+		}
+	}
+	page_flags[page] &= ~PAGE_FLAG_CODE;
+	current_hart->leave_block = true;
+	++current_hart->events[HART_EVENT_CODE_INVALIDATIONS];
+}
+
+static void flush_block_cache(void) {
+	// Only the pages of cached blocks are cleared so the map is never touched as a whole, a
+	// page left marked by an evicted block just costs one more invalidation later.
+	for (uint32_t block_index = 0; block_index < BLOCK_CACHE_SIZE; ++block_index) {
+		if (current_hart->blocks[block_index].count != 0) {
+			page_flags[current_hart->blocks[block_index].pc >> MEMORY_PAGE_SHIFT] &= ~PAGE_FLAG_CODE;
+		}
+		current_hart->blocks[block_index].count = 0;
+	}
+	current_hart->leave_block = true;
+}
+
+#ifdef KOMPJUTA_THREADED_DISPATCH
+
+// Alternative interpreter core that keeps pc and the register file pointer in locals and
+// dispatches from one instruction body straight to the next, through the label stored in
+// each record when the compiler supports computed goto and through a switch otherwise.
+
+#ifdef KOMPJUTA_COMPUTED_GOTO
+#define THREADED_CASE(name) threaded_##name:
+#define THREADED_DISPATCH()                                                                                                                                    \
+	if (instruction == end) {                                                                                                                                  \
+		goto threaded_done;                                                                                                                                    \
+	}                                                                                                                                                          \
+	goto *instruction->label;
+#else
+#define THREADED_CASE(name) case DECODED_OP_##name:
+#define THREADED_DISPATCH() continue;
+#endif
+
+#define THREADED_NEXT()                                                                                                                                        \
+	current_pc += decoded_size(instruction);                                                                                                                   \
+	++instruction;                                                                                                                                             \
+	THREADED_DISPATCH()
+
+// control flow always ends a block
+#define THREADED_JUMP(target)                                                                                                                                  \
+	current_pc = (target);                                                                                                                                     \
+	goto threaded_done;
+
+#define THREADED_BRANCH(name, condition)                                                                                                                       \
+	THREADED_CASE(name) {                                                                                                                                      \
+		uint64_t a = registers[instruction->rs1];                                                                                                              \
+		uint64_t b = registers[instruction->rs2];                                                                                                              \
+		if (condition) {                                                                                                                                       \
+			THREADED_JUMP(current_pc + (int64_t)instruction->immediate);                                                                                       \
+		}                                                                                                                                                      \
+		THREADED_JUMP(current_pc + decoded_size(instruction));                                                                                                 \
+	}
+
+#define THREADED_LOAD(name, value)                                                                                                                             \
+	THREADED_CASE(name) {                                                                                                                                      \
+		uint64_t address           = registers[instruction->rs1] + (int64_t)instruction->immediate;                                                            \
+		uint64_t result            = (value);                                                                                                                  \
+		if (current_hart->leave_block) {                                                                                                                       \
+			THREADED_JUMP(current_pc + decoded_size(instruction));                                                                                             \
+		}                                                                                                                                                      \
+		registers[instruction->rd] = result;                                                                                                                   \
+		registers[0]               = 0;                                                                                                                        \
+		THREADED_NEXT();                                                                                                                                       \
+	}
+
+#define THREADED_STORE(name, store)                                                                                                                            \
+	THREADED_CASE(name) {                                                                                                                                      \
+		uint64_t address = registers[instruction->rs1] + (int64_t)instruction->immediate;                                                                      \
+		uint64_t value   = registers[instruction->rs2];                                                                                                        \
+		store;                                                                                                                                                 \
+		if (current_hart->leave_block) {                                                                                                                       \
+			THREADED_JUMP(current_pc + decoded_size(instruction));                                                                                             \
+		}                                                                                                                                                      \
+		THREADED_NEXT();                                                                                                                                       \
+	}
+
+#define THREADED_ALU(name, result)                                                                                                                             \
+	THREADED_CASE(name) {                                                                                                                                      \
+		uint64_t a                 = registers[instruction->rs1];                                                                                              \
+		uint64_t b                 = registers[instruction->rs2];                                                                                              \
+		registers[instruction->rd] = (result);                                                                                                                 \
+		THREADED_NEXT();                                                                                                                                       \
+	}
+
+#define THREADED_ALU_IMMEDIATE(name, result)                                                                                                                   \
+	THREADED_CASE(name) {                                                                                                                                      \
+		uint64_t a                 = registers[instruction->rs1];                                                                                              \
+		int64_t  immediate         = instruction->immediate;                                                                                                   \
+		registers[instruction->rd] = (result);                                                                                                                 \
+		THREADED_NEXT();                                                                                                                                       \
+	}
+
+// Called once with NULL to publish the labels for decode_instruction.
+static void execute_threaded(const block *block) {
+#ifdef KOMPJUTA_COMPUTED_GOTO
+	static const void *const labels[DECODED_OP_COUNT] = {
+	    [DECODED_OP_FALLBACK] = &&threaded_FALLBACK,
+	    [DECODED_OP_NOP]      = &&threaded_NOP,
+	    [DECODED_OP_LUI]      = &&threaded_LUI,
+	    [DECODED_OP_AUIPC]    = &&threaded_AUIPC,
+	    [DECODED_OP_JAL]      = &&threaded_JAL,
+	    [DECODED_OP_JALR]     = &&threaded_JALR,
+	    [DECODED_OP_BEQ]      = &&threaded_BEQ,
+	    [DECODED_OP_BNE]      = &&threaded_BNE,
+	    [DECODED_OP_BLT]      = &&threaded_BLT,
+	    [DECODED_OP_BGE]      = &&threaded_BGE,
+	    [DECODED_OP_BLTU]     = &&threaded_BLTU,
+	    [DECODED_OP_BGEU]     = &&threaded_BGEU,
+	    [DECODED_OP_LB]       = &&threaded_LB,
+	    [DECODED_OP_LH]       = &&threaded_LH,
+	    [DECODED_OP_LW]       = &&threaded_LW,
+	    [DECODED_OP_LD]       = &&threaded_LD,
+	    [DECODED_OP_LBU]      = &&threaded_LBU,
+	    [DECODED_OP_LHU]      = &&threaded_LHU,
+	    [DECODED_OP_LWU]      = &&threaded_LWU,
+	    [DECODED_OP_SB]       = &&threaded_SB,
+	    [DECODED_OP_SH]       = &&threaded_SH,
+	    [DECODED_OP_SW]       = &&threaded_SW,
+	    [DECODED_OP_SD]       = &&threaded_SD,
+	    [DECODED_OP_ADDI]     = &&threaded_ADDI,
+	    [DECODED_OP_SLTI]     = &&threaded_SLTI,
+	    [DECODED_OP_SLTIU]    = &&threaded_SLTIU,
+	    [DECODED_OP_XORI]     = &&threaded_XORI,
+	    [DECODED_OP_ORI]      = &&threaded_ORI,
+	    [DECODED_OP_ANDI]     = &&threaded_ANDI,
+	    [DECODED_OP_SLLI]     = &&threaded_SLLI,
+	    [DECODED_OP_SRLI]     = &&threaded_SRLI,
+	    [DECODED_OP_SRAI]     = &&threaded_SRAI,
+	    [DECODED_OP_ADD]      = &&threaded_ADD,
+	    [DECODED_OP_SUB]      = &&threaded_SUB,
+	    [DECODED_OP_SLL]      = &&threaded_SLL,
+	    [DECODED_OP_SLT]      = &&threaded_SLT,
+	    [DECODED_OP_SLTU]     = &&threaded_SLTU,
+	    [DECODED_OP_XOR]      = &&threaded_XOR,
+	    [DECODED_OP_SRL]      = &&threaded_SRL,
+	    [DECODED_OP_SRA]      = &&threaded_SRA,
+	    [DECODED_OP_OR]       = &&threaded_OR,
+	    [DECODED_OP_AND]      = &&threaded_AND,
+	    [DECODED_OP_MUL]      = &&threaded_MUL,
+	    [DECODED_OP_MULH]     = &&threaded_MULH,
+	    [DECODED_OP_MULHSU]   = &&threaded_MULHSU,
+	    [DECODED_OP_MULHU]    = &&threaded_MULHU,
+	    [DECODED_OP_DIV]      = &&threaded_DIV,
+	    [DECODED_OP_DIVU]     = &&threaded_DIVU,
+	    [DECODED_OP_REM]      = &&threaded_REM,
+	    [DECODED_OP_REMU]     = &&threaded_REMU,
+	    [DECODED_OP_ADDIW]    = &&threaded_ADDIW,
+	    [DECODED_OP_SLLIW]    = &&threaded_SLLIW,
+	    [DECODED_OP_SRLIW]    = &&threaded_SRLIW,
+	    [DECODED_OP_SRAIW]    = &&threaded_SRAIW,
+	    [DECODED_OP_ADDW]     = &&threaded_ADDW,
+	    [DECODED_OP_SUBW]     = &&threaded_SUBW,
+	    [DECODED_OP_SLLW]     = &&threaded_SLLW,
+	    [DECODED_OP_SRLW]     = &&threaded_SRLW,
+	    [DECODED_OP_SRAW]     = &&threaded_SRAW,
+	    [DECODED_OP_MULW]     = &&threaded_MULW,
+	    [DECODED_OP_DIVW]     = &&threaded_DIVW,
+	    [DECODED_OP_DIVUW]    = &&threaded_DIVUW,
+	    [DECODED_OP_REMW]     = &&threaded_REMW,
+	    [DECODED_OP_REMUW]    = &&threaded_REMUW,
+	};
+
+	if (block == NULL) {
+		threaded_labels = labels;
+		return;
+	}
+#endif
+
+	uint64_t *const            registers   = current_hart->x;
+	uint64_t                   current_pc  = current_hart->pc;
+	const decoded_instruction *instruction = block->instructions;
+	const decoded_instruction *end         = instruction + block->count;
+
+#ifdef KOMPJUTA_COMPUTED_GOTO
+	THREADED_DISPATCH();
+#else
+	while (instruction != end) {
+		switch (instruction->op) {
+#endif
+
+	THREADED_CASE(FALLBACK) {
+		current_hart->pc = current_pc;
+		decoded_fallback(instruction);
+		current_pc = current_hart->pc;
+		++instruction;
+		if (current_hart->leave_block) {
+			goto threaded_done;
+		}
+		THREADED_DISPATCH();
+	}
+
+	THREADED_CASE(NOP) {
+		THREADED_NEXT();
+	}
+
+	THREADED_CASE(LUI) {
+		registers[instruction->rd] = (int64_t)instruction->immediate;
+		THREADED_NEXT();
+	}
+
+	THREADED_CASE(AUIPC) {
+		registers[instruction->rd] = current_pc + (int64_t)instruction->immediate;
+		THREADED_NEXT();
+	}
+
+	THREADED_CASE(JAL) {
+		if (instruction->rd != 0) {
+			registers[instruction->rd] = current_pc + decoded_size(instruction);
+		}
+		THREADED_JUMP(current_pc + (int64_t)instruction->immediate);
+	}
+
+	THREADED_CASE(JALR) {
+		uint64_t target = (registers[instruction->rs1] + (int64_t)instruction->immediate) & ~1ull;
+		if (instruction->rd != 0) {
+			registers[instruction->rd] = current_pc + decoded_size(instruction);
+		}
+		THREADED_JUMP(target);
+	}
+
+	THREADED_BRANCH(BEQ, a == b)
+	THREADED_BRANCH(BNE, a != b)
+	THREADED_BRANCH(BLT, (int64_t)a < (int64_t)b)
+	THREADED_BRANCH(BGE, (int64_t)a >= (int64_t)b)
+	THREADED_BRANCH(BLTU, a < b)
+	THREADED_BRANCH(BGEU, a >= b)
+
+	THREADED_LOAD(LB, (int64_t)(int8_t)read_memory8(address))
+	THREADED_LOAD(LH, (int64_t)(int16_t)read_memory16(address))
+	THREADED_LOAD(LW, (int64_t)(int32_t)read_memory32(address))
+	THREADED_LOAD(LD, read_memory64(address))
+	THREADED_LOAD(LBU, (uint8_t)read_memory8(address))
+	THREADED_LOAD(LHU, read_memory16(address))
+	THREADED_LOAD(LWU, read_memory32(address))
+
+	THREADED_STORE(SB, store_memory8(address, (uint8_t)value))
+	THREADED_STORE(SH, store_memory16(address, (uint16_t)value))
+	THREADED_STORE(SW, store_memory32(address, (uint32_t)value))
+	THREADED_STORE(SD, store_memory64(address, value))
+
+	THREADED_ALU_IMMEDIATE(ADDI, a + immediate)
+	THREADED_ALU_IMMEDIATE(SLTI, (int64_t)a < immediate ? 1 : 0)
+	THREADED_ALU_IMMEDIATE(SLTIU, a < (uint64_t)immediate ? 1 : 0)
+	THREADED_ALU_IMMEDIATE(XORI, a ^ immediate)
+	THREADED_ALU_IMMEDIATE(ORI, a | immediate)
+	THREADED_ALU_IMMEDIATE(ANDI, a & immediate)
+	THREADED_ALU_IMMEDIATE(SLLI, a << immediate)
+	THREADED_ALU_IMMEDIATE(SRLI, a >> immediate)
+	THREADED_ALU_IMMEDIATE(SRAI, (int64_t)a >> immediate)
+	THREADED_ALU(ADD, a + b)
+	THREADED_ALU(SUB, a - b)
+	THREADED_ALU(SLL, a << (b & 0x3f))
+	THREADED_ALU(SLT, (int64_t)a < (int64_t)b ? 1 : 0)
+	THREADED_ALU(SLTU, a < b ? 1 : 0)
+	THREADED_ALU(XOR, a ^ b)
+	THREADED_ALU(SRL, a >> (b & 0x3f))
+	THREADED_ALU(SRA, (int64_t)a >> (b & 0x3f))
+	THREADED_ALU(OR, a | b)
+	THREADED_ALU(AND, a & b)
+	THREADED_ALU(MUL, a * b)
+	THREADED_ALU(MULH, multiply_high_signed(a, b))
+	THREADED_ALU(MULHSU, multiply_high_signed_unsigned(a, b))
+	THREADED_ALU(MULHU, multiply_high_unsigned(a, b))
+	THREADED_ALU(DIV, divide_signed(a, b))
+	THREADED_ALU(DIVU, divide_unsigned(a, b))
+	THREADED_ALU(REM, remainder_signed(a, b))
+	THREADED_ALU(REMU, remainder_unsigned(a, b))
+	THREADED_ALU_IMMEDIATE(ADDIW, (int64_t)(int32_t)(a + immediate))
+	THREADED_ALU_IMMEDIATE(SLLIW, (int64_t)(int32_t)((uint32_t)a << immediate))
+	THREADED_ALU_IMMEDIATE(SRLIW, (int64_t)(int32_t)((uint32_t)a >> immediate))
+	THREADED_ALU_IMMEDIATE(SRAIW, (int64_t)((int32_t)a >> immediate))
+	THREADED_ALU(ADDW, (int64_t)(int32_t)(a + b))
+	THREADED_ALU(SUBW, (int64_t)(int32_t)(a - b))
+	THREADED_ALU(SLLW, (int64_t)(int32_t)((uint32_t)a << (b & 0x1f)))
+	THREADED_ALU(SRLW, (int64_t)(int32_t)((uint32_t)a >> (b & 0x1f)))
+	THREADED_ALU(SRAW, (int64_t)((int32_t)a >> (b & 0x1f)))
+	THREADED_ALU(MULW, (int64_t)(int32_t)(a * b))
+	THREADED_ALU(DIVW, divide_signed_word(a, b))
+	THREADED_ALU(DIVUW, divide_unsigned_word(a, b))
+	THREADED_ALU(REMW, remainder_signed_word(a, b))
+	THREADED_ALU(REMUW, remainder_unsigned_word(a, b))
+
+#ifndef KOMPJUTA_COMPUTED_GOTO
+		default:
+			assert(false);
+			break;
+		}
+	}
+#endif
+
+threaded_done:
+	current_hart->pc = current_pc;
+}
+
+#endif
+
+static bool jit_enabled = false;
+static bool jit_verify  = false;
+static bool lockstep    = false; // --lockstep checks every block against the reference, over --jit-verify
+
+static bool     report_mips              = false;
+static double   mips_report_time         = 0.0;
+static uint64_t mips_report_instructions = 0;
+static double   mips_report_wait_time    = 0.0;
+static double   emulation_wait_time      = 0.0;
+
+static bool        emulation_thread_enabled = false;
+static atomic_bool emulation_stop           = false;
+
+static const char *profile_path    = NULL;   // --profile writes the histogram there at exit
+static const char *sample_path     = NULL;   // --sample writes the sampled stacks there at exit
+static uint32_t    sample_interval = 100000; // instructions, rounded to blocks
+
+static const char *trace_path       = NULL; // --trace writes the commit log there
+static const char *trace_check_path = NULL; // --trace-check compares with a recorded one
+static bool        tracing          = false;
+static trace       commit_trace;
+
+static const char *save_snapshot_path    = NULL; // --save-snapshot writes the machine there at exit
+static const char *restore_snapshot_path = NULL; // --restore-snapshot starts from there instead of the program's entry
+static snapshot    restored_snapshot;
+
+static const char *disk_path          = NULL; // --disk is the block device's image
+static bool        disk_async_enabled = false;
+
+// Counted per block. Only the hart's own thread writes its counter, so there is no need for an atomic add.
+static void count_instructions(int64_t count) {
+	uint64_t executed = atomic_load_explicit(&current_hart->executed_instructions, memory_order_relaxed);
+	atomic_store_explicit(&current_hart->executed_instructions, executed + (uint64_t)count, memory_order_relaxed);
+}
+
+// A block that was left early did not run the instructions after the one that left it, and an
+// instruction that trapped did not retire either.
+static uint32_t unretired_instructions(const block *block) {
+	if (!current_hart->leave_block) {
+		return 0;
+	}
+
+	uint64_t pc = block->pc;
+	for (uint32_t index = 0; index < block->count; ++index) {
+		uint64_t next = pc + decoded_size(&block->instructions[index]);
+		if (current_hart->trapped ? pc == current_hart->mepc : next == current_hart->pc) {
+			return block->count - index - (current_hart->trapped ? 0 : 1);
+		}
+		pc = next;
+	}
+	return 0;
+}
+
+// Summed over all harts.
+static uint64_t executed_instructions(void) {
+	uint64_t executed = 0;
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		executed += atomic_load_explicit(&harts[hart_index].executed_instructions, memory_order_relaxed);
+	}
+	return executed;
+}
+
+static void interpret_block(const block *block) {
+#ifdef KOMPJUTA_THREADED_DISPATCH
+	execute_threaded(block);
+#else
+	for (uint32_t index = 0; index < block->count && !current_hart->leave_block; ++index) {
+		const decoded_instruction *instruction = &block->instructions[index];
+		instruction->handler(instruction);
+	}
+#endif
+}
+
+// Hot blocks are translated again once they reach JIT_THRESHOLD, blocks that failed
+// verification stay in the interpreter.
+static void drop_native_blocks(void) {
+	for (uint32_t block_index = 0; block_index < BLOCK_CACHE_SIZE; ++block_index) {
+		current_hart->blocks[block_index].native = NULL;
+		if (current_hart->blocks[block_index].executions != UINT32_MAX) {
+			current_hart->blocks[block_index].executions = 0;
+		}
+	}
+	jit_reset();
+}
+
+// Page flags that translated code depends on changed, every hart drops its blocks on its own
+// thread, where its code buffer lives.
+static void drop_all_native_blocks(void) {
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		atomic_store_explicit(&harts[hart_index].drop_native, true, memory_order_release);
+	}
+}
+
+static void compile_block(block *block) {
+	jit_func *native = jit_compile(block);
+	if (native == NULL) {
+		drop_native_blocks();
+		native = jit_compile(block);
+	}
+	block->native = native;
+}
+
+// Runs a translated block in the interpreter first, rolls its effects back, runs it again natively
+// and compares registers, pc and the stored memory. Blocks that touch MMIO or flagged pages or
+// contain untranslated instructions are not compared.
+static void verify_block(block *block) {
+	for (uint32_t index = 0; index < block->count; ++index) {
+		if (block->instructions[index].op == DECODED_OP_FALLBACK) {
+			current_hart->pc = block->native(current_hart);
+			return;
+		}
+	}
+
+	uint64_t start_registers[32];
+	memcpy(start_registers, current_hart->x, sizeof(current_hart->x));
+
+	store_journal_count    = 0;
+	store_journal_overflow = false;
+	store_journal_active   = true;
+	interpret_block(block);
+	store_journal_active = false;
+
+	if (current_hart->leave_block || store_journal_overflow) {
+		return;
+	}
+
+	uint64_t expected_pc = current_hart->pc;
+	uint64_t expected_registers[32];
+	memcpy(expected_registers, current_hart->x, sizeof(current_hart->x));
+
+	uint64_t expected_values[STORE_JOURNAL_SIZE] = {0};
+	for (uint32_t entry_index = 0; entry_index < store_journal_count; ++entry_index) {
+		memcpy(&expected_values[entry_index], guest_ram(store_journal[entry_index].address), store_journal[entry_index].size);
+	}
+	for (uint32_t entry_index = store_journal_count; entry_index > 0; --entry_index) {
+		store_journal_entry *entry = &store_journal[entry_index - 1];
+		memcpy(guest_ram(entry->address), &entry->old_value, entry->size);
+	}
+
+	memcpy(current_hart->x, start_registers, sizeof(current_hart->x));
+	current_hart->pc = block->native(current_hart);
+
+	bool matches = current_hart->pc == expected_pc;
+	if (!matches) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "JIT mismatch in block 0x%llx: next pc is 0x%llx, the interpreter got 0x%llx.", block->pc, current_hart->pc,
+		         expected_pc);
+	}
+	for (uint32_t reg = 0; reg < 32; ++reg) {
+		if (current_hart->x[reg] != expected_registers[reg]) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "JIT mismatch in block 0x%llx: x%u is 0x%llx, the interpreter got 0x%llx.", block->pc, reg, current_hart->x[reg],
+			         expected_registers[reg]);
+			matches = false;
+		}
+	}
+	for (uint32_t entry_index = 0; entry_index < store_journal_count; ++entry_index) {
+		store_journal_entry *entry = &store_journal[entry_index];
+		uint64_t             value = 0;
+		memcpy(&value, guest_ram(entry->address), entry->size);
+		if (value != expected_values[entry_index]) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "JIT mismatch in block 0x%llx: memory at 0x%llx is 0x%llx, the interpreter got 0x%llx.", block->pc, entry->address,
+			         value, expected_values[entry_index]);
+			matches = false;
+		}
+	}
+
+	if (!matches) {
+		// continue with the interpreter's results and never translate this block again
+		for (uint32_t entry_index = 0; entry_index < store_journal_count; ++entry_index) {
+			memcpy(guest_ram(store_journal[entry_index].address), &expected_values[entry_index], store_journal[entry_index].size);
+		}
+		memcpy(current_hart->x, expected_registers, sizeof(current_hart->x));
+		current_hart->pc  = expected_pc;
+		block->native     = NULL;
+		block->executions = UINT32_MAX;
+	}
+}
+
+// The reference of --lockstep: one instruction straight through opcodes[], without decoding,
+// blocks or translation. Compressed instructions run as their expansions, which leaves the
+// links and the fall-through of branches 2 bytes off.
+static void reference_step(void) {
+	uint64_t pc     = current_hart->pc;
+	uint16_t parcel = *(uint16_t *)&ram[pc];
+	if (!compressed_instruction(parcel)) {
+		execute_opcode();
+		return;
+	}
+
+	uint32_t instruction = compressed_expand(parcel);
+	uint8_t  opcode      = instruction & 0x7f;
+	uint8_t  rd          = (instruction >> 7) & 0x1f;
+	uint8_t  rs1         = (instruction >> 15) & 0x1f;
+
+	// c.beqz and c.bnez, a taken branch over 4 bytes would look like the fall-through
+	bool taken = (current_hart->x[rs1] == 0) == (((instruction >> 12) & 0x7) == 0x0);
+
+	opcodes[opcode](instruction);
+
+	switch (opcode) {
+	case 0x63:
+		if (!taken) {
+			current_hart->pc = pc + 2;
+		}
+		break;
+	case 0x67:
+	case 0x6f:
+		if (rd != 0) {
+			current_hart->x[rd] = pc + 2;
+		}
+		break;
+	default:
+		if (current_hart->pc == pc + 4) {
+			current_hart->pc -= 2;
+		}
+		break;
+	}
+}
+
+// Everything a block can change on its hart.
+typedef struct hart_state {
+	uint64_t x[32];
+	uint64_t pc;
+	uint64_t f[32];
+	uint8_t  frm;
+	uint8_t  fflags;
+	uint8_t  sew;
+	uint8_t  lmul;
+	uint8_t  lmuldiv;
+	uint16_t vl;
+	bool     reservation_valid;
+	uint64_t reservation_address;
+	uint64_t reservation_value;
+	vector   v[32];
+} hart_state;
+
+static void save_hart_state(hart_state *state) {
+	if (current_hart->float_flags_live) {
+		float_collect_flags(current_hart);
+	}
+	memcpy(state->x, current_hart->x, sizeof(state->x));
+	memcpy(state->f, current_hart->f, sizeof(state->f));
+	memcpy(state->v, current_hart->v, sizeof(state->v));
+	state->pc                  = current_hart->pc;
+	state->frm                 = current_hart->frm;
+	state->fflags              = current_hart->fflags;
+	state->sew                 = current_hart->sew;
+	state->lmul                = current_hart->lmul;
+	state->lmuldiv             = current_hart->lmuldiv;
+	state->vl                  = current_hart->vl;
+	state->reservation_valid   = current_hart->reservation_valid;
+	state->reservation_address = current_hart->reservation_address;
+	state->reservation_value   = current_hart->reservation_value;
+}
+
+static void load_hart_state(const hart_state *state) {
+	memcpy(current_hart->x, state->x, sizeof(state->x));
+	memcpy(current_hart->f, state->f, sizeof(state->f));
+	memcpy(current_hart->v, state->v, sizeof(state->v));
+	current_hart->pc                  = state->pc;
+	current_hart->frm                 = state->frm;
+	current_hart->fflags              = state->fflags;
+	current_hart->sew                 = state->sew;
+	current_hart->lmul                = state->lmul;
+	current_hart->lmuldiv             = state->lmuldiv;
+	current_hart->vl                  = state->vl;
+	current_hart->reservation_valid   = state->reservation_valid;
+	current_hart->reservation_address = state->reservation_address;
+	current_hart->reservation_value   = state->reservation_value;
+}
+
+// Logs the differences when asked to and returns whether there were none.
+static bool compare_hart_states(uint64_t pc, const hart_state *expected, const hart_state *actual, bool log) {
+	bool matches = true;
+
+	if (actual->pc != expected->pc) {
+		if (log) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: next pc is 0x%llx, the reference got 0x%llx.", pc, actual->pc, expected->pc);
+		}
+		matches = false;
+	}
+	for (uint32_t reg = 0; reg < 32; ++reg) {
+		if (actual->x[reg] != expected->x[reg]) {
+			if (log) {
+				kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: x%u is 0x%llx, the reference got 0x%llx.", pc, reg, actual->x[reg],
+				         expected->x[reg]);
+			}
+			matches = false;
+		}
+	}
+	for (uint32_t reg = 0; reg < 32; ++reg) {
+		if (actual->f[reg] != expected->f[reg]) {
+			if (log) {
+				kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: f%u is 0x%llx, the reference got 0x%llx.", pc, reg, actual->f[reg],
+				         expected->f[reg]);
+			}
+			matches = false;
+		}
+	}
+	for (uint32_t reg = 0; reg < 32; ++reg) {
+		if (memcmp(&actual->v[reg], &expected->v[reg], sizeof(vector)) != 0) {
+			if (log) {
+				kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: v%u differs from the reference.", pc, reg);
+			}
+			matches = false;
+		}
+	}
+	if (actual->frm != expected->frm || actual->fflags != expected->fflags) {
+		if (log) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: frm and fflags are %u and 0x%x, the reference got %u and 0x%x.", pc, actual->frm,
+			         actual->fflags, expected->frm, expected->fflags);
+		}
+		matches = false;
+	}
+	if (actual->sew != expected->sew || actual->lmul != expected->lmul || actual->lmuldiv != expected->lmuldiv || actual->vl != expected->vl) {
+		if (log) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: vl is %u at sew %u, the reference got %u at sew %u.", pc, actual->vl, actual->sew,
+			         expected->vl, expected->sew);
+		}
+		matches = false;
+	}
+	bool reservation_matches = actual->reservation_address == expected->reservation_address && actual->reservation_value == expected->reservation_value;
+	if (actual->reservation_valid != expected->reservation_valid || (actual->reservation_valid && !reservation_matches)) {
+		if (log) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: the LR reservation differs from the reference.", pc);
+		}
+		matches = false;
+	}
+
+	return matches;
+}
+
+// The stores of one run, with the values they left behind.
+typedef struct store_record {
+	uint32_t            count;
+	store_journal_entry entries[STORE_JOURNAL_SIZE];
+	uint64_t            values[STORE_JOURNAL_SIZE];
+} store_record;
+
+// Takes the journal entries from first on into the record and undoes them.
+static void take_stores(store_record *record, uint32_t first) {
+	record->count = store_journal_count - first;
+	for (uint32_t index = 0; index < record->count; ++index) {
+		store_journal_entry *entry = &store_journal[first + index];
+		record->entries[index]     = *entry;
+		record->values[index]      = 0;
+		memcpy(&record->values[index], guest_ram(entry->address), entry->size);
+	}
+	for (uint32_t entry_index = store_journal_count; entry_index > first; --entry_index) {
+		store_journal_entry *entry = &store_journal[entry_index - 1];
+		memcpy(guest_ram(entry->address), &entry->old_value, entry->size);
+	}
+	store_journal_count = first;
+}
+
+// Memory the reference stored has to hold its values, memory only the other run stored has to
+// be unchanged, RAM is at the other run's state.
+static bool compare_stores(uint64_t pc, const store_record *expected, uint32_t first, bool log) {
+	bool matches = true;
+
+	for (uint32_t index = 0; index < expected->count; ++index) {
+		const store_journal_entry *entry = &expected->entries[index];
+		uint64_t                   value = 0;
+		memcpy(&value, guest_ram(entry->address), entry->size);
+		if (value != expected->values[index]) {
+			if (log) {
+				kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: memory at 0x%llx is 0x%llx, the reference stored 0x%llx.", pc, entry->address,
+				         value, expected->values[index]);
+			}
+			matches = false;
+		}
+	}
+
+	for (uint32_t entry_index = first; entry_index < store_journal_count; ++entry_index) {
+		const store_journal_entry *entry  = &store_journal[entry_index];
+		bool                       stored = false;
+		for (uint32_t index = 0; index < expected->count && !stored; ++index) {
+			stored = expected->entries[index].address == entry->address && expected->entries[index].size == entry->size;
+		}
+		uint64_t value = 0;
+		memcpy(&value, guest_ram(entry->address), entry->size);
+		if (!stored && value != entry->old_value) {
+			if (log) {
+				kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep mismatch at 0x%llx: memory at 0x%llx is 0x%llx, the reference left it at 0x%llx.", pc, entry->address,
+				         value, entry->old_value);
+			}
+			matches = false;
+		}
+	}
+
+	return matches;
+}
+
+// How the block runs without lockstep, translated or interpreted.
+static void run_block(const block *block) {
+	if (block->native != NULL) {
+		current_hart->pc = block->native(current_hart);
+	}
+	else {
+		interpret_block(block);
+	}
+}
+
+// The instruction at pc as it is in memory, compressed ones as their 16 bits.
+static uint32_t instruction_bits(uint64_t pc, uint8_t *size) {
+	uint16_t parcel = *(uint16_t *)&ram[pc];
+	if (compressed_instruction(parcel)) {
+		*size = 2;
+		return parcel;
+	}
+	*size = 4;
+	return *(uint32_t *)&ram[pc];
+}
+
+static hart_state   lockstep_start;
+static hart_state   lockstep_expected;
+static hart_state   lockstep_actual;
+static store_record lockstep_stores;
+
+// Goes through the block again from its start, one decoded handler against one reference step,
+// to name the first instruction that differs. RAM and the hart are at the block's start and
+// are left somewhere inside of it.
+static void find_divergent_instruction(const block *block) {
+	uint64_t pc = current_hart->pc;
+
+	for (uint32_t index = 0; index < block->count; ++index) {
+		const decoded_instruction *instruction = &block->instructions[index];
+		uint32_t                   first       = store_journal_count;
+
+		save_hart_state(&lockstep_start);
+		store_journal_active = true;
+		reference_step();
+		store_journal_active = false;
+		save_hart_state(&lockstep_expected);
+		take_stores(&lockstep_stores, first);
+
+		load_hart_state(&lockstep_start);
+		store_journal_active = true;
+		instruction->handler(instruction);
+		store_journal_active = false;
+		save_hart_state(&lockstep_actual);
+
+		if (current_hart->leave_block || store_journal_overflow) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep could not step through the block at 0x%llx.", block->pc);
+			return;
+		}
+
+		bool matches = compare_hart_states(pc, &lockstep_expected, &lockstep_actual, false);
+		matches      = compare_stores(pc, &lockstep_stores, first, false) && matches;
+		if (!matches) {
+			uint8_t  size;
+			uint32_t bits = instruction_bits(pc, &size);
+			kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep: the first divergent instruction is 0x%0*x at 0x%llx, its decoded handler differs from the reference.",
+			         size * 2, bits, pc);
+			compare_hart_states(pc, &lockstep_expected, &lockstep_actual, true);
+			compare_stores(pc, &lockstep_stores, first, true);
+			return;
+		}
+
+		pc = current_hart->pc;
+	}
+
+	kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep: one by one the decoded handlers agree with the reference, the %s of the block at 0x%llx is at fault.",
+	         block->native != NULL ? "translated code" : "threaded dispatch", block->pc);
+}
+
+// Runs the block on the reference first and then again the way it runs otherwise, translated
+// or interpreted, from the same state, like verify_block does for the JIT. Blocks that leave
+// early, at MMIO, self-modifying code or a fault, keep the reference's results, blocks with
+// SYSTEM instructions are run once as those read clocks. The first mismatch halts the hart on
+// the reference's results.
+static void lockstep_block(block *block) {
+	for (uint32_t index = 0; index < block->count; ++index) {
+		if (block->instructions[index].op == DECODED_OP_FALLBACK && (block->instructions[index].instruction & 0x7f) == 0x73) {
+			run_block(block);
+			return;
+		}
+	}
+
+	save_hart_state(&lockstep_start);
+
+	store_journal_count    = 0;
+	store_journal_overflow = false;
+	store_journal_active   = true;
+	for (uint32_t index = 0; index < block->count && !current_hart->leave_block; ++index) {
+		reference_step();
+	}
+	store_journal_active = false;
+
+	if (current_hart->leave_block || store_journal_overflow) {
+		return;
+	}
+
+	save_hart_state(&lockstep_expected);
+	take_stores(&lockstep_stores, 0);
+	load_hart_state(&lockstep_start);
+
+	store_journal_active = true;
+	run_block(block);
+	store_journal_active = false;
+
+	if (store_journal_overflow) {
+		return;
+	}
+
+	save_hart_state(&lockstep_actual);
+	bool matches = compare_hart_states(block->pc, &lockstep_expected, &lockstep_actual, true);
+	matches      = compare_stores(block->pc, &lockstep_stores, 0, true) && matches;
+	if (matches) {
+		return;
+	}
+
+	// back to the start for the search, then on with the reference's results
+	store_record reference_stores = lockstep_stores;
+	hart_state   expected         = lockstep_expected;
+	take_stores(&lockstep_stores, 0);
+	load_hart_state(&lockstep_start);
+	current_hart->leave_block = false;
+
+	find_divergent_instruction(block);
+
+	take_stores(&lockstep_stores, 0);
+	for (uint32_t index = 0; index < reference_stores.count; ++index) {
+		memcpy(guest_ram(reference_stores.entries[index].address), &reference_stores.values[index], reference_stores.entries[index].size);
+	}
+	load_hart_state(&expected);
+
+	kore_log(KORE_LOG_LEVEL_ERROR, "Lockstep diverged in the block at 0x%llx, hart %u is halted.", block->pc, current_hart->id);
+	current_hart->halted      = true;
+	current_hart->leave_block = true;
+}
+
+static_assert(TRACE_MAX_STORES >= STORE_JOURNAL_SIZE, "a trace record takes every store of the journal");
+
+static void record_write(trace_record *record, char file, uint32_t index, uint64_t value) {
+	if (record->write_count < TRACE_MAX_WRITES) {
+		trace_register_write *write = &record->writes[record->write_count++];
+		write->file                 = file;
+		write->index                = (uint8_t)index;
+		write->value                = value;
+	}
+}
+
+// Integer destinations come from the encoding, so writes of an unchanged value are logged like
+// Spike logs them. Everything else, floating point registers and integer results of floating
+// point instructions, is found by what changed.
+static void record_writes(trace_record *record, uint32_t instruction, const uint64_t *x, const uint64_t *f) {
+	uint8_t opcode = instruction & 0x7f;
+	uint8_t rd     = (instruction >> 7) & 0x1f;
+
+	bool integer_destination = opcode == 0x03 || opcode == 0x13 || opcode == 0x17 || opcode == 0x1b || opcode == 0x2f || opcode == 0x33 || opcode == 0x37 ||
+	                           opcode == 0x3b || opcode == 0x67 || opcode == 0x6f || (opcode == 0x73 && ((instruction >> 12) & 0x7) != 0);
+	if (integer_destination) {
+		if (rd != 0) {
+			record_write(record, 'x', rd, current_hart->x[rd]);
+		}
+	}
+	else {
+		for (uint32_t reg = 1; reg < 32; ++reg) {
+			if (current_hart->x[reg] != x[reg]) {
+				record_write(record, 'x', reg, current_hart->x[reg]);
+			}
+		}
+	}
+
+	for (uint32_t reg = 0; reg < 32; ++reg) {
+		if (current_hart->f[reg] != f[reg]) {
+			record_write(record, 'f', reg, current_hart->f[reg]);
+		}
+	}
+}
+
+// With --trace and --trace-check blocks run one decoded handler at a time, each instruction
+// recorded with the registers it wrote and the stores the journal saw.
+static void trace_block(const block *block) {
+	for (uint32_t index = 0; index < block->count && !current_hart->leave_block; ++index) {
+		const decoded_instruction *instruction = &block->instructions[index];
+
+		trace_record record;
+		record.hart        = current_hart->id;
+		record.pc          = current_hart->pc;
+		record.instruction = instruction_bits(record.pc, &record.size);
+		record.write_count = 0;
+		record.store_count = 0;
+
+		uint64_t x[32];
+		uint64_t f[32];
+		memcpy(x, current_hart->x, sizeof(x));
+		memcpy(f, current_hart->f, sizeof(f));
+
+		store_journal_count    = 0;
+		store_journal_overflow = false;
+		store_journal_active   = true;
+		instruction->handler(instruction);
+		store_journal_active = false;
+
+		if (current_hart->halted) {
+			return;
+		}
+
+		if (current_hart->float_flags_live) {
+			float_collect_flags(current_hart);
+		}
+
+		record_writes(&record, record.size == 2 ? compressed_expand((uint16_t)record.instruction) : record.instruction, x, f);
+		for (uint32_t entry_index = 0; entry_index < store_journal_count; ++entry_index) {
+			trace_store *store = &record.stores[record.store_count++];
+			store->address     = store_journal[entry_index].address;
+			store->size        = store_journal[entry_index].size;
+			store->value       = 0;
+			memcpy(&store->value, guest_ram(store->address), store->size);
+		}
+
+		if (trace_path != NULL) {
+			trace_write(&commit_trace, &record);
+		}
+		else if (!trace_check(&commit_trace, &record)) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Hart %u is halted at the first divergence from the trace.", current_hart->id);
+			current_hart->halted      = true;
+			current_hart->leave_block = true;
+			return;
+		}
+	}
+}
+
+// The block ended right after the load or store that faulted, every core leaves the pc at the
+// instruction after it.
+static void take_access_fault(const block *block) {
+	uint64_t pc = block->pc;
+	for (uint32_t index = 0; index < block->count && pc + decoded_size(&block->instructions[index]) != current_hart->pc; ++index) {
+		pc += decoded_size(&block->instructions[index]);
+	}
+
+	uint64_t cause            = current_hart->fault_cause;
+	current_hart->fault_cause = 0;
+	current_hart->pc          = pc;
+	enter_trap(cause, current_hart->fault_address);
+}
+
+static void execute_block(void) {
+	if (current_hart->waiting || ((current_hart->mstatus & MSTATUS_MIE) != 0 && current_hart->mie != 0)) {
+		if (!check_interrupts()) {
+			return;
+		}
+	}
+
+	// code is only run from the main RAM, which is what blocks and the page flags cover
+	if (current_hart->pc > memory_size - 2 || (page_flags[current_hart->pc >> MEMORY_PAGE_SHIFT] & PAGE_FLAG_ALIAS) != 0) {
+		access_fault(EXCEPTION_INSTRUCTION_ACCESS_FAULT, current_hart->pc, "Instruction");
+		return;
+	}
+
+	if (atomic_load_explicit(&current_hart->drop_native, memory_order_relaxed) && atomic_exchange_explicit(&current_hart->drop_native, false, memory_order_acquire)) {
+		drop_native_blocks();
+	}
+
+	block *block = &current_hart->blocks[(current_hart->pc >> 1) & (BLOCK_CACHE_SIZE - 1)];
+	if (block->pc != current_hart->pc || block->count == 0) {
+		decode_block(block, current_hart->pc);
+	}
+
+	current_hart->leave_block = false;
+	current_hart->trapped     = false;
+
+	// up front so that a counter read in the block sees the instructions before it, what did not
+	// retire is taken back once the block ran
+	count_instructions(block->count);
+	++current_hart->events[HART_EVENT_BLOCKS];
+	if (profile_path != NULL) {
+		profile_count(&current_hart->profile, block->pc, block->count);
+	}
+	if (sample_path != NULL) {
+		if (current_hart->sample_countdown <= block->count) {
+			sampler_sample(&current_hart->sampler, current_hart->x, block->pc);
+			current_hart->sample_countdown = sample_interval;
+		}
+		else {
+			current_hart->sample_countdown -= block->count;
+		}
+	}
+
+	if (tracing) {
+		trace_block(block);
+	}
+	else if (block->native != NULL) {
+		++current_hart->events[HART_EVENT_TRANSLATED_BLOCKS];
+		if (lockstep) {
+			lockstep_block(block);
+		}
+		else if (jit_verify) {
+			verify_block(block);
+		}
+		else {
+			current_hart->pc = block->native(current_hart);
+		}
+	}
+	else {
+		if (lockstep) {
+			lockstep_block(block);
+		}
+		else {
+			interpret_block(block);
+		}
+
+		// blocks the verification rejected stay at UINT32_MAX
+		if (jit_enabled && block->count != 0 && block->executions < JIT_THRESHOLD && ++block->executions == JIT_THRESHOLD) {
+			compile_block(block);
+		}
+	}
+
+	if (current_hart->fault_cause != 0) {
+		take_access_fault(block);
+	}
+	count_instructions(-(int64_t)unretired_instructions(block));
+
+	// the emulator's own floating point math must not end up in fflags
+	if (current_hart->float_flags_live) {
+		float_collect_flags(current_hart);
+	}
+}
+
+static void run_until_present(void) {
+	while (!framebuffer_present && !command_list_present && !current_hart->halted && !atomic_load_explicit(&emulation_stop, memory_order_relaxed)) {
+		execute_block();
+
+		// on the render thread wfi ends the frame, the vsync it might wait for comes after it
+		if (current_hart->waiting && !emulation_thread_enabled) {
+			break;
+		}
+	}
+}
+
+// With --harts every hart after the first runs on a thread of its own from the start on, over
+// the same RAM. Each hart keeps its own block cache, TLB and translated code, so code another
+// hart wrote only becomes visible after a fence.i, which is what the ISA asks for anyway.
+// Presenting and the GPU are left to the first hart.
+
+static kore_thread hart_threads[MAX_HARTS];
+static atomic_bool harts_stop = false;
+
+static void reset_harts(uint64_t entry) {
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		hart *hart  = &harts[hart_index];
+		hart->id    = hart_index;
+		hart->pc    = entry;
+		hart->x[10] = hart_index; // a0 holds the hart id, like SBI firmware passes it
+		atomic_store_explicit(&hart->mtimecmp, UINT64_MAX, memory_order_relaxed);
+		kore_event_init(&hart_wakeups[hart_index], true);
+
+		hart->blocks = (block *)calloc(BLOCK_CACHE_SIZE, sizeof(block));
+		assert(hart->blocks != NULL);
+	}
+}
+
+static void release_harts(void) {
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		free(harts[hart_index].blocks);
+		harts[hart_index].blocks = NULL;
+		profile_release(&harts[hart_index].profile);
+		sampler_release(&harts[hart_index].sampler);
+		kore_event_destroy(&hart_wakeups[hart_index]);
+	}
+}
+
+// Once all harts stopped.
+static void write_profile(void) {
+	if (profile_path == NULL) {
+		return;
+	}
+
+	profile profiles[MAX_HARTS];
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		profiles[hart_index] = harts[hart_index].profile;
+	}
+	if (profile_write(profiles, hart_count, profile_path)) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Wrote the profile to %s.", profile_path);
+	}
+}
+
+// Once all harts stopped.
+static void write_samples(void) {
+	if (sample_path == NULL) {
+		return;
+	}
+
+	sampler samplers[MAX_HARTS];
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		samplers[hart_index] = harts[hart_index].sampler;
+	}
+	if (sampler_write(samplers, hart_count, sample_path)) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Wrote the sampled stacks to %s.", sample_path);
+	}
+}
+
+// Once all harts stopped.
+static void save_snapshot(void) {
+	if (save_snapshot_path == NULL) {
+		return;
+	}
+
+	// with --framebuffer-alias the framebuffer's pages live in the GPU buffer, RAM under them is stale
+	for (uint64_t page = 0; page < memory_size >> MEMORY_PAGE_SHIFT; ++page) {
+		if ((page_flags[page] & PAGE_FLAG_ALIAS) != 0) {
+			memcpy(&ram[page << MEMORY_PAGE_SHIFT], guest_ram(page << MEMORY_PAGE_SHIFT), MEMORY_PAGE_SIZE);
+		}
+	}
+
+	snapshot_machine machine = {
+	    .memory_size          = memory_size,
+	    .hart_count           = hart_count,
+	    .framebuffer_width    = framebuffer_width,
+	    .framebuffer_height   = framebuffer_height,
+	    .framebuffer_stride   = framebuffer_stride,
+	    .framebuffer_address  = framebuffer_address,
+	    .command_list_address = command_list_address,
+	    .command_list_size    = command_list_size,
+	    .command_ring_address = atomic_load(&command_ring_address),
+	    .command_ring_size    = atomic_load(&command_ring_size),
+	    .command_ring_head    = atomic_load(&command_ring_head),
+	    .command_ring_tail    = atomic_load(&command_ring_tail),
+	    .command_ring_fence   = atomic_load(&command_ring_fence),
+	    .vsync_count          = atomic_load(&vsync_count),
+	    .block_queue_address  = atomic_load(&block_queue_address),
+	    .block_queue_size     = atomic_load(&block_queue_size),
+	    .block_queue_head     = block_device_completed(),
+	    .time                 = read_time(),
+	};
+	memcpy(machine.blitter_registers, blitter_registers, sizeof(blitter_registers));
+	if (snapshot_save(save_snapshot_path, &machine, harts, ram)) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Wrote a snapshot after %llu instructions to %s.", executed_instructions(), save_snapshot_path);
+	}
+}
+
+// Once the host decided on its framebuffer, the registers the guest wrote come back.
+static void restore_system_device(void) {
+	if (restore_snapshot_path == NULL) {
+		return;
+	}
+
+	const snapshot_machine *machine = &restored_snapshot.machine;
+	if (machine->framebuffer_width != framebuffer_width || machine->framebuffer_height != framebuffer_height ||
+	    machine->framebuffer_stride != framebuffer_stride) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "The snapshot was taken with a %ux%u framebuffer of stride %u, the guest now gets %ux%u of stride %u.",
+		         machine->framebuffer_width, machine->framebuffer_height, machine->framebuffer_stride, framebuffer_width, framebuffer_height,
+		         framebuffer_stride);
+	}
+
+	framebuffer_address  = machine->framebuffer_address;
+	command_list_address = machine->command_list_address;
+	command_list_size    = machine->command_list_size;
+	atomic_store(&command_ring_address, machine->command_ring_address);
+	atomic_store(&command_ring_size, machine->command_ring_size);
+	atomic_store(&command_ring_head, machine->command_ring_head);
+	atomic_store(&command_ring_tail, machine->command_ring_tail);
+	atomic_store(&command_ring_fence, machine->command_ring_fence);
+	atomic_store(&vsync_count, machine->vsync_count);
+	memcpy(blitter_registers, machine->blitter_registers, sizeof(blitter_registers));
+	atomic_store(&block_queue_address, machine->block_queue_address);
+	atomic_store(&block_queue_size, machine->block_queue_size);
+	atomic_store(&block_queue_tail, machine->block_queue_head);
+	block_device_set_completed(machine->block_queue_head);
+}
+
+static void close_trace(void) {
+	if (!tracing) {
+		return;
+	}
+
+	if (trace_path != NULL) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Wrote %llu instructions to the trace %s.", commit_trace.records, trace_path);
+	}
+	else {
+		kore_log(KORE_LOG_LEVEL_INFO, "Checked %llu instructions against the trace %s.", commit_trace.records, trace_check_path);
+	}
+	trace_close(&commit_trace);
+}
+
+// Binds the calling thread to a hart, before the thread runs any of its blocks.
+static void enter_hart(hart *hart) {
+	current_hart = hart;
+	tlb_flush();
+	if (jit_enabled) {
+		jit_init();
+	}
+}
+
+static void run_hart(void *data) {
+	enter_hart((hart *)data);
+	while (!current_hart->halted && !atomic_load_explicit(&harts_stop, memory_order_relaxed)) {
+		execute_block();
+	}
+}
+
+static void start_harts(void) {
+	kore_event_init(&command_ring_progress, true);
+	for (uint32_t hart_index = 1; hart_index < hart_count; ++hart_index) {
+		kore_thread_init(&hart_threads[hart_index], run_hart, &harts[hart_index]);
+	}
+}
+
+static void stop_harts(void) {
+	atomic_store_explicit(&harts_stop, true, memory_order_relaxed);
+	kore_event_signal(&command_ring_progress);
+	for (uint32_t hart_index = 1; hart_index < hart_count; ++hart_index) {
+		wake_hart(&harts[hart_index]);
+		kore_thread_wait_and_destroy(&hart_threads[hart_index]);
+	}
+	kore_event_destroy(&command_ring_progress);
+}
+
+static bool any_hart_halted(void) {
+	for (uint32_t hart_index = 0; hart_index < hart_count; ++hart_index) {
+		if (harts[hart_index].halted) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool read_magic_number(uint8_t *binary, uint64_t *offset) {
+	bool value = binary[*offset + 0] == 0x7f && binary[*offset + 1] == 0x45 && binary[*offset + 2] == 0x4c && binary[*offset + 3] == 0x46;
+	*offset += 4;
+	return value;
+}
+
+uint8_t read_uint8(uint8_t *binary, uint64_t *offset) {
+	uint8_t value = binary[*offset];
+	*offset += 1;
+	return value;
+}
+
+uint16_t read_uint16(uint8_t *binary, uint64_t *offset) {
+	uint16_t value = *(uint16_t *)&binary[*offset];
+	*offset += 2;
+	return value;
+}
+
+uint32_t read_uint32(uint8_t *binary, uint64_t *offset) {
+	uint32_t value = *(uint32_t *)&binary[*offset];
+	*offset += 4;
+	return value;
+}
+
+uint64_t read_uint64(uint8_t *binary, uint64_t *offset) {
+	uint64_t value = *(uint64_t *)&binary[*offset];
+	*offset += 8;
+	return value;
 }
 
 static uint64_t program_header_offset;
 static uint16_t program_header_entry_size;
 static uint16_t program_header_entry_count;
 
-uint64_t entry;
+static uint64_t section_header_offset;
+static uint16_t section_header_entry_size;
+static uint16_t section_header_entry_count;
+
+uint64_t entry;
+
+static void read_header(uint8_t *binary) {
+	uint64_t offset = 0;
+
+	read_magic_number(binary, &offset);
+
+	uint8_t width = read_uint8(binary, &offset);
+	assert(width == 2);
+
+	uint8_t endianess = read_uint8(binary, &offset);
+	assert(endianess == 1);
+
+	uint8_t ident_version = read_uint8(binary, &offset);
+	assert(ident_version == 1);
+
+	uint8_t abi = read_uint8(binary, &offset);
+	assert(abi == 0);
+
+	uint8_t abi_version = read_uint8(binary, &offset);
+	assert(abi_version == 0);
+
+	offset += 7;
+
+	uint16_t object_type = read_uint16(binary, &offset);
+	assert(object_type == 0x2);
+
+	uint16_t machine = read_uint16(binary, &offset);
+	assert(machine == 0xf3);
+
+	uint32_t elf_version = read_uint32(binary, &offset);
+	assert(elf_version == 1);
+
+	entry = read_uint64(binary, &offset);
+
+	program_header_offset = read_uint64(binary, &offset);
+
+	section_header_offset = read_uint64(binary, &offset);
+
+	uint32_t flags = read_uint32(binary, &offset);
+
+	uint32_t header_size = read_uint16(binary, &offset);
+
+	program_header_entry_size = read_uint16(binary, &offset);
+
+	program_header_entry_count = read_uint16(binary, &offset);
+
+	section_header_entry_size = read_uint16(binary, &offset);
+
+	section_header_entry_count = read_uint16(binary, &offset);
+
+	uint16_t section_header_names_entry_index = read_uint16(binary, &offset);
+}
+
+// Whole host pages of a segment are mapped from the file copy-on-write, so instances of the
+// same program share them until they are written. The partial pages at the ends are copied,
+// they can share a page with the neighbouring segment, and the rest of the segment is left
+// alone, fresh RAM is already zero.
+static void read_loadable_segments(uint8_t *binary, uint64_t binary_size, FILE *file) {
+	uint64_t page_size      = ram_host_page_size();
+	uint64_t mapped_bytes   = 0;
+	uint64_t copied_bytes   = 0;
+	uint8_t *program_header = &binary[program_header_offset];
+	for (uint16_t program_header_index = 0; program_header_index < program_header_entry_count; ++program_header_index) {
+		uint8_t *program_header_entry = &program_header[program_header_index * program_header_entry_size];
+
+		uint64_t offset       = 0;
+		uint32_t program_type = read_uint32(program_header_entry, &offset);
+		if (program_type == 0x1) {
+			uint32_t flags            = read_uint32(program_header_entry, &offset);
+			uint64_t file_offset      = read_uint64(program_header_entry, &offset);
+			uint64_t virtual_address  = read_uint64(program_header_entry, &offset);
+			uint64_t physical_address = read_uint64(program_header_entry, &offset);
+			uint64_t file_size        = read_uint64(program_header_entry, &offset);
+			uint64_t segment_size     = read_uint64(program_header_entry, &offset);
+			uint64_t alignment        = read_uint64(program_header_entry, &offset);
+
+			kore_log(KORE_LOG_LEVEL_INFO, "Setting up a memory area from 0x%x to 0x%x.", virtual_address, virtual_address + segment_size);
+			assert(virtual_address + segment_size <= memory_size);
+			assert(file_size <= segment_size && file_offset + file_size <= binary_size);
+
+			uint64_t start = (virtual_address + page_size - 1) & ~(page_size - 1);
+			uint64_t end   = (virtual_address + file_size) & ~(page_size - 1);
+
+			// segments without a whole page and segments aligned to less than a host page, which
+			// sit at other page offsets in the file, are copied as a whole
+			if ((virtual_address - file_offset) % page_size != 0 || start >= end ||
+			    !ram_map_file(&ram[start], end - start, file, file_offset + (start - virtual_address))) {
+				memcpy(&ram[virtual_address], &binary[file_offset], file_size);
+				copied_bytes += file_size;
+				continue;
+			}
+
+			memcpy(&ram[virtual_address], &binary[file_offset], start - virtual_address);
+			memcpy(&ram[end], &binary[file_offset + (end - virtual_address)], virtual_address + file_size - end);
+			mapped_bytes += end - start;
+			copied_bytes += file_size - (end - start);
+		}
+	}
+
+	kore_log(KORE_LOG_LEVEL_INFO, "Mapped %llu KiB of the program and copied %llu bytes.", (unsigned long long)(mapped_bytes / 1024),
+	         (unsigned long long)copied_bytes);
+}
 
-static void read_header(uint8_t *binary) {
-	uint64_t offset = 0;
+// Function and label symbols of .symtab, for the profiles. Binaries without sections or
+// without a symbol table just have no symbols.
+// Whether size bytes at offset lie within the file, without overflowing.
+static bool in_binary(uint64_t offset, uint64_t size, uint64_t binary_size) {
+	return offset <= binary_size && size <= binary_size - offset;
+}
 
-	read_magic_number(binary, &offset);
+// Symbols are only a help for profiles and traces, a symbol table that points outside of the
+// file is skipped with a warning.
+static void read_symbols(uint8_t *binary, uint64_t binary_size) {
+	if (section_header_offset == 0) {
+		return;
+	}
 
-	uint8_t width = read_uint8(binary, &offset);
-	assert(width == 2);
+	if (section_header_entry_size < 64 || !in_binary(section_header_offset, (uint64_t)section_header_entry_count * section_header_entry_size, binary_size)) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "The section headers lie outside of the program, it has no symbols.");
+		return;
+	}
 
-	uint8_t endianess = read_uint8(binary, &offset);
-	assert(endianess == 1);
+	uint8_t *section_header = &binary[section_header_offset];
+	for (uint16_t section_index = 0; section_index < section_header_entry_count; ++section_index) {
+		uint8_t *section_header_entry = &section_header[section_index * section_header_entry_size];
 
-	uint8_t ident_version = read_uint8(binary, &offset);
-	assert(ident_version == 1);
+		uint64_t offset       = 4;
+		uint32_t section_type = read_uint32(section_header_entry, &offset);
+		if (section_type != 0x2) { // SHT_SYMTAB
+			continue;
+		}
 
-	uint8_t abi = read_uint8(binary, &offset);
-	assert(abi == 0);
+		offset                     = 24;
+		uint64_t file_offset       = read_uint64(section_header_entry, &offset);
+		uint64_t section_size      = read_uint64(section_header_entry, &offset);
+		uint32_t string_section    = read_uint32(section_header_entry, &offset);
+		offset                     = 56;
+		uint64_t symbol_entry_size = read_uint64(section_header_entry, &offset);
 
-	uint8_t abi_version = read_uint8(binary, &offset);
-	assert(abi_version == 0);
+		if (string_section >= section_header_entry_count || symbol_entry_size < 24 || !in_binary(file_offset, section_size, binary_size)) {
+			kore_log(KORE_LOG_LEVEL_WARNING, "Skipping the malformed symbol table in section %u.", section_index);
+			continue;
+		}
+
+		offset                     = 24;
+		uint8_t    *string_entry   = &section_header[string_section * section_header_entry_size];
+		uint64_t    strings_offset = read_uint64(string_entry, &offset);
+		uint64_t    strings_size   = read_uint64(string_entry, &offset);
+		const char *strings        = (const char *)&binary[strings_offset];
+
+		if (!in_binary(strings_offset, strings_size, binary_size)) {
+			kore_log(KORE_LOG_LEVEL_WARNING, "Skipping the symbol table in section %u, its strings lie outside of the program.", section_index);
+			continue;
+		}
+
+		// the first entry is the reserved empty symbol
+		for (uint64_t symbol_offset = symbol_entry_size; symbol_offset + symbol_entry_size <= section_size; symbol_offset += symbol_entry_size) {
+			uint8_t *symbol_entry = &binary[file_offset + symbol_offset];
+
+			offset                     = 0;
+			uint32_t name              = read_uint32(symbol_entry, &offset);
+			uint8_t  info              = read_uint8(symbol_entry, &offset);
+			offset += 1; // st_other
+			uint16_t section_reference = read_uint16(symbol_entry, &offset);
+			uint64_t value             = read_uint64(symbol_entry, &offset);
+			uint64_t size              = read_uint64(symbol_entry, &offset);
+
+			// names have to end within the string table
+			if (name >= strings_size || memchr(&strings[name], '\0', strings_size - name) == NULL) {
+				continue;
+			}
+
+			// STT_NOTYPE and STT_FUNC only, without undefined symbols, local labels and the
+			// $x and $d mapping symbols
+			const char *symbol_name = &strings[name];
+			uint8_t     type        = info & 0xf;
+			if (section_reference == 0 || (type != 0 && type != 2) || symbol_name[0] == '\0' || symbol_name[0] == '$' || strncmp(symbol_name, ".L", 2) == 0) {
+				continue;
+			}
+
+			symbols_add(symbol_name, value, size);
+		}
+	}
+}
+
+static kore_gpu_device       device;
+static kore_gpu_command_list list;
+static kore_gpu_buffer       framebuffer_buffer;
+
+static const int width  = 800;
+static const int height = 600;
+
+// Guest command lists point at vertices, indices and shader names. The commands are executed
+// against data, which is RAM itself or, on the emulation thread, a copy of what the commands
+// point at that was taken when the guest submitted them.
+
+#define SHADER_NAME_SIZE 64
+
+// The buffers and the pipeline that draws use, set by the commands before them.
+typedef struct draw_state {
+	bool                  rendering; // a render pass on the framebuffer is open
+	bool                  index_buffer_set;
+	bool                  vertex_buffer_set;
+	gpu_pipeline          pipeline;
+	rasterizer_pipeline   raster_pipeline; // of --headless
+	uint64_t              index_address;
+	kore_gpu_index_format index_format;
+	uint64_t              vertex_address;
+	uint64_t              vertex_stride;
+} draw_state;
+
+static bool pipeline_warning_logged = false;
+static bool draw_warning_logged     = false;
+
+static uint64_t guest_address(const void *pointer) {
+	return (uint64_t)(uintptr_t)pointer;
+}
+
+static uint32_t index_size(kore_gpu_index_format format) {
+	return format == KORE_GPU_INDEX_FORMAT_UINT16 ? 2 : 4;
+}
+
+static void set_index_buffer(draw_state *state, const kompjuta_gpu_command *command) {
+	// anything but 16 bit indices is taken as 32 bit
+	kore_gpu_index_format format = command->data.set_index_buffer.index_format;
+	state->index_address         = guest_address(command->data.set_index_buffer.data);
+	state->index_format          = format == KORE_GPU_INDEX_FORMAT_UINT16 ? format : KORE_GPU_INDEX_FORMAT_UINT32;
+	state->index_buffer_set      = true;
+}
+
+static void set_vertex_buffer(draw_state *state, const kompjuta_gpu_command *command) {
+	state->vertex_address    = guest_address(command->data.set_vertex_buffer.data);
+	state->vertex_stride     = command->data.set_vertex_buffer.stride;
+	state->vertex_buffer_set = true;
+}
+
+// What an indexed draw reads, the bytes of the index buffer up to its last index and the
+// vertices up to the highest one it uses. Returns false for draws that read outside of data,
+// also below the vertex buffer through a negative base_vertex, or draw nothing.
+static bool measure_draw(const uint8_t *data, uint64_t data_size, const draw_state *state, const kompjuta_gpu_command *command, uint64_t *index_bytes,
+                         uint32_t *vertex_count) {
+	uint32_t index_count = command->data.draw_indexed.index_count;
+	uint32_t first_index = command->data.draw_indexed.first_index;
+	if (!state->index_buffer_set || !state->vertex_buffer_set || index_count == 0 || command->data.draw_indexed.instance_count == 0) {
+		return false;
+	}
+
+	uint32_t size = index_size(state->index_format);
+	uint64_t end  = ((uint64_t)first_index + index_count) * size;
+	if (state->index_address > data_size || end > data_size - state->index_address) {
+		return false;
+	}
+
+	const uint8_t *indices = &data[state->index_address];
+	uint32_t       lowest  = UINT32_MAX;
+	uint32_t       highest = 0;
+	for (uint64_t index_offset = (uint64_t)first_index * size; index_offset < end; index_offset += size) {
+		uint32_t index = 0;
+		if (size == 2) {
+			uint16_t short_index;
+			memcpy(&short_index, &indices[index_offset], sizeof(short_index));
+			index = short_index;
+		}
+		else {
+			memcpy(&index, &indices[index_offset], sizeof(index));
+		}
+		lowest  = index < lowest ? index : lowest;
+		highest = index > highest ? index : highest;
+	}
+
+	int64_t  first_vertex = (int64_t)lowest + command->data.draw_indexed.base_vertex;
+	int64_t  last_vertex  = (int64_t)highest + command->data.draw_indexed.base_vertex;
+	uint64_t stride       = state->vertex_stride;
+	if (first_vertex < 0 || last_vertex >= UINT32_MAX || stride < sizeof(guest_vertex) || stride > data_size || state->vertex_address > data_size ||
+	    (uint64_t)last_vertex * stride + sizeof(guest_vertex) > data_size - state->vertex_address) {
+		return false;
+	}
+
+	*index_bytes  = end;
+	*vertex_count = (uint32_t)last_vertex + 1;
+	return true;
+}
+
+// Copies a NUL-terminated name out of data, names that do not end in time come back empty.
+static void read_shader_name(const uint8_t *data, uint64_t data_size, uint64_t address, char *name) {
+	name[0] = 0;
+	for (uint64_t offset = 0; offset < SHADER_NAME_SIZE && address < data_size && offset < data_size - address; ++offset) {
+		name[offset] = (char)data[address + offset];
+		if (name[offset] == 0) {
+			return;
+		}
+	}
+	name[0] = 0;
+}
+
+static void begin_framebuffer_pass(kore_gpu_load_op load_op, kore_gpu_color clear_color) {
+	kore_gpu_texture *gpu_framebuffer = kore_gpu_device_get_framebuffer(&device);
+
+	kore_gpu_render_pass_parameters parameters = {
+	    .color_attachments_count = 1,
+	    .color_attachments =
+	        {
+	            {
+	                .load_op     = load_op,
+	                .clear_value = clear_color,
+	                .texture =
+	                    {
+	                        .texture           = gpu_framebuffer,
+	                        .array_layer_count = 1,
+	                        .mip_level_count   = 1,
+	                        .format            = kore_gpu_device_framebuffer_format(&device),
+	                        .dimension         = KORE_GPU_TEXTURE_VIEW_DIMENSION_2D,
+	                    },
+	            },
+	        },
+	};
+	kore_gpu_command_list_begin_render_pass(&list, &parameters);
+}
+
+static void end_framebuffer_pass(draw_state *state) {
+	if (state->rendering) {
+		kore_gpu_command_list_end_render_pass(&list);
+		state->rendering = false;
+	}
+}
+
+static void set_render_pipeline(draw_state *state, const uint8_t *data, uint64_t data_size, const kompjuta_gpu_command *command) {
+	char vertex_shader[SHADER_NAME_SIZE];
+	char fragment_shader[SHADER_NAME_SIZE];
+	read_shader_name(data, data_size, guest_address(command->data.set_render_pipeline.vertex_shader), vertex_shader);
+	read_shader_name(data, data_size, guest_address(command->data.set_render_pipeline.fragment_shader), fragment_shader);
+
+	state->pipeline        = gpu_cache_pipeline(vertex_shader, fragment_shader);
+	state->raster_pipeline = rasterizer_find_pipeline(vertex_shader, fragment_shader);
+	if (state->pipeline == NULL && !pipeline_warning_logged) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "There is no pipeline of the shaders \"%s\" and \"%s\", its draws are skipped.", vertex_shader, fragment_shader);
+		pipeline_warning_logged = true;
+	}
+}
+
+static void warn_skipped_draw(void) {
+	if (!draw_warning_logged) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Skipped a draw that is empty, has no buffers set or reads outside of RAM.");
+		draw_warning_logged = true;
+	}
+}
+
+static void draw_indexed(draw_state *state, const uint8_t *data, uint64_t data_size, const kompjuta_gpu_command *command) {
+	uint64_t index_bytes;
+	uint32_t vertex_count;
+	if (!measure_draw(data, data_size, state, command, &index_bytes, &vertex_count)) {
+		warn_skipped_draw();
+		return;
+	}
+	if (state->pipeline == NULL) {
+		return;
+	}
+
+	guest_vertex_buffer *vertices = gpu_cache_vertices(&data[state->vertex_address], state->vertex_stride, vertex_count);
+	kore_gpu_buffer     *indices  = gpu_cache_indices(&data[state->index_address], index_bytes);
+
+	if (!state->rendering) {
+		kore_gpu_color unused = {0};
+		begin_framebuffer_pass(KORE_GPU_LOAD_OP_LOAD, unused);
+		state->rendering = true;
+	}
+
+	state->pipeline(&list);
+	kong_set_vertex_buffer_guest_vertex(&list, vertices);
+	kore_gpu_command_list_set_index_buffer(&list, indices, state->index_format, 0, index_bytes);
+	kore_gpu_command_list_draw_indexed(&list, command->data.draw_indexed.index_count, command->data.draw_indexed.instance_count,
+	                                   command->data.draw_indexed.first_index, command->data.draw_indexed.base_vertex,
+	                                   command->data.draw_indexed.first_instance);
+}
+
+// Only the emulation thread waits for the ring, without it the ring is worked through on the hart's own thread.
+static void signal_command_ring_progress(void) {
+	kore_event_signal(&command_ring_progress);
+}
+
+// Draws upload what they read when they are recorded, so once the commands before a fence
+// are recorded the guest can have its buffers back.
+static void signal_fence(const kompjuta_gpu_command *command) {
+	atomic_store_explicit(&command_ring_fence, command->data.signal_fence.value, memory_order_release);
+	signal_command_ring_progress();
+}
+
+// Returns whether the commands presented.
+static bool execute_commands(const kompjuta_gpu_command *commands, uint32_t count, const uint8_t *data, uint64_t data_size) {
+	bool       presented = false;
+	draw_state state     = {0};
+
+	for (uint32_t command_index = 0; command_index < count; ++command_index) {
+		const kompjuta_gpu_command *command = &commands[command_index];
+		switch (command->kind) {
+		case KOMPJUTA_GPU_COMMAND_CLEAR: {
+			kore_gpu_color clear_color = {
+			    .r = command->data.clear.r,
+			    .g = command->data.clear.g,
+			    .b = command->data.clear.b,
+			    .a = command->data.clear.a,
+			};
+
+			// draws that follow go into the same pass
+			end_framebuffer_pass(&state);
+			begin_framebuffer_pass(KORE_GPU_LOAD_OP_CLEAR, clear_color);
+			state.rendering = true;
+			break;
+		}
+		case KOMPJUTA_GPU_COMMAND_SET_INDEX_BUFFER:
+			set_index_buffer(&state, command);
+			break;
+		case KOMPJUTA_GPU_COMMAND_SET_VERTEX_BUFFER:
+			set_vertex_buffer(&state, command);
+			break;
+		case KOMPJUTA_GPU_COMMAND_SET_RENDER_PIPELINE:
+			set_render_pipeline(&state, data, data_size, command);
+			break;
+		case KOMPJUTA_GPU_COMMAND_DRAW_INDEXED:
+			draw_indexed(&state, data, data_size, command);
+			break;
+		case KOMPJUTA_GPU_COMMAND_PRESENT:
+			end_framebuffer_pass(&state);
+			kore_gpu_command_list_present(&list);
+			presented = true;
+			break;
+		case KOMPJUTA_GPU_COMMAND_SIGNAL_FENCE:
+			signal_fence(command);
+			break;
+		}
+	}
+
+	end_framebuffer_pass(&state);
+	kore_gpu_device_execute_command_list(&device, &list);
+
+	if (presented) {
+		gpu_cache_frame_presented();
+	}
+	return presented;
+}
+
+// On the emulation thread the time spent waiting for a free frame is left out, which makes
+// the number independent of the display rate.
+static void update_mips_report(void) {
+	double now     = host_seconds();
+	double elapsed = now - mips_report_time;
+	if (elapsed < 1.0) {
+		return;
+	}
+
+	double   waited   = emulation_wait_time - mips_report_wait_time;
+	double   running  = elapsed - waited;
+	uint64_t executed = executed_instructions();
+	double   mips     = running > 0.0 ? (double)(executed - mips_report_instructions) / running / 1000000.0 : 0.0;
+	if (emulation_thread_enabled) {
+		kore_log(KORE_LOG_LEVEL_INFO, "%.1f guest MIPS, %.0f%% of the time waiting for the display", mips, 100.0 * waited / elapsed);
+	}
+	else {
+		kore_log(KORE_LOG_LEVEL_INFO, "%.1f guest MIPS", mips);
+	}
+
+	mips_report_time         = now;
+	mips_report_instructions = executed;
+	mips_report_wait_time    = emulation_wait_time;
+}
+
+// Presenting copies the guest framebuffer into framebuffer_buffer, which the GPU then copies
+// into the swapchain. With one hart, framebuffer pages are watched through page_flags so only
+// rows written since the last present are copied, and with --framebuffer-alias the pages are
+// instead backed by the locked buffer itself and presenting copies nothing on the CPU. That
+// relies on the backend keeping a locked upload buffer coherent, and the guest can tear
+// because it keeps writing while the GPU copies.
+
+static bool     framebuffer_alias_enabled = false;
+static bool     framebuffer_attached      = false;
+static uint8_t *framebuffer_alias         = NULL;
+static uint32_t framebuffer_buffer_stride = 0;
+static uint64_t framebuffer_buffer_size   = 0;
+static uint8_t *framebuffer_dirty_rows    = NULL;
+static bool     framebuffer_watch         = true; // off with more than one hart, every row is dirty then
+
+static uint64_t round_up_to_page(uint64_t size) {
+	return (size + MEMORY_PAGE_SIZE - 1) & ~(MEMORY_PAGE_SIZE - 1);
+}
+
+static uint64_t framebuffer_size(void) {
+	return (uint64_t)framebuffer_stride * framebuffer_height;
+}
+
+static void set_framebuffer_page_flags(uint8_t flag, bool set) {
+	uint64_t first = framebuffer_address >> MEMORY_PAGE_SHIFT;
+	uint64_t last  = (framebuffer_address + framebuffer_size() - 1) >> MEMORY_PAGE_SHIFT;
+	for (uint64_t page = first; page <= last; ++page) {
+		if (set) {
+			page_flags[page] |= flag;
+		}
+		else {
+			page_flags[page] &= ~flag;
+		}
+	}
+}
+
+static void framebuffer_page_written(uint64_t page) {
+	page_flags[page] &= ~PAGE_FLAG_WATCH;
+
+	uint64_t start     = page << MEMORY_PAGE_SHIFT;
+	uint64_t first_row = start <= framebuffer_address ? 0 : (start - framebuffer_address) / framebuffer_stride;
+	uint64_t last_row  = (start + MEMORY_PAGE_SIZE - 1 - framebuffer_address) / framebuffer_stride;
+	if (last_row >= framebuffer_height) {
+		last_row = framebuffer_height - 1;
+	}
+	memset(&framebuffer_dirty_rows[first_row], 1, last_row - first_row + 1);
+}
+
+static void attach_framebuffer(void) {
+	uint64_t size = framebuffer_size();
+	if (size == 0 || framebuffer_address >= memory_size || size > memory_size - framebuffer_address) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "The framebuffer at 0x%llx is not in RAM and can not be presented.", framebuffer_address);
+		return;
+	}
+
+	framebuffer_attached = true;
+
+	uint64_t alias_size = round_up_to_page(size);
+	if (framebuffer_alias_enabled && (framebuffer_address & (MEMORY_PAGE_SIZE - 1)) == 0 && framebuffer_stride == framebuffer_buffer_stride &&
+	    alias_size <= framebuffer_buffer_size && framebuffer_address + alias_size <= memory_size) {
+		framebuffer_alias = (uint8_t *)kore_gpu_buffer_lock_all(&framebuffer_buffer);
+		memcpy(framebuffer_alias, &ram[framebuffer_address], alias_size);
+		memory_map_add_ram("framebuffer", framebuffer_address, alias_size, framebuffer_alias);
+		set_framebuffer_page_flags(PAGE_FLAG_ALIAS, true);
+		aliased_page_count += (uint32_t)(alias_size >> MEMORY_PAGE_SHIFT);
+		drop_all_native_blocks();
+	}
+	else {
+		if (framebuffer_alias_enabled) {
+			kore_log(KORE_LOG_LEVEL_INFO, "The framebuffer at 0x%llx can not be aliased, presenting copies the rows that changed.", framebuffer_address);
+		}
+		if (framebuffer_watch) {
+			set_framebuffer_page_flags(PAGE_FLAG_WATCH, true);
+		}
+		memset(framebuffer_dirty_rows, 1, framebuffer_height);
+	}
+}
+
+static void detach_framebuffer(void) {
+	if (!framebuffer_attached) {
+		return;
+	}
+	framebuffer_attached = false;
+
+	if (framebuffer_alias != NULL) {
+		uint64_t alias_size = round_up_to_page(framebuffer_size());
+		memcpy(&ram[framebuffer_address], framebuffer_alias, alias_size);
+		memory_map_remove(framebuffer_address);
+		set_framebuffer_page_flags(PAGE_FLAG_ALIAS, false);
+		aliased_page_count -= (uint32_t)(alias_size >> MEMORY_PAGE_SHIFT);
+		kore_gpu_buffer_unlock(&framebuffer_buffer);
+		framebuffer_alias = NULL;
+		drop_all_native_blocks();
+	}
+	else {
+		set_framebuffer_page_flags(PAGE_FLAG_WATCH, false);
+	}
+}
+
+static void set_framebuffer_address(uint64_t address) {
+	detach_framebuffer();
+	framebuffer_address = address;
+	attach_framebuffer();
+}
+
+static void upload_framebuffer_rows(const uint8_t *source, uint64_t source_stride, const uint8_t *dirty_rows) {
+	uint8_t *pixels = NULL;
+	for (uint32_t y = 0; y < framebuffer_height; ++y) {
+		if (dirty_rows[y] == 0) {
+			continue;
+		}
+		if (pixels == NULL) {
+			pixels = (uint8_t *)kore_gpu_buffer_lock_all(&framebuffer_buffer);
+		}
+		memcpy(&pixels[framebuffer_buffer_stride * y], &source[source_stride * y], framebuffer_width * 4);
+	}
+	if (pixels != NULL) {
+		kore_gpu_buffer_unlock(&framebuffer_buffer);
+	}
+}
+
+static void upload_framebuffer(void) {
+	if (!framebuffer_attached || framebuffer_alias != NULL) {
+		return;
+	}
+
+	upload_framebuffer_rows(&ram[framebuffer_address], framebuffer_stride, framebuffer_dirty_rows);
+
+	if (framebuffer_watch) {
+		memset(framebuffer_dirty_rows, 0, framebuffer_height);
+		set_framebuffer_page_flags(PAGE_FLAG_WATCH, true);
+	}
+}
+
+static void present_framebuffer(void) {
+	kore_gpu_texture *gpu_framebuffer = kore_gpu_device_get_framebuffer(&device);
+
+	kore_gpu_color clear_color = {
+	    .r = 0.0f,
+	    .g = 0.0f,
+	    .b = 0.0f,
+	    .a = 1.0f,
+	};
+	begin_framebuffer_pass(KORE_GPU_LOAD_OP_CLEAR, clear_color);
+	kore_gpu_command_list_end_render_pass(&list);
+
+	kore_gpu_image_copy_buffer copy_buffer = {
+	    .buffer         = &framebuffer_buffer,
+	    .bytes_per_row  = framebuffer_buffer_stride,
+	    .offset         = 0,
+	    .rows_per_image = framebuffer_height,
+	};
+
+	kore_gpu_image_copy_texture copy_texture = {
+	    .texture   = gpu_framebuffer,
+	    .origin_x  = 0,
+	    .origin_y  = 0,
+	    .origin_z  = 0,
+	    .mip_level = 0,
+	    .aspect    = KORE_GPU_IMAGE_COPY_ASPECT_ALL,
+	};
+
+	kore_gpu_command_list_copy_buffer_to_texture(&list, &copy_buffer, &copy_texture, framebuffer_width, framebuffer_height, 1);
+
+	kore_gpu_command_list_present(&list);
+
+	kore_gpu_device_execute_command_list(&device, &list);
+
+	gpu_cache_frame_presented();
+}
+
+// --headless runs the guest without a window or GPU device, for batch runs in CI. Presented
+// framebuffers can be hashed or written out as PPM files, and the run ends when the guest
+// halts or one of the budgets is used up. Command lists are drawn by the software rasterizer.
+
+static bool        headless                  = false;
+static bool        headless_hash_frames      = false;
+static const char *headless_frame_prefix     = NULL;
+static uint64_t    headless_max_instructions = 0; // 0 for no limit
+static uint64_t    headless_max_frames       = 0;
+static double      headless_max_seconds      = 0.0;
+static uint64_t    headless_frames           = 0;
+static uint32_t    headless_raster_threads   = 0; // 0 for every core
+
+static bool commands_present(const kompjuta_gpu_command *commands, uint32_t count) {
+	for (uint32_t command_index = 0; command_index < count; ++command_index) {
+		if (commands[command_index].kind == KOMPJUTA_GPU_COMMAND_PRESENT) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint64_t hash_framebuffer(void) {
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (uint32_t y = 0; y < framebuffer_height; ++y) {
+		const uint8_t *row = guest_ram(framebuffer_address + framebuffer_stride * y);
+		for (uint32_t byte = 0; byte < framebuffer_width * 4; ++byte) {
+			hash = (hash ^ row[byte]) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+static void dump_framebuffer(uint64_t frame_index) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%06llu.ppm", headless_frame_prefix, (unsigned long long)frame_index);
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "Could not write %s.", path);
+		return;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", framebuffer_width, framebuffer_height);
+
+	uint8_t *rgb = (uint8_t *)malloc(framebuffer_width * 3);
+	assert(rgb != NULL);
+	for (uint32_t y = 0; y < framebuffer_height; ++y) {
+		const uint8_t *row = guest_ram(framebuffer_address + framebuffer_stride * y);
+		for (uint32_t x = 0; x < framebuffer_width; ++x) {
+			rgb[x * 3 + 0] = row[x * 4 + 0];
+			rgb[x * 3 + 1] = row[x * 4 + 1];
+			rgb[x * 3 + 2] = row[x * 4 + 2];
+		}
+		fwrite(rgb, 1, framebuffer_width * 3, file);
+	}
+	free(rgb);
+
+	fclose(file);
+}
+
+// Once the host presented, the first hart gets its external interrupt. Without the emulation
+// thread the first hart runs on the calling thread and sees it before its next block.
+static void raise_vsync(void) {
+	atomic_fetch_add_explicit(&vsync_count, 1, memory_order_relaxed);
+	atomic_fetch_or_explicit(&harts[0].mip, MIP_MEIP, memory_order_relaxed);
+	if (emulation_thread_enabled) {
+		wake_hart(&harts[0]);
+	}
+}
+
+static void present_headless(void) {
+	uint64_t frame_index = headless_frames++;
+
+	if (!framebuffer_attached) {
+		return;
+	}
+
+	if (headless_hash_frames) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Frame %llu: %016llx", frame_index, hash_framebuffer());
+	}
+
+	if (headless_frame_prefix != NULL) {
+		dump_framebuffer(frame_index);
+	}
+}
+
+static void run_headless(void) {
+	double   start            = host_seconds();
+	uint64_t start_executed   = executed_instructions(); // not 0 after a restore
+	uint32_t blocks_till_time = 0;
+
+	start_harts();
+
+	while (!current_hart->halted) {
+		if (headless_max_instructions != 0 && executed_instructions() - start_executed >= headless_max_instructions) {
+			break;
+		}
+
+		// the clock is only read every few thousand blocks, or whenever a wfi parked the hart
+		if (headless_max_seconds > 0.0 && (blocks_till_time-- == 0 || current_hart->waiting)) {
+			if (host_seconds() - start >= headless_max_seconds) {
+				break;
+			}
+			blocks_till_time = 4096;
+		}
+
+		execute_block();
+
+		if (framebuffer_present || command_list_present) {
+			present_headless();
+			framebuffer_present  = false;
+			command_list_present = false;
+			raise_vsync();
+
+			if (report_mips) {
+				update_mips_report();
+			}
+
+			if (headless_max_frames != 0 && headless_frames >= headless_max_frames) {
+				break;
+			}
+		}
+	}
+
+	stop_harts();
+
+	double   seconds  = host_seconds() - start;
+	uint64_t executed = executed_instructions() - start_executed;
+	kore_log(KORE_LOG_LEVEL_INFO, "Ran %llu instructions and %llu frames in %.3f s, %.1f guest MIPS and %.1f frames/s.", executed, headless_frames, seconds,
+	         seconds > 0.0 ? (double)executed / seconds / 1000000.0 : 0.0, seconds > 0.0 ? (double)headless_frames / seconds : 0.0);
+}
+
+// With --emulation-thread the guest runs on its own thread and the render callback only
+// presents. Every finished frame, the dirty framebuffer rows and the command lists the guest
+// submitted, goes through frame_queue, so the guest can run up to FRAME_RING_SIZE frames
+// ahead of the display. Only the render thread talks to the GPU.
+
+#define FRAME_MAX_COMMAND_LISTS 16
+
+typedef struct frame {
+	bool                  framebuffer; // present the framebuffer after the command lists
+	uint8_t              *pixels;      // framebuffer_width * 4 bytes per row, only dirty rows are current
+	uint8_t              *dirty_rows;
+	kompjuta_gpu_command *commands;
+	uint32_t              command_count;
+	uint32_t              command_capacity;
+	uint32_t              list_sizes[FRAME_MAX_COMMAND_LISTS];
+	uint32_t              list_count;
+	uint8_t              *data; // what the captured commands point at
+	uint64_t              data_size;
+	uint64_t              data_capacity;
+} frame;
+
+static frame       frames[FRAME_RING_SIZE];
+static frame_ring  frame_queue;
+static frame      *current_frame = NULL;
+static kore_thread emulation_thread;
+
+// Returns the offset of the copy in the frame's data.
+static uint64_t capture_data(const uint8_t *source, uint64_t size) {
+	uint64_t offset = (current_frame->data_size + 7) & ~7ull;
+	if (offset + size > current_frame->data_capacity) {
+		current_frame->data_capacity = (offset + size) * 2;
+		current_frame->data          = (uint8_t *)realloc(current_frame->data, current_frame->data_capacity);
+		assert(current_frame->data != NULL);
+	}
+	memcpy(&current_frame->data[offset], source, size);
+	current_frame->data_size = offset + size;
+	return offset;
+}
+
+// Buffers no draw reads from are left empty.
+static void *capture_buffer(const void *pointer, uint64_t extent) {
+	if (extent == 0) {
+		return NULL;
+	}
+	return (void *)(uintptr_t)capture_data(&ram[guest_address(pointer)], extent);
+}
+
+static void *capture_shader_name(const void *pointer) {
+	char name[SHADER_NAME_SIZE];
+	read_shader_name(ram, memory_size, guest_address(pointer), name);
+	return (void *)(uintptr_t)capture_data((const uint8_t *)name, strlen(name) + 1);
+}
+
+// The render thread executes the commands while the guest goes on, so the parts of the
+// buffers that draws read and the shader names are copied when the list is submitted and
+// the captured commands point into the frame's data instead of RAM. Draws that read
+// outside of RAM draw nothing.
+static void capture_draw_data(kompjuta_gpu_command *commands, uint32_t count) {
+	static uint64_t *extents         = NULL; // per buffer command, the bytes its draws read
+	static uint32_t  extent_capacity = 0;
+	if (count > extent_capacity) {
+		extent_capacity = count;
+		extents         = (uint64_t *)realloc(extents, extent_capacity * sizeof(uint64_t));
+		assert(extents != NULL);
+	}
+	memset(extents, 0, count * sizeof(uint64_t));
+
+	draw_state state          = {0};
+	uint32_t   index_command  = 0;
+	uint32_t   vertex_command = 0;
+	for (uint32_t command_index = 0; command_index < count; ++command_index) {
+		kompjuta_gpu_command *command = &commands[command_index];
+		switch (command->kind) {
+		case KOMPJUTA_GPU_COMMAND_SET_INDEX_BUFFER:
+			set_index_buffer(&state, command);
+			index_command = command_index;
+			break;
+		case KOMPJUTA_GPU_COMMAND_SET_VERTEX_BUFFER:
+			set_vertex_buffer(&state, command);
+			vertex_command = command_index;
+			break;
+		case KOMPJUTA_GPU_COMMAND_DRAW_INDEXED: {
+			uint64_t index_bytes;
+			uint32_t vertex_count;
+			if (!measure_draw(ram, memory_size, &state, command, &index_bytes, &vertex_count)) {
+				command->data.draw_indexed.index_count = 0;
+				break;
+			}
+			uint64_t vertex_bytes   = (uint64_t)(vertex_count - 1) * state.vertex_stride + sizeof(guest_vertex);
+			extents[index_command]  = index_bytes > extents[index_command] ? index_bytes : extents[index_command];
+			extents[vertex_command] = vertex_bytes > extents[vertex_command] ? vertex_bytes : extents[vertex_command];
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	for (uint32_t command_index = 0; command_index < count; ++command_index) {
+		kompjuta_gpu_command *command = &commands[command_index];
+		switch (command->kind) {
+		case KOMPJUTA_GPU_COMMAND_SET_INDEX_BUFFER:
+			command->data.set_index_buffer.data = capture_buffer(command->data.set_index_buffer.data, extents[command_index]);
+			break;
+		case KOMPJUTA_GPU_COMMAND_SET_VERTEX_BUFFER:
+			command->data.set_vertex_buffer.data = capture_buffer(command->data.set_vertex_buffer.data, extents[command_index]);
+			break;
+		case KOMPJUTA_GPU_COMMAND_SET_RENDER_PIPELINE:
+			command->data.set_render_pipeline.vertex_shader   = capture_shader_name(command->data.set_render_pipeline.vertex_shader);
+			command->data.set_render_pipeline.fragment_shader = capture_shader_name(command->data.set_render_pipeline.fragment_shader);
+			break;
+		default:
+			break;
+		}
+	}
+}
 
-	offset += 7;
+static void capture_command_list(const kompjuta_gpu_command *commands, uint32_t count) {
+	if (current_frame->command_count + count > current_frame->command_capacity) {
+		current_frame->command_capacity = current_frame->command_count + count;
+		current_frame->commands = (kompjuta_gpu_command *)realloc(current_frame->commands, current_frame->command_capacity * sizeof(kompjuta_gpu_command));
+		assert(current_frame->commands != NULL);
+	}
+	memcpy(&current_frame->commands[current_frame->command_count], commands, count * sizeof(kompjuta_gpu_command));
+	capture_draw_data(&current_frame->commands[current_frame->command_count], count);
+	current_frame->command_count += count;
 
-	uint16_t object_type = read_uint16(binary, &offset);
-	assert(object_type == 0x2);
+	if (current_frame->list_count < FRAME_MAX_COMMAND_LISTS) {
+		current_frame->list_sizes[current_frame->list_count++] = count;
+	}
+	else {
+		current_frame->list_sizes[FRAME_MAX_COMMAND_LISTS - 1] += count;
+	}
 
-	uint16_t machine = read_uint16(binary, &offset);
-	assert(machine == 0xf3);
+	if (commands_present(commands, count)) {
+		command_list_present = true;
+	}
+}
 
-	uint32_t elf_version = read_uint32(binary, &offset);
-	assert(elf_version == 1);
+static void snapshot_framebuffer(frame *frame) {
+	frame->framebuffer = true;
 
-	entry = read_uint64(binary, &offset);
+	if (!framebuffer_attached) {
+		memset(frame->dirty_rows, 0, framebuffer_height);
+		return;
+	}
 
-	program_header_offset = read_uint64(binary, &offset);
+	for (uint32_t y = 0; y < framebuffer_height; ++y) {
+		if (framebuffer_dirty_rows[y] != 0) {
+			memcpy(&frame->pixels[framebuffer_width * 4 * y], &ram[framebuffer_address + framebuffer_stride * y], framebuffer_width * 4);
+		}
+	}
+	memcpy(frame->dirty_rows, framebuffer_dirty_rows, framebuffer_height);
 
-	uint64_t section_header_offset = read_uint64(binary, &offset);
+	if (framebuffer_watch) {
+		memset(framebuffer_dirty_rows, 0, framebuffer_height);
+		set_framebuffer_page_flags(PAGE_FLAG_WATCH, true);
+	}
+}
 
-	uint32_t flags = read_uint32(binary, &offset);
+static void run_emulation_thread(void *data) {
+	(void)data;
+	enter_hart(&harts[0]);
 
-	uint32_t header_size = read_uint16(binary, &offset);
+	while (!atomic_load_explicit(&emulation_stop, memory_order_relaxed) && !current_hart->halted) {
+		double   wait_start = host_seconds();
+		uint32_t slot       = frame_ring_begin_write(&frame_queue);
+		emulation_wait_time += host_seconds() - wait_start;
+		if (atomic_load_explicit(&emulation_stop, memory_order_relaxed)) {
+			break;
+		}
 
-	program_header_entry_size = read_uint16(binary, &offset);
+		current_frame                = &frames[slot];
+		current_frame->framebuffer   = false;
+		current_frame->command_count = 0;
+		current_frame->list_count    = 0;
+		current_frame->data_size     = 0;
 
-	program_header_entry_count = read_uint16(binary, &offset);
+		run_until_present();
 
-	uint16_t section_header_entry_size = read_uint16(binary, &offset);
+		if (framebuffer_present) {
+			snapshot_framebuffer(current_frame);
+			framebuffer_present = false;
+		}
+		command_list_present = false;
 
-	uint16_t section_header_entry_count = read_uint16(binary, &offset);
+		frame_ring_end_write(&frame_queue);
 
-	uint16_t section_header_names_entry_index = read_uint16(binary, &offset);
+		if (report_mips) {
+			update_mips_report();
+		}
+	}
 }
 
-static void read_loadable_segments(uint8_t *binary) {
-	uint8_t *program_header = &binary[program_header_offset];
-	for (uint16_t program_header_index = 0; program_header_index < program_header_entry_count; ++program_header_index) {
-		uint8_t *program_header_entry = &program_header[program_header_index * program_header_entry_size];
-
-		uint64_t offset       = 0;
-		uint32_t program_type = read_uint32(program_header_entry, &offset);
-		if (program_type == 0x1) {
-			uint32_t flags            = read_uint32(program_header_entry, &offset);
-			uint64_t file_offset      = read_uint64(program_header_entry, &offset);
-			uint64_t virtual_address  = read_uint64(program_header_entry, &offset);
-			uint64_t physical_address = read_uint64(program_header_entry, &offset);
-			uint64_t file_size        = read_uint64(program_header_entry, &offset);
-			uint64_t memory_size      = read_uint64(program_header_entry, &offset);
-			uint64_t alignment        = read_uint64(program_header_entry, &offset);
+static void start_emulation_thread(void) {
+	for (uint32_t slot = 0; slot < FRAME_RING_SIZE; ++slot) {
+		frames[slot].pixels     = (uint8_t *)malloc((size_t)framebuffer_width * 4 * framebuffer_height);
+		frames[slot].dirty_rows = (uint8_t *)calloc(framebuffer_height, 1);
+		assert(frames[slot].pixels != NULL && frames[slot].dirty_rows != NULL);
+	}
 
-			kore_log(KORE_LOG_LEVEL_INFO, "Setting up a memory area from 0x%x to 0x%x.", virtual_address, virtual_address + memory_size);
+	frame_ring_init(&frame_queue);
+	kore_thread_init(&emulation_thread, run_emulation_thread, NULL);
+}
 
-			memcpy(&ram[virtual_address], &binary[file_offset], file_size);
-			memset(&ram[virtual_address + file_size], 0, memory_size - file_size);
-		}
+static void stop_emulation_thread(void) {
+	atomic_store_explicit(&emulation_stop, true, memory_order_relaxed);
+	frame_ring_wake_writer(&frame_queue);
+	wake_hart(&harts[0]);
+	kore_event_signal(&command_ring_progress);
+	kore_thread_wait_and_destroy(&emulation_thread);
+	frame_ring_destroy(&frame_queue);
+
+	for (uint32_t slot = 0; slot < FRAME_RING_SIZE; ++slot) {
+		free(frames[slot].pixels);
+		free(frames[slot].dirty_rows);
+		free(frames[slot].commands);
+		free(frames[slot].data);
 	}
 }
 
-static kore_gpu_device       device;
-static kore_gpu_command_list list;
-static kore_gpu_buffer       framebuffer_buffer;
-
-static const int width  = 800;
-static const int height = 600;
+static void present_queued_frame(void) {
+	uint32_t slot;
+	if (!frame_ring_begin_read(&frame_queue, &slot)) {
+		return;
+	}
 
-static void execute_command_list(void) {
-	kompjuta_gpu_command *commands = (kompjuta_gpu_command *)&ram[command_list_address];
+	frame   *frame         = &frames[slot];
+	uint32_t first_command = 0;
+	for (uint32_t list_index = 0; list_index < frame->list_count; ++list_index) {
+		execute_commands(&frame->commands[first_command], frame->list_sizes[list_index], frame->data, frame->data_size);
+		first_command += frame->list_sizes[list_index];
+	}
 
-	void    *vertex_shader   = NULL;
-	void    *fragment_shader = NULL;
-	void    *index_data      = NULL;
-	void    *vertex_data     = NULL;
-	uint64_t vertex_stride   = 0;
+	if (frame->framebuffer) {
+		upload_framebuffer_rows(frame->pixels, framebuffer_width * 4, frame->dirty_rows);
+		present_framebuffer();
+	}
 
-	for (uint32_t command_index = 0; command_index < command_list_size; ++command_index) {
-		kompjuta_gpu_command *command = &commands[command_index];
-		switch (command->kind) {
-		case KOMPJUTA_GPU_COMMAND_CLEAR: {
-			kore_gpu_texture *gpu_framebuffer = kore_gpu_device_get_framebuffer(&device);
+	frame_ring_end_read(&frame_queue);
+}
 
-			kore_gpu_color clear_color = {
-			    .r = command->data.clear.r,
-			    .g = command->data.clear.g,
-			    .b = command->data.clear.b,
-			    .a = command->data.clear.a,
-			};
 
-			kore_gpu_render_pass_parameters parameters = {
-			    .color_attachments_count = 1,
-			    .color_attachments =
-			        {
-			            {
-			                .load_op     = KORE_GPU_LOAD_OP_CLEAR,
-			                .clear_value = clear_color,
-			                .texture =
-			                    {
-			                        .texture           = gpu_framebuffer,
-			                        .array_layer_count = 1,
-			                        .mip_level_count   = 1,
-			                        .format            = kore_gpu_device_framebuffer_format(&device),
-			                        .dimension         = KORE_GPU_TEXTURE_VIEW_DIMENSION_2D,
-			                    },
-			            },
-			        },
-			};
-			kore_gpu_command_list_begin_render_pass(&list, &parameters);
+// Headless command lists are rasterised into the guest framebuffer right away.
+static void rasterize_commands(const kompjuta_gpu_command *commands, uint32_t count) {
+	if (!framebuffer_attached) {
+		return;
+	}
 
-			kore_gpu_command_list_end_render_pass(&list);
+	rasterizer_target target = {
+	    .pixels = &ram[framebuffer_address],
+	    .width  = framebuffer_width,
+	    .height = framebuffer_height,
+	    .stride = framebuffer_stride,
+	};
+	rasterizer_begin(&target);
+
+	draw_state state = {0};
+	for (uint32_t command_index = 0; command_index < count; ++command_index) {
+		const kompjuta_gpu_command *command = &commands[command_index];
+		switch (command->kind) {
+		case KOMPJUTA_GPU_COMMAND_CLEAR:
+			rasterizer_clear(command->data.clear.r, command->data.clear.g, command->data.clear.b, command->data.clear.a);
 			break;
-		}
 		case KOMPJUTA_GPU_COMMAND_SET_INDEX_BUFFER:
-			index_data = command->data.set_index_buffer.data;
+			set_index_buffer(&state, command);
 			break;
 		case KOMPJUTA_GPU_COMMAND_SET_VERTEX_BUFFER:
-			vertex_data   = command->data.set_vertex_buffer.data;
-			vertex_stride = command->data.set_vertex_buffer.stride;
+			set_vertex_buffer(&state, command);
 			break;
 		case KOMPJUTA_GPU_COMMAND_SET_RENDER_PIPELINE:
-			vertex_shader   = command->data.set_render_pipeline.vertex_shader;
-			fragment_shader = command->data.set_render_pipeline.fragment_shader;
+			set_render_pipeline(&state, ram, memory_size, command);
 			break;
-		case KOMPJUTA_GPU_COMMAND_DRAW_INDEXED:
+		case KOMPJUTA_GPU_COMMAND_DRAW_INDEXED: {
+			uint64_t index_bytes;
+			uint32_t vertex_count;
+			if (!measure_draw(ram, memory_size, &state, command, &index_bytes, &vertex_count)) {
+				warn_skipped_draw();
+				break;
+			}
+			if (state.raster_pipeline == RASTERIZER_PIPELINE_NONE) {
+				break;
+			}
+
+			rasterizer_draw draw = {
+			    .pipeline      = state.raster_pipeline,
+			    .vertices      = &ram[state.vertex_address],
+			    .vertex_stride = state.vertex_stride,
+			    .vertex_count  = vertex_count,
+			    .indices       = &ram[state.index_address],
+			    .index_size    = index_size(state.index_format),
+			    .first_index   = command->data.draw_indexed.first_index,
+			    .index_count   = command->data.draw_indexed.index_count,
+			    .base_vertex   = command->data.draw_indexed.base_vertex,
+			};
+			rasterizer_draw_indexed(&draw);
 			break;
+		}
 		case KOMPJUTA_GPU_COMMAND_PRESENT:
-			kore_gpu_command_list_present(&list);
-			command_list_present = true;
+			break;
+		case KOMPJUTA_GPU_COMMAND_SIGNAL_FENCE:
+			// triangles are set up by now, the rasterizer does not read RAM anymore
+			signal_fence(command);
 			break;
 		}
 	}
 
-	kore_gpu_device_execute_command_list(&device, &list);
+	rasterizer_end();
 }
 
-static void update(void *data) {
-	while (!framebuffer_present && !command_list_present) {
-		execute_opcode();
+static void execute_command_list(void) {
+	uint64_t size = (uint64_t)command_list_size * sizeof(kompjuta_gpu_command);
+	if (command_list_address >= memory_size || size > memory_size - command_list_address) {
+		access_fault(EXCEPTION_STORE_ACCESS_FAULT, command_list_address, "Command list");
+		return;
 	}
 
-	if (framebuffer_present) {
-		uint8_t *pixels        = (uint8_t *)kore_gpu_buffer_lock_all(&framebuffer_buffer);
-		uint32_t buffer_stride = kore_gpu_device_align_texture_row_bytes(&device, framebuffer_width * 4);
-		for (uint32_t y = 0; y < framebuffer_height; ++y) {
-			memcpy(&pixels[buffer_stride * y], &ram[framebuffer_address + framebuffer_stride * y], framebuffer_width * 4);
-		}
-		kore_gpu_buffer_unlock(&framebuffer_buffer);
+	const kompjuta_gpu_command *commands = (const kompjuta_gpu_command *)&ram[command_list_address];
+	if (headless) {
+		rasterize_commands(commands, command_list_size);
+		command_list_present = commands_present(commands, command_list_size);
+	}
+	else if (emulation_thread_enabled) {
+		capture_command_list(commands, command_list_size);
+	}
+	else if (execute_commands(commands, command_list_size, ram, memory_size)) {
+		command_list_present = true;
+	}
+}
 
-		kore_gpu_texture *gpu_framebuffer = kore_gpu_device_get_framebuffer(&device);
+static bool command_ring_valid(uint64_t address, uint64_t size) {
+	return size != 0 && (size & (size - 1)) == 0 && size <= memory_size / sizeof(kompjuta_gpu_command) && address < memory_size &&
+	       size * sizeof(kompjuta_gpu_command) <= memory_size - address;
+}
 
-		kore_gpu_color clear_color = {
-		    .r = 0.0f,
-		    .g = 0.0f,
-		    .b = 0.0f,
-		    .a = 1.0f,
-		};
+static const kompjuta_gpu_command *command_ring_slot(uint64_t address, uint64_t size, uint64_t position) {
+	return (const kompjuta_gpu_command *)&ram[address + (position & (size - 1)) * sizeof(kompjuta_gpu_command)];
+}
 
-		kore_gpu_render_pass_parameters parameters = {
-		    .color_attachments_count = 1,
-		    .color_attachments =
-		        {
-		            {
-		                .load_op     = KORE_GPU_LOAD_OP_CLEAR,
-		                .clear_value = clear_color,
-		                .texture =
-		                    {
-		                        .texture           = gpu_framebuffer,
-		                        .array_layer_count = 1,
-		                        .mip_level_count   = 1,
-		                        .format            = kore_gpu_device_framebuffer_format(&device),
-		                        .dimension         = KORE_GPU_TEXTURE_VIEW_DIMENSION_2D,
-		                    },
-		            },
-		        },
-		};
-		kore_gpu_command_list_begin_render_pass(&list, &parameters);
+// Works through the queued commands, with one_frame only up to the first present so a host
+// frame shows one guest frame. The commands are copied out of the ring first and their
+// slots go back to the guest with the head.
+static void drain_command_ring(bool one_frame) {
+	static kompjuta_gpu_command *commands         = NULL;
+	static uint64_t              command_capacity = 0;
+
+	uint64_t tail = atomic_load_explicit(&command_ring_tail, memory_order_acquire);
+	uint64_t head = atomic_load_explicit(&command_ring_head, memory_order_relaxed);
+	if (head == tail) {
+		return;
+	}
 
-		kore_gpu_command_list_end_render_pass(&list);
+	// checked by the doorbell, but the guest may have moved the ring since
+	uint64_t address = atomic_load_explicit(&command_ring_address, memory_order_relaxed);
+	uint64_t size    = atomic_load_explicit(&command_ring_size, memory_order_relaxed);
+	if (!command_ring_valid(address, size) || tail - head > size) {
+		atomic_store_explicit(&command_ring_head, tail, memory_order_release);
+		signal_command_ring_progress();
+		return;
+	}
 
-		kore_gpu_image_copy_buffer copy_buffer = {
-		    .buffer         = &framebuffer_buffer,
-		    .bytes_per_row  = buffer_stride,
-		    .offset         = 0,
-		    .rows_per_image = framebuffer_height,
-		};
+	if (tail - head > command_capacity) {
+		command_capacity = tail - head;
+		commands         = (kompjuta_gpu_command *)realloc(commands, command_capacity * sizeof(kompjuta_gpu_command));
+		assert(commands != NULL);
+	}
 
-		kore_gpu_image_copy_texture copy_texture = {
-		    .texture   = gpu_framebuffer,
-		    .origin_x  = 0,
-		    .origin_y  = 0,
-		    .origin_z  = 0,
-		    .mip_level = 0,
-		    .aspect    = KORE_GPU_IMAGE_COPY_ASPECT_ALL,
-		};
+	uint32_t count     = 0;
+	bool     presented = false;
+	while (head + count != tail && !(one_frame && presented)) {
+		commands[count] = *command_ring_slot(address, size, head + count);
+		presented |= commands[count].kind == KOMPJUTA_GPU_COMMAND_PRESENT;
+		++count;
+	}
+
+	if (headless) {
+		rasterize_commands(commands, count);
+	}
+	else {
+		execute_commands(commands, count, ram, memory_size);
+	}
+
+	atomic_store_explicit(&command_ring_head, head + count, memory_order_release);
+	signal_command_ring_progress();
+}
+
+// Ends the guest's frame when the new commands present, the ring itself is worked through
+// by update or, headless, right away.
+static void ring_command_doorbell(uint64_t tail) {
+	uint64_t address  = atomic_load_explicit(&command_ring_address, memory_order_relaxed);
+	uint64_t size     = atomic_load_explicit(&command_ring_size, memory_order_relaxed);
+	uint64_t old_tail = atomic_load_explicit(&command_ring_tail, memory_order_relaxed);
+	uint64_t head     = atomic_load_explicit(&command_ring_head, memory_order_acquire);
+	if (!command_ring_valid(address, size) || tail - old_tail > size || tail - head > size) {
+		access_fault(EXCEPTION_STORE_ACCESS_FAULT, address, "Command ring");
+		return;
+	}
+
+	bool presents = false;
+	for (uint64_t position = old_tail; position != tail; ++position) {
+		presents |= command_ring_slot(address, size, position)->kind == KOMPJUTA_GPU_COMMAND_PRESENT;
+	}
+
+	// publishes the commands together with the tail
+	atomic_store_explicit(&command_ring_tail, tail, memory_order_release);
+
+	if (headless) {
+		drain_command_ring(false);
+	}
+	command_list_present |= presents;
+}
+
+// Without the emulation thread the ring is only worked through between the guest's frames,
+// a guest that polls or waits gets it done on the spot instead of spinning forever.
+static void catch_up_command_ring(void) {
+	if (!emulation_thread_enabled && current_hart->id == 0) {
+		drain_command_ring(false);
+	}
+}
+
+// The other harts can not work through the ring themselves, without the emulation thread they
+// wait for the first hart or for the end of the frame to do it.
+static void wait_for_fence(uint64_t value) {
+	if (!emulation_thread_enabled && current_hart->id == 0) {
+		catch_up_command_ring();
+		return;
+	}
+
+	while (atomic_load_explicit(&command_ring_fence, memory_order_acquire) < value &&
+	       atomic_load_explicit(&command_ring_head, memory_order_relaxed) != atomic_load_explicit(&command_ring_tail, memory_order_relaxed) &&
+	       !atomic_load_explicit(&emulation_stop, memory_order_relaxed) && !atomic_load_explicit(&harts_stop, memory_order_relaxed)) {
+		kore_event_try_to_wait(&command_ring_progress, WFI_MAX_SLEEP);
+	}
+}
+
+static void update(void *data) {
+	if (emulation_thread_enabled) {
+		present_queued_frame();
+		drain_command_ring(true);
+		raise_vsync();
+		return;
+	}
 
-		kore_gpu_command_list_copy_buffer_to_texture(&list, &copy_buffer, &copy_texture, framebuffer_width, framebuffer_height, 1);
+	run_until_present();
 
-		kore_gpu_command_list_present(&list);
+	if (report_mips) {
+		update_mips_report();
+	}
 
-		kore_gpu_device_execute_command_list(&device, &list);
+	drain_command_ring(true);
 
+	if (framebuffer_present) {
+		upload_framebuffer();
+		present_framebuffer();
 		framebuffer_present = false;
 	}
 
 	command_list_present = false;
+	raise_vsync();
+}
+
+static void log_resident_memory(void) {
+	uint64_t pages = ram_resident_pages(ram, memory_size);
+	if (pages == UINT64_MAX) {
+		kore_log(KORE_LOG_LEVEL_INFO, "Guest RAM: %llu MiB reserved.", memory_size / (1024 * 1024));
+	}
+	else {
+		kore_log(KORE_LOG_LEVEL_INFO, "Guest RAM: %llu MiB reserved, %llu pages (%llu KiB) resident.", memory_size / (1024 * 1024), pages,
+		         pages * ram_host_page_size() / 1024);
+	}
 }
 
 int kickstart(int argc, char **argv) {
-	assert(argc == 2);
-	FILE *file = fopen(argv[1], "rb");
-	fseek(file, 0, SEEK_END);
-	uint32_t size = ftell(file);
-	fseek(file, 0, 0);
-
-	uint8_t *binary = (uint8_t *)malloc(size);
-	assert(binary != NULL);
-	fread(binary, 1, size, file);
-	fclose(file);
+	const char *path = NULL;
+
+	jit_enabled = jit_available();
+
+	for (int arg = 1; arg < argc; ++arg) {
+		if (strcmp(argv[arg], "--no-jit") == 0) {
+			jit_enabled = false;
+		}
+		else if (strcmp(argv[arg], "--jit-verify") == 0) {
+			jit_verify = true;
+		}
+		else if (strcmp(argv[arg], "--lockstep") == 0) {
+			lockstep = true;
+		}
+		else if (strcmp(argv[arg], "--mips") == 0) {
+			report_mips = true;
+		}
+		else if (strcmp(argv[arg], "--framebuffer-alias") == 0) {
+			framebuffer_alias_enabled = true;
+		}
+		else if (strcmp(argv[arg], "--emulation-thread") == 0) {
+			emulation_thread_enabled = true;
+		}
+		else if (strcmp(argv[arg], "--memory") == 0 && arg + 1 < argc) {
+			uint64_t megabytes = strtoull(argv[++arg], NULL, 10);
+			memory_size        = megabytes < (MMIO_BASE >> 20) ? megabytes * 1024 * 1024 : MMIO_BASE; // MMIO_BASE is rejected below
+		}
+		else if (strcmp(argv[arg], "--headless") == 0) {
+			headless = true;
+		}
+		else if (strcmp(argv[arg], "--hash-frames") == 0) {
+			headless_hash_frames = true;
+		}
+		else if (strcmp(argv[arg], "--dump-frames") == 0 && arg + 1 < argc) {
+			headless_frame_prefix = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--max-instructions") == 0 && arg + 1 < argc) {
+			headless_max_instructions = strtoull(argv[++arg], NULL, 10);
+		}
+		else if (strcmp(argv[arg], "--max-frames") == 0 && arg + 1 < argc) {
+			headless_max_frames = strtoull(argv[++arg], NULL, 10);
+		}
+		else if (strcmp(argv[arg], "--max-seconds") == 0 && arg + 1 < argc) {
+			headless_max_seconds = strtod(argv[++arg], NULL);
+		}
+		else if (strcmp(argv[arg], "--raster-threads") == 0 && arg + 1 < argc) {
+			headless_raster_threads = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		}
+		else if (strcmp(argv[arg], "--harts") == 0 && arg + 1 < argc) {
+			hart_count = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		}
+		else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc) {
+			profile_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--sample") == 0 && arg + 1 < argc) {
+			sample_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--sample-interval") == 0 && arg + 1 < argc) {
+			sample_interval = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		}
+		else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+			trace_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--trace-check") == 0 && arg + 1 < argc) {
+			trace_check_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--save-snapshot") == 0 && arg + 1 < argc) {
+			save_snapshot_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--restore-snapshot") == 0 && arg + 1 < argc) {
+			restore_snapshot_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--disk") == 0 && arg + 1 < argc) {
+			disk_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "--disk-async") == 0) {
+			disk_async_enabled = true;
+		}
+		else {
+			path = argv[arg];
+		}
+	}
+
+	if (hart_count < 1 || hart_count > MAX_HARTS) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "--harts takes 1 to %u harts.", MAX_HARTS);
+		return 1;
+	}
+
+	if (memory_size < MIN_MEMORY_SIZE || memory_size >= MMIO_BASE) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "--memory takes at least %llu MiB and has to end below the MMIO region.", MIN_MEMORY_SIZE >> 20);
+		return 1;
+	}
+
+	// the snapshot decides the size of the machine, the program is only needed for its symbols
+	if (restore_snapshot_path != NULL) {
+		if (!snapshot_open(&restored_snapshot, restore_snapshot_path)) {
+			return 1;
+		}
+		memory_size = restored_snapshot.machine.memory_size;
+		hart_count  = restored_snapshot.machine.hart_count;
+		if (hart_count < 1 || hart_count > MAX_HARTS || memory_size < MIN_MEMORY_SIZE || memory_size >= MMIO_BASE || memory_size % SNAPSHOT_CHUNK_SIZE != 0) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "%s describes a machine with %u harts and %llu bytes of RAM, which can not be restored.", restore_snapshot_path,
+			         hart_count, memory_size);
+			snapshot_close(&restored_snapshot);
+			return 1;
+		}
+	}
+
+	assert(hart_count >= 1 && hart_count <= MAX_HARTS);
+
+	if (headless && (framebuffer_alias_enabled || emulation_thread_enabled)) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "--framebuffer-alias and --emulation-thread are ignored when running headless.");
+		framebuffer_alias_enabled = false;
+		emulation_thread_enabled  = false;
+	}
+
+	if (hart_count > 1 && (framebuffer_alias_enabled || jit_verify)) {
+		// aliasing changes the memory map while other harts use it and the verification
+		// replays blocks against memory the other harts keep writing
+		kore_log(KORE_LOG_LEVEL_WARNING, "--framebuffer-alias and --jit-verify are ignored with more than one hart.");
+		framebuffer_alias_enabled = false;
+		jit_verify                = false;
+	}
+
+	// the rows are copied and cleared while the other harts keep storing, a row one of them
+	// marks in between would be lost, so with several harts every row is copied every frame
+	framebuffer_watch = hart_count == 1;
+
+	if (hart_count > 1 && (lockstep || trace_path != NULL || trace_check_path != NULL)) {
+		// both use the store journal, which is there once, and a trace of several harts would
+		// depend on how their threads interleave
+		kore_log(KORE_LOG_LEVEL_WARNING, "--lockstep, --trace and --trace-check are ignored with more than one hart.");
+		lockstep         = false;
+		trace_path       = NULL;
+		trace_check_path = NULL;
+	}
+
+	if (trace_path != NULL || trace_check_path != NULL) {
+		if (lockstep) {
+			kore_log(KORE_LOG_LEVEL_WARNING, "--lockstep is ignored while tracing.");
+			lockstep = false;
+		}
+
+		bool opened = trace_path != NULL ? trace_open_write(&commit_trace, trace_path) : trace_open_check(&commit_trace, trace_check_path);
+		if (opened) {
+			// instructions are recorded one by one, translated blocks run as a whole
+			tracing     = true;
+			jit_enabled = false;
+		}
+		else {
+			kore_log(KORE_LOG_LEVEL_WARNING, "Could not open the trace %s.", trace_path != NULL ? trace_path : trace_check_path);
+		}
+	}
+
+	if (disk_async_enabled && (lockstep || jit_verify || tracing)) {
+		// they compare blocks that poll the queue's head with runs of the same blocks
+		kore_log(KORE_LOG_LEVEL_WARNING, "--disk-async is ignored with --lockstep, --jit-verify and while tracing.");
+		disk_async_enabled = false;
+	}
+
+	if (!block_device_open(disk_path, disk_async_enabled)) {
+		return 1;
+	}
+
+	// the program is mapped instead of read, its segments are mapped from it further down
+	FILE    *binary_file = NULL;
+	uint8_t *binary      = NULL;
+	uint64_t binary_size = 0;
+	if (path != NULL) {
+		binary_file = fopen(path, "rb");
+		binary      = binary_file != NULL ? ram_map_file_read_only(binary_file, &binary_size) : NULL;
+		if (binary == NULL) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Could not load the program %s.", path);
+			if (binary_file != NULL) {
+				fclose(binary_file);
+			}
+			return 1;
+		}
+
+		read_header(binary);
+		read_symbols(binary, binary_size);
+	}
+	else {
+		assert(restore_snapshot_path != NULL);
+	}
+
+	assert(memory_size >= MIN_MEMORY_SIZE && memory_size < MMIO_BASE);
+
+	// Reserved but untouched, the host only backs the pages the guest actually uses.
+	ram        = ram_reserve(memory_size);
+	page_flags = (_Atomic uint8_t *)ram_reserve(memory_size >> MEMORY_PAGE_SHIFT);
+	if (ram == NULL || page_flags == NULL) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "Could not reserve %llu MiB of guest RAM.", memory_size >> 20);
+		return 1;
+	}
+
+	memory_map_add_ram("ram", 0, memory_size, ram);
+	memory_map_add_mmio("system", MMIO_BASE, MEMORY_PAGE_SIZE, system_device_read, system_device_write, NULL);
+	memory_map_add_mmio("clint", CLINT_BASE, CLINT_SIZE, clint_read, clint_write, NULL);
+	memory_map_add_mmio("blitter", BLITTER_BASE, MEMORY_PAGE_SIZE, blitter_read, blitter_write, NULL);
+	memory_map_add_mmio("block", BLOCK_BASE, MEMORY_PAGE_SIZE, block_device_read, block_device_write, NULL);
+
+	if (restore_snapshot_path != NULL) {
+		if (!snapshot_load_ram(&restored_snapshot, ram)) {
+			return 1;
+		}
+	}
+	else {
+		read_loadable_segments(binary, binary_size, binary_file);
+	}
+
+	// mapped segments stay valid without the file
+	if (binary != NULL) {
+		ram_unmap_file(binary, binary_size);
+		fclose(binary_file);
+	}
+
+	log_resident_memory();
+
+	reset_harts(entry);
+
+	if (restore_snapshot_path != NULL) {
+		if (!snapshot_load_harts(&restored_snapshot, harts)) {
+			return 1;
+		}
+		kore_log(KORE_LOG_LEVEL_INFO, "Restored %u harts and %llu KiB of RAM from %s.", hart_count,
+		         restored_snapshot.chunk_count * (SNAPSHOT_CHUNK_SIZE / 1024), restore_snapshot_path);
+		snapshot_close(&restored_snapshot);
+	}
+
+	// the emulation thread enters the first hart itself
+	if (!emulation_thread_enabled) {
+		enter_hart(&harts[0]);
+	}
+
+#ifdef KOMPJUTA_COMPUTED_GOTO
+	execute_threaded(NULL);
+#endif
+
+	mips_report_time         = host_seconds();
+	mips_report_instructions = executed_instructions();
+	counter_start            = host_nanoseconds();
+	if (restore_snapshot_path != NULL) {
+		counter_start -= restored_snapshot.machine.time * NANOSECONDS_PER_TICK;
+	}
+
+	if (headless) {
+		framebuffer_width   = width;
+		framebuffer_height  = height;
+		framebuffer_stride  = framebuffer_width * 4u;
+		framebuffer_address = (memory_size - framebuffer_size()) & ~(MEMORY_PAGE_SIZE - 1);
+		restore_system_device();
+
+		framebuffer_dirty_rows = (uint8_t *)calloc(framebuffer_height, 1);
+		assert(framebuffer_dirty_rows != NULL);
+
+		attach_framebuffer();
+		rasterizer_init(headless_raster_threads);
+
+		run_headless();
 
-	read_header(binary);
+		block_device_close();
+		rasterizer_destroy();
 
-	ram = malloc(MEMORY_SIZE);
-	assert(ram != NULL);
-	memset(ram, 0, MEMORY_SIZE);
+		write_profile();
+		write_samples();
+		close_trace();
+		save_snapshot();
 
-	read_loadable_segments(binary);
+		detach_framebuffer();
 
-	framebuffer_width   = width;
-	framebuffer_height  = height;
-	framebuffer_stride  = framebuffer_width * 4u;
-	framebuffer_address = MEMORY_SIZE - framebuffer_stride * framebuffer_height;
+		log_resident_memory();
 
-	pc = entry;
+		// 1 when a hart was halted by a fault
+		int result = any_hart_halted() ? 1 : 0;
+
+		release_harts();
+		symbols_release();
+
+		ram_release((void *)page_flags, memory_size >> MEMORY_PAGE_SHIFT);
+		ram_release(ram, memory_size);
+
+		return result;
+	}
 
 	kore_init("Kompjuta", width, height, NULL, NULL);
 	kore_set_update_callback(update, NULL);
@@ -1649,26 +5368,75 @@ int kickstart(int argc, char **argv) {
 	kore_gpu_device_create(&device, &wishlist);
 
 	kong_init(&device);
+	gpu_cache_init(&device);
 
 	kore_gpu_device_create_command_list(&device, KORE_GPU_COMMAND_LIST_TYPE_GRAPHICS, &list);
 
-	while (!framebuffer_present && !command_list_present) {
-		execute_opcode();
+	framebuffer_width         = width;
+	framebuffer_height        = height;
+	framebuffer_buffer_stride = kore_gpu_device_align_texture_row_bytes(&device, framebuffer_width * 4);
+	framebuffer_buffer_size   = round_up_to_page((uint64_t)framebuffer_buffer_stride * framebuffer_height);
+
+	if (framebuffer_alias_enabled && emulation_thread_enabled) {
+		// the render thread would read the buffer while the guest writes it
+		kore_log(KORE_LOG_LEVEL_WARNING, "--framebuffer-alias is ignored when running on an emulation thread.");
+		framebuffer_alias_enabled = false;
 	}
 
-	if (framebuffer_present) {
-		kore_gpu_buffer_parameters parameters = {
-		    .size        = kore_gpu_device_align_texture_row_bytes(&device, framebuffer_width * 4) * framebuffer_height,
-		    .usage_flags = KORE_GPU_BUFFER_USAGE_CPU_WRITE | KORE_GPU_BUFFER_USAGE_COPY_SRC,
-		};
-		kore_gpu_device_create_buffer(&device, &parameters, &framebuffer_buffer);
+	// aliasing needs the guest to lay out rows like the buffer does
+	framebuffer_stride  = framebuffer_alias_enabled ? framebuffer_buffer_stride : framebuffer_width * 4u;
+	framebuffer_address = (memory_size - framebuffer_size()) & ~(MEMORY_PAGE_SIZE - 1);
+	restore_system_device();
+
+	kore_gpu_buffer_parameters parameters = {
+	    .size        = framebuffer_buffer_size,
+	    .usage_flags = KORE_GPU_BUFFER_USAGE_CPU_WRITE | KORE_GPU_BUFFER_USAGE_COPY_SRC,
+	};
+	kore_gpu_device_create_buffer(&device, &parameters, &framebuffer_buffer);
+
+	framebuffer_dirty_rows = (uint8_t *)calloc(framebuffer_height, 1);
+	assert(framebuffer_dirty_rows != NULL);
+
+	attach_framebuffer();
+
+	start_harts();
+
+	if (emulation_thread_enabled) {
+		start_emulation_thread();
+	}
+	else {
+		run_until_present();
 	}
 
 	kore_start();
 
+	if (emulation_thread_enabled) {
+		stop_emulation_thread();
+	}
+
+	stop_harts();
+	block_device_close();
+
+	write_profile();
+	write_samples();
+	close_trace();
+	save_snapshot();
+
+	detach_framebuffer();
+
+	log_resident_memory();
+
+	gpu_cache_destroy();
+
 	kore_gpu_command_list_destroy(&list);
 
 	kore_gpu_device_destroy(&device);
 
+	release_harts();
+	symbols_release();
+
+	ram_release((void *)page_flags, memory_size >> MEMORY_PAGE_SHIFT);
+	ram_release(ram, memory_size);
+
 	return 0;
 }
@@ -0,0 +1,260 @@
+#ifndef KOMPJUTA_RISC_V_HEADER
+#define KOMPJUTA_RISC_V_HEADER
+
+#include "memory_map.h"
+#include "profile.h"
+#include "sampler.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Guest RAM size unless --memory is given, in MiB on the command line, and the least it takes.
+#define DEFAULT_MEMORY_SIZE (1024ull * 1024 * 1024)
+#define MIN_MEMORY_SIZE     (16ull * 1024 * 1024)
+
+// Harts that --harts can ask for, every hart but the first runs on its own host thread.
+#define MAX_HARTS 8
+
+// Flags per page of guest RAM in page_flags. RAM stores that hit a page with any flag set
+// take the slow path through prepare_store, in the interpreter as well as in the JIT.
+#define PAGE_FLAG_CODE  0x1 // holds cached blocks
+#define PAGE_FLAG_WATCH 0x2 // the next store is reported to the framebuffer, then the flag is cleared
+#define PAGE_FLAG_ALIAS 0x4 // RAM is shadowed by another memory region, ram[] is stale
+
+// Decoded basic blocks. Every instruction is decoded once into a compact record holding its
+// pre-extracted operands and a handler, and blocks of those records are cached by guest pc.
+// Instructions without a specialized handler fall back to opcodes[].
+
+typedef enum decoded_op {
+	DECODED_OP_FALLBACK,
+	DECODED_OP_NOP,
+	DECODED_OP_LUI,
+	DECODED_OP_AUIPC,
+	DECODED_OP_JAL,
+	DECODED_OP_JALR,
+	DECODED_OP_BEQ,
+	DECODED_OP_BNE,
+	DECODED_OP_BLT,
+	DECODED_OP_BGE,
+	DECODED_OP_BLTU,
+	DECODED_OP_BGEU,
+	DECODED_OP_LB,
+	DECODED_OP_LH,
+	DECODED_OP_LW,
+	DECODED_OP_LD,
+	DECODED_OP_LBU,
+	DECODED_OP_LHU,
+	DECODED_OP_LWU,
+	DECODED_OP_SB,
+	DECODED_OP_SH,
+	DECODED_OP_SW,
+	DECODED_OP_SD,
+	DECODED_OP_ADDI,
+	DECODED_OP_SLTI,
+	DECODED_OP_SLTIU,
+	DECODED_OP_XORI,
+	DECODED_OP_ORI,
+	DECODED_OP_ANDI,
+	DECODED_OP_SLLI,
+	DECODED_OP_SRLI,
+	DECODED_OP_SRAI,
+	DECODED_OP_ADD,
+	DECODED_OP_SUB,
+	DECODED_OP_SLL,
+	DECODED_OP_SLT,
+	DECODED_OP_SLTU,
+	DECODED_OP_XOR,
+	DECODED_OP_SRL,
+	DECODED_OP_SRA,
+	DECODED_OP_OR,
+	DECODED_OP_AND,
+	DECODED_OP_MUL,
+	DECODED_OP_MULH,
+	DECODED_OP_MULHSU,
+	DECODED_OP_MULHU,
+	DECODED_OP_DIV,
+	DECODED_OP_DIVU,
+	DECODED_OP_REM,
+	DECODED_OP_REMU,
+	DECODED_OP_ADDIW,
+	DECODED_OP_SLLIW,
+	DECODED_OP_SRLIW,
+	DECODED_OP_SRAIW,
+	DECODED_OP_ADDW,
+	DECODED_OP_SUBW,
+	DECODED_OP_SLLW,
+	DECODED_OP_SRLW,
+	DECODED_OP_SRAW,
+	DECODED_OP_MULW,
+	DECODED_OP_DIVW,
+	DECODED_OP_DIVUW,
+	DECODED_OP_REMW,
+	DECODED_OP_REMUW,
+	DECODED_OP_COUNT,
+} decoded_op;
+
+// Build with KOMPJUTA_THREADED_DISPATCH to run blocks through the threaded interpreter
+// core, which uses computed goto where the compiler has it and a switch elsewhere.
+#if defined(KOMPJUTA_THREADED_DISPATCH) && defined(__GNUC__)
+#define KOMPJUTA_COMPUTED_GOTO
+#endif
+
+typedef struct decoded_instruction decoded_instruction;
+
+typedef void decoded_func(const decoded_instruction *instruction);
+
+struct decoded_instruction {
+	decoded_func *handler;
+#ifdef KOMPJUTA_COMPUTED_GOTO
+	const void *label;
+#endif
+	union {
+		int32_t  immediate;
+		uint32_t instruction; // DECODED_OP_FALLBACK only
+	};
+	uint8_t op         : 7;
+	uint8_t compressed : 1; // decoded from a 16 bit instruction of the C extension
+	uint8_t rd;
+	uint8_t rs1;
+	uint8_t rs2;
+};
+
+static_assert(DECODED_OP_COUNT <= 128, "decoded_instruction.op has 7 bits");
+
+static inline uint32_t decoded_size(const decoded_instruction *instruction) {
+	return instruction->compressed ? 2 : 4;
+}
+
+typedef struct hart hart;
+
+// Translated blocks take the hart they run on and return the next guest pc.
+typedef uint64_t jit_func(hart *hart);
+
+#define BLOCK_CACHE_SIZE       4096
+#define BLOCK_MAX_INSTRUCTIONS 32
+
+typedef struct block {
+	uint64_t            pc;
+	uint32_t            count;
+	uint32_t            executions;
+	jit_func           *native;
+	decoded_instruction instructions[BLOCK_MAX_INSTRUCTIONS];
+} block;
+
+typedef struct vector {
+	union {
+		uint8_t  u8[128];
+		uint16_t u16[64];
+		uint32_t u32[32];
+		uint64_t u64[16];
+		float    f32[32];
+		double   f64[16];
+	} values;
+} vector;
+
+// What hpmcounter3 and up count, the other hpmcounters read 0.
+typedef enum hart_event {
+	HART_EVENT_BLOCKS,             // blocks run, in the interpreter or translated
+	HART_EVENT_TRANSLATED_BLOCKS,  // blocks run as translated code
+	HART_EVENT_BLOCK_DECODES,      // blocks decoded, so block cache misses
+	HART_EVENT_CODE_INVALIDATIONS, // stores that hit code and dropped its blocks
+	HART_EVENT_COUNT,
+} hart_event;
+
+// The architectural state of one hart and everything it caches. Translated blocks get the
+// hart in a register and address x, pc and leave_block relative to it, x has to stay first.
+struct hart {
+	uint64_t x[32];
+	uint64_t pc;
+	bool     leave_block;
+	bool     halted; // stopped for good, by a trap or an access fault before mtvec was set or by a failed check
+	uint8_t  sew;
+	uint8_t  lmul;
+	uint8_t  lmuldiv;
+	uint16_t vl;
+	uint32_t id;
+
+	// LR/SC reservation, SC succeeds while the reserved value is still in memory
+	bool     reservation_valid;
+	uint64_t reservation_address;
+	uint64_t reservation_value;
+
+	_Atomic uint64_t executed_instructions; // written by the hart's thread only
+	uint64_t         events[HART_EVENT_COUNT];
+	profile          profile; // only counted with --profile
+	sampler          sampler; // only sampled with --sample
+	uint32_t         sample_countdown;
+
+	uint64_t f[32]; // raw bits, singles NaN-boxed
+	uint8_t  frm;
+	uint8_t  fflags;
+	bool     float_flags_live; // the host's floating point status holds flags that are not in fflags yet
+
+	vector v[32];
+
+	// Machine mode traps, the only privilege level there is. mtimecmp and mip are written by
+	// other threads, through the CLINT and by the host's vsync.
+	uint64_t         mstatus; // MIE and MPIE, the other fields read fixed values
+	uint64_t         mie;
+	uint64_t         mtvec;
+	uint64_t         mscratch;
+	uint64_t         mepc;
+	uint64_t         mcause;
+	uint64_t         mtval;
+	uint64_t         fault_cause;   // of a load or store access fault that is taken once its block ended, 0 for none
+	uint64_t         fault_address;
+	bool             trapped; // entered a trap in the current block, the instruction at mepc did not retire
+	_Atomic uint64_t mtimecmp;
+	_Atomic uint64_t mip;                 // MSIP and MEIP, MTIP follows from time and mtimecmp
+	bool             waiting;             // in wfi until an enabled interrupt is pending
+	uint32_t         interrupt_countdown; // blocks until time is compared with mtimecmp again
+	_Atomic bool     drop_native; // set from any thread, the hart drops its translated blocks before its next block
+
+	block *blocks; // BLOCK_CACHE_SIZE decoded blocks
+};
+
+extern uint8_t         *ram;
+extern uint64_t         memory_size;
+extern _Atomic uint8_t *page_flags;         // one byte per page of guest RAM, shared by all harts
+extern uint32_t         aliased_page_count; // loads in translated blocks check page_flags while not 0
+
+uint32_t read_memory8(uint64_t address);
+uint16_t read_memory16(uint64_t address);
+uint32_t read_memory32(uint64_t address);
+uint64_t read_memory64(uint64_t address);
+
+void store_memory8(uint64_t address, uint8_t value);
+void store_memory16(uint64_t address, uint16_t value);
+void store_memory32(uint64_t address, uint32_t value);
+void store_memory64(uint64_t address, uint64_t value);
+
+// Bulk copies between guest memory and host memory. They return false without touching
+// anything unless the whole range is RAM, the caller falls back to single accesses then.
+bool read_memory_block(uint64_t address, void *data, uint64_t size);
+bool store_memory_block(uint64_t address, const void *data, uint64_t size);
+
+uint64_t multiply_high_signed(uint64_t a, uint64_t b);
+uint64_t multiply_high_signed_unsigned(uint64_t a, uint64_t b);
+uint64_t multiply_high_unsigned(uint64_t a, uint64_t b);
+uint64_t divide_signed(uint64_t a, uint64_t b);
+uint64_t divide_unsigned(uint64_t a, uint64_t b);
+uint64_t remainder_signed(uint64_t a, uint64_t b);
+uint64_t remainder_unsigned(uint64_t a, uint64_t b);
+uint64_t divide_signed_word(uint64_t a, uint64_t b);
+uint64_t divide_unsigned_word(uint64_t a, uint64_t b);
+uint64_t remainder_signed_word(uint64_t a, uint64_t b);
+uint64_t remainder_unsigned_word(uint64_t a, uint64_t b);
+
+void decoded_fallback(const decoded_instruction *instruction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,142 @@
+#include "sampler.h"
+#include "risc-v.h"
+
+#include <kore3/log.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLER_INITIAL_CAPACITY 1024
+
+static uint32_t hash_frames(const symbol *const *frames, uint32_t depth) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (uint32_t frame_index = 0; frame_index < depth; ++frame_index) {
+		hash = (hash ^ (uint64_t)(uintptr_t)frames[frame_index]) * 0x100000001b3ull;
+	}
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static sampled_stack *find_stack(sampler *sampler, uint32_t hash, const symbol *const *frames, uint32_t depth) {
+	uint32_t index = hash & (sampler->capacity - 1);
+	for (;;) {
+		sampled_stack *stack = &sampler->stacks[index];
+		if (stack->count == 0 ||
+		    (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(const symbol *)) == 0)) {
+			return stack;
+		}
+		index = (index + 1) & (sampler->capacity - 1);
+	}
+}
+
+static void grow(sampler *sampler) {
+	sampled_stack *old_stacks   = sampler->stacks;
+	uint32_t       old_capacity = sampler->capacity;
+
+	sampler->capacity = old_capacity == 0 ? SAMPLER_INITIAL_CAPACITY : old_capacity * 2;
+	sampler->stacks   = (sampled_stack *)calloc(sampler->capacity, sizeof(sampled_stack));
+	assert(sampler->stacks != NULL);
+
+	for (uint32_t stack_index = 0; stack_index < old_capacity; ++stack_index) {
+		const sampled_stack *old_stack = &old_stacks[stack_index];
+		if (old_stack->count != 0) {
+			*find_stack(sampler, old_stack->hash, old_stack->frames, old_stack->depth) = *old_stack;
+		}
+	}
+	free(old_stacks);
+}
+
+static void add(sampler *sampler, const symbol *const *frames, uint32_t depth, uint64_t count) {
+	// kept at most half full
+	if ((sampler->count + 1) * 2 > sampler->capacity) {
+		grow(sampler);
+	}
+
+	uint32_t       hash  = hash_frames(frames, depth);
+	sampled_stack *stack = find_stack(sampler, hash, frames, depth);
+	if (stack->count == 0) {
+		stack->hash  = hash;
+		stack->depth = depth;
+		memcpy(stack->frames, frames, depth * sizeof(const symbol *));
+		++sampler->count;
+	}
+	stack->count += count;
+}
+
+void sampler_sample(sampler *sampler, const uint64_t *x, uint64_t pc) {
+	const symbol *frames[SAMPLER_MAX_DEPTH];
+	uint32_t      depth = 0;
+
+	frames[depth++] = symbols_find(pc);
+
+	uint64_t frame_pointer = x[8];
+	uint64_t saved[2]; // the caller's fp and the return address
+	bool     framed = frame_pointer % 8 == 0 && frame_pointer >= 16 && read_memory_block(frame_pointer - 16, saved, sizeof(saved));
+
+	// ra only names a caller of its own in leaf functions, which do not save it, and not
+	// after the function called something itself, when it points back into the function
+	uint64_t      return_address = x[1];
+	const symbol *caller         = symbols_find(return_address);
+	if (return_address != 0 && caller != frames[0] && !(framed && saved[1] == return_address)) {
+		frames[depth++] = caller;
+	}
+
+	while (framed && depth < SAMPLER_MAX_DEPTH && saved[1] != 0) {
+		frames[depth++] = symbols_find(saved[1]);
+
+		// stacks grow down, so a caller's frame is always above
+		uint64_t caller_frame_pointer = saved[0];
+		if (caller_frame_pointer <= frame_pointer) {
+			break;
+		}
+		frame_pointer = caller_frame_pointer;
+		framed        = frame_pointer % 8 == 0 && read_memory_block(frame_pointer - 16, saved, sizeof(saved));
+	}
+
+	add(sampler, frames, depth, 1);
+}
+
+bool sampler_write(const sampler *samplers, uint32_t sampler_count, const char *path) {
+	sampler merged = {0};
+	for (uint32_t sampler_index = 0; sampler_index < sampler_count; ++sampler_index) {
+		const sampler *source = &samplers[sampler_index];
+		for (uint32_t stack_index = 0; stack_index < source->capacity; ++stack_index) {
+			const sampled_stack *stack = &source->stacks[stack_index];
+			if (stack->count != 0) {
+				add(&merged, stack->frames, stack->depth, stack->count);
+			}
+		}
+	}
+
+	FILE *file    = fopen(path, "w");
+	bool  written = file != NULL;
+	if (!written) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Could not write the samples to %s.", path);
+	}
+	else {
+		for (uint32_t stack_index = 0; stack_index < merged.capacity; ++stack_index) {
+			const sampled_stack *stack = &merged.stacks[stack_index];
+			if (stack->count == 0) {
+				continue;
+			}
+			for (uint32_t frame_index = stack->depth; frame_index > 0; --frame_index) {
+				const symbol *frame = stack->frames[frame_index - 1];
+				fprintf(file, "%s%s", frame != NULL ? frame->name : "[unknown]", frame_index > 1 ? ";" : "");
+			}
+			fprintf(file, " %llu\n", (unsigned long long)stack->count);
+		}
+		fclose(file);
+	}
+
+	sampler_release(&merged);
+
+	return written;
+}
+
+void sampler_release(sampler *sampler) {
+	free(sampler->stacks);
+	sampler->stacks   = NULL;
+	sampler->capacity = 0;
+	sampler->count    = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef KOMPJUTA_SAMPLER_HEADER
+#define KOMPJUTA_SAMPLER_HEADER
+
+#include "symbols.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The sampling profiler of --sample. Every so many instructions a hart records the function
+// it is in and the functions it was called from, found by walking the frame pointer chain
+// the standard RISC-V frame layout leaves behind: the return address at fp - 8 and the
+// caller's fp at fp - 16. Code built without frame pointers just shows shorter stacks.
+// Samples of identical stacks are counted together, every hart in a table of its own.
+
+#define SAMPLER_MAX_DEPTH 64
+
+typedef struct sampled_stack {
+	uint64_t      count; // 0 for free entries
+	uint32_t      hash;
+	uint32_t      depth;
+	const symbol *frames[SAMPLER_MAX_DEPTH]; // innermost first, NULL outside of all symbols
+} sampled_stack;
+
+typedef struct sampler {
+	sampled_stack *stacks; // open addressing
+	uint32_t       capacity;
+	uint32_t       count;
+} sampler;
+
+// Takes the sample on the calling hart's thread, x are the hart's registers.
+void sampler_sample(sampler *sampler, const uint64_t *x, uint64_t pc);
+
+// Writes the stacks of all tables in the collapsed format of flamegraph.pl and speedscope,
+// outermost function first.
+bool sampler_write(const sampler *samplers, uint32_t sampler_count, const char *path);
+
+void sampler_release(sampler *sampler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
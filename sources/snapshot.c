@@ -0,0 +1,264 @@
+#include "snapshot.h"
+#include "ram.h"
+
+#include <kore3/log.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC   "KOMPSNAP"
+#define SNAPSHOT_VERSION 5
+
+typedef struct snapshot_header {
+	char             magic[8];
+	uint32_t         version;
+	uint32_t         hart_size; // sizeof(snapshot_hart), which differs between hosts of other layouts
+	snapshot_machine machine;
+	uint64_t         chunk_count;
+	uint64_t         harts_offset;
+	uint64_t         chunks_offset;
+	uint64_t         data_offset;
+} snapshot_header;
+
+// What is kept of a hart, independent of the hart struct and its caches.
+typedef struct snapshot_hart {
+	uint64_t x[32];
+	uint64_t pc;
+	uint64_t f[32];
+	vector   v[32];
+	uint64_t executed_instructions;
+	uint64_t reservation_address;
+	uint64_t reservation_value;
+	uint64_t mstatus;
+	uint64_t mie;
+	uint64_t mtvec;
+	uint64_t mscratch;
+	uint64_t mepc;
+	uint64_t mcause;
+	uint64_t mtval;
+	uint64_t mtimecmp;
+	uint64_t mip;
+	uint16_t vl;
+	uint8_t  frm;
+	uint8_t  fflags;
+	uint8_t  sew;
+	uint8_t  lmul;
+	uint8_t  lmuldiv;
+	uint8_t  reservation_valid;
+	uint8_t  waiting;
+} snapshot_hart;
+
+static const uint8_t zeros[SNAPSHOT_CHUNK_SIZE];
+
+static bool chunk_used(const uint8_t *chunk) {
+	const uint64_t *words = (const uint64_t *)chunk;
+	for (uint32_t index = 0; index < SNAPSHOT_CHUNK_SIZE / 8; ++index) {
+		if (words[index] != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint64_t align_chunk(uint64_t offset) {
+	return (offset + SNAPSHOT_CHUNK_SIZE - 1) & ~(uint64_t)(SNAPSHOT_CHUNK_SIZE - 1);
+}
+
+static void save_hart(snapshot_hart *saved, const hart *hart) {
+	memset(saved, 0, sizeof(*saved));
+	memcpy(saved->x, hart->x, sizeof(saved->x));
+	memcpy(saved->f, hart->f, sizeof(saved->f));
+	memcpy(saved->v, hart->v, sizeof(saved->v));
+	saved->pc                    = hart->pc;
+	saved->executed_instructions = atomic_load_explicit(&hart->executed_instructions, memory_order_relaxed);
+	saved->reservation_address   = hart->reservation_address;
+	saved->reservation_value     = hart->reservation_value;
+	saved->mstatus               = hart->mstatus;
+	saved->mie                   = hart->mie;
+	saved->mtvec                 = hart->mtvec;
+	saved->mscratch              = hart->mscratch;
+	saved->mepc                  = hart->mepc;
+	saved->mcause                = hart->mcause;
+	saved->mtval                 = hart->mtval;
+	saved->mtimecmp              = atomic_load_explicit(&hart->mtimecmp, memory_order_relaxed);
+	saved->mip                   = atomic_load_explicit(&hart->mip, memory_order_relaxed);
+	saved->vl                    = hart->vl;
+	saved->frm                   = hart->frm;
+	saved->fflags                = hart->fflags;
+	saved->sew                   = hart->sew;
+	saved->lmul                  = hart->lmul;
+	saved->lmuldiv               = hart->lmuldiv;
+	saved->reservation_valid     = hart->reservation_valid;
+	saved->waiting               = hart->waiting;
+}
+
+static void load_hart(hart *hart, const snapshot_hart *saved) {
+	memcpy(hart->x, saved->x, sizeof(hart->x));
+	memcpy(hart->f, saved->f, sizeof(hart->f));
+	memcpy(hart->v, saved->v, sizeof(hart->v));
+	hart->pc = saved->pc;
+	atomic_store_explicit(&hart->executed_instructions, saved->executed_instructions, memory_order_relaxed);
+	hart->reservation_address = saved->reservation_address;
+	hart->reservation_value   = saved->reservation_value;
+	hart->mstatus             = saved->mstatus;
+	hart->mie                 = saved->mie;
+	hart->mtvec               = saved->mtvec;
+	hart->mscratch            = saved->mscratch;
+	hart->mepc                = saved->mepc;
+	hart->mcause              = saved->mcause;
+	hart->mtval               = saved->mtval;
+	atomic_store_explicit(&hart->mtimecmp, saved->mtimecmp, memory_order_relaxed);
+	atomic_store_explicit(&hart->mip, saved->mip, memory_order_relaxed);
+	hart->vl                  = saved->vl;
+	hart->frm                 = saved->frm;
+	hart->fflags              = saved->fflags;
+	hart->sew                 = saved->sew;
+	hart->lmul                = saved->lmul;
+	hart->lmuldiv             = saved->lmuldiv;
+	hart->reservation_valid   = saved->reservation_valid != 0;
+	hart->waiting             = saved->waiting != 0;
+}
+
+bool snapshot_save(const char *path, const snapshot_machine *machine, const hart *harts, const uint8_t *ram) {
+	assert(machine->memory_size % SNAPSHOT_CHUNK_SIZE == 0);
+
+	uint64_t  chunk_total = machine->memory_size / SNAPSHOT_CHUNK_SIZE;
+	uint64_t *chunks      = (uint64_t *)malloc(chunk_total * sizeof(uint64_t));
+	assert(chunks != NULL);
+
+	// chunks the host never backed are skipped without reading them, which would back them
+	uint64_t chunk_count = 0;
+	for (uint64_t chunk = 0; chunk < chunk_total; ++chunk) {
+		const uint8_t *memory = &ram[chunk * SNAPSHOT_CHUNK_SIZE];
+		bool           backed = ram_file_mapped(memory, SNAPSHOT_CHUNK_SIZE) || ram_resident_pages(memory, SNAPSHOT_CHUNK_SIZE) != 0;
+		if (backed && chunk_used(memory)) {
+			chunks[chunk_count++] = chunk;
+		}
+	}
+
+	snapshot_header header = {0};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version       = SNAPSHOT_VERSION;
+	header.hart_size     = sizeof(snapshot_hart);
+	header.machine       = *machine;
+	header.chunk_count   = chunk_count;
+	header.harts_offset  = sizeof(snapshot_header);
+	header.chunks_offset = header.harts_offset + machine->hart_count * sizeof(snapshot_hart);
+	header.data_offset   = align_chunk(header.chunks_offset + chunk_count * sizeof(uint64_t));
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Could not write the snapshot to %s.", path);
+		free(chunks);
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	for (uint32_t hart_index = 0; hart_index < machine->hart_count; ++hart_index) {
+		snapshot_hart saved;
+		save_hart(&saved, &harts[hart_index]);
+		fwrite(&saved, sizeof(saved), 1, file);
+	}
+
+	fwrite(chunks, sizeof(uint64_t), (size_t)chunk_count, file);
+	fwrite(zeros, 1, (size_t)(header.data_offset - header.chunks_offset - chunk_count * sizeof(uint64_t)), file);
+
+	for (uint64_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index) {
+		fwrite(&ram[chunks[chunk_index] * SNAPSHOT_CHUNK_SIZE], 1, SNAPSHOT_CHUNK_SIZE, file);
+	}
+
+	bool written = ferror(file) == 0;
+	written      = fclose(file) == 0 && written;
+	free(chunks);
+
+	if (!written) {
+		kore_log(KORE_LOG_LEVEL_WARNING, "Could not write the snapshot to %s.", path);
+	}
+	return written;
+}
+
+bool snapshot_open(snapshot *snapshot, const char *path) {
+	memset(snapshot, 0, sizeof(*snapshot));
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "Could not open the snapshot %s.", path);
+		return false;
+	}
+
+	snapshot_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != SNAPSHOT_VERSION || header.hart_size != sizeof(snapshot_hart)) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "%s is no snapshot of this version of Kompjuta.", path);
+		fclose(file);
+		return false;
+	}
+
+	snapshot->file          = file;
+	snapshot->machine       = header.machine;
+	snapshot->chunk_count   = header.chunk_count;
+	snapshot->harts_offset  = header.harts_offset;
+	snapshot->chunks_offset = header.chunks_offset;
+	snapshot->data_offset   = header.data_offset;
+	return true;
+}
+
+bool snapshot_load_ram(snapshot *snapshot, uint8_t *ram) {
+	uint64_t *chunks = (uint64_t *)malloc(snapshot->chunk_count * sizeof(uint64_t) + 1);
+	assert(chunks != NULL);
+
+	bool loaded = fseek(snapshot->file, (long)snapshot->chunks_offset, SEEK_SET) == 0 &&
+	              fread(chunks, sizeof(uint64_t), (size_t)snapshot->chunk_count, snapshot->file) == snapshot->chunk_count;
+
+	// runs of consecutive chunks are consecutive in the file as well and mapped in one go
+	uint64_t chunk_total = snapshot->machine.memory_size / SNAPSHOT_CHUNK_SIZE;
+	for (uint64_t first = 0; first < snapshot->chunk_count && loaded;) {
+		uint64_t last = first;
+		while (last + 1 < snapshot->chunk_count && chunks[last + 1] == chunks[last] + 1) {
+			++last;
+		}
+
+		if (chunks[last] >= chunk_total) {
+			loaded = false;
+			break;
+		}
+
+		uint64_t count  = last - first + 1;
+		uint64_t offset = snapshot->data_offset + first * SNAPSHOT_CHUNK_SIZE;
+		loaded          = ram_map_file(&ram[chunks[first] * SNAPSHOT_CHUNK_SIZE], count * SNAPSHOT_CHUNK_SIZE, snapshot->file, offset);
+		first           = last + 1;
+	}
+
+	free(chunks);
+
+	if (!loaded) {
+		kore_log(KORE_LOG_LEVEL_ERROR, "Could not load the RAM of the snapshot.");
+	}
+	return loaded;
+}
+
+bool snapshot_load_harts(snapshot *snapshot, hart *harts) {
+	if (fseek(snapshot->file, (long)snapshot->harts_offset, SEEK_SET) != 0) {
+		return false;
+	}
+
+	for (uint32_t hart_index = 0; hart_index < snapshot->machine.hart_count; ++hart_index) {
+		snapshot_hart saved;
+		if (fread(&saved, sizeof(saved), 1, snapshot->file) != 1) {
+			kore_log(KORE_LOG_LEVEL_ERROR, "Could not load the harts of the snapshot.");
+			return false;
+		}
+		load_hart(&harts[hart_index], &saved);
+	}
+	return true;
+}
+
+void snapshot_close(snapshot *snapshot) {
+	if (snapshot->file != NULL) {
+		fclose(snapshot->file);
+		snapshot->file = NULL;
+	}
+}
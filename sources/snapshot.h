@@ -0,0 +1,75 @@
+#ifndef KOMPJUTA_SNAPSHOT_HEADER
+#define KOMPJUTA_SNAPSHOT_HEADER
+
+#include "blitter.h"
+#include "risc-v.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Machine snapshots of --save-snapshot and --restore-snapshot: the architectural state of
+// every hart, the system device's registers and RAM. RAM is kept sparsely, in chunks that
+// hold anything but zeros, stored at chunk aligned file offsets so a restore maps them
+// copy-on-write instead of reading them. Many processes restoring one snapshot then share
+// its pages and a restore costs about the same no matter how much RAM the guest uses.
+//
+// Snapshots are raw host memory layouts and only load on hosts of the same byte order. The
+// block device's image is not part of them, a restore is given the same --disk again.
+
+#define SNAPSHOT_CHUNK_SIZE (64 * 1024)
+
+typedef struct snapshot_machine {
+	uint64_t memory_size;
+	uint32_t hart_count;
+	uint32_t framebuffer_width; // decided by the host, the guest expects the same after a restore
+	uint32_t framebuffer_height;
+	uint32_t framebuffer_stride;
+	uint64_t framebuffer_address;
+	uint64_t command_list_address;
+	uint32_t command_list_size;
+	uint64_t command_ring_address;
+	uint64_t command_ring_size;
+	uint64_t command_ring_head; // the commands between head and tail are in RAM and run after a restore
+	uint64_t command_ring_tail;
+	uint64_t command_ring_fence;
+	uint64_t vsync_count;
+	uint64_t blitter_registers[MAX_HARTS][BLITTER_REGISTER_COUNT];
+	uint64_t block_queue_address;
+	uint64_t block_queue_size;
+	uint64_t block_queue_head; // and tail, the block device finishes its requests before a snapshot
+	uint64_t time; // of the time CSR, which keeps counting from there
+} snapshot_machine;
+
+typedef struct snapshot {
+	FILE            *file;
+	snapshot_machine machine;
+	uint64_t         chunk_count;
+	uint64_t         harts_offset;
+	uint64_t         chunks_offset; // the indices of the stored chunks
+	uint64_t         data_offset;   // their contents, in index order
+} snapshot;
+
+// Harts are stopped and ram holds machine->memory_size bytes.
+bool snapshot_save(const char *path, const snapshot_machine *machine, const hart *harts, const uint8_t *ram);
+
+// Reads the machine, RAM and the harts are loaded once they are set up for it.
+bool snapshot_open(snapshot *snapshot, const char *path);
+
+// ram is a zeroed reservation of machine.memory_size bytes.
+bool snapshot_load_ram(snapshot *snapshot, uint8_t *ram);
+
+// Architectural state only, the harts' caches have to be empty.
+bool snapshot_load_harts(snapshot *snapshot, hart *harts);
+
+void snapshot_close(snapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
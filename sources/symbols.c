@@ -0,0 +1,77 @@
+#include "symbols.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static symbol  *symbols         = NULL;
+static uint32_t symbol_count    = 0;
+static uint32_t symbol_capacity = 0;
+static bool     symbols_sorted  = true;
+
+void symbols_add(const char *name, uint64_t address, uint64_t size) {
+	if (symbol_count == symbol_capacity) {
+		symbol_capacity = symbol_capacity == 0 ? 256 : symbol_capacity * 2;
+		symbols         = (symbol *)realloc(symbols, symbol_capacity * sizeof(symbol));
+		assert(symbols != NULL);
+	}
+
+	size_t name_size = strlen(name) + 1;
+	char  *copy      = (char *)malloc(name_size);
+	assert(copy != NULL);
+	memcpy(copy, name, name_size);
+
+	symbols[symbol_count].address = address;
+	symbols[symbol_count].size    = size;
+	symbols[symbol_count].name    = copy;
+	++symbol_count;
+
+	symbols_sorted = false;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+	uint64_t address_a = ((const symbol *)a)->address;
+	uint64_t address_b = ((const symbol *)b)->address;
+	return address_a < address_b ? -1 : (address_a > address_b ? 1 : 0);
+}
+
+const symbol *symbols_find(uint64_t address) {
+	if (!symbols_sorted) {
+		qsort(symbols, symbol_count, sizeof(symbol), compare_symbols);
+		symbols_sorted = true;
+	}
+
+	// the last symbol that starts at or before address
+	uint32_t low  = 0;
+	uint32_t high = symbol_count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (symbols[middle].address <= address) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	if (low == 0) {
+		return NULL;
+	}
+
+	const symbol *found = &symbols[low - 1];
+	if (found->size != 0 && address - found->address >= found->size) {
+		return NULL;
+	}
+	return found;
+}
+
+void symbols_release(void) {
+	for (uint32_t symbol_index = 0; symbol_index < symbol_count; ++symbol_index) {
+		free((void *)symbols[symbol_index].name);
+	}
+	free(symbols);
+	symbols         = NULL;
+	symbol_count    = 0;
+	symbol_capacity = 0;
+	symbols_sorted  = true;
+}
@@ -0,0 +1,30 @@
+#ifndef KOMPJUTA_SYMBOLS_HEADER
+#define KOMPJUTA_SYMBOLS_HEADER
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Function and label symbols of the guest binary, for the host side profiles.
+
+typedef struct symbol {
+	uint64_t    address;
+	uint64_t    size; // 0 when the ELF did not say, the symbol then reaches up to the next one
+	const char *name;
+} symbol;
+
+// Copies the name. Symbols can be added in any order, lookups sort them first.
+void symbols_add(const char *name, uint64_t address, uint64_t size);
+
+// Returns the symbol that covers address or NULL.
+const symbol *symbols_find(uint64_t address);
+
+void symbols_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
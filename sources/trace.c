@@ -0,0 +1,190 @@
+#include "trace.h"
+
+#include <kore3/log.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_LINE_SIZE 4096
+
+static void format_record(const trace_record *record, char *text, size_t size) {
+	int length = snprintf(text, size, "core %3u: 3 0x%016llx (0x%0*x)", record->hart, (unsigned long long)record->pc, record->size * 2,
+	                      record->instruction);
+	for (uint32_t write_index = 0; write_index < record->write_count && length < (int)size; ++write_index) {
+		const trace_register_write *write = &record->writes[write_index];
+		length += snprintf(text + length, size - length, " %c%-2u 0x%016llx", write->file, write->index, (unsigned long long)write->value);
+	}
+	for (uint32_t store_index = 0; store_index < record->store_count && length < (int)size; ++store_index) {
+		const trace_store *store = &record->stores[store_index];
+		length += snprintf(text + length, size - length, " mem 0x%016llx 0x%0*llx", (unsigned long long)store->address, store->size * 2,
+		                   (unsigned long long)store->value);
+	}
+}
+
+static bool register_name(const char *token) {
+	if ((token[0] != 'x' && token[0] != 'f') || token[1] == 0) {
+		return false;
+	}
+	for (const char *digit = &token[1]; *digit != 0; ++digit) {
+		if (!isdigit((unsigned char)*digit)) {
+			return false;
+		}
+	}
+	return atoi(&token[1]) < 32;
+}
+
+static bool parse_record(const char *text, trace_record *record) {
+	memset(record, 0, sizeof(*record));
+
+	unsigned long long pc;
+	char               instruction[17];
+	int                length;
+	if (sscanf(text, "core %u: %*u 0x%llx (0x%16[0-9a-fA-F])%n", &record->hart, &pc, instruction, &length) != 3) {
+		return false;
+	}
+	record->pc          = pc;
+	record->instruction = (uint32_t)strtoul(instruction, NULL, 16);
+	record->size        = strlen(instruction) <= 4 ? 2 : 4;
+
+	const char *cursor = text + length;
+	char        token[64];
+	while (sscanf(cursor, "%63s%n", token, &length) == 1) {
+		cursor += length;
+
+		unsigned long long value;
+		if (register_name(token)) {
+			if (sscanf(cursor, " 0x%llx%n", &value, &length) == 1) {
+				cursor += length;
+				if (record->write_count < TRACE_MAX_WRITES) {
+					trace_register_write *write = &record->writes[record->write_count++];
+					write->file                 = token[0];
+					write->index                = (uint8_t)atoi(&token[1]);
+					write->value                = value;
+				}
+			}
+		}
+		else if (strcmp(token, "mem") == 0) {
+			unsigned long long address;
+			char               stored[17];
+			if (sscanf(cursor, " 0x%llx%n", &address, &length) != 1) {
+				continue;
+			}
+			cursor += length;
+
+			// loads only log the address
+			if (sscanf(cursor, " 0x%16[0-9a-fA-F]%n", stored, &length) == 1) {
+				cursor += length;
+				if (record->store_count < TRACE_MAX_STORES) {
+					trace_store *store = &record->stores[record->store_count++];
+					store->address     = address;
+					store->value       = strtoull(stored, NULL, 16);
+					store->size        = (uint8_t)((strlen(stored) + 1) / 2);
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool write_recorded(const trace_record *record, const trace_register_write *write) {
+	for (uint32_t write_index = 0; write_index < record->write_count; ++write_index) {
+		const trace_register_write *other = &record->writes[write_index];
+		if (other->file == write->file && other->index == write->index && other->value == write->value) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Spike prints compressed instructions with four or eight digits, so the size is not compared.
+static bool records_match(const trace_record *expected, const trace_record *actual) {
+	if (expected->pc != actual->pc || expected->instruction != actual->instruction) {
+		return false;
+	}
+
+	if (expected->write_count != actual->write_count) {
+		return false;
+	}
+	for (uint32_t write_index = 0; write_index < expected->write_count; ++write_index) {
+		if (!write_recorded(actual, &expected->writes[write_index])) {
+			return false;
+		}
+	}
+
+	if (expected->store_count != actual->store_count) {
+		return false;
+	}
+	for (uint32_t store_index = 0; store_index < expected->store_count; ++store_index) {
+		const trace_store *expected_store = &expected->stores[store_index];
+		const trace_store *actual_store   = &actual->stores[store_index];
+		if (expected_store->address != actual_store->address || expected_store->size != actual_store->size || expected_store->value != actual_store->value) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool trace_open_write(trace *trace, const char *path) {
+	memset(trace, 0, sizeof(*trace));
+	trace->file = fopen(path, "w");
+	trace->path = path;
+	return trace->file != NULL;
+}
+
+bool trace_open_check(trace *trace, const char *path) {
+	memset(trace, 0, sizeof(*trace));
+	trace->file = fopen(path, "r");
+	trace->path = path;
+	return trace->file != NULL;
+}
+
+void trace_write(trace *trace, const trace_record *record) {
+	char text[TRACE_LINE_SIZE];
+	format_record(record, text, sizeof(text));
+	fprintf(trace->file, "%s\n", text);
+	++trace->records;
+}
+
+bool trace_check(trace *trace, const trace_record *record) {
+	if (trace->file == NULL) {
+		return true;
+	}
+
+	// lines that are no instructions, like Spike's own messages, are skipped
+	char         text[TRACE_LINE_SIZE];
+	trace_record expected;
+	do {
+		if (fgets(text, sizeof(text), trace->file) == NULL) {
+			kore_log(KORE_LOG_LEVEL_INFO, "The trace %s ends after %llu instructions, the rest is not checked.", trace->path,
+			         (unsigned long long)trace->records);
+			fclose(trace->file);
+			trace->file = NULL;
+			return true;
+		}
+		++trace->line;
+	} while (!parse_record(text, &expected));
+
+	if (!records_match(&expected, record)) {
+		char actual[TRACE_LINE_SIZE];
+		format_record(&expected, text, sizeof(text));
+		format_record(record, actual, sizeof(actual));
+		kore_log(KORE_LOG_LEVEL_ERROR, "Diverged from the trace %s at instruction %llu, line %llu:", trace->path, (unsigned long long)trace->records,
+		         (unsigned long long)trace->line);
+		kore_log(KORE_LOG_LEVEL_ERROR, "  expected %s", text);
+		kore_log(KORE_LOG_LEVEL_ERROR, "  executed %s", actual);
+		return false;
+	}
+
+	++trace->records;
+	return true;
+}
+
+void trace_close(trace *trace) {
+	if (trace->file != NULL) {
+		fclose(trace->file);
+		trace->file = NULL;
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef KOMPJUTA_TRACE_HEADER
+#define KOMPJUTA_TRACE_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The commit log of --trace and --trace-check, one line per instruction in the layout of
+// Spike's --log-commits:
+//
+//   core   0: 3 0x0000000000010074 (0x00a50533) x10 0x0000000000000003
+//   core   0: 3 0x0000000000010078 (0xc108) mem 0x0000000000020000 0x00000003
+//
+// the hart, the privilege level (always machine mode), pc and instruction, then the registers
+// the instruction wrote and the memory it stored. When a trace is read, loads (mem with an
+// address only) and anything else Spike adds, like CSR writes, are skipped.
+
+#define TRACE_MAX_WRITES 4
+#define TRACE_MAX_STORES 64 // what the store journal holds, larger vector stores are cut off
+
+typedef struct trace_register_write {
+	char     file; // 'x' or 'f'
+	uint8_t  index;
+	uint64_t value;
+} trace_register_write;
+
+typedef struct trace_store {
+	uint64_t address;
+	uint64_t value;
+	uint8_t  size;
+} trace_store;
+
+typedef struct trace_record {
+	uint32_t             hart;
+	uint64_t             pc;
+	uint32_t             instruction;
+	uint8_t              size; // 2 for compressed instructions, otherwise 4
+	uint32_t             write_count;
+	trace_register_write writes[TRACE_MAX_WRITES];
+	uint32_t             store_count;
+	trace_store          stores[TRACE_MAX_STORES];
+} trace_record;
+
+typedef struct trace {
+	FILE       *file;
+	const char *path;
+	uint64_t    line;
+	uint64_t    records; // written or checked so far
+} trace;
+
+bool trace_open_write(trace *trace, const char *path);
+bool trace_open_check(trace *trace, const char *path);
+
+void trace_write(trace *trace, const trace_record *record);
+
+// Compares the record with the next one of the trace and logs both when they differ, which
+// is the first divergence. Once the trace ran out everything matches.
+bool trace_check(trace *trace, const trace_record *record);
+
+void trace_close(trace *trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
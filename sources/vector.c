@@ -0,0 +1,1768 @@
+#include "vector.h"
+
+#include "floating_point.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Arithmetic computes whole chunks of VECTOR_CHUNK bytes and blends the active elements into vd through a byte mask.
+
+#define VECTOR_CHUNK    32
+#define GROUP_MAX_BYTES (8 * sizeof(vector))
+
+#define UNSIGNED_MAX(bits) (~0ull >> (64 - (bits)))
+#define SIGNED_MAX(bits)   ((int64_t)(UNSIGNED_MAX(bits) >> 1))
+#define SIGNED_MIN(bits)   (-SIGNED_MAX(bits) - 1)
+
+#define FUSED_MULTIPLY_ADD(x, y, z) _Generic((x), float: fmaf, default: fma)(x, y, z)
+#define SQUARE_ROOT(x)              _Generic((x), float: sqrtf, default: sqrt)(x)
+#define COPY_SIGN(x, y)             _Generic((x), float: copysignf, default: copysign)(x, y)
+#define FLOAT_CLASS(x)              _Generic((x), float: float_class32, default: float_class64)(x)
+
+// vs1_step is SIZE_MAX when vs1 is a register group and 0 when it points to one chunk that
+// holds a broadcast scalar.
+typedef void vector_kernel(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, size_t vs1_step, const uint8_t *mask, uint32_t bytes);
+
+// Writes one byte per element, 1 where the comparison holds.
+typedef void vector_compare(uint8_t *results, const uint8_t *vs2, const uint8_t *vs1, size_t vs1_step, uint32_t bytes);
+
+typedef struct operand {
+	const uint8_t *data;
+	size_t         step;
+	uint64_t       scalar;
+	uint8_t        chunk[VECTOR_CHUNK];
+} operand;
+
+enum { OPIVV = 0x0, OPFVV = 0x1, OPMVV = 0x2, OPIVI = 0x3, OPIVX = 0x4, OPFVF = 0x5, OPMVX = 0x6, OPCFG = 0x7 };
+
+static uint8_t *group(hart *hart, uint8_t reg) {
+	return hart->v[reg].values.u8;
+}
+
+static uint32_t vlmax(const hart *hart) {
+	return (uint32_t)(sizeof(vector) * 8 / hart->sew) * hart->lmul / hart->lmuldiv;
+}
+
+// A register group that holds vlmax elements of bits each has to start at a multiple of its
+// size and may not be larger than 8 registers, which also keeps it from running past v31.
+// Fractional groups take one register, a bits of 0 stands for a mask or a scalar.
+static bool group_valid(const hart *hart, uint8_t reg, uint32_t bits) {
+	uint32_t registers = (uint32_t)(vlmax(hart) * bits / (8 * sizeof(vector)));
+	if (registers <= 1) {
+		return true;
+	}
+	return registers <= 8 && reg % registers == 0;
+}
+
+static uint32_t sew_index(const hart *hart) {
+	switch (hart->sew) {
+	case 8:
+		return 0;
+	case 16:
+		return 1;
+	case 32:
+		return 2;
+	case 64:
+		return 3;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+static uint32_t chunked_bytes(const hart *hart, uint32_t element_size) {
+	return (hart->vl * element_size + VECTOR_CHUNK - 1) & ~(VECTOR_CHUNK - 1);
+}
+
+static bool mask_bit(const uint8_t *mask, uint32_t element) {
+	return (mask[element >> 3] >> (element & 7)) & 1;
+}
+
+static bool element_active(hart *hart, bool masked, uint32_t element) {
+	return !masked || mask_bit(group(hart, 0), element);
+}
+
+static uint64_t read_element(const uint8_t *group, uint32_t index, uint32_t size) {
+	uint64_t value = 0;
+	memcpy(&value, &group[index * size], size);
+	return value;
+}
+
+static void write_element(uint8_t *group, uint32_t index, uint32_t size, uint64_t value) {
+	memcpy(&group[index * size], &value, size);
+}
+
+static uint64_t operand_element(const operand *operand, uint32_t index, uint32_t size) {
+	uint64_t value = 0;
+	memcpy(&value, &operand->data[(index * size) & operand->step], size);
+	return value;
+}
+
+static double read_float(const uint8_t *group, uint32_t index, uint32_t size) {
+	if (size == 4) {
+		float value;
+		memcpy(&value, &group[index * 4], 4);
+		return value;
+	}
+	double value;
+	memcpy(&value, &group[index * 8], 8);
+	return value;
+}
+
+static void write_float(uint8_t *group, uint32_t index, uint32_t size, double value) {
+	if (size == 4) {
+		float single = (float)value;
+		memcpy(&group[index * 4], &single, 4);
+	}
+	else {
+		memcpy(&group[index * 8], &value, 8);
+	}
+}
+
+static int64_t sign_extend(uint64_t value, uint32_t size) {
+	uint32_t shift = 64 - size * 8;
+	return (int64_t)(value << shift) >> shift;
+}
+
+static void vector_operand(operand *operand, hart *hart, uint8_t reg) {
+	operand->data   = group(hart, reg);
+	operand->step   = SIZE_MAX;
+	operand->scalar = 0;
+}
+
+static void scalar_operand(operand *operand, uint64_t value, uint32_t size) {
+	for (uint32_t offset = 0; offset < VECTOR_CHUNK; offset += size) {
+		memcpy(&operand->chunk[offset], &value, size);
+	}
+	operand->data   = operand->chunk;
+	operand->step   = 0;
+	operand->scalar = value;
+}
+
+static uint64_t float_scalar(hart *hart, uint8_t rs1) {
+	return hart->sew == 32 ? float_unbox(hart->f[rs1]) : hart->f[rs1];
+}
+
+// Fixed point helpers, rounding to nearest up like vxrm after reset. vxsat is not tracked.
+
+static uint64_t round_bit(uint64_t value, uint32_t shift) {
+	return shift == 0 ? 0 : (value >> (shift - 1)) & 1;
+}
+
+static uint64_t clip_unsigned(uint64_t value, uint32_t shift, uint32_t bits) {
+	uint64_t result = (value >> shift) + round_bit(value, shift);
+	return result > UNSIGNED_MAX(bits) ? UNSIGNED_MAX(bits) : result;
+}
+
+static int64_t clip_signed(int64_t value, uint32_t shift, uint32_t bits) {
+	int64_t result = (value >> shift) + (int64_t)round_bit((uint64_t)value, shift);
+	return result > SIGNED_MAX(bits) ? SIGNED_MAX(bits) : result < SIGNED_MIN(bits) ? SIGNED_MIN(bits) : result;
+}
+
+static int64_t fractional_multiply64(int64_t a, int64_t b) {
+	if (a == INT64_MIN && b == INT64_MIN) {
+		return INT64_MAX;
+	}
+	uint64_t high = multiply_high_signed((uint64_t)a, (uint64_t)b);
+	uint64_t low  = (uint64_t)a * (uint64_t)b;
+	return (int64_t)(((high << 1) | (low >> 63)) + ((low >> 62) & 1));
+}
+
+// Floating point helpers, they round to nearest even whatever frm says and do not track
+// fflags. Minimum and maximum return the operand that is a number when the other one is a NaN
+// and order -0 below +0, they work on floats widened to double because that is exact.
+
+static double minimum(double a, double b) {
+	if (isnan(a) || isnan(b)) {
+		return isnan(a) ? (isnan(b) ? (double)NAN : b) : a;
+	}
+	return a < b || (a == b && signbit(a)) ? a : b;
+}
+
+static double maximum(double a, double b) {
+	if (isnan(a) || isnan(b)) {
+		return isnan(a) ? (isnan(b) ? (double)NAN : b) : a;
+	}
+	return a > b || (a == b && !signbit(a)) ? a : b;
+}
+
+static uint64_t float_to_unsigned(double value, uint32_t bits) {
+	if (isnan(value)) {
+		return UNSIGNED_MAX(bits);
+	}
+	if (value <= 0.0) {
+		return 0;
+	}
+	if (value >= ldexp(1.0, bits)) {
+		return UNSIGNED_MAX(bits);
+	}
+	return (uint64_t)value;
+}
+
+static int64_t float_to_signed(double value, uint32_t bits) {
+	if (isnan(value)) {
+		return SIGNED_MAX(bits);
+	}
+	if (value < -ldexp(1.0, bits - 1)) {
+		return SIGNED_MIN(bits);
+	}
+	if (value >= ldexp(1.0, bits - 1)) {
+		return SIGNED_MAX(bits);
+	}
+	return (int64_t)value;
+}
+
+static float round_to_odd(double value) {
+	float result = (float)value;
+	if (isnan(value) || (double)result == value) {
+		return result;
+	}
+	if (fabs((double)result) > fabs(value)) {
+		result = nextafterf(result, 0.0f);
+	}
+	uint32_t bits;
+	memcpy(&bits, &result, sizeof(bits));
+	bits |= 1;
+	memcpy(&result, &bits, sizeof(bits));
+	return result;
+}
+
+static uint32_t float_class(int category, bool negative, bool quiet) {
+	switch (category) {
+	case FP_INFINITE:
+		return negative ? 1u << 0 : 1u << 7;
+	case FP_NORMAL:
+		return negative ? 1u << 1 : 1u << 6;
+	case FP_SUBNORMAL:
+		return negative ? 1u << 2 : 1u << 5;
+	case FP_ZERO:
+		return negative ? 1u << 3 : 1u << 4;
+	default:
+		return quiet ? 1u << 9 : 1u << 8;
+	}
+}
+
+static uint32_t float_class32(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return float_class(fpclassify(value), signbit(value) != 0, (bits >> 22) & 1);
+}
+
+static uint32_t float_class64(double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return float_class(fpclassify(value), signbit(value) != 0, (bits >> 51) & 1);
+}
+
+// Kernels
+
+static void blend(uint8_t *vd, const void *results, const uint8_t *mask) {
+	uint64_t d[VECTOR_CHUNK / 8];
+	uint64_t r[VECTOR_CHUNK / 8];
+	uint64_t m[VECTOR_CHUNK / 8];
+	memcpy(d, vd, VECTOR_CHUNK);
+	memcpy(r, results, VECTOR_CHUNK);
+	memcpy(m, mask, VECTOR_CHUNK);
+	for (uint32_t i = 0; i < VECTOR_CHUNK / 8; ++i) {
+		d[i] ^= (d[i] ^ r[i]) & m[i];
+	}
+	memcpy(vd, d, VECTOR_CHUNK);
+}
+
+// Defines a kernel that sets vd[i] to expression, which sees a = vs2[i], b = vs1[i] or the scalar,
+// d = vd[i] and BITS, the width of vd's elements. The element types differ for widening and
+// narrowing operations, the chunks follow vd.
+#define VECTOR_KERNEL(name, d_type, a_type, b_type, expression)                                                                                                \
+	static void name(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, size_t vs1_step, const uint8_t *mask, uint32_t bytes) {                              \
+		enum { COUNT = VECTOR_CHUNK / sizeof(d_type), BITS = sizeof(d_type) * 8 };                                                                             \
+		for (uint32_t offset = 0; offset < bytes; offset += VECTOR_CHUNK) {                                                                                    \
+			uint32_t element = offset / sizeof(d_type);                                                                                                        \
+			a_type   as[COUNT];                                                                                                                                \
+			b_type   bs[COUNT];                                                                                                                                \
+			d_type   ds[COUNT];                                                                                                                                \
+			memcpy(as, vs2 + element * sizeof(a_type), sizeof(as));                                                                                            \
+			memcpy(bs, vs1 + ((element * sizeof(b_type)) & vs1_step), sizeof(bs));                                                                             \
+			memcpy(ds, vd + offset, sizeof(ds));                                                                                                               \
+			for (uint32_t i = 0; i < COUNT; ++i) {                                                                                                             \
+				a_type a = as[i];                                                                                                                              \
+				b_type b = bs[i];                                                                                                                              \
+				d_type d = ds[i];                                                                                                                              \
+				(void)a;                                                                                                                                       \
+				(void)b;                                                                                                                                       \
+				(void)d;                                                                                                                                       \
+				ds[i] = (d_type)(expression);                                                                                                                  \
+			}                                                                                                                                                  \
+			blend(vd + offset, ds, mask + offset);                                                                                                             \
+		}                                                                                                                                                      \
+	}
+
+#define VECTOR_COMPARE(name, type, expression)                                                                                                                 \
+	static void name(uint8_t *results, const uint8_t *vs2, const uint8_t *vs1, size_t vs1_step, uint32_t bytes) {                                              \
+		enum { COUNT = VECTOR_CHUNK / sizeof(type) };                                                                                                          \
+		for (uint32_t offset = 0; offset < bytes; offset += VECTOR_CHUNK) {                                                                                    \
+			type as[COUNT];                                                                                                                                    \
+			type bs[COUNT];                                                                                                                                    \
+			memcpy(as, vs2 + offset, sizeof(as));                                                                                                              \
+			memcpy(bs, vs1 + (offset & vs1_step), sizeof(bs));                                                                                                 \
+			for (uint32_t i = 0; i < COUNT; ++i) {                                                                                                             \
+				type a = as[i];                                                                                                                                \
+				type b = bs[i];                                                                                                                                \
+				results[offset / sizeof(type) + i] = (expression) ? 1 : 0;                                                                                     \
+			}                                                                                                                                                  \
+		}                                                                                                                                                      \
+	}
+
+// sign is int or uint
+#define INTEGER_KERNELS(name, sign, expression)                                                                                                                \
+	VECTOR_KERNEL(name##8, sign##8_t, sign##8_t, sign##8_t, expression)                                                                                        \
+	VECTOR_KERNEL(name##16, sign##16_t, sign##16_t, sign##16_t, expression)                                                                                    \
+	VECTOR_KERNEL(name##32, sign##32_t, sign##32_t, sign##32_t, expression)                                                                                    \
+	VECTOR_KERNEL(name##64, sign##64_t, sign##64_t, sign##64_t, expression)
+
+// Up to 32 bit, for the operations that need a wider type in between
+#define NARROW_INTEGER_KERNELS(name, sign, expression)                                                                                                         \
+	VECTOR_KERNEL(name##8, sign##8_t, sign##8_t, sign##8_t, expression)                                                                                        \
+	VECTOR_KERNEL(name##16, sign##16_t, sign##16_t, sign##16_t, expression)                                                                                    \
+	VECTOR_KERNEL(name##32, sign##32_t, sign##32_t, sign##32_t, expression)
+
+// vd and vs2 of 2 * SEW for the .wv and .wx forms
+#define WIDENING_KERNELS(name, d_sign, a_sign, b_sign, expression)                                                                                             \
+	VECTOR_KERNEL(name##8, d_sign##16_t, a_sign##8_t, b_sign##8_t, expression)                                                                                 \
+	VECTOR_KERNEL(name##16, d_sign##32_t, a_sign##16_t, b_sign##16_t, expression)                                                                              \
+	VECTOR_KERNEL(name##32, d_sign##64_t, a_sign##32_t, b_sign##32_t, expression)
+
+#define WIDE_OPERAND_KERNELS(name, d_sign, b_sign, expression)                                                                                                 \
+	VECTOR_KERNEL(name##8, d_sign##16_t, d_sign##16_t, b_sign##8_t, expression)                                                                                \
+	VECTOR_KERNEL(name##16, d_sign##32_t, d_sign##32_t, b_sign##16_t, expression)                                                                              \
+	VECTOR_KERNEL(name##32, d_sign##64_t, d_sign##64_t, b_sign##32_t, expression)
+
+// vs2 of 2 * SEW, the shift amount in vs1 of SEW
+#define NARROWING_KERNELS(name, sign, expression)                                                                                                              \
+	VECTOR_KERNEL(name##8, sign##8_t, sign##16_t, uint8_t, expression)                                                                                         \
+	VECTOR_KERNEL(name##16, sign##16_t, sign##32_t, uint16_t, expression)                                                                                      \
+	VECTOR_KERNEL(name##32, sign##32_t, sign##64_t, uint32_t, expression)
+
+#define FLOAT_KERNELS(name, expression)                                                                                                                        \
+	VECTOR_KERNEL(name##32, float, float, float, expression)                                                                                                   \
+	VECTOR_KERNEL(name##64, double, double, double, expression)
+
+#define INTEGER_COMPARES(name, sign, expression)                                                                                                               \
+	VECTOR_COMPARE(name##8, sign##8_t, expression)                                                                                                             \
+	VECTOR_COMPARE(name##16, sign##16_t, expression)                                                                                                           \
+	VECTOR_COMPARE(name##32, sign##32_t, expression)                                                                                                           \
+	VECTOR_COMPARE(name##64, sign##64_t, expression)
+
+#define FLOAT_COMPARES(name, expression)                                                                                                                       \
+	VECTOR_COMPARE(name##32, float, expression)                                                                                                                \
+	VECTOR_COMPARE(name##64, double, expression)
+
+// OPIVV, OPIVX and OPIVI
+
+INTEGER_KERNELS(vadd, uint, a + b)
+INTEGER_KERNELS(vsub, uint, a - b)
+INTEGER_KERNELS(vrsub, uint, b - a)
+INTEGER_KERNELS(vminu, uint, a < b ? a : b)
+INTEGER_KERNELS(vmin, int, a < b ? a : b)
+INTEGER_KERNELS(vmaxu, uint, a > b ? a : b)
+INTEGER_KERNELS(vmax, int, a > b ? a : b)
+INTEGER_KERNELS(vand, uint, a & b)
+INTEGER_KERNELS(vor, uint, a | b)
+INTEGER_KERNELS(vxor, uint, a ^ b)
+INTEGER_KERNELS(vmv, uint, b)
+INTEGER_KERNELS(vsaddu, uint, a > UNSIGNED_MAX(BITS) - b ? UNSIGNED_MAX(BITS) : a + b)
+INTEGER_KERNELS(vsadd, int,
+                b > 0 && a > SIGNED_MAX(BITS) - b   ? SIGNED_MAX(BITS)
+                : b < 0 && a < SIGNED_MIN(BITS) - b ? SIGNED_MIN(BITS)
+                                                    : a + b)
+INTEGER_KERNELS(vssubu, uint, a < b ? 0 : a - b)
+INTEGER_KERNELS(vssub, int,
+                b < 0 && a > SIGNED_MAX(BITS) + b   ? SIGNED_MAX(BITS)
+                : b > 0 && a < SIGNED_MIN(BITS) + b ? SIGNED_MIN(BITS)
+                                                    : a - b)
+INTEGER_KERNELS(vsll, uint, (uint64_t)a << (b & (BITS - 1)))
+INTEGER_KERNELS(vsrl, uint, a >> (b & (BITS - 1)))
+INTEGER_KERNELS(vsra, int, a >> (b & (BITS - 1)))
+INTEGER_KERNELS(vssrl, uint, (a >> (b & (BITS - 1))) + round_bit(a, b & (BITS - 1)))
+INTEGER_KERNELS(vssra, int, (a >> (b & (BITS - 1))) + (int64_t)round_bit((uint64_t)a, b & (BITS - 1)))
+NARROW_INTEGER_KERNELS(vsmul, int,
+                       a == SIGNED_MIN(BITS) && b == SIGNED_MIN(BITS)
+                           ? SIGNED_MAX(BITS)
+                           : (((int64_t)a * b) >> (BITS - 1)) + (int64_t)round_bit((uint64_t)((int64_t)a * b), BITS - 1))
+VECTOR_KERNEL(vsmul64, int64_t, int64_t, int64_t, fractional_multiply64(a, b))
+NARROWING_KERNELS(vnsrl, uint, a >> (b & (2 * BITS - 1)))
+NARROWING_KERNELS(vnsra, int, a >> (b & (2 * BITS - 1)))
+NARROWING_KERNELS(vnclipu, uint, clip_unsigned(a, b & (2 * BITS - 1), BITS))
+NARROWING_KERNELS(vnclip, int, clip_signed(a, b & (2 * BITS - 1), BITS))
+
+INTEGER_COMPARES(vmseq, uint, a == b)
+INTEGER_COMPARES(vmsne, uint, a != b)
+INTEGER_COMPARES(vmsltu, uint, a < b)
+INTEGER_COMPARES(vmslt, int, a < b)
+INTEGER_COMPARES(vmsleu, uint, a <= b)
+INTEGER_COMPARES(vmsle, int, a <= b)
+INTEGER_COMPARES(vmsgtu, uint, a > b)
+INTEGER_COMPARES(vmsgt, int, a > b)
+
+// OPMVV and OPMVX
+
+INTEGER_KERNELS(vaaddu, uint, (a >> 1) + (b >> 1) + (a & b & 1) + ((a ^ b) & 1))
+INTEGER_KERNELS(vaadd, int, (a >> 1) + (b >> 1) + (a & b & 1) + ((a ^ b) & 1))
+INTEGER_KERNELS(vasubu, uint, (a >> 1) - (b >> 1) - (~a & b & 1) + ((a ^ b) & 1))
+INTEGER_KERNELS(vasub, int, (a >> 1) - (b >> 1) - (~a & b & 1) + ((a ^ b) & 1))
+INTEGER_KERNELS(vdivu, uint, b == 0 ? UNSIGNED_MAX(BITS) : a / b)
+INTEGER_KERNELS(vdiv, int, b == 0 ? ~0ull : b == -1 ? 0 - (uint64_t)a : (uint64_t)(a / b))
+INTEGER_KERNELS(vremu, uint, b == 0 ? a : a % b)
+INTEGER_KERNELS(vrem, int, b == 0 ? a : b == -1 ? 0 : a % b)
+NARROW_INTEGER_KERNELS(vmulhu, uint, ((uint64_t)a * b) >> BITS)
+VECTOR_KERNEL(vmulhu64, uint64_t, uint64_t, uint64_t, multiply_high_unsigned(a, b))
+INTEGER_KERNELS(vmul, uint, (uint64_t)a * b)
+VECTOR_KERNEL(vmulhsu8, int8_t, int8_t, uint8_t, ((int64_t)a * (int64_t)b) >> BITS)
+VECTOR_KERNEL(vmulhsu16, int16_t, int16_t, uint16_t, ((int64_t)a * (int64_t)b) >> BITS)
+VECTOR_KERNEL(vmulhsu32, int32_t, int32_t, uint32_t, ((int64_t)a * (int64_t)b) >> BITS)
+VECTOR_KERNEL(vmulhsu64, int64_t, int64_t, uint64_t, multiply_high_signed_unsigned((uint64_t)a, b))
+NARROW_INTEGER_KERNELS(vmulh, int, ((int64_t)a * b) >> BITS)
+VECTOR_KERNEL(vmulh64, int64_t, int64_t, int64_t, multiply_high_signed((uint64_t)a, (uint64_t)b))
+INTEGER_KERNELS(vmadd, uint, (uint64_t)b * d + a)
+INTEGER_KERNELS(vnmsub, uint, a - (uint64_t)b * d)
+INTEGER_KERNELS(vmacc, uint, (uint64_t)b * a + d)
+INTEGER_KERNELS(vnmsac, uint, d - (uint64_t)b * a)
+
+WIDENING_KERNELS(vwaddu, uint, uint, uint, (uint64_t)a + b)
+WIDENING_KERNELS(vwadd, int, int, int, (int64_t)a + b)
+WIDENING_KERNELS(vwsubu, uint, uint, uint, (uint64_t)a - b)
+WIDENING_KERNELS(vwsub, int, int, int, (int64_t)a - b)
+WIDE_OPERAND_KERNELS(vwaddu_w, uint, uint, (uint64_t)a + b)
+WIDE_OPERAND_KERNELS(vwadd_w, int, int, (int64_t)a + b)
+WIDE_OPERAND_KERNELS(vwsubu_w, uint, uint, (uint64_t)a - b)
+WIDE_OPERAND_KERNELS(vwsub_w, int, int, (int64_t)a - b)
+WIDENING_KERNELS(vwmulu, uint, uint, uint, (uint64_t)a * b)
+WIDENING_KERNELS(vwmulsu, int, int, uint, (int64_t)a * (int64_t)b)
+WIDENING_KERNELS(vwmul, int, int, int, (int64_t)a * b)
+WIDENING_KERNELS(vwmaccu, uint, uint, uint, (uint64_t)b * a + d)
+WIDENING_KERNELS(vwmacc, int, int, int, (uint64_t)((int64_t)b * a) + (uint64_t)d)
+WIDENING_KERNELS(vwmaccus, int, int, uint, (uint64_t)((int64_t)b * (int64_t)a) + (uint64_t)d)
+WIDENING_KERNELS(vwmaccsu, int, uint, int, (uint64_t)((int64_t)b * (int64_t)a) + (uint64_t)d)
+
+VECTOR_KERNEL(vzext_vf2_16, uint16_t, uint8_t, uint16_t, a)
+VECTOR_KERNEL(vzext_vf2_32, uint32_t, uint16_t, uint32_t, a)
+VECTOR_KERNEL(vzext_vf2_64, uint64_t, uint32_t, uint64_t, a)
+VECTOR_KERNEL(vzext_vf4_32, uint32_t, uint8_t, uint32_t, a)
+VECTOR_KERNEL(vzext_vf4_64, uint64_t, uint16_t, uint64_t, a)
+VECTOR_KERNEL(vzext_vf8_64, uint64_t, uint8_t, uint64_t, a)
+VECTOR_KERNEL(vsext_vf2_16, int16_t, int8_t, int16_t, a)
+VECTOR_KERNEL(vsext_vf2_32, int32_t, int16_t, int32_t, a)
+VECTOR_KERNEL(vsext_vf2_64, int64_t, int32_t, int64_t, a)
+VECTOR_KERNEL(vsext_vf4_32, int32_t, int8_t, int32_t, a)
+VECTOR_KERNEL(vsext_vf4_64, int64_t, int16_t, int64_t, a)
+VECTOR_KERNEL(vsext_vf8_64, int64_t, int8_t, int64_t, a)
+
+// OPFVV and OPFVF
+
+FLOAT_KERNELS(vfadd, a + b)
+FLOAT_KERNELS(vfsub, a - b)
+FLOAT_KERNELS(vfrsub, b - a)
+FLOAT_KERNELS(vfmul, a * b)
+FLOAT_KERNELS(vfdiv, a / b)
+FLOAT_KERNELS(vfrdiv, b / a)
+FLOAT_KERNELS(vfmin, minimum(a, b))
+FLOAT_KERNELS(vfmax, maximum(a, b))
+FLOAT_KERNELS(vfsgnj, COPY_SIGN(a, b))
+FLOAT_KERNELS(vfsgnjn, COPY_SIGN(a, -b))
+FLOAT_KERNELS(vfsgnjx, signbit(b) ? -a : a)
+FLOAT_KERNELS(vfmacc, FUSED_MULTIPLY_ADD(b, a, d))
+FLOAT_KERNELS(vfnmacc, FUSED_MULTIPLY_ADD(-b, a, -d))
+FLOAT_KERNELS(vfmsac, FUSED_MULTIPLY_ADD(b, a, -d))
+FLOAT_KERNELS(vfnmsac, FUSED_MULTIPLY_ADD(-b, a, d))
+FLOAT_KERNELS(vfmadd, FUSED_MULTIPLY_ADD(b, d, a))
+FLOAT_KERNELS(vfnmadd, FUSED_MULTIPLY_ADD(-b, d, -a))
+FLOAT_KERNELS(vfmsub, FUSED_MULTIPLY_ADD(b, d, -a))
+FLOAT_KERNELS(vfnmsub, FUSED_MULTIPLY_ADD(-b, d, a))
+FLOAT_KERNELS(vfsqrt, SQUARE_ROOT(a))
+VECTOR_KERNEL(vfclass32, uint32_t, float, uint32_t, FLOAT_CLASS(a))
+VECTOR_KERNEL(vfclass64, uint64_t, double, uint64_t, FLOAT_CLASS(a))
+
+VECTOR_KERNEL(vfwadd32, double, float, float, (double)a + b)
+VECTOR_KERNEL(vfwsub32, double, float, float, (double)a - b)
+VECTOR_KERNEL(vfwadd_w32, double, double, float, a + (double)b)
+VECTOR_KERNEL(vfwsub_w32, double, double, float, a - (double)b)
+VECTOR_KERNEL(vfwmul32, double, float, float, (double)a * b)
+VECTOR_KERNEL(vfwmacc32, double, float, float, fma((double)b, a, d))
+VECTOR_KERNEL(vfwnmacc32, double, float, float, fma(-(double)b, a, -d))
+VECTOR_KERNEL(vfwmsac32, double, float, float, fma((double)b, a, -d))
+VECTOR_KERNEL(vfwnmsac32, double, float, float, fma(-(double)b, a, d))
+
+FLOAT_COMPARES(vmfeq, a == b)
+FLOAT_COMPARES(vmfle, a <= b)
+FLOAT_COMPARES(vmflt, a < b)
+FLOAT_COMPARES(vmfne, a != b)
+FLOAT_COMPARES(vmfgt, a > b)
+FLOAT_COMPARES(vmfge, a >= b)
+
+// VFUNARY0, the rtz forms truncate instead of rounding
+
+VECTOR_KERNEL(vfcvt_xu_f32, uint32_t, float, uint32_t, float_to_unsigned(nearbyint(a), BITS))
+VECTOR_KERNEL(vfcvt_xu_f64, uint64_t, double, uint64_t, float_to_unsigned(nearbyint(a), BITS))
+VECTOR_KERNEL(vfcvt_x_f32, int32_t, float, int32_t, float_to_signed(nearbyint(a), BITS))
+VECTOR_KERNEL(vfcvt_x_f64, int64_t, double, int64_t, float_to_signed(nearbyint(a), BITS))
+VECTOR_KERNEL(vfcvt_f_xu32, float, uint32_t, float, a)
+VECTOR_KERNEL(vfcvt_f_xu64, double, uint64_t, double, a)
+VECTOR_KERNEL(vfcvt_f_x32, float, int32_t, float, a)
+VECTOR_KERNEL(vfcvt_f_x64, double, int64_t, double, a)
+VECTOR_KERNEL(vfcvt_rtz_xu_f32, uint32_t, float, uint32_t, float_to_unsigned(trunc(a), BITS))
+VECTOR_KERNEL(vfcvt_rtz_xu_f64, uint64_t, double, uint64_t, float_to_unsigned(trunc(a), BITS))
+VECTOR_KERNEL(vfcvt_rtz_x_f32, int32_t, float, int32_t, float_to_signed(trunc(a), BITS))
+VECTOR_KERNEL(vfcvt_rtz_x_f64, int64_t, double, int64_t, float_to_signed(trunc(a), BITS))
+
+VECTOR_KERNEL(vfwcvt_xu_f32, uint64_t, float, uint64_t, float_to_unsigned(nearbyint(a), BITS))
+VECTOR_KERNEL(vfwcvt_x_f32, int64_t, float, int64_t, float_to_signed(nearbyint(a), BITS))
+VECTOR_KERNEL(vfwcvt_f_xu16, float, uint16_t, float, a)
+VECTOR_KERNEL(vfwcvt_f_xu32, double, uint32_t, double, a)
+VECTOR_KERNEL(vfwcvt_f_x16, float, int16_t, float, a)
+VECTOR_KERNEL(vfwcvt_f_x32, double, int32_t, double, a)
+VECTOR_KERNEL(vfwcvt_f_f32, double, float, double, a)
+VECTOR_KERNEL(vfwcvt_rtz_xu_f32, uint64_t, float, uint64_t, float_to_unsigned(trunc(a), BITS))
+VECTOR_KERNEL(vfwcvt_rtz_x_f32, int64_t, float, int64_t, float_to_signed(trunc(a), BITS))
+
+VECTOR_KERNEL(vfncvt_xu_f16, uint16_t, float, uint16_t, float_to_unsigned(nearbyint(a), BITS))
+VECTOR_KERNEL(vfncvt_xu_f32, uint32_t, double, uint32_t, float_to_unsigned(nearbyint(a), BITS))
+VECTOR_KERNEL(vfncvt_x_f16, int16_t, float, int16_t, float_to_signed(nearbyint(a), BITS))
+VECTOR_KERNEL(vfncvt_x_f32, int32_t, double, int32_t, float_to_signed(nearbyint(a), BITS))
+VECTOR_KERNEL(vfncvt_f_xu32, float, uint64_t, float, a)
+VECTOR_KERNEL(vfncvt_f_x32, float, int64_t, float, a)
+VECTOR_KERNEL(vfncvt_f_f32, float, double, float, a)
+VECTOR_KERNEL(vfncvt_rod_f_f32, float, double, float, round_to_odd(a))
+VECTOR_KERNEL(vfncvt_rtz_xu_f16, uint16_t, float, uint16_t, float_to_unsigned(trunc(a), BITS))
+VECTOR_KERNEL(vfncvt_rtz_xu_f32, uint32_t, double, uint32_t, float_to_unsigned(trunc(a), BITS))
+VECTOR_KERNEL(vfncvt_rtz_x_f16, int16_t, float, int16_t, float_to_signed(trunc(a), BITS))
+VECTOR_KERNEL(vfncvt_rtz_x_f32, int32_t, double, int32_t, float_to_signed(trunc(a), BITS))
+
+// Kernels by funct6 and SEW, NULL for what does not exist
+
+#define INTEGER_TABLE(name)      {name##8, name##16, name##32, name##64}
+#define DOUBLE_WIDTH_TABLE(name) {name##8, name##16, name##32, NULL}
+#define FLOAT_TABLE(name)        {NULL, NULL, name##32, name##64}
+#define FLOAT_WIDENING(name)     {NULL, NULL, name##32, NULL}
+
+static vector_kernel *const opi_kernels[64][4] = {
+    [0x00] = INTEGER_TABLE(vadd),       [0x02] = INTEGER_TABLE(vsub),       [0x03] = INTEGER_TABLE(vrsub),     [0x04] = INTEGER_TABLE(vminu),
+    [0x05] = INTEGER_TABLE(vmin),       [0x06] = INTEGER_TABLE(vmaxu),      [0x07] = INTEGER_TABLE(vmax),      [0x09] = INTEGER_TABLE(vand),
+    [0x0a] = INTEGER_TABLE(vor),        [0x0b] = INTEGER_TABLE(vxor),       [0x17] = INTEGER_TABLE(vmv),       [0x20] = INTEGER_TABLE(vsaddu),
+    [0x21] = INTEGER_TABLE(vsadd),      [0x22] = INTEGER_TABLE(vssubu),     [0x23] = INTEGER_TABLE(vssub),     [0x25] = INTEGER_TABLE(vsll),
+    [0x27] = INTEGER_TABLE(vsmul),      [0x28] = INTEGER_TABLE(vsrl),       [0x29] = INTEGER_TABLE(vsra),      [0x2a] = INTEGER_TABLE(vssrl),
+    [0x2b] = INTEGER_TABLE(vssra),      [0x2c] = DOUBLE_WIDTH_TABLE(vnsrl), [0x2d] = DOUBLE_WIDTH_TABLE(vnsra), [0x2e] = DOUBLE_WIDTH_TABLE(vnclipu),
+    [0x2f] = DOUBLE_WIDTH_TABLE(vnclip),
+};
+
+static vector_compare *const opi_compares[64][4] = {
+    [0x18] = INTEGER_TABLE(vmseq),  [0x19] = INTEGER_TABLE(vmsne), [0x1a] = INTEGER_TABLE(vmsltu), [0x1b] = INTEGER_TABLE(vmslt),
+    [0x1c] = INTEGER_TABLE(vmsleu), [0x1d] = INTEGER_TABLE(vmsle), [0x1e] = INTEGER_TABLE(vmsgtu), [0x1f] = INTEGER_TABLE(vmsgt),
+};
+
+static vector_kernel *const opm_kernels[64][4] = {
+    [0x08] = INTEGER_TABLE(vaaddu),           [0x09] = INTEGER_TABLE(vaadd),            [0x0a] = INTEGER_TABLE(vasubu),
+    [0x0b] = INTEGER_TABLE(vasub),            [0x20] = INTEGER_TABLE(vdivu),            [0x21] = INTEGER_TABLE(vdiv),
+    [0x22] = INTEGER_TABLE(vremu),            [0x23] = INTEGER_TABLE(vrem),             [0x24] = INTEGER_TABLE(vmulhu),
+    [0x25] = INTEGER_TABLE(vmul),             [0x26] = INTEGER_TABLE(vmulhsu),          [0x27] = INTEGER_TABLE(vmulh),
+    [0x29] = INTEGER_TABLE(vmadd),            [0x2b] = INTEGER_TABLE(vnmsub),           [0x2d] = INTEGER_TABLE(vmacc),
+    [0x2f] = INTEGER_TABLE(vnmsac),           [0x30] = DOUBLE_WIDTH_TABLE(vwaddu),      [0x31] = DOUBLE_WIDTH_TABLE(vwadd),
+    [0x32] = DOUBLE_WIDTH_TABLE(vwsubu),      [0x33] = DOUBLE_WIDTH_TABLE(vwsub),       [0x34] = DOUBLE_WIDTH_TABLE(vwaddu_w),
+    [0x35] = DOUBLE_WIDTH_TABLE(vwadd_w),     [0x36] = DOUBLE_WIDTH_TABLE(vwsubu_w),    [0x37] = DOUBLE_WIDTH_TABLE(vwsub_w),
+    [0x38] = DOUBLE_WIDTH_TABLE(vwmulu),      [0x3a] = DOUBLE_WIDTH_TABLE(vwmulsu),     [0x3b] = DOUBLE_WIDTH_TABLE(vwmul),
+    [0x3c] = DOUBLE_WIDTH_TABLE(vwmaccu),     [0x3d] = DOUBLE_WIDTH_TABLE(vwmacc),      [0x3e] = DOUBLE_WIDTH_TABLE(vwmaccus),
+    [0x3f] = DOUBLE_WIDTH_TABLE(vwmaccsu),
+};
+
+// VXUNARY0 by the vs1 field
+static vector_kernel *const extension_kernels[8][4] = {
+    [0x2] = {NULL, NULL, NULL, vzext_vf8_64},         [0x3] = {NULL, NULL, NULL, vsext_vf8_64},
+    [0x4] = {NULL, NULL, vzext_vf4_32, vzext_vf4_64}, [0x5] = {NULL, NULL, vsext_vf4_32, vsext_vf4_64},
+    [0x6] = {NULL, vzext_vf2_16, vzext_vf2_32, vzext_vf2_64}, [0x7] = {NULL, vsext_vf2_16, vsext_vf2_32, vsext_vf2_64},
+};
+
+static vector_kernel *const opf_kernels[64][4] = {
+    [0x00] = FLOAT_TABLE(vfadd),      [0x02] = FLOAT_TABLE(vfsub),        [0x04] = FLOAT_TABLE(vfmin),       [0x06] = FLOAT_TABLE(vfmax),
+    [0x08] = FLOAT_TABLE(vfsgnj),     [0x09] = FLOAT_TABLE(vfsgnjn),      [0x0a] = FLOAT_TABLE(vfsgnjx),     [0x20] = FLOAT_TABLE(vfdiv),
+    [0x21] = FLOAT_TABLE(vfrdiv),     [0x24] = FLOAT_TABLE(vfmul),        [0x27] = FLOAT_TABLE(vfrsub),      [0x28] = FLOAT_TABLE(vfmadd),
+    [0x29] = FLOAT_TABLE(vfnmadd),    [0x2a] = FLOAT_TABLE(vfmsub),       [0x2b] = FLOAT_TABLE(vfnmsub),     [0x2c] = FLOAT_TABLE(vfmacc),
+    [0x2d] = FLOAT_TABLE(vfnmacc),    [0x2e] = FLOAT_TABLE(vfmsac),       [0x2f] = FLOAT_TABLE(vfnmsac),     [0x30] = FLOAT_WIDENING(vfwadd),
+    [0x32] = FLOAT_WIDENING(vfwsub),  [0x34] = FLOAT_WIDENING(vfwadd_w),  [0x36] = FLOAT_WIDENING(vfwsub_w),  [0x38] = FLOAT_WIDENING(vfwmul),
+    [0x3c] = FLOAT_WIDENING(vfwmacc), [0x3d] = FLOAT_WIDENING(vfwnmacc),  [0x3e] = FLOAT_WIDENING(vfwmsac),  [0x3f] = FLOAT_WIDENING(vfwnmsac),
+};
+
+static vector_compare *const opf_compares[64][4] = {
+    [0x18] = FLOAT_TABLE(vmfeq), [0x19] = FLOAT_TABLE(vmfle), [0x1b] = FLOAT_TABLE(vmflt),
+    [0x1c] = FLOAT_TABLE(vmfne), [0x1d] = FLOAT_TABLE(vmfgt), [0x1f] = FLOAT_TABLE(vmfge),
+};
+
+// VFUNARY0 by the vs1 field, single width, widening and then narrowing
+static vector_kernel *const conversion_kernels[32][4] = {
+    [0x00] = FLOAT_TABLE(vfcvt_xu_f),
+    [0x01] = FLOAT_TABLE(vfcvt_x_f),
+    [0x02] = FLOAT_TABLE(vfcvt_f_xu),
+    [0x03] = FLOAT_TABLE(vfcvt_f_x),
+    [0x06] = FLOAT_TABLE(vfcvt_rtz_xu_f),
+    [0x07] = FLOAT_TABLE(vfcvt_rtz_x_f),
+    [0x08] = FLOAT_WIDENING(vfwcvt_xu_f),
+    [0x09] = FLOAT_WIDENING(vfwcvt_x_f),
+    [0x0a] = {NULL, vfwcvt_f_xu16, vfwcvt_f_xu32, NULL},
+    [0x0b] = {NULL, vfwcvt_f_x16, vfwcvt_f_x32, NULL},
+    [0x0c] = FLOAT_WIDENING(vfwcvt_f_f),
+    [0x0e] = FLOAT_WIDENING(vfwcvt_rtz_xu_f),
+    [0x0f] = FLOAT_WIDENING(vfwcvt_rtz_x_f),
+    [0x10] = {NULL, vfncvt_xu_f16, vfncvt_xu_f32, NULL},
+    [0x11] = {NULL, vfncvt_x_f16, vfncvt_x_f32, NULL},
+    [0x12] = FLOAT_WIDENING(vfncvt_f_xu),
+    [0x13] = FLOAT_WIDENING(vfncvt_f_x),
+    [0x14] = FLOAT_WIDENING(vfncvt_f_f),
+    [0x15] = FLOAT_WIDENING(vfncvt_rod_f_f),
+    [0x16] = {NULL, vfncvt_rtz_xu_f16, vfncvt_rtz_xu_f32, NULL},
+    [0x17] = {NULL, vfncvt_rtz_x_f16, vfncvt_rtz_x_f32, NULL},
+};
+
+// Sets all bytes of the active body elements, the mask the kernels blend with.
+static inline void expand_mask(uint8_t *mask, const uint8_t *bits, uint32_t count, uint32_t element_size) {
+	for (uint32_t element = 0; element < count; ++element) {
+		uint64_t value = 0 - (uint64_t)mask_bit(bits, element);
+		memcpy(&mask[element * element_size], &value, element_size);
+	}
+}
+
+static void build_mask(hart *hart, uint8_t *mask, uint32_t element_size, bool masked, uint32_t bytes) {
+	uint32_t body = hart->vl * element_size;
+
+	if (masked) {
+		switch (element_size) {
+		case 1:
+			expand_mask(mask, group(hart, 0), hart->vl, 1);
+			break;
+		case 2:
+			expand_mask(mask, group(hart, 0), hart->vl, 2);
+			break;
+		case 4:
+			expand_mask(mask, group(hart, 0), hart->vl, 4);
+			break;
+		case 8:
+			expand_mask(mask, group(hart, 0), hart->vl, 8);
+			break;
+		}
+	}
+	else {
+		memset(mask, 0xff, body);
+	}
+
+	memset(&mask[body], 0, bytes - body);
+}
+
+// Returns false when there is no kernel for the operation at this SEW.
+static bool run_kernel(hart *hart, vector_kernel *kernel, uint8_t vd, uint8_t vs2, const operand *b, uint32_t element_size, bool masked) {
+	if (kernel == NULL) {
+		return false;
+	}
+
+	if (hart->vl == 0) {
+		return true;
+	}
+
+	uint8_t  mask[GROUP_MAX_BYTES];
+	uint32_t bytes = chunked_bytes(hart, element_size);
+	build_mask(hart, mask, element_size, masked, bytes);
+	kernel(group(hart, vd), group(hart, vs2), b->data, b->step, mask, bytes);
+	return true;
+}
+
+// Packs one result byte per element into the mask register vd, for the active body elements.
+static void write_mask(hart *hart, uint8_t vd, const uint8_t *results, bool masked) {
+	uint8_t       *destination = group(hart, vd);
+	const uint8_t *v0          = group(hart, 0);
+
+	for (uint32_t element = 0; element < hart->vl; element += 8) {
+		uint32_t count = hart->vl - element < 8 ? hart->vl - element : 8;
+
+		uint8_t bits = 0;
+		for (uint32_t i = 0; i < count; ++i) {
+			bits |= results[element + i] << i;
+		}
+
+		uint8_t enabled = (uint8_t)(0xff >> (8 - count));
+		if (masked) {
+			enabled &= v0[element / 8];
+		}
+
+		destination[element / 8] ^= (destination[element / 8] ^ bits) & enabled;
+	}
+}
+
+static bool run_compare(hart *hart, vector_compare *compare, uint8_t vd, uint8_t vs2, const operand *b, bool masked) {
+	if (compare == NULL) {
+		return false;
+	}
+
+	if (hart->vl == 0) {
+		return true;
+	}
+
+	uint8_t results[GROUP_MAX_BYTES];
+	compare(results, group(hart, vs2), b->data, b->step, chunked_bytes(hart, hart->sew / 8));
+	write_mask(hart, vd, results, masked);
+	return true;
+}
+
+// vmerge and vfmerge take vs2 where the mask is clear and vs1 or the scalar where it is set,
+// without a mask they are vmv.v and vfmv.v.
+static void merge(hart *hart, uint8_t vd, uint8_t vs2, const operand *b, bool masked) {
+	vector_kernel *move         = opi_kernels[0x17][sew_index(hart)];
+	uint32_t       element_size = hart->sew / 8;
+
+	if (!masked) {
+		run_kernel(hart, move, vd, vs2, b, element_size, false);
+		return;
+	}
+
+	if (hart->vl == 0) {
+		return;
+	}
+
+	uint8_t  selected[GROUP_MAX_BYTES];
+	uint8_t  mask[GROUP_MAX_BYTES];
+	uint32_t bytes = chunked_bytes(hart, element_size);
+
+	memcpy(selected, group(hart, vs2), bytes);
+	build_mask(hart, mask, element_size, true, bytes);
+	move(selected, selected, b->data, b->step, mask, bytes);
+
+	build_mask(hart, mask, element_size, false, bytes);
+	move(group(hart, vd), selected, selected, SIZE_MAX, mask, bytes);
+}
+
+// vadc, vmadc, vsbc and vmsbc, v0 holds the carries or borrows instead of a mask
+static void carry_operation(hart *hart, uint8_t funct6, uint8_t vd, uint8_t vs2, const operand *b, bool carry_in) {
+	uint32_t size = hart->sew / 8;
+	uint64_t all  = UNSIGNED_MAX(hart->sew);
+
+	uint8_t results[GROUP_MAX_BYTES];
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		uint64_t x     = read_element(group(hart, vs2), element, size);
+		uint64_t y     = operand_element(b, element, size);
+		uint64_t carry = carry_in ? mask_bit(group(hart, 0), element) : 0;
+
+		switch (funct6) {
+		case 0x10: // vadc
+			write_element(group(hart, vd), element, size, x + y + carry);
+			break;
+		case 0x11: { // vmadc
+			uint64_t sum     = (x + y + carry) & all;
+			results[element] = sum < x || (carry != 0 && sum == x);
+			break;
+		}
+		case 0x12: // vsbc
+			write_element(group(hart, vd), element, size, x - y - carry);
+			break;
+		case 0x13: // vmsbc
+			results[element] = x < y || (carry != 0 && x == y);
+			break;
+		}
+	}
+
+	if (funct6 == 0x11 || funct6 == 0x13) {
+		write_mask(hart, vd, results, false);
+	}
+}
+
+static void integer_reduction(hart *hart, uint8_t funct6, uint8_t vd, uint8_t vs2, uint8_t vs1, bool masked) {
+	if (hart->vl == 0) {
+		return;
+	}
+
+	bool     widening = funct6 >= 0x30;
+	uint32_t size     = hart->sew / 8;
+	uint32_t wide     = widening ? size * 2 : size;
+
+	uint64_t accumulator = read_element(group(hart, vs1), 0, wide);
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (!element_active(hart, masked, element)) {
+			continue;
+		}
+
+		uint64_t value = read_element(group(hart, vs2), element, size);
+
+		switch (funct6) {
+		case 0x00: // vredsum
+		case 0x30: // vwredsumu
+			accumulator += value;
+			break;
+		case 0x31: // vwredsum
+			accumulator += (uint64_t)sign_extend(value, size);
+			break;
+		case 0x01: // vredand
+			accumulator &= value;
+			break;
+		case 0x02: // vredor
+			accumulator |= value;
+			break;
+		case 0x03: // vredxor
+			accumulator ^= value;
+			break;
+		case 0x04: // vredminu
+			accumulator = value < accumulator ? value : accumulator;
+			break;
+		case 0x05: // vredmin
+			accumulator = sign_extend(value, size) < sign_extend(accumulator, size) ? value : accumulator;
+			break;
+		case 0x06: // vredmaxu
+			accumulator = value > accumulator ? value : accumulator;
+			break;
+		case 0x07: // vredmax
+			accumulator = sign_extend(value, size) > sign_extend(accumulator, size) ? value : accumulator;
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+
+	write_element(group(hart, vd), 0, wide, accumulator);
+}
+
+// The unordered sums add in order as well, which makes them deterministic.
+static void float_reduction(hart *hart, uint8_t funct6, uint8_t vd, uint8_t vs2, uint8_t vs1, bool masked) {
+	if (hart->vl == 0) {
+		return;
+	}
+
+	bool     widening = funct6 >= 0x30;
+	uint32_t size     = hart->sew / 8;
+	uint32_t wide     = widening ? size * 2 : size;
+	assert(size == 4 || (size == 8 && !widening));
+
+	if (size == 4 && !widening && (funct6 == 0x01 || funct6 == 0x03)) { // vfredusum and vfredosum round to single precision every step
+		float accumulator = (float)read_float(group(hart, vs1), 0, 4);
+		for (uint32_t element = 0; element < hart->vl; ++element) {
+			if (element_active(hart, masked, element)) {
+				accumulator += (float)read_float(group(hart, vs2), element, 4);
+			}
+		}
+		write_float(group(hart, vd), 0, 4, accumulator);
+		return;
+	}
+
+	double accumulator = read_float(group(hart, vs1), 0, wide);
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (!element_active(hart, masked, element)) {
+			continue;
+		}
+
+		double value = read_float(group(hart, vs2), element, size);
+
+		switch (funct6) {
+		case 0x01: // vfredusum
+		case 0x03: // vfredosum
+		case 0x31: // vfwredusum
+		case 0x33: // vfwredosum
+			accumulator += value;
+			break;
+		case 0x05: // vfredmin
+			accumulator = minimum(accumulator, value);
+			break;
+		case 0x07: // vfredmax
+			accumulator = maximum(accumulator, value);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+
+	write_float(group(hart, vd), 0, wide, accumulator);
+}
+
+// vrgather and vrgatherei16, indices past VLMAX read 0
+static void gather(hart *hart, uint8_t vd, uint8_t vs2, const operand *indices, uint32_t index_size, bool masked) {
+	uint32_t size  = hart->sew / 8;
+	uint32_t limit = vlmax(hart);
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (element_active(hart, masked, element)) {
+			uint64_t index = indices->step == 0 ? indices->scalar : operand_element(indices, element, index_size);
+			write_element(group(hart, vd), element, size, index < limit ? read_element(group(hart, vs2), (uint32_t)index, size) : 0);
+		}
+	}
+}
+
+static void slide_up(hart *hart, uint8_t vd, uint8_t vs2, uint64_t offset, bool masked) {
+	uint32_t size = hart->sew / 8;
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (element >= offset && element_active(hart, masked, element)) {
+			write_element(group(hart, vd), element, size, read_element(group(hart, vs2), element - (uint32_t)offset, size));
+		}
+	}
+}
+
+static void slide_down(hart *hart, uint8_t vd, uint8_t vs2, uint64_t offset, bool masked) {
+	uint32_t size  = hart->sew / 8;
+	uint32_t limit = vlmax(hart);
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (element_active(hart, masked, element)) {
+			uint64_t source = element + offset;
+			write_element(group(hart, vd), element, size, offset < limit && source < limit ? read_element(group(hart, vs2), (uint32_t)source, size) : 0);
+		}
+	}
+}
+
+static void slide1_up(hart *hart, uint8_t vd, uint8_t vs2, uint64_t value, bool masked) {
+	uint32_t size = hart->sew / 8;
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (element_active(hart, masked, element)) {
+			write_element(group(hart, vd), element, size, element == 0 ? value : read_element(group(hart, vs2), element - 1, size));
+		}
+	}
+}
+
+static void slide1_down(hart *hart, uint8_t vd, uint8_t vs2, uint64_t value, bool masked) {
+	uint32_t size = hart->sew / 8;
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (element_active(hart, masked, element)) {
+			write_element(group(hart, vd), element, size, element == hart->vl - 1u ? value : read_element(group(hart, vs2), element + 1, size));
+		}
+	}
+}
+
+static void compress(hart *hart, uint8_t vd, uint8_t vs2, uint8_t vs1) {
+	uint32_t size  = hart->sew / 8;
+	uint32_t index = 0;
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (mask_bit(group(hart, vs1), element)) {
+			write_element(group(hart, vd), index++, size, read_element(group(hart, vs2), element, size));
+		}
+	}
+}
+
+static void mask_logical(hart *hart, uint8_t funct6, uint8_t vd, uint8_t vs2, uint8_t vs1) {
+	for (uint32_t element = 0; element < hart->vl; element += 8) {
+		uint8_t a = group(hart, vs2)[element / 8];
+		uint8_t b = group(hart, vs1)[element / 8];
+
+		uint8_t result;
+		switch (funct6) {
+		case 0x18: // vmandn
+			result = a & ~b;
+			break;
+		case 0x19: // vmand
+			result = a & b;
+			break;
+		case 0x1a: // vmor
+			result = a | b;
+			break;
+		case 0x1b: // vmxor
+			result = a ^ b;
+			break;
+		case 0x1c: // vmorn
+			result = a | ~b;
+			break;
+		case 0x1d: // vmnand
+			result = ~(a & b);
+			break;
+		case 0x1e: // vmnor
+			result = ~(a | b);
+			break;
+		default: // vmxnor
+			result = ~(a ^ b);
+			break;
+		}
+
+		uint8_t enabled = hart->vl - element < 8 ? (uint8_t)(0xff >> (8 - (hart->vl - element))) : 0xff;
+		group(hart, vd)[element / 8] ^= (group(hart, vd)[element / 8] ^ result) & enabled;
+	}
+}
+
+// VMUNARY0
+static void mask_unary(hart *hart, uint8_t operation, uint8_t vd, uint8_t vs2, bool masked) {
+	uint32_t size = hart->sew / 8;
+
+	if (operation == 0x10 || operation == 0x11) { // viota, vid
+		uint64_t count = 0;
+		for (uint32_t element = 0; element < hart->vl; ++element) {
+			if (element_active(hart, masked, element)) {
+				write_element(group(hart, vd), element, size, operation == 0x11 ? element : count);
+				count += mask_bit(group(hart, vs2), element);
+			}
+		}
+		return;
+	}
+
+	uint8_t results[GROUP_MAX_BYTES];
+	bool    found = false;
+
+	for (uint32_t element = 0; element < hart->vl; ++element) {
+		if (!element_active(hart, masked, element)) {
+			results[element] = 0;
+			continue;
+		}
+
+		bool bit = mask_bit(group(hart, vs2), element);
+
+		switch (operation) {
+		case 0x01: // vmsbf
+			results[element] = !found && !bit;
+			break;
+		case 0x02: // vmsof
+			results[element] = !found && bit;
+			break;
+		case 0x03: // vmsif
+			results[element] = !found;
+			break;
+		default:
+			assert(false);
+			break;
+		}
+
+		found = found || bit;
+	}
+
+	write_mask(hart, vd, results, masked);
+}
+
+static bool execute_opi(hart *hart, uint32_t instruction, const operand *b) {
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct6 = instruction >> 26;
+	bool    masked = ((instruction >> 25) & 0x1) == 0;
+	uint8_t vs2    = (instruction >> 20) & 0x1f;
+	uint8_t vd     = (instruction >> 7) & 0x1f;
+
+	switch (funct6) {
+	case 0x0c: // vrgather
+		gather(hart, vd, vs2, b, hart->sew / 8, masked);
+		break;
+	case 0x0e: // vslideup, vrgatherei16
+		if (funct3 == OPIVV) {
+			gather(hart, vd, vs2, b, 2, masked);
+		}
+		else {
+			slide_up(hart, vd, vs2, b->scalar, masked);
+		}
+		break;
+	case 0x0f: // vslidedown
+		slide_down(hart, vd, vs2, b->scalar, masked);
+		break;
+	case 0x10: // vadc
+	case 0x11: // vmadc
+	case 0x12: // vsbc
+	case 0x13: // vmsbc
+		carry_operation(hart, funct6, vd, vs2, b, masked);
+		break;
+	case 0x17: // vmerge, vmv.v
+		merge(hart, vd, vs2, b, masked);
+		break;
+	case 0x18:
+	case 0x19:
+	case 0x1a:
+	case 0x1b:
+	case 0x1c:
+	case 0x1d:
+	case 0x1e:
+	case 0x1f:
+		return run_compare(hart, opi_compares[funct6][sew_index(hart)], vd, vs2, b, masked);
+	case 0x27: // vsmul, vmv<nr>r for OPIVI
+		if (funct3 == OPIVI) {
+			uint32_t registers = (uint32_t)b->scalar + 1;
+			if ((registers != 1 && registers != 2 && registers != 4 && registers != 8) || vd % registers != 0 || vs2 % registers != 0) {
+				return false;
+			}
+			memmove(group(hart, vd), group(hart, vs2), registers * sizeof(vector));
+			break;
+		}
+		return run_kernel(hart, opi_kernels[funct6][sew_index(hart)], vd, vs2, b, hart->sew / 8, masked);
+	case 0x30: // vwredsumu
+	case 0x31: // vwredsum
+		integer_reduction(hart, funct6, vd, vs2, (instruction >> 15) & 0x1f, masked);
+		break;
+	default:
+		return run_kernel(hart, opi_kernels[funct6][sew_index(hart)], vd, vs2, b, hart->sew / 8, masked);
+	}
+
+	return true;
+}
+
+static bool execute_opm(hart *hart, uint32_t instruction, const operand *b) {
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct6 = instruction >> 26;
+	bool    masked = ((instruction >> 25) & 0x1) == 0;
+	uint8_t vs2    = (instruction >> 20) & 0x1f;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t vd     = (instruction >> 7) & 0x1f;
+
+	switch (funct6) {
+	case 0x00: // vredsum
+	case 0x01: // vredand
+	case 0x02: // vredor
+	case 0x03: // vredxor
+	case 0x04: // vredminu
+	case 0x05: // vredmin
+	case 0x06: // vredmaxu
+	case 0x07: // vredmax
+		integer_reduction(hart, funct6, vd, vs2, rs1, masked);
+		break;
+	case 0x0e: // vslide1up
+		slide1_up(hart, vd, vs2, b->scalar, masked);
+		break;
+	case 0x0f: // vslide1down
+		slide1_down(hart, vd, vs2, b->scalar, masked);
+		break;
+	case 0x10: // VWXUNARY0, VRXUNARY0
+		if (funct3 == OPMVX) { // vmv.s.x
+			if (vs2 != 0) {
+				return false;
+			}
+			if (hart->vl > 0) {
+				write_element(group(hart, vd), 0, hart->sew / 8, b->scalar);
+			}
+		}
+		else {
+			uint64_t value = 0;
+			switch (rs1) {
+			case 0x00: // vmv.x.s
+				value = (uint64_t)sign_extend(read_element(group(hart, vs2), 0, hart->sew / 8), hart->sew / 8);
+				break;
+			case 0x10: // vcpop.m
+				for (uint32_t element = 0; element < hart->vl; ++element) {
+					value += element_active(hart, masked, element) && mask_bit(group(hart, vs2), element);
+				}
+				break;
+			case 0x11: // vfirst.m
+				value = ~0ull;
+				for (uint32_t element = 0; element < hart->vl; ++element) {
+					if (element_active(hart, masked, element) && mask_bit(group(hart, vs2), element)) {
+						value = element;
+						break;
+					}
+				}
+				break;
+			default:
+				return false;
+			}
+
+			if (vd != 0) {
+				hart->x[vd] = value;
+			}
+		}
+		break;
+	case 0x12: // VXUNARY0
+		if (rs1 >= 8) {
+			return false;
+		}
+		return run_kernel(hart, extension_kernels[rs1][sew_index(hart)], vd, vs2, b, hart->sew / 8, masked);
+	case 0x14: // VMUNARY0
+		if (rs1 != 0x01 && rs1 != 0x02 && rs1 != 0x03 && rs1 != 0x10 && rs1 != 0x11) {
+			return false;
+		}
+		mask_unary(hart, rs1, vd, vs2, masked);
+		break;
+	case 0x17: // vcompress
+		compress(hart, vd, vs2, rs1);
+		break;
+	case 0x18:
+	case 0x19:
+	case 0x1a:
+	case 0x1b:
+	case 0x1c:
+	case 0x1d:
+	case 0x1e:
+	case 0x1f:
+		mask_logical(hart, funct6, vd, vs2, rs1);
+		break;
+	default:
+		return run_kernel(hart, opm_kernels[funct6][sew_index(hart)], vd, vs2, b, funct6 >= 0x30 ? hart->sew / 4 : hart->sew / 8, masked);
+	}
+
+	return true;
+}
+
+static bool execute_opf(hart *hart, uint32_t instruction, const operand *b) {
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct6 = instruction >> 26;
+	bool    masked = ((instruction >> 25) & 0x1) == 0;
+	uint8_t vs2    = (instruction >> 20) & 0x1f;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t vd     = (instruction >> 7) & 0x1f;
+
+	switch (funct6) {
+	case 0x01: // vfredusum
+	case 0x03: // vfredosum
+	case 0x05: // vfredmin
+	case 0x07: // vfredmax
+	case 0x31: // vfwredusum
+	case 0x33: // vfwredosum
+		float_reduction(hart, funct6, vd, vs2, rs1, masked);
+		break;
+	case 0x0e: // vfslide1up
+		slide1_up(hart, vd, vs2, b->scalar, masked);
+		break;
+	case 0x0f: // vfslide1down
+		slide1_down(hart, vd, vs2, b->scalar, masked);
+		break;
+	case 0x10: // VWFUNARY0, VRFUNARY0
+		if (funct3 == OPFVF) { // vfmv.s.f
+			if (vs2 != 0) {
+				return false;
+			}
+			if (hart->vl > 0) {
+				write_element(group(hart, vd), 0, hart->sew / 8, b->scalar);
+			}
+		}
+		else { // vfmv.f.s
+			if (rs1 != 0) {
+				return false;
+			}
+			uint64_t bits = read_element(group(hart, vs2), 0, hart->sew / 8);
+			hart->f[vd]   = hart->sew == 32 ? float_box((uint32_t)bits) : bits;
+		}
+		break;
+	case 0x12: { // VFUNARY0
+		uint32_t element_size = rs1 >= 0x08 && rs1 < 0x10 ? hart->sew / 4 : hart->sew / 8;
+		return run_kernel(hart, conversion_kernels[rs1][sew_index(hart)], vd, vs2, b, element_size, masked);
+	}
+	case 0x13: // VFUNARY1
+		switch (rs1) {
+		case 0x00: { // vfsqrt
+			vector_kernel *const kernels[4] = FLOAT_TABLE(vfsqrt);
+			return run_kernel(hart, kernels[sew_index(hart)], vd, vs2, b, hart->sew / 8, masked);
+		}
+		case 0x10: { // vfclass
+			vector_kernel *const kernels[4] = FLOAT_TABLE(vfclass);
+			return run_kernel(hart, kernels[sew_index(hart)], vd, vs2, b, hart->sew / 8, masked);
+		}
+		default: // vfrsqrt7 and vfrec7
+			return false;
+		}
+	case 0x17: // vfmerge, vfmv.v.f
+		merge(hart, vd, vs2, b, masked);
+		break;
+	case 0x18:
+	case 0x19:
+	case 0x1b:
+	case 0x1c:
+	case 0x1d:
+	case 0x1f:
+		return run_compare(hart, opf_compares[funct6][sew_index(hart)], vd, vs2, b, masked);
+	default:
+		return run_kernel(hart, opf_kernels[funct6][sew_index(hart)], vd, vs2, b, funct6 >= 0x30 ? hart->sew / 4 : hart->sew / 8, masked);
+	}
+
+	return true;
+}
+
+// Loads and stores. Unit-stride accesses that lie in RAM are copied in bulk, everything else
+// goes element by element through the memory map. Loads work on a copy of the destination
+// registers that is written back at the end, so an index register the load overwrites is
+// still intact while it is read.
+
+typedef struct access {
+	uint64_t       base;
+	int64_t        stride;  // between elements, unused when indexed
+	const uint8_t *indices; // NULL unless indexed
+	uint32_t       index_size;
+	uint32_t       size;        // of the data elements
+	uint32_t       fields;      // of a segment
+	uint32_t       field_bytes; // register group bytes per field
+	uint32_t       count;
+	bool           masked;
+} access;
+
+static uint32_t width_size(uint8_t width) {
+	switch (width) {
+	case 0x0:
+		return 1;
+	case 0x5:
+		return 2;
+	case 0x6:
+		return 4;
+	case 0x7:
+		return 8;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+// Bytes of the register group that holds vlmax elements of size, at least one register.
+static uint32_t group_bytes(const hart *hart, uint32_t size) {
+	uint32_t bytes = vlmax(hart) * size;
+	return bytes < sizeof(vector) ? sizeof(vector) : bytes;
+}
+
+static uint64_t element_address(const access *access, uint32_t element, uint32_t field) {
+	uint64_t offset = access->indices != NULL ? read_element(access->indices, element, access->index_size) : (uint64_t)access->stride * element;
+	return access->base + offset + field * access->size;
+}
+
+static uint64_t load_element(uint64_t address, uint32_t size) {
+	switch (size) {
+	case 1:
+		return read_memory8(address);
+	case 2:
+		return read_memory16(address);
+	case 4:
+		return read_memory32(address);
+	default:
+		return read_memory64(address);
+	}
+}
+
+static void store_element(uint64_t address, uint32_t size, uint64_t value) {
+	switch (size) {
+	case 1:
+		store_memory8(address, (uint8_t)value);
+		break;
+	case 2:
+		store_memory16(address, (uint16_t)value);
+		break;
+	case 4:
+		store_memory32(address, (uint32_t)value);
+		break;
+	default:
+		store_memory64(address, value);
+		break;
+	}
+}
+
+static bool element_mapped(uint64_t address, uint32_t size) {
+	const memory_region *region = memory_map_find(address);
+	return region != NULL && address + size - 1 - region->base < region->size;
+}
+
+// Fault-only-first loads shorten vl to the first element past 0 that is not mapped.
+static void load_elements(hart *hart, const access *access, uint8_t *registers, bool fault_only_first) {
+	uint64_t address = access->base;
+	if (access->indices == NULL && access->stride == (int64_t)(access->size * access->fields)) {
+		uint8_t  memory[GROUP_MAX_BYTES];
+		uint32_t bytes = access->count * access->size * access->fields;
+		if (read_memory_block(address, memory, bytes)) {
+			for (uint32_t element = 0; element < access->count; ++element) {
+				if (element_active(hart, access->masked, element)) {
+					for (uint32_t field = 0; field < access->fields; ++field) {
+						uint64_t value = read_element(memory, element * access->fields + field, access->size);
+						write_element(&registers[field * access->field_bytes], element, access->size, value);
+					}
+				}
+			}
+			return;
+		}
+	}
+
+	for (uint32_t element = 0; element < access->count && !hart->halted; ++element) {
+		if (!element_active(hart, access->masked, element)) {
+			continue;
+		}
+		if (fault_only_first && element > 0 && !element_mapped(element_address(access, element, 0), access->size * access->fields)) {
+			hart->vl = (uint16_t)element;
+			return;
+		}
+		for (uint32_t field = 0; field < access->fields; ++field) {
+			write_element(&registers[field * access->field_bytes], element, access->size, load_element(element_address(access, element, field), access->size));
+		}
+	}
+}
+
+static void store_elements(hart *hart, const access *access, const uint8_t *registers) {
+	if (access->indices == NULL && access->stride == (int64_t)(access->size * access->fields) && !access->masked) {
+		uint32_t bytes = access->count * access->size * access->fields;
+		if (access->fields == 1) {
+			if (store_memory_block(access->base, registers, bytes)) {
+				return;
+			}
+		}
+		else {
+			uint8_t memory[GROUP_MAX_BYTES];
+			for (uint32_t element = 0; element < access->count; ++element) {
+				for (uint32_t field = 0; field < access->fields; ++field) {
+					uint64_t value = read_element(&registers[field * access->field_bytes], element, access->size);
+					write_element(memory, element * access->fields + field, access->size, value);
+				}
+			}
+			if (store_memory_block(access->base, memory, bytes)) {
+				return;
+			}
+		}
+	}
+
+	for (uint32_t element = 0; element < access->count && !hart->halted; ++element) {
+		if (!element_active(hart, access->masked, element)) {
+			continue;
+		}
+		for (uint32_t field = 0; field < access->fields; ++field) {
+			store_element(element_address(access, element, field), access->size, read_element(&registers[field * access->field_bytes], element, access->size));
+		}
+	}
+}
+
+// Decodes the addressing of a LOAD-FP or STORE-FP vector instruction. The whole register and
+// mask forms ignore vtype and are set up as plain unit-stride accesses of bytes. Returns false
+// for a reserved encoding or when the data or index registers do not fit in v0 to v31.
+static bool decode_access(hart *hart, uint32_t instruction, access *access, bool *fault_only_first) {
+	uint8_t  rs1   = (instruction >> 15) & 0x1f;
+	uint8_t  rs2   = (instruction >> 20) & 0x1f;
+	uint8_t  vd    = (instruction >> 7) & 0x1f;
+	uint8_t  mop   = (instruction >> 26) & 0x3;
+	uint32_t width = width_size((instruction >> 12) & 0x7);
+
+	if (((instruction >> 28) & 0x1) != 0) { // mew
+		return false;
+	}
+
+	access->base       = hart->x[rs1];
+	access->indices    = NULL;
+	access->index_size = 0;
+	access->fields     = (instruction >> 29) + 1;
+	access->count      = hart->vl;
+	access->masked     = ((instruction >> 25) & 0x1) == 0;
+	*fault_only_first  = false;
+
+	uint32_t registers = 0; // for the forms that ignore vtype
+
+	switch (mop) {
+	case 0x0: // unit-stride
+		access->size = width;
+		switch (rs2) {
+		case 0x00:
+			break;
+		case 0x08: // vl<nf>re<eew>, vs<nf>r
+			if ((access->fields != 1 && access->fields != 2 && access->fields != 4 && access->fields != 8) || access->masked) {
+				return false;
+			}
+			access->count  = access->fields * sizeof(vector) / width;
+			registers      = access->fields;
+			access->fields = 1;
+			break;
+		case 0x0b: // vlm, vsm
+			if (width != 1 || access->fields != 1 || access->masked) {
+				return false;
+			}
+			access->count = (hart->vl + 7) / 8;
+			registers     = 1;
+			break;
+		case 0x10: // fault-only-first
+			*fault_only_first = true;
+			break;
+		default:
+			return false;
+		}
+		access->stride = access->size * access->fields;
+		break;
+	case 0x2: // strided
+		access->size   = width;
+		access->stride = (int64_t)hart->x[rs2];
+		break;
+	case 0x1: // indexed-unordered
+	case 0x3: // indexed-ordered
+		if (hart->sew == 0 || !group_valid(hart, rs2, width * 8)) {
+			return false;
+		}
+		access->size       = hart->sew / 8;
+		access->stride     = 0;
+		access->indices    = group(hart, rs2);
+		access->index_size = width;
+		break;
+	}
+
+	if (registers == 0 && hart->sew == 0) { // vill
+		return false;
+	}
+
+	// segments take at most 8 registers all together, each field group aligned to its size
+	access->field_bytes = registers != 0 ? registers * sizeof(vector) : group_bytes(hart, access->size);
+	uint32_t field_registers = access->field_bytes / sizeof(vector);
+	uint32_t bytes           = access->fields * access->field_bytes;
+	return bytes <= GROUP_MAX_BYTES && vd % field_registers == 0 && vd * sizeof(vector) + bytes <= sizeof(hart->v);
+}
+
+// A reserved vtype sets vill, which the hart keeps as a sew of 0, and vl to 0.
+static void set_vector_type(hart *hart, uint64_t vtype, uint64_t avl, uint8_t rd) {
+	uint8_t vlmul = vtype & 0x7;
+	uint8_t vsew  = (vtype >> 3) & 0x7;
+
+	if (vsew > 0x3 || vlmul == 0x4 || (vtype >> 8) != 0) {
+		hart->sew     = 0;
+		hart->lmul    = 1;
+		hart->lmuldiv = 1;
+		hart->vl      = 0;
+		if (rd != 0) {
+			hart->x[rd] = 0;
+		}
+		return;
+	}
+
+	switch (vsew) {
+	case 0x0:
+		hart->sew = 8;
+		break;
+	case 0x1:
+		hart->sew = 16;
+		break;
+	case 0x2:
+		hart->sew = 32;
+		break;
+	default:
+		hart->sew = 64;
+		break;
+	}
+
+	switch (vlmul) {
+	case 0x0:
+		hart->lmul    = 1;
+		hart->lmuldiv = 1;
+		break;
+	case 0x1:
+		hart->lmul    = 2;
+		hart->lmuldiv = 1;
+		break;
+	case 0x2:
+		hart->lmul    = 4;
+		hart->lmuldiv = 1;
+		break;
+	case 0x3:
+		hart->lmul    = 8;
+		hart->lmuldiv = 1;
+		break;
+	case 0x5:
+		hart->lmul    = 1;
+		hart->lmuldiv = 8;
+		break;
+	case 0x6:
+		hart->lmul    = 1;
+		hart->lmuldiv = 4;
+		break;
+	default:
+		hart->lmul    = 1;
+		hart->lmuldiv = 2;
+		break;
+	}
+
+	uint32_t limit = vlmax(hart);
+	hart->vl       = (uint16_t)(avl < limit ? avl : limit);
+
+	if (rd != 0) {
+		hart->x[rd] = hart->vl;
+	}
+}
+
+// vsetvli, vsetivli and vsetvl
+static void configure(hart *hart, uint32_t instruction) {
+	uint8_t rs1 = (instruction >> 15) & 0x1f;
+	uint8_t rd  = (instruction >> 7) & 0x1f;
+
+	if (((instruction >> 30) & 0x3) == 0x3) { // vsetivli
+		set_vector_type(hart, (instruction >> 20) & 0x3ff, rs1, rd);
+		return;
+	}
+
+	uint64_t avl;
+	if (rs1 != 0) {
+		avl = hart->x[rs1];
+	}
+	else if (rd != 0) {
+		avl = ~0ull;
+	}
+	else {
+		avl = hart->vl;
+	}
+
+	if ((instruction >> 31) == 0) { // vsetvli
+		set_vector_type(hart, (instruction >> 20) & 0x7ff, avl, rd);
+	}
+	else { // vsetvl
+		set_vector_type(hart, hart->x[(instruction >> 20) & 0x1f], avl, rd);
+	}
+}
+
+// Checks vd, vs2 and vs1 of an arithmetic instruction against the group sizes they have at
+// the current vtype. Widening operands take twice the bits of SEW.
+static bool registers_valid(const hart *hart, uint32_t instruction) {
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct6 = instruction >> 26;
+	uint8_t vs2    = (instruction >> 20) & 0x1f;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+	uint8_t vd     = (instruction >> 7) & 0x1f;
+
+	uint32_t single = hart->sew;
+	uint32_t wide   = hart->sew * 2;
+
+	uint32_t vd_bits  = single;
+	uint32_t vs2_bits = single;
+	uint32_t vs1_bits = funct3 == OPIVV || funct3 == OPMVV || funct3 == OPFVV ? single : 0;
+
+	switch (funct3) {
+	case OPIVV:
+	case OPIVX:
+	case OPIVI:
+		if (funct6 == 0x0e && funct3 == OPIVV) { // vrgatherei16
+			vs1_bits = 16;
+		}
+		else if (funct6 == 0x11 || funct6 == 0x13 || (funct6 >= 0x18 && funct6 <= 0x1f)) { // vmadc, vmsbc and the compares
+			vd_bits = 0;
+		}
+		else if (funct6 == 0x27 && funct3 == OPIVI) { // vmv<nr>r checks its own registers
+			return true;
+		}
+		else if (funct6 >= 0x2c && funct6 <= 0x2f) { // narrowing shifts and clips
+			vs2_bits = wide;
+		}
+		else if (funct6 == 0x30 || funct6 == 0x31) { // vwredsum
+			vd_bits  = 0;
+			vs1_bits = 0;
+		}
+		break;
+	case OPMVV:
+	case OPMVX:
+		if (funct6 <= 0x07) { // reductions
+			vd_bits  = 0;
+			vs1_bits = 0;
+		}
+		else if (funct6 == 0x10) { // moves between x and element 0, vcpop and vfirst
+			return true;
+		}
+		else if (funct6 == 0x12) { // vzext and vsext, vs1 selects the fraction
+			vs2_bits = rs1 >= 0x6 ? single / 2 : rs1 >= 0x4 ? single / 4 : single / 8;
+			vs1_bits = 0;
+		}
+		else if (funct6 == 0x14) { // viota and vid write a group, the others a mask
+			vd_bits  = rs1 == 0x10 || rs1 == 0x11 ? single : 0;
+			vs2_bits = 0;
+			vs1_bits = 0;
+		}
+		else if (funct6 == 0x17) { // vcompress
+			vs1_bits = 0;
+		}
+		else if (funct6 >= 0x18 && funct6 <= 0x1f) { // mask logical
+			return true;
+		}
+		else if (funct6 >= 0x30) {
+			vd_bits  = wide;
+			vs2_bits = funct6 >= 0x34 && funct6 <= 0x37 ? wide : single;
+		}
+		break;
+	case OPFVV:
+	case OPFVF:
+		if (hart->sew < 32) { // no Zvfh
+			return false;
+		}
+		if (funct6 == 0x01 || funct6 == 0x03 || funct6 == 0x05 || funct6 == 0x07 || funct6 == 0x31 || funct6 == 0x33) { // reductions
+			vd_bits  = 0;
+			vs1_bits = 0;
+		}
+		else if (funct6 == 0x10) { // moves between f and element 0
+			return true;
+		}
+		else if (funct6 == 0x12) { // conversions, vs1 selects single, widening or narrowing
+			vd_bits  = rs1 >= 0x08 && rs1 < 0x10 ? wide : single;
+			vs2_bits = rs1 >= 0x10 ? wide : single;
+			vs1_bits = 0;
+		}
+		else if (funct6 == 0x13) { // vfsqrt and vfclass
+			vs1_bits = 0;
+		}
+		else if (funct6 >= 0x18 && funct6 <= 0x1f) { // compares
+			vd_bits = 0;
+		}
+		else if (funct6 >= 0x30) {
+			vd_bits  = wide;
+			vs2_bits = funct6 == 0x34 || funct6 == 0x36 ? wide : single;
+		}
+		break;
+	}
+
+	return group_valid(hart, vd, vd_bits) && group_valid(hart, vs2, vs2_bits) && group_valid(hart, rs1, vs1_bits);
+}
+
+bool vector_execute(hart *hart, uint32_t instruction) {
+	uint8_t funct3 = (instruction >> 12) & 0x7;
+	uint8_t funct6 = instruction >> 26;
+	uint8_t rs1    = (instruction >> 15) & 0x1f;
+
+	if (funct3 == OPCFG) {
+		configure(hart, instruction);
+		return true;
+	}
+
+	bool whole_move = funct3 == OPIVI && funct6 == 0x27; // vmv<nr>r ignores vtype
+	if (!whole_move && (hart->sew == 0 || !registers_valid(hart, instruction))) {
+		return false;
+	}
+
+	operand b;
+
+	switch (funct3) {
+	case OPIVV:
+		vector_operand(&b, hart, rs1);
+		return execute_opi(hart, instruction, &b);
+	case OPIVX:
+		scalar_operand(&b, hart->x[rs1], hart->sew / 8);
+		return execute_opi(hart, instruction, &b);
+	case OPIVI: {
+		// slides, vrgather, shifts and vmv<nr>r take the immediate unsigned, everything else
+		// sign extends it
+		bool     unsigned_immediate = funct6 == 0x0c || funct6 == 0x0e || funct6 == 0x0f || funct6 == 0x25 || funct6 == 0x27 || (funct6 >= 0x28 && funct6 <= 0x2f);
+		uint64_t immediate          = unsigned_immediate ? rs1 : (uint64_t)(int64_t)((rs1 ^ 0x10) - 0x10);
+		scalar_operand(&b, immediate, whole_move ? 1 : hart->sew / 8);
+		return execute_opi(hart, instruction, &b);
+	}
+	case OPMVV:
+		vector_operand(&b, hart, rs1);
+		return execute_opm(hart, instruction, &b);
+	case OPMVX:
+		scalar_operand(&b, hart->x[rs1], hart->sew / 8);
+		return execute_opm(hart, instruction, &b);
+	case OPFVV:
+		vector_operand(&b, hart, rs1);
+		return execute_opf(hart, instruction, &b);
+	default: // OPFVF
+		scalar_operand(&b, float_scalar(hart, rs1), hart->sew / 8);
+		return execute_opf(hart, instruction, &b);
+	}
+}
+
+bool vector_load(hart *hart, uint32_t instruction) {
+	uint8_t vd = (instruction >> 7) & 0x1f;
+
+	access access;
+	bool   fault_only_first;
+	if (!decode_access(hart, instruction, &access, &fault_only_first)) {
+		return false;
+	}
+
+	// the common case of a plain unit-stride load goes straight into the registers
+	if (!access.masked && access.fields == 1 && access.stride == (int64_t)access.size && access.indices == NULL &&
+	    read_memory_block(access.base, group(hart, vd), access.count * access.size)) {
+		return true;
+	}
+
+	uint8_t  registers[GROUP_MAX_BYTES];
+	uint32_t bytes = access.fields * access.field_bytes;
+	memcpy(registers, group(hart, vd), bytes);
+	load_elements(hart, &access, registers, fault_only_first);
+	memcpy(group(hart, vd), registers, bytes);
+	return true;
+}
+
+bool vector_store(hart *hart, uint32_t instruction) {
+	uint8_t vs3 = (instruction >> 7) & 0x1f;
+
+	access access;
+	bool   fault_only_first;
+	if (!decode_access(hart, instruction, &access, &fault_only_first) || fault_only_first) {
+		return false;
+	}
+
+	store_elements(hart, &access, group(hart, vs3));
+	return true;
+}
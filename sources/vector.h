@@ -0,0 +1,32 @@
+#ifndef KOMPJUTA_VECTOR_HEADER
+#define KOMPJUTA_VECTOR_HEADER
+
+#include "risc-v.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The V extension with VLEN = 1024 and ELEN = 64. Floating point elements are 32 or 64 bit,
+// there is no Zvfh. vstart is always 0, masked off and tail elements are left undisturbed
+// whatever vta and vma say.
+
+// Executes an instruction of the OP-V major opcode, vsetvl and friends included. Does not
+// advance the pc. Returns false for an illegal instruction, a reserved encoding, a register
+// group that does not fit the current vtype or anything but vsetvl while vill is set.
+bool vector_execute(hart *hart, uint32_t instruction);
+
+// Execute the vector instructions of the LOAD-FP and STORE-FP major opcodes, the ones with an
+// element width of 8, 16, 32 or 64 bit. Neither advances the pc, both return false for an
+// illegal instruction.
+bool vector_load(hart *hart, uint32_t instruction);
+bool vector_store(hart *hart, uint32_t instruction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
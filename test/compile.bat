@@ -1 +1,9 @@
-P:\Tools\clang18.1.8\bin\clang.exe --target=riscv64-unknown-elf -march=rv64im -mabi=lp64 -Os -ffreestanding -fno-builtin -nostdlib -nostartfiles -mno-relax "-Wl,--no-relax" main.c -o prog.elf
\ No newline at end of file
+set CLANG=P:\Tools\clang18.1.8\bin\clang.exe
+set FLAGS=--target=riscv64-unknown-elf -mabi=lp64d -O2 -ffreestanding -fno-builtin -nostdlib -nostartfiles -mno-relax "-Wl,--no-relax"
+
+%CLANG% %FLAGS% -march=rv64gc guest\alu.c -o alu.elf
+%CLANG% %FLAGS% -march=rv64gc guest\memory.c -o memory.elf
+%CLANG% %FLAGS% -march=rv64gc guest\float.c -o float.elf
+%CLANG% %FLAGS% -march=rv64gc guest\flags.c -o flags.elf
+%CLANG% %FLAGS% -march=rv64gc guest\compressed.c -o compressed.elf
+%CLANG% %FLAGS% -march=rv64gc guest\traps.c -o traps.elf
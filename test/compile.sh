@@ -0,0 +1,13 @@
+#!/bin/sh
+set -e
+cd "$(dirname "$0")"
+
+CLANG=${CLANG:-clang}
+FLAGS="--target=riscv64-unknown-elf -mabi=lp64d -O2 -ffreestanding -fno-builtin -nostdlib -nostartfiles -mno-relax -Wl,--no-relax"
+
+$CLANG $FLAGS -march=rv64gc guest/alu.c -o alu.elf
+$CLANG $FLAGS -march=rv64gc guest/memory.c -o memory.elf
+$CLANG $FLAGS -march=rv64gc guest/float.c -o float.elf
+$CLANG $FLAGS -march=rv64gc guest/flags.c -o flags.elf
+$CLANG $FLAGS -march=rv64gc guest/compressed.c -o compressed.elf
+$CLANG $FLAGS -march=rv64gc guest/traps.c -o traps.elf
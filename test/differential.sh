@@ -0,0 +1,53 @@
+#!/bin/sh
+# Runs the test programs with the JIT, --jit-verify and --lockstep and compares their frame
+# hashes with the ones of the interpreter, --no-jit. Build the programs with compile.sh first.
+#
+#   differential.sh <kompjuta> [emulator options...]
+#
+# Options, like --harts 2, are passed to every run. A build with KOMPJUTA_THREADED_DISPATCH
+# checks the threaded core the same way.
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <kompjuta> [emulator options...]" >&2
+	exit 2
+fi
+
+emulator=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+shift
+cd "$(dirname "$0")"
+
+FRAMES=${FRAMES:-10}
+log=$(mktemp)
+trap 'rm -f "$log"' EXIT
+
+# Prints the frame hashes of a run, fails when the emulator failed or found a mismatch.
+hashes() {
+	"$emulator" --headless --hash-frames --max-frames "$FRAMES" "$@" >"$log" 2>&1 || return 1
+	if grep -q "mismatch\|diverge" "$log"; then
+		return 1
+	fi
+	grep "Frame [0-9]*:" "$log"
+}
+
+failed=0
+for program in alu memory float flags compressed traps; do
+	if ! reference=$(hashes --no-jit "$@" "$program.elf") || [ -z "$reference" ]; then
+		echo "FAIL $program with --no-jit"
+		cat "$log"
+		failed=1
+		continue
+	fi
+
+	for mode in "" --jit-verify --lockstep; do
+		if [ "$(hashes $mode "$@" "$program.elf")" != "$reference" ]; then
+			echo "FAIL $program with ${mode:-the JIT}"
+			grep -i "mismatch\|diverge\|fault" "$log" | head -n 5
+			failed=1
+		fi
+	done
+done
+
+if [ $failed = 0 ]; then
+	echo "All runs agree with the interpreter."
+fi
+exit $failed
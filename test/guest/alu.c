@@ -0,0 +1,101 @@
+#include "test.h"
+
+// Integer arithmetic, shifts, comparisons and branches. The instructions whose C operators
+// are undefined for some operands, like division by zero, are written as inline assembly.
+
+#define REGISTER_OP(name)                                                      \
+	static inline uint64_t op_##name(uint64_t a, uint64_t b) {                 \
+		uint64_t result;                                                       \
+		__asm__ volatile(#name " %0, %1, %2" : "=r"(result) : "r"(a), "r"(b)); \
+		return result;                                                         \
+	}
+
+REGISTER_OP(div)
+REGISTER_OP(divu)
+REGISTER_OP(rem)
+REGISTER_OP(remu)
+REGISTER_OP(divw)
+REGISTER_OP(divuw)
+REGISTER_OP(remw)
+REGISTER_OP(remuw)
+REGISTER_OP(mulh)
+REGISTER_OP(mulhsu)
+REGISTER_OP(mulhu)
+REGISTER_OP(mulw)
+REGISTER_OP(sll)
+REGISTER_OP(srl)
+REGISTER_OP(sra)
+REGISTER_OP(sllw)
+REGISTER_OP(srlw)
+REGISTER_OP(sraw)
+
+#define ROUNDS 2000
+
+int main(void) {
+	test_init();
+
+	uint64_t state = 0x243f6a8885a308d3ull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t round = 0; round < ROUNDS; ++round) {
+			uint64_t a = test_operand(&state);
+			uint64_t b = test_operand(&state);
+
+			test_result(a + b);
+			test_result(a - b);
+			test_result(a * b);
+			test_result(a ^ b);
+			test_result(a | b);
+			test_result(a & ~b);
+			test_result((uint64_t)(int64_t)(int32_t)((uint32_t)a + (uint32_t)b));
+			test_result((uint64_t)(int64_t)(int32_t)((uint32_t)a - (uint32_t)b));
+
+			test_result(op_div(a, b));
+			test_result(op_divu(a, b));
+			test_result(op_rem(a, b));
+			test_result(op_remu(a, b));
+			test_result(op_divw(a, b));
+			test_result(op_divuw(a, b));
+			test_result(op_remw(a, b));
+			test_result(op_remuw(a, b));
+			test_result(op_mulh(a, b));
+			test_result(op_mulhsu(a, b));
+			test_result(op_mulhu(a, b));
+			test_result(op_mulw(a, b));
+			test_result(op_sll(a, b));
+			test_result(op_srl(a, b));
+			test_result(op_sra(a, b));
+			test_result(op_sllw(a, b));
+			test_result(op_srlw(a, b));
+			test_result(op_sraw(a, b));
+
+			// immediate forms
+			test_result(a + 2047);
+			test_result(a - 2048);
+			test_result(a ^ 0x5a5);
+			test_result(a << 13);
+			test_result((uint64_t)((int64_t)a >> 45));
+			test_result((uint64_t)(int64_t)(int32_t)((uint32_t)a >> 7));
+			test_result((uint64_t)(int64_t)((int32_t)a >> 19));
+
+			uint64_t taken = 0;
+			if ((int64_t)a < (int64_t)b) {
+				taken |= 1;
+			}
+			if (a < b) {
+				taken |= 2;
+			}
+			if (a == b) {
+				taken |= 4;
+			}
+			if ((int32_t)a >= (int32_t)b) {
+				taken |= 8;
+			}
+			if ((a & 0xff) > 100) {
+				taken |= 16;
+			}
+			test_result(taken);
+		}
+		present();
+	}
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+
+// The compressed instructions, written out one by one so each one goes through the expander
+// as what it is. The three register forms only reach x8 to x15, the operands sit in a0 to a5.
+
+#define REGISTER_OP(name)                                 \
+	static inline uint64_t name(uint64_t a, uint64_t b) { \
+		uint64_t result;                                  \
+		__asm__ volatile("mv a0, %1\n"                    \
+		                 "mv a1, %2\n"                    \
+		                 "c." #name " a0, a1\n"           \
+		                 "mv %0, a0"                      \
+		                 : "=r"(result)                   \
+		                 : "r"(a), "r"(b)                 \
+		                 : "a0", "a1");                   \
+		return result;                                    \
+	}
+
+REGISTER_OP(add)
+REGISTER_OP(sub)
+REGISTER_OP(xor)
+REGISTER_OP(or)
+REGISTER_OP(and)
+REGISTER_OP(addw)
+REGISTER_OP(subw)
+REGISTER_OP(mv)
+
+// the immediates at the ends of their ranges
+static inline uint64_t immediates(uint64_t a) {
+	uint64_t result = 0;
+	__asm__ volatile("mv a0, %1\n"
+	                 "c.addi a0, -32\n"
+	                 "xor %0, %0, a0\n"
+	                 "c.addi a0, 31\n"
+	                 "c.addiw a0, -1\n"
+	                 "xor %0, %0, a0\n"
+	                 "c.andi a0, -21\n"
+	                 "xor %0, %0, a0\n"
+	                 "c.slli a0, 63\n"
+	                 "xor %0, %0, a0\n"
+	                 "mv a0, %1\n"
+	                 "c.srli a0, 1\n"
+	                 "xor %0, %0, a0\n"
+	                 "c.srai a0, 63\n"
+	                 "xor %0, %0, a0\n"
+	                 "c.li a1, -32\n"
+	                 "add %0, %0, a1\n"
+	                 "c.lui a1, 0xfffe1\n"
+	                 "add %0, %0, a1\n"
+	                 "c.lui a1, 31\n"
+	                 "add %0, %0, a1"
+	                 : "+r"(result)
+	                 : "r"(a)
+	                 : "a0", "a1");
+	return result;
+}
+
+// every compressed load and store, from a buffer and from the stack
+static inline uint64_t loads_and_stores(uint64_t *buffer, uint64_t a) {
+	uint64_t result = 0;
+	__asm__ volatile("mv a0, %1\n"
+	                 "mv a1, %2\n"
+	                 "c.sd a1, 248(a0)\n"
+	                 "c.sw a1, 124(a0)\n"
+	                 "c.ld a2, 248(a0)\n"
+	                 "c.lw a3, 124(a0)\n"
+	                 "c.fld fa0, 248(a0)\n"
+	                 "c.fsd fa0, 0(a0)\n"
+	                 "c.ld a4, 0(a0)\n"
+	                 "add %0, a2, a3\n"
+	                 "xor %0, %0, a4\n"
+	                 "c.addi16sp sp, -64\n"
+	                 "c.sdsp a1, 56(sp)\n"
+	                 "c.swsp a1, 4(sp)\n"
+	                 "c.fsdsp fa0, 8(sp)\n"
+	                 "c.ldsp a2, 56(sp)\n"
+	                 "c.lwsp a3, 4(sp)\n"
+	                 "c.fldsp fa1, 8(sp)\n"
+	                 "c.addi4spn a5, sp, 16\n"
+	                 "sub a5, a5, sp\n"
+	                 "c.addi16sp sp, 64\n"
+	                 "fmv.x.d a4, fa1\n"
+	                 "add %0, %0, a2\n"
+	                 "add %0, %0, a3\n"
+	                 "add %0, %0, a4\n"
+	                 "add %0, %0, a5"
+	                 : "+r"(result)
+	                 : "r"(buffer), "r"(a)
+	                 : "a0", "a1", "a2", "a3", "a4", "a5", "fa0", "fa1", "memory");
+	return result;
+}
+
+// c.beqz and c.bnez taken and not taken, c.j, c.jr and c.jalr
+static inline uint64_t jumps(uint64_t a) {
+	uint64_t result = 0;
+	__asm__ volatile("mv a0, %1\n"
+	                 "andi a0, a0, 1\n"
+	                 "c.beqz a0, 1f\n"
+	                 "addi %0, %0, 1\n"
+	                 "1:\n"
+	                 "c.bnez a0, 2f\n"
+	                 "addi %0, %0, 2\n"
+	                 "2:\n"
+	                 "c.j 4f\n"
+	                 "3:\n"
+	                 "addi %0, %0, 4\n"
+	                 "c.jr ra\n"
+	                 "4:\n"
+	                 "mv a1, ra\n"
+	                 "la a2, 3b\n"
+	                 "c.jalr a2\n"
+	                 "sub a3, ra, a2\n"
+	                 "add %0, %0, a3\n"
+	                 "mv ra, a1"
+	                 : "+r"(result)
+	                 : "r"(a)
+	                 : "a0", "a1", "a2", "a3", "ra");
+	return result;
+}
+
+#define ROUNDS 4000
+
+__attribute__((aligned(8))) static uint64_t buffer[32];
+
+int main(void) {
+	test_init();
+
+	uint64_t state = 0x082efa98ec4e6c89ull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t round = 0; round < ROUNDS; ++round) {
+			uint64_t a = test_operand(&state);
+			uint64_t b = test_operand(&state);
+
+			test_result(add(a, b));
+			test_result(sub(a, b));
+			test_result(xor(a, b));
+			test_result(or(a, b));
+			test_result(and(a, b));
+			test_result(addw(a, b));
+			test_result(subw(a, b));
+			test_result(mv(a, b));
+			test_result(immediates(a));
+			test_result(loads_and_stores(buffer, b));
+			test_result(jumps(a));
+		}
+		present();
+	}
+}
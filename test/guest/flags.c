@@ -0,0 +1,152 @@
+#include "test.h"
+
+// The floating point flags of the cases the IEEE rules single out: comparisons with quiet and
+// signaling NaNs, minimum and maximum of NaNs, conversions out of range, and the exact, the
+// underflowing and the overflowing results in every rounding mode. Each case reports its
+// result and the flags it raised alone.
+
+#define QUIET_NAN     0x7ff8000000000000ull
+#define SIGNALING_NAN 0x7ff4000000000000ull
+#define INFINITY_BITS 0x7ff0000000000000ull
+#define ONE           0x3ff0000000000000ull
+#define THREE         0x4008000000000000ull
+#define HUGE          0x7fe0000000000000ull
+#define TINY          0x0010000000000000ull
+
+#define COMPARE(name, instruction)                                      \
+	static inline uint64_t name(uint64_t a, uint64_t b) {               \
+		uint64_t result;                                                \
+		__asm__ volatile("fmv.d.x ft0, %1\n"                            \
+		                 "fmv.d.x ft1, %2\n"                            \
+		                 "fsflags zero\n" instruction " %0, ft0, ft1\n" \
+		                 : "=r"(result)                                 \
+		                 : "r"(a), "r"(b)                               \
+		                 : "ft0", "ft1");                               \
+		return result;                                                  \
+	}
+
+#define BINARY_OP(name, instruction)                                     \
+	static inline uint64_t name(uint64_t a, uint64_t b) {                \
+		uint64_t result;                                                 \
+		__asm__ volatile("fmv.d.x ft0, %1\n"                             \
+		                 "fmv.d.x ft1, %2\n"                             \
+		                 "fsflags zero\n" instruction " ft2, ft0, ft1\n" \
+		                 "fmv.x.d %0, ft2"                               \
+		                 : "=r"(result)                                  \
+		                 : "r"(a), "r"(b)                                \
+		                 : "ft0", "ft1", "ft2");                         \
+		return result;                                                   \
+	}
+
+#define CONVERT(name, instruction)                         \
+	static inline uint64_t name(uint64_t a) {              \
+		uint64_t result;                                   \
+		__asm__ volatile("fmv.d.x ft0, %1\n"               \
+		                 "fsflags zero\n" instruction "\n" \
+		                 : "=r"(result)                    \
+		                 : "r"(a)                          \
+		                 : "ft0", "ft1");                  \
+		return result;                                     \
+	}
+
+COMPARE(flt_d, "flt.d")
+COMPARE(fle_d, "fle.d")
+COMPARE(feq_d, "feq.d")
+
+BINARY_OP(fmin_d, "fmin.d")
+BINARY_OP(fmax_d, "fmax.d")
+BINARY_OP(fadd_d, "fadd.d")
+BINARY_OP(fmul_d, "fmul.d")
+BINARY_OP(fdiv_d, "fdiv.d")
+
+CONVERT(fcvt_w_d, "fcvt.w.d %0, ft0")
+CONVERT(fcvt_wu_d, "fcvt.wu.d %0, ft0")
+CONVERT(fcvt_l_d, "fcvt.l.d %0, ft0")
+CONVERT(fcvt_lu_d, "fcvt.lu.d %0, ft0")
+CONVERT(fcvt_s_d, "fcvt.s.d ft1, ft0\nfmv.x.w %0, ft1")
+CONVERT(fsqrt_d, "fsqrt.d ft1, ft0\nfmv.x.d %0, ft1")
+CONVERT(fclass_d, "fclass.d %0, ft0")
+
+// a single that is not NaN-boxed reads as the canonical NaN
+static inline uint64_t unboxed_single(uint64_t a) {
+	uint64_t result;
+	__asm__ volatile("fmv.d.x ft0, %1\n"
+	                 "fsflags zero\n"
+	                 "fadd.s ft1, ft0, ft0\n"
+	                 "fmv.x.w %0, ft1"
+	                 : "=r"(result)
+	                 : "r"(a)
+	                 : "ft0", "ft1");
+	return result;
+}
+
+static inline uint64_t fmadd_d(uint64_t a, uint64_t b, uint64_t c) {
+	uint64_t result;
+	__asm__ volatile("fmv.d.x ft0, %1\n"
+	                 "fmv.d.x ft1, %2\n"
+	                 "fmv.d.x ft2, %3\n"
+	                 "fsflags zero\n"
+	                 "fmadd.d ft3, ft0, ft1, ft2\n"
+	                 "fmv.x.d %0, ft3"
+	                 : "=r"(result)
+	                 : "r"(a), "r"(b), "r"(c)
+	                 : "ft0", "ft1", "ft2", "ft3");
+	return result;
+}
+
+static inline uint64_t flags(void) {
+	uint64_t flags;
+	__asm__ volatile("frflags %0" : "=r"(flags));
+	return flags;
+}
+
+#define CASE(expression)         \
+	do {                         \
+		test_result(expression); \
+		test_result(flags());    \
+	} while (0)
+
+static const uint64_t operands[] = {
+    0, 0x8000000000000000ull, ONE, THREE, HUGE, TINY, INFINITY_BITS, INFINITY_BITS | 0x8000000000000000ull, QUIET_NAN, SIGNALING_NAN,
+};
+
+#define OPERAND_COUNT (sizeof(operands) / sizeof(operands[0]))
+
+int main(void) {
+	test_init();
+
+	uint64_t state = 0x452821e638d01377ull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t mode = 0; mode < 5; ++mode) {
+			__asm__ volatile("fsrm %0" : : "r"(mode));
+
+			for (uint32_t a_index = 0; a_index < OPERAND_COUNT; ++a_index) {
+				uint64_t a = operands[a_index];
+				for (uint32_t b_index = 0; b_index < OPERAND_COUNT; ++b_index) {
+					uint64_t b = operands[b_index];
+					CASE(flt_d(a, b));
+					CASE(fle_d(a, b));
+					CASE(feq_d(a, b));
+					CASE(fmin_d(a, b));
+					CASE(fmax_d(a, b));
+					CASE(fadd_d(a, b));
+					CASE(fmul_d(a, b));
+					CASE(fdiv_d(a, b));
+					CASE(fmadd_d(a, b, operands[test_random(&state) % OPERAND_COUNT]));
+				}
+
+				CASE(fcvt_w_d(a));
+				CASE(fcvt_wu_d(a));
+				CASE(fcvt_l_d(a));
+				CASE(fcvt_lu_d(a));
+				CASE(fcvt_s_d(a));
+				CASE(fsqrt_d(a));
+				CASE(fclass_d(a));
+				CASE(unboxed_single(a));
+				CASE(fsqrt_d(a | 0x8000000000000000ull));
+			}
+		}
+		present();
+	}
+}
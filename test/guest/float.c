@@ -0,0 +1,150 @@
+#include "test.h"
+
+// Floating point arithmetic, fused multiply-adds, square roots, conversions in every
+// rounding mode and the flags they raise. Results are compared bit for bit, NaNs included.
+
+#define BINARY_OP(name, instruction, suffix)              \
+	static inline uint64_t name(uint64_t a, uint64_t b) { \
+		uint64_t result;                                  \
+		__asm__ volatile("fmv." suffix ".x ft0, %1\n"     \
+		                 "fmv." suffix ".x ft1, %2\n"     \
+		                 instruction " ft2, ft0, ft1\n"   \
+		                 "fmv.x." suffix " %0, ft2"       \
+		                 : "=r"(result)                   \
+		                 : "r"(a), "r"(b)                 \
+		                 : "ft0", "ft1", "ft2");          \
+		return result;                                    \
+	}
+
+BINARY_OP(add_d, "fadd.d", "d")
+BINARY_OP(sub_d, "fsub.d", "d")
+BINARY_OP(mul_d, "fmul.d", "d")
+BINARY_OP(div_d, "fdiv.d", "d")
+BINARY_OP(min_d, "fmin.d", "d")
+BINARY_OP(max_d, "fmax.d", "d")
+BINARY_OP(sgnjx_d, "fsgnjx.d", "d")
+BINARY_OP(add_s, "fadd.s", "w")
+BINARY_OP(mul_s, "fmul.s", "w")
+BINARY_OP(div_s, "fdiv.s", "w")
+
+static inline uint64_t fmadd_d(uint64_t a, uint64_t b, uint64_t c) {
+	uint64_t result;
+	__asm__ volatile("fmv.d.x ft0, %1\n"
+	                 "fmv.d.x ft1, %2\n"
+	                 "fmv.d.x ft2, %3\n"
+	                 "fmadd.d ft3, ft0, ft1, ft2\n"
+	                 "fmv.x.d %0, ft3"
+	                 : "=r"(result)
+	                 : "r"(a), "r"(b), "r"(c)
+	                 : "ft0", "ft1", "ft2", "ft3");
+	return result;
+}
+
+static inline uint64_t sqrt_d(uint64_t a) {
+	uint64_t result;
+	__asm__ volatile("fmv.d.x ft0, %1\n"
+	                 "fsqrt.d ft1, ft0\n"
+	                 "fmv.x.d %0, ft1"
+	                 : "=r"(result)
+	                 : "r"(a)
+	                 : "ft0", "ft1");
+	return result;
+}
+
+// with the dynamic rounding mode
+static inline uint64_t convert_to_int(uint64_t a) {
+	uint64_t result;
+	__asm__ volatile("fmv.d.x ft0, %1\n"
+	                 "fcvt.l.d %0, ft0"
+	                 : "=r"(result)
+	                 : "r"(a)
+	                 : "ft0");
+	return result;
+}
+
+static inline uint64_t convert_to_double(uint64_t a) {
+	uint64_t result;
+	__asm__ volatile("fcvt.d.l ft0, %1\n"
+	                 "fmv.x.d %0, ft0"
+	                 : "=r"(result)
+	                 : "r"(a)
+	                 : "ft0");
+	return result;
+}
+
+static inline uint64_t compare_and_classify(uint64_t a, uint64_t b) {
+	uint64_t less;
+	uint64_t equal;
+	uint64_t kind;
+	__asm__ volatile("fmv.d.x ft0, %3\n"
+	                 "fmv.d.x ft1, %4\n"
+	                 "flt.d %0, ft0, ft1\n"
+	                 "feq.d %1, ft0, ft1\n"
+	                 "fclass.d %2, ft0"
+	                 : "=r"(less), "=r"(equal), "=r"(kind)
+	                 : "r"(a), "r"(b)
+	                 : "ft0", "ft1");
+	return less | equal << 1 | kind << 2;
+}
+
+static inline void set_rounding_mode(uint64_t mode) {
+	__asm__ volatile("fsrm %0" : : "r"(mode));
+}
+
+// reads and clears the flags
+static inline uint64_t take_flags(void) {
+	uint64_t flags;
+	__asm__ volatile("csrrw %0, fflags, zero" : "=r"(flags));
+	return flags;
+}
+
+// Doubles in all magnitudes, with infinities, NaNs, zeros and subnormals among them.
+static uint64_t float_operand(uint64_t *state) {
+	static const uint64_t edges[] = {
+	    0x0000000000000000, 0x8000000000000000, 0x7ff0000000000000, 0xfff0000000000000, 0x7ff8000000000000,
+	    0x7ff0000000000001, 0x0000000000000001, 0x3ff0000000000000, 0x43e0000000000000, 0xc3e0000000000000,
+	};
+	uint64_t value = test_random(state);
+	if ((value & 7) == 0) {
+		return edges[(value >> 3) % (sizeof(edges) / sizeof(edges[0]))];
+	}
+	// an exponent around 1 most of the time so the conversions do not all saturate
+	return (value & 0x800fffffffffffffull) | ((uint64_t)(1023 - 32 + ((value >> 52) & 63)) << 52);
+}
+
+#define ROUNDS 2000
+
+int main(void) {
+	test_init();
+
+	uint64_t state = 0xa4093822299f31d0ull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t round = 0; round < ROUNDS; ++round) {
+			uint64_t a = float_operand(&state);
+			uint64_t b = float_operand(&state);
+			uint64_t c = float_operand(&state);
+
+			// the modes 0 to 4, the others are reserved
+			set_rounding_mode(round % 5);
+
+			test_result(add_d(a, b));
+			test_result(sub_d(a, b));
+			test_result(mul_d(a, b));
+			test_result(div_d(a, b));
+			test_result(min_d(a, b));
+			test_result(max_d(a, b));
+			test_result(sgnjx_d(a, b));
+			test_result(add_s(a, b));
+			test_result(mul_s(a >> 32, b));
+			test_result(div_s(a, b >> 32));
+			test_result(fmadd_d(a, b, c));
+			test_result(sqrt_d(a));
+			test_result(convert_to_int(a));
+			test_result(convert_to_double(b));
+			test_result(compare_and_classify(a, b));
+			test_result(take_flags());
+		}
+		present();
+	}
+}
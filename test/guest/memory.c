@@ -0,0 +1,79 @@
+#include "test.h"
+
+// Loads and stores of every width at every alignment, across page boundaries, with sign and
+// zero extension. The accesses are inline assembly so none of them is split or merged.
+
+#define BUFFER_SIZE (3 * 4096)
+
+__attribute__((aligned(4096))) static uint8_t buffer[BUFFER_SIZE];
+
+#define STORE(name)                                                                   \
+	static inline void name(uint8_t *address, uint64_t value) {                       \
+		__asm__ volatile(#name " %1, 0(%0)" : : "r"(address), "r"(value) : "memory"); \
+	}
+
+#define LOAD(name)                                                                    \
+	static inline uint64_t name(const uint8_t *address) {                             \
+		uint64_t value;                                                               \
+		__asm__ volatile(#name " %0, 0(%1)" : "=r"(value) : "r"(address) : "memory"); \
+		return value;                                                                 \
+	}
+
+STORE(sb)
+STORE(sh)
+STORE(sw)
+STORE(sd)
+
+LOAD(lb)
+LOAD(lbu)
+LOAD(lh)
+LOAD(lhu)
+LOAD(lw)
+LOAD(lwu)
+LOAD(ld)
+
+#define ROUNDS 4000
+
+int main(void) {
+	test_init();
+
+	uint64_t state = 0x13198a2e03707344ull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t round = 0; round < ROUNDS; ++round) {
+			uint64_t random = test_random(&state);
+			uint64_t value  = test_operand(&state);
+			// near the page boundaries half of the time
+			uint32_t offset = (random & 1) != 0 ? 4096 * (1 + ((random >> 1) & 1)) - 8 + ((random >> 2) & 15) : (random >> 8) % (BUFFER_SIZE - 8);
+			uint8_t *address = &buffer[offset];
+
+			switch ((random >> 32) & 3) {
+			case 0:
+				sb(address, value);
+				break;
+			case 1:
+				sh(address, value);
+				break;
+			case 2:
+				sw(address, value);
+				break;
+			case 3:
+				sd(address, value);
+				break;
+			}
+
+			test_result(lb(address));
+			test_result(lbu(address));
+			test_result(lh(address));
+			test_result(lhu(address));
+			test_result(lw(address));
+			test_result(lwu(address));
+			test_result(ld(address));
+		}
+
+		for (uint32_t offset = 0; offset < BUFFER_SIZE; offset += 8) {
+			test_result(ld(&buffer[offset]));
+		}
+		present();
+	}
+}
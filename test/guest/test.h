@@ -0,0 +1,98 @@
+#ifndef KOMPJUTA_TEST_HEADER
+#define KOMPJUTA_TEST_HEADER
+
+#include <stdint.h>
+
+// Shared by the programs of differential.sh, which run bare on the emulator. Every program
+// includes this once, it brings the entry point and the stack along. Every result a program
+// computes ends up in its framebuffer, so the frame hashes of two runs only match when both
+// computed the same.
+
+// the registers of sources/mmio.h that the tests use
+#define MMIO_BASE 0xffffffff00000000ull
+
+#define FB_ADDR   0x0
+#define FB_STRIDE 0x08
+#define FB_HEIGHT 0x10
+#define PRESENT   0x18
+
+static inline uint32_t mmio_read32(uint32_t offset) {
+	return *(volatile uint32_t *)(uintptr_t)(MMIO_BASE + offset);
+}
+
+static inline void mmio_write8(uint32_t offset, uint8_t value) {
+	*(volatile uint8_t *)(uintptr_t)(MMIO_BASE + offset) = value;
+}
+
+static inline void mmio_write64(uint32_t offset, uint64_t value) {
+	*(volatile uint64_t *)(uintptr_t)(MMIO_BASE + offset) = value;
+}
+
+static inline void present(void) {
+	mmio_write8(PRESENT, 1);
+}
+
+#define TEST_STACK_SIZE (64 * 1024)
+
+__attribute__((aligned(16))) uint8_t test_stack[TEST_STACK_SIZE];
+
+int main(void);
+
+// The emulator starts harts at the entry point with nothing but a0 set.
+__attribute__((naked, noreturn)) void _start(void) {
+	__asm__ volatile("la sp, test_stack\n"
+	                 "li t0, %0\n"
+	                 "add sp, sp, t0\n"
+	                 "call main\n"
+	                 "1: j 1b\n"
+	                 :
+	                 : "i"(TEST_STACK_SIZE));
+}
+
+// xorshift, for inputs that the compiler can not see through
+static inline uint64_t test_random(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+#define TEST_MAX_PIXELS (2048 * 2048)
+
+__attribute__((aligned(4096))) uint32_t test_pixels[TEST_MAX_PIXELS];
+
+static uint32_t test_cursor   = 0;
+static uint32_t test_capacity = 0;
+
+static inline void test_init(void) {
+	mmio_write64(FB_ADDR, (uint64_t)(uintptr_t)test_pixels);
+	uint32_t capacity = mmio_read32(FB_STRIDE) / 4 * mmio_read32(FB_HEIGHT);
+	test_capacity     = capacity < TEST_MAX_PIXELS ? capacity : TEST_MAX_PIXELS;
+}
+
+static inline void test_begin_frame(void) {
+	test_cursor = 0;
+}
+
+// Results past the end of the framebuffer are dropped.
+static inline void test_result(uint64_t value) {
+	if (test_cursor + 2 <= test_capacity) {
+		test_pixels[test_cursor++] = (uint32_t)value;
+		test_pixels[test_cursor++] = (uint32_t)(value >> 32);
+	}
+}
+
+// Operands that are random most of the time and an edge case of overflow and division
+// otherwise.
+static const uint64_t test_edges[] = {
+    0, 1, 2, 0x7fffffff, 0x80000000, 0xffffffff, 0x7fffffffffffffff, 0x8000000000000000, 0xffffffffffffffff,
+};
+
+static inline uint64_t test_operand(uint64_t *state) {
+	uint64_t value = test_random(state);
+	return (value & 3) == 0 ? test_edges[(value >> 2) % (sizeof(test_edges) / sizeof(test_edges[0]))] : value;
+}
+
+#endif
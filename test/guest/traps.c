@@ -0,0 +1,112 @@
+#include "test.h"
+
+// Instructions that trap, from every place a core raises one: illegal and reserved encodings,
+// CSRs that do not exist or are read-only, ecall and ebreak, faulting loads, stores and atomics,
+// a fetch from outside of RAM and vector instructions with an invalid vtype or register group.
+// The handler records mcause, mtval and mepc and resumes after the trapping instruction.
+
+// outside of RAM and of every device
+#define BAD_ADDRESS 0x7000000000000000ull
+
+static volatile uint64_t trap_record[3];
+
+// Fetch faults return to ra, everything else to the next instruction.
+__attribute__((naked, aligned(4))) static void trap_handler(void) {
+	__asm__ volatile("addi sp, sp, -16\n"
+	                 "sd t0, 0(sp)\n"
+	                 "sd t1, 8(sp)\n"
+	                 "la t0, trap_record\n"
+	                 "csrr t1, mcause\n"
+	                 "sd t1, 0(t0)\n"
+	                 "csrr t1, mtval\n"
+	                 "sd t1, 8(t0)\n"
+	                 "csrr t1, mepc\n"
+	                 "sd t1, 16(t0)\n"
+	                 "csrr t0, mcause\n"
+	                 "addi t0, t0, -1\n"
+	                 "bnez t0, 1f\n"
+	                 "csrw mepc, ra\n"
+	                 "j 3f\n"
+	                 "1:\n"
+	                 "csrr t0, mepc\n"
+	                 "lhu t1, 0(t0)\n"
+	                 "andi t1, t1, 3\n"
+	                 "addi t1, t1, -3\n"
+	                 "addi t0, t0, 2\n"
+	                 "bnez t1, 2f\n"
+	                 "addi t0, t0, 2\n"
+	                 "2:\n"
+	                 "csrw mepc, t0\n"
+	                 "3:\n"
+	                 "ld t0, 0(sp)\n"
+	                 "ld t1, 8(sp)\n"
+	                 "addi sp, sp, 16\n"
+	                 "mret");
+}
+
+#define TRAP(name, instructions)                                                                         \
+	static inline uint64_t name(uint64_t *address, uint64_t value) {                                     \
+		uint64_t result = value;                                                                         \
+		__asm__ volatile(instructions : "+r"(result) : "r"(address), "r"(value) : "ra", "t0", "memory"); \
+		return result;                                                                                   \
+	}
+
+TRAP(ecall, "ecall")
+TRAP(ebreak, "ebreak")
+TRAP(compressed_ebreak, "c.ebreak")
+TRAP(custom, ".4byte 0x0000000b")
+TRAP(compressed_illegal, ".2byte 0")
+TRAP(sret, "sret")
+TRAP(sfence, "sfence.vma")
+TRAP(reserved_system, ".4byte 0x0000c073")
+TRAP(unknown_csr, "csrr %0, 0x7c0")
+TRAP(write_cycle, "csrw cycle, %2")
+TRAP(set_instret, "csrs instret, %2")
+TRAP(load, "ld %0, 0(%1)")
+TRAP(store, "sw %2, 4(%1)")
+TRAP(atomic, "amoadd.d %0, %2, (%1)")
+TRAP(reserve, "lr.w %0, (%1)")
+TRAP(fetch, "li t0, 0x7000000000000000\njalr ra, 0(t0)")
+// vsetvl with vsew 7, which sets vill, then vadd.vv v1, v2, v3
+TRAP(invalid_vtype, "li t0, 0x38\n.4byte 0x805072d7\n.4byte 0x022180d7")
+// vsetvli e32, m2, ta, ma, then vadd.vv v1, v2, v4 on an odd group
+TRAP(odd_group, ".4byte 0x0d1072d7\n.4byte 0x022200d7")
+
+typedef uint64_t trap_func(uint64_t *address, uint64_t value);
+
+static trap_func *const traps[] = {
+    ecall, ebreak, compressed_ebreak, custom, compressed_illegal, sret, sfence, reserved_system, unknown_csr, write_cycle,
+    set_instret, load, store, atomic, reserve, fetch, invalid_vtype, odd_group,
+};
+
+#define TRAP_COUNT (sizeof(traps) / sizeof(traps[0]))
+
+#define ROUNDS 200
+
+__attribute__((aligned(8))) static uint64_t buffer[2];
+
+int main(void) {
+	test_init();
+	__asm__ volatile("csrw mtvec, %0" : : "r"(trap_handler));
+
+	uint64_t state = 0xbe5466cf34e90c6cull;
+	for (;;) {
+		test_begin_frame();
+		for (uint32_t round = 0; round < ROUNDS; ++round) {
+			uint64_t value = test_random(&state);
+			for (uint32_t trap_index = 0; trap_index < TRAP_COUNT; ++trap_index) {
+				// outside of RAM the loads, stores and atomics fault, in RAM only the misaligned atomics do
+				uint64_t *address = (value & 1) != 0 ? (uint64_t *)(uintptr_t)BAD_ADDRESS : (uint64_t *)((uintptr_t)buffer + 1);
+
+				trap_record[0] = 0;
+				trap_record[1] = 0;
+				trap_record[2] = 0;
+				test_result(traps[trap_index](address, value));
+				test_result(trap_record[0]);
+				test_result(trap_record[1]);
+				test_result(trap_record[2]);
+			}
+		}
+		present();
+	}
+}